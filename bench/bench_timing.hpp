@@ -0,0 +1,34 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+// Timing shared by the microbenchmarks
+
+static inline double
+millisecondsSince (std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli> (
+             std::chrono::steady_clock::now () - start)
+      .count ();
+}
+
+// Sorts times and prints the best and median of them without ending the
+// line, returns the median
+static inline double
+printTimes (const char *name, std::vector<double> &times, int nameWidth)
+{
+  std::sort (times.begin (), times.end ());
+  double median = times[times.size () / 2];
+  printf ("  %-*s best %7.3f ms  median %7.3f ms", nameWidth, name,
+          times.front (), median);
+  return median;
+}
+
+static inline void
+report (const char *name, std::vector<double> &times)
+{
+  printTimes (name, times, 18);
+  printf ("\n");
+}
@@ -0,0 +1,102 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "../include/frustum_culler.hpp"
+#include "bench_timing.hpp"
+using namespace VulkanApp;
+
+// A million objects scattered through a cube around a camera looking
+// down -z. Each iteration moves all of them a little and culls them with
+// every instruction set the CPU supports, checking each visible list
+// against the scalar one. Prints the best and median time of each step.
+
+static const uint32_t OBJECT_COUNT = 1000000;
+static const int ITERATIONS = 30;
+static const float CUBE_HALF_SIZE = 100.0f;
+
+int
+main ()
+{
+  std::mt19937 random (42);
+  std::uniform_real_distribution<float> position (-CUBE_HALF_SIZE,
+                                                  CUBE_HALF_SIZE);
+  std::uniform_real_distribution<float> size (0.25f, 2.0f);
+
+  FrustumCuller culler;
+  culler.reserve (OBJECT_COUNT);
+  for (uint32_t i = 0; i < OBJECT_COUNT; i++)
+    {
+      float center[3] = { position (random), position (random),
+                          position (random) };
+      float extent[3] = { size (random), size (random), size (random) };
+      float radius = std::sqrt (extent[0] * extent[0] + extent[1] * extent[1]
+                                + extent[2] * extent[2]);
+      culler.add (center, radius, extent);
+    }
+
+  Frustum frustum = extractFrustum (
+      perspective (1.0f, 16.0f / 9.0f, 0.1f, CUBE_HALF_SIZE * 1.5f)
+      * lookAt (Vec3{ 0.0f, 0.0f, 0.0f }, Vec3{ 0.0f, 0.0f, -1.0f },
+                Vec3{ 0.0f, 1.0f, 0.0f }));
+
+  const CullIsa isas[]
+      = { CullIsa::Scalar, CullIsa::Sse2, CullIsa::Avx2, CullIsa::Avx512 };
+  std::vector<double> transformTimes;
+  std::vector<double> cullTimes[4];
+  std::vector<uint32_t> reference (OBJECT_COUNT);
+  std::vector<uint32_t> visible (OBJECT_COUNT);
+  uint32_t referenceCount = 0;
+  uint32_t mismatches = 0;
+  // sways back and forth, the objects stay around the camera
+  Mat4 forth = translate (Vec3{ 0.5f, 0.0f, 0.25f });
+  Mat4 back = translate (Vec3{ -0.5f, 0.0f, -0.25f });
+  for (int iteration = 0; iteration < ITERATIONS; iteration++)
+    {
+      auto start = std::chrono::steady_clock::now ();
+      culler.transform (iteration % 2 == 0 ? forth : back);
+      transformTimes.push_back (millisecondsSince (start));
+
+      for (size_t k = 0; k < 4; k++)
+        {
+          if (!cullIsaSupported (isas[k]))
+            {
+              continue;
+            }
+          uint32_t *out = k == 0 ? reference.data () : visible.data ();
+          start = std::chrono::steady_clock::now ();
+          uint32_t count = culler.cull (&frustum, 1, out, isas[k]);
+          cullTimes[k].push_back (millisecondsSince (start));
+
+          if (k == 0)
+            {
+              referenceCount = count;
+            }
+          else if (count != referenceCount
+                   || !std::equal (visible.begin (), visible.begin () + count,
+                                   reference.begin ()))
+            {
+              mismatches++;
+            }
+        }
+    }
+
+  printf ("%u objects, %u visible, best isa %s, %u mismatching lists\n",
+          OBJECT_COUNT, referenceCount, cullIsaName (bestCullIsa ()),
+          mismatches);
+  report ("transform", transformTimes);
+  for (size_t k = 0; k < 4; k++)
+    {
+      if (!cullTimes[k].empty ())
+        {
+          char name[32];
+          snprintf (name, sizeof (name), "cull %s", cullIsaName (isas[k]));
+          report (name, cullTimes[k]);
+        }
+    }
+  return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,166 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "../include/frustum_culler.hpp"
+#include "../include/job_system.hpp"
+#include "bench_timing.hpp"
+using namespace VulkanApp;
+
+// Runs the shapes of work the renderer hands the job system and checks
+// their results: a fan out of tiny jobs spawned from a worker, so they go
+// through its deque and get stolen, chains of dependent jobs, and frustum
+// culling split into chunks like cullInstances, compared to culling in one
+// go. Prints the best and median time of each.
+
+static const uint32_t FAN_OUT_JOBS = 100000;
+static const uint32_t CHAIN_LENGTH = 1000;
+static const uint32_t OBJECT_COUNT = 1000000;
+static const uint32_t CULL_CHUNK = 16384;
+static const int ITERATIONS = 20;
+
+int
+main ()
+{
+  JobSystem &jobs = JobSystem::shared ();
+  uint32_t failures = 0;
+
+  std::mt19937 random (42);
+  std::uniform_real_distribution<float> position (-100.0f, 100.0f);
+  FrustumCuller culler;
+  culler.reserve (OBJECT_COUNT);
+  for (uint32_t i = 0; i < OBJECT_COUNT; i++)
+    {
+      float center[3] = { position (random), position (random),
+                          position (random) };
+      float extent[3] = { 1.0f, 1.0f, 1.0f };
+      culler.add (center, std::sqrt (3.0f), extent);
+    }
+  Frustum frustum = extractFrustum (
+      perspective (1.0f, 16.0f / 9.0f, 0.1f, 150.0f)
+      * lookAt (Vec3{ 0.0f, 0.0f, 0.0f }, Vec3{ 0.0f, 0.0f, -1.0f },
+                Vec3{ 0.0f, 1.0f, 0.0f }));
+  std::vector<uint32_t> reference (OBJECT_COUNT);
+  uint32_t referenceCount = culler.cull (&frustum, 1, reference.data ());
+  std::vector<uint32_t> visible (OBJECT_COUNT);
+  std::vector<uint32_t> chunkVisible ((OBJECT_COUNT + CULL_CHUNK - 1)
+                                      / CULL_CHUNK);
+
+  std::vector<double> fanOutTimes, chainTimes, serialTimes, parallelTimes;
+  for (int iteration = 0; iteration < ITERATIONS; iteration++)
+    {
+      // One job spawns the rest from a worker
+      std::atomic<uint32_t> ran{ 0 };
+      JobCounter fanOut;
+      auto start = std::chrono::steady_clock::now ();
+      jobs.run (
+          [&jobs, &ran, &fanOut] () {
+            for (uint32_t i = 0; i < FAN_OUT_JOBS; i++)
+              {
+                jobs.run (
+                    [&ran] () { ran.fetch_add (1, std::memory_order_relaxed); },
+                    &fanOut);
+              }
+          },
+          &fanOut);
+      jobs.wait (fanOut);
+      fanOutTimes.push_back (millisecondsSince (start));
+      failures += ran.load () != FAN_OUT_JOBS;
+
+      // Every link checks the one before it finished first
+      std::vector<JobCounter> links (CHAIN_LENGTH);
+      std::vector<uint32_t> order;
+      order.reserve (CHAIN_LENGTH);
+      start = std::chrono::steady_clock::now ();
+      jobs.run ([&order] () { order.push_back (0); }, &links[0]);
+      for (uint32_t i = 1; i < CHAIN_LENGTH; i++)
+        {
+          jobs.runAfter (
+              links[i - 1], [&order, i] () { order.push_back (i); },
+              &links[i]);
+        }
+      jobs.wait (links.back ());
+      chainTimes.push_back (millisecondsSince (start));
+      for (uint32_t i = 0; i < CHAIN_LENGTH; i++)
+        {
+          failures += order.size () != CHAIN_LENGTH || order[i] != i;
+          jobs.wait (links[i]);
+        }
+
+      start = std::chrono::steady_clock::now ();
+      culler.cull (&frustum, 1, visible.data ());
+      serialTimes.push_back (millisecondsSince (start));
+
+      start = std::chrono::steady_clock::now ();
+      jobs.parallelFor (OBJECT_COUNT, CULL_CHUNK,
+                        [&] (uint32_t begin, uint32_t end) {
+                          chunkVisible[begin / CULL_CHUNK] = culler.cull (
+                              &frustum, 1, begin, end, visible.data () + begin);
+                        });
+      uint32_t count = 0;
+      for (size_t chunk = 0; chunk < chunkVisible.size (); chunk++)
+        {
+          std::memmove (visible.data () + count,
+                        visible.data () + chunk * CULL_CHUNK,
+                        chunkVisible[chunk] * sizeof (uint32_t));
+          count += chunkVisible[chunk];
+        }
+      parallelTimes.push_back (millisecondsSince (start));
+      failures += count != referenceCount
+                  || !std::equal (visible.begin (), visible.begin () + count,
+                                  reference.begin ());
+    }
+
+  // The first exception a counter's jobs throw comes out of wait, of any
+  // type. One nobody waits for goes to the logger.
+  Logger logger;
+  jobs.setLogger (&logger);
+  JobCounter failing;
+  jobs.run ([] () { throw std::runtime_error ("expected"); }, &failing);
+  jobs.run ([] () {}, &failing);
+  bool rethrown = false;
+  try
+    {
+      jobs.wait (failing);
+    }
+  catch (const std::runtime_error &)
+    {
+      rethrown = true;
+    }
+  failures += !rethrown;
+
+  JobCounter unusual;
+  jobs.run ([] () { throw 42; }, &unusual);
+  rethrown = false;
+  try
+    {
+      jobs.wait (unusual);
+    }
+  catch (int)
+    {
+      rethrown = true;
+    }
+  failures += !rethrown;
+
+  JobCounter after;
+  jobs.run ([] () { throw 42; });
+  jobs.run ([] () {}, &after);
+  jobs.wait (after);
+  logger.stop ();
+  jobs.setLogger (nullptr);
+
+  printf ("%zu workers, %u failed checks\n", jobs.workerCount (), failures);
+  report ("fan out", fanOutTimes);
+  report ("dependency chain", chainTimes);
+  report ("cull serial", serialTimes);
+  report ("cull parallel", parallelTimes);
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
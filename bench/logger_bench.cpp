@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../include/logger.hpp"
+using namespace VulkanApp;
+
+// Four threads log the same handful of validation-style messages over and
+// over, like a per-draw error does, and the time per log call is printed.
+// Every message must come out as exactly one of written, duplicate, rate
+// limited or dropped.
+
+static const int THREADS = 4;
+static const int MESSAGES_PER_THREAD = 250000;
+static const int DISTINCT_IDS = 8;
+
+int
+main ()
+{
+  LoggerSettings settings;
+  settings.minimumSeverity = LogSeverity::Verbose;
+  settings.capacity = 4096;
+
+  std::string text (200, 'x');
+  text.replace (0, 32, "vkCmdDraw(): descriptor not bound");
+
+  std::vector<double> nanosPerCall (THREADS);
+  LoggerStats stats;
+  {
+    Logger logger (settings);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; t++)
+      {
+        threads.emplace_back ([&, t] () {
+          auto start = std::chrono::steady_clock::now ();
+          for (int i = 0; i < MESSAGES_PER_THREAD; i++)
+            {
+              int32_t id = 0x1000 + (i % DISTINCT_IDS);
+              logger.log (LogSeverity::Error, id, text.c_str ());
+            }
+          auto end = std::chrono::steady_clock::now ();
+          nanosPerCall[t]
+              = std::chrono::duration<double, std::nano> (end - start).count ()
+                / MESSAGES_PER_THREAD;
+        });
+      }
+    for (auto &thread : threads)
+      {
+        thread.join ();
+      }
+
+    logger.stop ();
+    stats = logger.stats ();
+  }
+
+  std::sort (nanosPerCall.begin (), nanosPerCall.end ());
+  printf ("log () %d threads  best %6.1f ns  worst %6.1f ns per call\n",
+          THREADS, nanosPerCall.front (), nanosPerCall.back ());
+  printf ("written %llu  duplicates %llu  rate limited %llu  dropped %llu\n",
+          static_cast<unsigned long long> (stats.written),
+          static_cast<unsigned long long> (stats.duplicates),
+          static_cast<unsigned long long> (stats.rateLimited),
+          static_cast<unsigned long long> (stats.dropped));
+
+  uint64_t total = stats.written + stats.duplicates + stats.rateLimited
+                   + stats.dropped;
+  if (total != static_cast<uint64_t> (THREADS) * MESSAGES_PER_THREAD)
+    {
+      fprintf (stderr, "logger lost track of %lld messages\n",
+               static_cast<long long> (THREADS * MESSAGES_PER_THREAD)
+                   - static_cast<long long> (total));
+      return EXIT_FAILURE;
+    }
+  if (stats.written != DISTINCT_IDS)
+    {
+      fprintf (stderr, "expected each id to be written once\n");
+      return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../include/mesh_cache.hpp"
+#include "../include/mesh_import.hpp"
+#include "../include/mesh_optimizer.hpp"
+#include "../include/mesh_simplify.hpp"
+#include "bench_timing.hpp"
+using namespace VulkanApp;
+
+// Loads an OBJ cold (parse, optimize, simplify, write the cache) and then
+// warm from the mesh cache. Without an argument a ~1M triangle sphere is
+// generated.
+
+static const int SPHERE_RINGS = 500;
+static const int SPHERE_SEGMENTS = 1000;
+
+static void
+writeSphere (const std::string &path)
+{
+  std::ofstream file (path);
+  const float pi = 3.14159265f;
+
+  for (int ring = 0; ring <= SPHERE_RINGS; ring++)
+    {
+      float theta = pi * ring / SPHERE_RINGS;
+      for (int segment = 0; segment < SPHERE_SEGMENTS; segment++)
+        {
+          float phi = 2.0f * pi * segment / SPHERE_SEGMENTS;
+          file << "v " << std::sin (theta) * std::cos (phi) << " "
+               << std::cos (theta) << " " << std::sin (theta) * std::sin (phi)
+               << "\n";
+        }
+    }
+
+  for (int ring = 0; ring < SPHERE_RINGS; ring++)
+    {
+      for (int segment = 0; segment < SPHERE_SEGMENTS; segment++)
+        {
+          int next = (segment + 1) % SPHERE_SEGMENTS;
+          int a = ring * SPHERE_SEGMENTS + segment + 1;
+          int b = ring * SPHERE_SEGMENTS + next + 1;
+          int c = (ring + 1) * SPHERE_SEGMENTS + next + 1;
+          int d = (ring + 1) * SPHERE_SEGMENTS + segment + 1;
+          file << "f " << a << " " << b << " " << c << "\n";
+          file << "f " << a << " " << c << " " << d << "\n";
+        }
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  std::filesystem::path directory
+      = std::filesystem::temp_directory_path () / "mesh_cache_bench";
+  std::filesystem::remove_all (directory);
+  std::filesystem::create_directories (directory);
+
+  std::string source;
+  if (argc > 1)
+    {
+      source = argv[1];
+    }
+  else
+    {
+      source = (directory / "sphere.obj").string ();
+      writeSphere (source);
+    }
+
+  auto start = std::chrono::steady_clock::now ();
+  MeshData imported = importObj (source);
+  double parseTime = millisecondsSince (start);
+
+  size_t unoptimizedVertices = imported.vertices.size ();
+  deduplicateVertices (imported);
+  float acmrBefore = averageCacheMissRatio (imported.indices,
+                                            imported.vertices.size ());
+
+  start = std::chrono::steady_clock::now ();
+  optimizeVertexCache (imported.indices, imported.vertices.size ());
+  float acmrAfter = averageCacheMissRatio (imported.indices,
+                                           imported.vertices.size ());
+  optimizeOverdraw (imported.indices, imported.vertices);
+  optimizeVertexFetch (imported);
+  double optimizeTime = millisecondsSince (start);
+
+  printf ("%zu triangles, %zu vertices (%zu before deduplication)\n",
+          imported.indices.size () / 3, imported.vertices.size (),
+          unoptimizedVertices);
+  printf ("ACMR %.3f -> %.3f (overdraw pass: %.3f)\n", acmrBefore, acmrAfter,
+          averageCacheMissRatio (imported.indices,
+                                 imported.vertices.size ()));
+  printf ("OBJ parse   %9.3f ms\n", parseTime);
+  printf ("optimize    %9.3f ms\n", optimizeTime);
+
+  start = std::chrono::steady_clock::now ();
+  buildLods (imported);
+  double simplifyTime = millisecondsSince (start);
+  for (size_t lod = 0; lod < imported.lods.size (); lod++)
+    {
+      printf ("LOD %zu       %9u triangles, error %.5f\n", lod,
+              imported.lods[lod].indexCount / 3, imported.lods[lod].error);
+    }
+  printf ("simplify    %9.3f ms\n", simplifyTime);
+
+  std::string cacheDirectory = (directory / "cache").string ();
+  start = std::chrono::steady_clock::now ();
+  loadMesh (source, cacheDirectory, VertexFormat::Quantized);
+  printf ("cold load   %9.3f ms (parse, optimize, simplify, write cache)\n",
+          millisecondsSince (start));
+
+  // What uploading does with the mapping: one pass over all of it
+  std::vector<char> staging;
+  start = std::chrono::steady_clock::now ();
+  MappedMesh mesh
+      = loadMesh (source, cacheDirectory, VertexFormat::Quantized);
+  staging.resize (mesh.vertexBytes () + mesh.indexBytes ());
+  std::copy_n (static_cast<const char *> (mesh.vertexData ()),
+               mesh.vertexBytes (), staging.data ());
+  std::copy_n (reinterpret_cast<const char *> (mesh.indices ()),
+               mesh.indexBytes (), staging.data () + mesh.vertexBytes ());
+  printf ("cached load %9.3f ms (mmap and copy %.1f MB)\n",
+          millisecondsSince (start), staging.size () / 1048576.0);
+
+  std::filesystem::remove_all (directory);
+  return EXIT_SUCCESS;
+}
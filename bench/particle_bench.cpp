@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "../include/particle_reference.hpp"
+#include "bench_timing.hpp"
+using namespace VulkanApp;
+
+// A million particle fountain stepped on the CPU the way particles.comp
+// steps it on the GPU, once with the SSE2 simulation and once with the
+// scalar one. Runs long enough for the system to fill up and particles to
+// die, then checks both ended up bit for bit the same. Prints the best and
+// median time of each step over the last MEASURED steps, once full.
+
+static const uint32_t PARTICLE_COUNT = 1000000;
+// a little past MAX_LIFETIME, the first particles are dying by then
+static const int STEPS = 300;
+static const int MEASURED = 60;
+
+int
+main ()
+{
+  ParticleEmitter emitter;
+  emitter.position[1] = -1.0f;
+  emitter.scale = 2.0f;
+  uint32_t rate = Particles::emitRate (PARTICLE_COUNT);
+
+  ParticleReference simd (PARTICLE_COUNT);
+  ParticleReference scalar (PARTICLE_COUNT);
+  std::vector<double> emitTimes, simdTimes, scalarTimes, compactTimes;
+  for (int step = 0; step < STEPS; step++)
+    {
+      if (step == STEPS - MEASURED)
+        {
+          emitTimes.clear ();
+          simdTimes.clear ();
+          scalarTimes.clear ();
+          compactTimes.clear ();
+        }
+
+      auto start = std::chrono::steady_clock::now ();
+      simd.emit (emitter, rate, step);
+      emitTimes.push_back (millisecondsSince (start));
+      scalar.emit (emitter, rate, step);
+
+      start = std::chrono::steady_clock::now ();
+      simd.simulate (emitter, true);
+      simdTimes.push_back (millisecondsSince (start));
+
+      start = std::chrono::steady_clock::now ();
+      scalar.simulate (emitter, false);
+      scalarTimes.push_back (millisecondsSince (start));
+
+      start = std::chrono::steady_clock::now ();
+      simd.compact ();
+      compactTimes.push_back (millisecondsSince (start));
+      scalar.compact ();
+    }
+
+  uint32_t mismatches = 0;
+  if (simd.aliveCount () != scalar.aliveCount ())
+    {
+      mismatches++;
+    }
+  else
+    {
+      for (uint32_t a = 0; a < Particles::ATTRIBUTE_COUNT; a++)
+        {
+          Particles::Attribute attribute
+              = static_cast<Particles::Attribute> (a);
+          if (std::memcmp (simd.attribute (attribute),
+                           scalar.attribute (attribute),
+                           simd.aliveCount () * sizeof (float))
+              != 0)
+            {
+              mismatches++;
+            }
+        }
+    }
+
+  printf ("%u particles, %u emitted per step, %u alive after %d steps, %u "
+          "mismatching attributes\n",
+          PARTICLE_COUNT, rate, simd.aliveCount (), STEPS, mismatches);
+  report ("emit", emitTimes);
+  report ("simulate sse2", simdTimes);
+  report ("simulate scalar", scalarTimes);
+  report ("compact", compactTimes);
+  return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "../include/quad_stream.hpp"
+#include "bench_timing.hpp"
+using namespace VulkanApp;
+
+// Writes 1M quads per iteration into a destination array standing in for
+// the mapped stream buffer, cycling through a number of textures. QuadStream
+// writes each quad once in place, the reference collects the quads in a
+// vector, sorts them by texture and copies them over. Prints the best and
+// median time of each and the batches QuadStream ends up with.
+
+static const uint32_t QUAD_COUNT = 1000000;
+static const int ITERATIONS = 20;
+
+static void
+writeQuad (Quad *quad, uint32_t i, float angle)
+{
+  quad->position[0] = static_cast<float> (i % 1024);
+  quad->position[1] = static_cast<float> (i / 1024);
+  quad->size[0] = 2.0f;
+  quad->size[1] = 2.0f;
+  quad->uv[0] = 0;
+  quad->uv[1] = 0;
+  quad->uv[2] = 0xffff;
+  quad->uv[3] = 0xffff;
+  quad->color = 0xc0808080u ^ i;
+  quad->rotation = angle + i * 0.1f;
+}
+
+static void
+reportBandwidth (const char *name, std::vector<double> &times)
+{
+  double median = printTimes (name, times, 10);
+  printf ("  %6.2f GB/s\n", QUAD_COUNT * sizeof (Quad) / (median * 1e6));
+}
+
+int
+main ()
+{
+  // Stands in for the mapped buffer, sized like QuadBatcher sizes it for
+  // the most textures and touched once so page faults don't count
+  uint32_t capacity = QuadStream::capacityFor (QUAD_COUNT, 64);
+  std::vector<Quad> destination (capacity);
+  std::memset (destination.data (), 0, capacity * sizeof (Quad));
+
+  struct Collected
+  {
+    uint32_t texture;
+    Quad quad;
+  };
+  std::vector<Collected> collected;
+  collected.reserve (QUAD_COUNT);
+
+  QuadStream stream;
+  for (uint32_t textures : { 1u, 4u, 64u })
+    {
+      std::vector<double> streamTimes;
+      std::vector<double> sortTimes;
+      size_t batches = 0;
+      for (int iteration = 0; iteration < ITERATIONS; iteration++)
+        {
+          float angle = iteration * 0.02f;
+
+          auto start = std::chrono::steady_clock::now ();
+          stream.begin (destination.data (), capacity);
+          for (uint32_t i = 0; i < QUAD_COUNT; i++)
+            {
+              writeQuad (stream.add (i % textures), i, angle);
+            }
+          batches = stream.end ().size ();
+          streamTimes.push_back (millisecondsSince (start));
+
+          start = std::chrono::steady_clock::now ();
+          collected.clear ();
+          for (uint32_t i = 0; i < QUAD_COUNT; i++)
+            {
+              collected.push_back ({ i % textures, {} });
+              writeQuad (&collected.back ().quad, i, angle);
+            }
+          std::stable_sort (collected.begin (), collected.end (),
+                            [] (const Collected &a, const Collected &b) {
+                              return a.texture < b.texture;
+                            });
+          for (uint32_t i = 0; i < QUAD_COUNT; i++)
+            {
+              destination[i] = collected[i].quad;
+            }
+          sortTimes.push_back (millisecondsSince (start));
+        }
+
+      printf ("%u quads over %u textures, %zu batches, %u dropped\n",
+              stream.quadCount (), textures, batches, stream.dropped ());
+      reportBandwidth ("stream", streamTimes);
+      reportBandwidth ("sort+copy", sortTimes);
+    }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "../include/resource_pool.hpp"
+#include "bench_timing.hpp"
+using namespace VulkanApp;
+
+// 100k buffer-like resources. Each iteration walks all of them summing
+// their sizes, looks each up by handle in random order and replaces a
+// tenth of them. ResourcePool keeps the hot fields apart from the cold
+// ones, the reference keeps whole records in an unordered_map keyed by a
+// counter, the way raw members end up once they are made addressable.
+// Prints the best and median time of each step.
+
+static const uint32_t RESOURCE_COUNT = 100000;
+static const uint32_t CHURN = RESOURCE_COUNT / 10;
+static const int ITERATIONS = 20;
+
+struct BenchHot
+{
+  uint64_t buffer;
+  uint64_t offset;
+  uint64_t size;
+};
+
+// roughly what a buffer needs to be created, named and destroyed again
+struct BenchCold
+{
+  uint64_t memory;
+  uint32_t usage;
+  uint32_t properties;
+  void *mapped;
+  char name[40];
+};
+
+struct BenchTag;
+using BenchPool = ResourcePool<BenchTag, BenchHot, BenchCold>;
+
+struct Record
+{
+  BenchHot hot;
+  BenchCold cold;
+};
+
+static BenchHot
+makeHot (uint64_t i)
+{
+  return { i * 16 + 1, i * 256, 256 + (i & 1023) };
+}
+
+int
+main ()
+{
+  std::mt19937 random (42);
+
+  BenchPool pool;
+  std::vector<BenchPool::Handle> handles;
+  std::unordered_map<uint32_t, Record> records;
+  std::vector<uint32_t> keys;
+  uint32_t nextKey = 1;
+  for (uint32_t i = 0; i < RESOURCE_COUNT; i++)
+    {
+      handles.push_back (pool.create (makeHot (i), BenchCold{}));
+      records[nextKey] = { makeHot (i), BenchCold{} };
+      keys.push_back (nextKey++);
+    }
+
+  std::vector<uint32_t> order (RESOURCE_COUNT);
+  for (uint32_t i = 0; i < RESOURCE_COUNT; i++)
+    {
+      order[i] = i;
+    }
+
+  std::vector<double> poolWalk, poolLookup, poolChurn;
+  std::vector<double> mapWalk, mapLookup, mapChurn;
+  uint64_t poolSum = 0;
+  uint64_t mapSum = 0;
+  uint32_t stale = 0;
+  for (int iteration = 0; iteration < ITERATIONS; iteration++)
+    {
+      std::shuffle (order.begin (), order.end (), random);
+
+      auto start = std::chrono::steady_clock::now ();
+      const BenchHot *hot = pool.hotData ();
+      for (size_t i = 0; i < pool.size (); i++)
+        {
+          poolSum += hot[i].size;
+        }
+      poolWalk.push_back (millisecondsSince (start));
+
+      start = std::chrono::steady_clock::now ();
+      for (const auto &entry : records)
+        {
+          mapSum += entry.second.hot.size;
+        }
+      mapWalk.push_back (millisecondsSince (start));
+
+      start = std::chrono::steady_clock::now ();
+      for (uint32_t i : order)
+        {
+          poolSum += pool.hot (handles[i])->offset;
+        }
+      poolLookup.push_back (millisecondsSince (start));
+
+      start = std::chrono::steady_clock::now ();
+      for (uint32_t i : order)
+        {
+          mapSum += records.find (keys[i])->second.hot.offset;
+        }
+      mapLookup.push_back (millisecondsSince (start));
+
+      // The old handles have to stop resolving once their slot is reused
+      start = std::chrono::steady_clock::now ();
+      for (uint32_t c = 0; c < CHURN; c++)
+        {
+          uint32_t i = order[c];
+          BenchPool::Handle old = handles[i];
+          pool.destroy (old);
+          handles[i] = pool.create (makeHot (i), BenchCold{});
+          stale += pool.contains (old) ? 1 : 0;
+        }
+      poolChurn.push_back (millisecondsSince (start));
+
+      start = std::chrono::steady_clock::now ();
+      for (uint32_t c = 0; c < CHURN; c++)
+        {
+          uint32_t i = order[c];
+          records.erase (keys[i]);
+          keys[i] = nextKey++;
+          records[keys[i]] = { makeHot (i), BenchCold{} };
+        }
+      mapChurn.push_back (millisecondsSince (start));
+    }
+
+  printf ("%u resources, %u replaced per iteration, %u stale handles "
+          "resolved\n",
+          RESOURCE_COUNT, CHURN, stale);
+  report ("pool walk", poolWalk);
+  report ("map walk", mapWalk);
+  report ("pool lookup", poolLookup);
+  report ("map lookup", mapLookup);
+  report ("pool churn", poolChurn);
+  report ("map churn", mapChurn);
+  // keeps the sums from being optimized away
+  printf ("  checksum %llu %llu\n", static_cast<unsigned long long> (poolSum),
+          static_cast<unsigned long long> (mapSum));
+  return stale == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "../include/sort_keys.hpp"
+using namespace VulkanApp;
+
+// Sorts 1M draw keys per iteration with RadixSorter and with std::sort over
+// key/index pairs, printing the best and median time of each.
+
+static const size_t KEY_COUNT = 1000000;
+static const int ITERATIONS = 20;
+
+static std::vector<uint64_t>
+makeKeys (size_t count)
+{
+  // Roughly what a busy frame looks like: a handful of pipelines, more
+  // materials, many meshes and arbitrary depth
+  std::mt19937 rng (1234);
+  std::uniform_int_distribution<uint32_t> pipeline (0, 31);
+  std::uniform_int_distribution<uint32_t> descriptorSet (0, 1023);
+  std::uniform_int_distribution<uint32_t> mesh (0, 8191);
+  std::uniform_real_distribution<float> depth (0.0f, 1.0f);
+
+  std::vector<uint64_t> keys (count);
+  for (auto &key : keys)
+    {
+      key = DrawKey::make (pipeline (rng), descriptorSet (rng), mesh (rng),
+                           depth (rng));
+    }
+  return keys;
+}
+
+static void
+report (const char *name, std::vector<double> &times)
+{
+  std::sort (times.begin (), times.end ());
+  printf ("%-12s best %8.3f ms  median %8.3f ms  %7.1f Mkeys/s\n", name,
+          times.front (), times[times.size () / 2],
+          KEY_COUNT / (times[times.size () / 2] * 1000.0));
+}
+
+int
+main ()
+{
+  const std::vector<uint64_t> source = makeKeys (KEY_COUNT);
+
+  std::vector<uint64_t> keys (KEY_COUNT);
+  std::vector<uint32_t> values (KEY_COUNT);
+  RadixSorter sorter;
+  std::vector<double> radixTimes;
+
+  for (int i = 0; i < ITERATIONS; i++)
+    {
+      keys = source;
+      for (size_t j = 0; j < KEY_COUNT; j++)
+        {
+          values[j] = static_cast<uint32_t> (j);
+        }
+
+      auto start = std::chrono::steady_clock::now ();
+      sorter.sort (keys.data (), values.data (), KEY_COUNT);
+      auto end = std::chrono::steady_clock::now ();
+      radixTimes.push_back (
+          std::chrono::duration<double, std::milli> (end - start).count ());
+
+      if (!std::is_sorted (keys.begin (), keys.end ()))
+        {
+          fprintf (stderr, "radix sort produced unsorted keys\n");
+          return EXIT_FAILURE;
+        }
+      for (size_t j = 0; j < KEY_COUNT; j++)
+        {
+          if (source[values[j]] != keys[j])
+            {
+              fprintf (stderr, "radix sort lost a key/value pairing\n");
+              return EXIT_FAILURE;
+            }
+        }
+    }
+
+  std::vector<std::pair<uint64_t, uint32_t> > pairs (KEY_COUNT);
+  std::vector<double> stdTimes;
+
+  for (int i = 0; i < ITERATIONS; i++)
+    {
+      for (size_t j = 0; j < KEY_COUNT; j++)
+        {
+          pairs[j] = { source[j], static_cast<uint32_t> (j) };
+        }
+
+      auto start = std::chrono::steady_clock::now ();
+      std::sort (pairs.begin (), pairs.end ());
+      auto end = std::chrono::steady_clock::now ();
+      stdTimes.push_back (
+          std::chrono::duration<double, std::milli> (end - start).count ());
+    }
+
+  printf ("sorting %zu draw keys, %d iterations\n", KEY_COUNT, ITERATIONS);
+  report ("radix", radixTimes);
+  report ("std::sort", stdTimes);
+
+  return EXIT_SUCCESS;
+}
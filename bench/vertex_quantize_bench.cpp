@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../include/image_writer.hpp"
+#include "../include/vertex_quantize.hpp"
+using namespace VulkanApp;
+
+// Encodes 1M vertices with the scalar and the SIMD quantizer, checks both
+// agree and reports the size and precision of the packed format. Also writes
+// an equirectangular map of the normal encoding error (black = exact, white =
+// the worst direction) to the path given as argument, or
+// quantization_error.ppm.
+
+static const size_t VERTEX_COUNT = 1000000;
+static const int ITERATIONS = 10;
+static const uint32_t MAP_WIDTH = 1024;
+static const uint32_t MAP_HEIGHT = 512;
+
+static std::vector<Vertex>
+makeVertices (size_t count)
+{
+  std::mt19937 rng (1234);
+  std::normal_distribution<float> direction (0.0f, 1.0f);
+  std::uniform_real_distribution<float> position (-50.0f, 50.0f);
+  // Tiled textures use uvs well outside 0..1
+  std::uniform_real_distribution<float> uv (-4.0f, 4.0f);
+  std::uniform_real_distribution<float> unit (0.0f, 1.0f);
+
+  std::vector<Vertex> vertices (count);
+  for (Vertex &vertex : vertices)
+    {
+      float n[3] = { direction (rng), direction (rng), direction (rng) };
+      float length = std::sqrt (n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+      for (int k = 0; k < 3; k++)
+        {
+          vertex.position[k] = position (rng);
+          vertex.normal[k] = n[k] / length;
+        }
+      vertex.uv[0] = uv (rng);
+      vertex.uv[1] = uv (rng);
+      for (int k = 0; k < 4; k++)
+        {
+          vertex.color[k] = unit (rng);
+        }
+    }
+  return vertices;
+}
+
+static double
+medianEncodeTime (const std::vector<Vertex> &vertices,
+                  const MeshBounds &bounds, std::vector<PackedVertex> &packed,
+                  bool useSimd)
+{
+  std::vector<double> times;
+  for (int i = 0; i < ITERATIONS; i++)
+    {
+      auto start = std::chrono::steady_clock::now ();
+      quantizeVertices (vertices.data (), vertices.size (), bounds,
+                        packed.data (), useSimd);
+      times.push_back (std::chrono::duration<double, std::milli> (
+                           std::chrono::steady_clock::now () - start)
+                           .count ());
+    }
+  std::sort (times.begin (), times.end ());
+  return times[times.size () / 2];
+}
+
+static void
+writeNormalErrorMap (const std::string &path)
+{
+  const float pi = 3.14159265f;
+  MeshBounds bounds;
+  std::vector<float> errors (MAP_WIDTH * MAP_HEIGHT);
+  float worst = 0.0f;
+
+  for (uint32_t y = 0; y < MAP_HEIGHT; y++)
+    {
+      for (uint32_t x = 0; x < MAP_WIDTH; x++)
+        {
+          float theta = pi * (y + 0.5f) / MAP_HEIGHT;
+          float phi = 2.0f * pi * (x + 0.5f) / MAP_WIDTH;
+
+          Vertex vertex{};
+          vertex.normal[0] = std::sin (theta) * std::cos (phi);
+          vertex.normal[1] = std::cos (theta);
+          vertex.normal[2] = std::sin (theta) * std::sin (phi);
+
+          PackedVertex packed;
+          quantizeVertices (&vertex, 1, bounds, &packed);
+          float error = measureQuantizationError (&vertex, &packed, 1, bounds)
+                            .maxNormalDegrees;
+          errors[y * MAP_WIDTH + x] = error;
+          worst = std::max (worst, error);
+        }
+    }
+
+  std::vector<uint8_t> pixels (MAP_WIDTH * MAP_HEIGHT * 4, 255);
+  for (size_t i = 0; i < errors.size (); i++)
+    {
+      uint8_t value = static_cast<uint8_t> (
+          worst > 0.0f ? std::lrint (errors[i] / worst * 255.0f) : 0);
+      pixels[i * 4 + 0] = value;
+      pixels[i * 4 + 1] = value;
+      pixels[i * 4 + 2] = value;
+    }
+
+  ImageData image;
+  image.pixels = pixels.data ();
+  image.width = MAP_WIDTH;
+  image.height = MAP_HEIGHT;
+  image.rowPitch = MAP_WIDTH * 4;
+  image.layout = PixelLayout::RGBA8;
+  writeImage (path, ImageFileFormat::PPM, image);
+
+  printf ("normal error map  %s (white = %.5f deg)\n", path.c_str (), worst);
+}
+
+int
+main (int argc, char **argv)
+{
+  const std::vector<Vertex> vertices = makeVertices (VERTEX_COUNT);
+  const MeshBounds bounds = computeBounds (vertices);
+
+  std::vector<PackedVertex> scalar (VERTEX_COUNT);
+  std::vector<PackedVertex> simd (VERTEX_COUNT);
+  double scalarTime = medianEncodeTime (vertices, bounds, scalar, false);
+  double simdTime = medianEncodeTime (vertices, bounds, simd, true);
+
+  if (std::memcmp (scalar.data (), simd.data (),
+                   VERTEX_COUNT * sizeof (PackedVertex))
+      != 0)
+    {
+      fprintf (stderr, "SIMD and scalar encodings differ!\n");
+      return EXIT_FAILURE;
+    }
+
+  printf ("vertex size       %zu -> %zu bytes (%.1f%%)\n", sizeof (Vertex),
+          sizeof (PackedVertex),
+          100.0 * sizeof (PackedVertex) / sizeof (Vertex));
+  printf ("scalar encode     %8.3f ms  %7.1f Mverts/s\n", scalarTime,
+          VERTEX_COUNT / (scalarTime * 1000.0));
+  printf ("simd encode       %8.3f ms  %7.1f Mverts/s\n", simdTime,
+          VERTEX_COUNT / (simdTime * 1000.0));
+
+  QuantizationError error = measureQuantizationError (
+      vertices.data (), simd.data (), VERTEX_COUNT, bounds);
+  printf ("position error    max %.2e  mean %.2e  (of bounds diagonal)\n",
+          error.maxPosition, error.meanPosition);
+  printf ("normal error      max %.5f  mean %.5f  degrees\n",
+          error.maxNormalDegrees, error.meanNormalDegrees);
+  printf ("uv error          max %.2e\n", error.maxUv);
+  printf ("color error       max %.2e\n", error.maxColor);
+
+  writeNormalErrorMap (argc > 1 ? argv[1] : "quantization_error.ppm");
+  return EXIT_SUCCESS;
+}
@@ -1,4 +1,18 @@
 #!/bin/bash
 
-glslc src/shaders/shader.frag -o src/shaders/frag.spv
-glslc src/shaders/shader.frag -o src/shaders/frag.spv
+glslc shaders/shader.vert -o shaders/vert.spv
+glslc shaders/shader.frag -o shaders/frag.spv
+glslc shaders/mesh.vert -o shaders/mesh_vert.spv
+glslc shaders/mesh.frag -o shaders/mesh_frag.spv
+glslc shaders/depth_pyramid.comp -o shaders/depth_pyramid.spv
+glslc shaders/occlusion_cull.comp -o shaders/occlusion_cull.spv
+glslc shaders/quad.vert -o shaders/quad_vert.spv
+glslc shaders/quad.frag -o shaders/quad_frag.spv
+glslc shaders/hud.vert -o shaders/hud_vert.spv
+glslc shaders/hud.frag -o shaders/hud_frag.spv
+glslc -DEMIT shaders/particles.comp -o shaders/particle_emit.spv
+glslc -DSIMULATE shaders/particles.comp -o shaders/particle_simulate.spv
+glslc -DSCAN shaders/particles.comp -o shaders/particle_scan.spv
+glslc -DCOMPACT shaders/particles.comp -o shaders/particle_compact.spv
+glslc shaders/particle.vert -o shaders/particle_vert.spv
+glslc shaders/particle.frag -o shaders/particle_frag.spv
@@ -0,0 +1,115 @@
+#pragma once
+#include "frame_capture.hpp"
+#include "logger.hpp"
+#include "mesh.hpp"
+#include "resolution_scaler.hpp"
+
+namespace VulkanApp
+{
+const uint32_t MAX_WINDOWS = 8;
+// upper bound of AppOptions::framesInFlight
+const uint32_t MAX_FRAMES_IN_FLIGHT = 4;
+
+struct BenchSettings
+{
+  bool enabled = false;
+  // golden images, one <scene>.ppm per scene
+  std::string goldenDirectory = "bench/golden";
+  // "<scene> <mean frame ms>" per line
+  std::string baselinePath = "bench/baseline.txt";
+  // captured frames and per-frame timings go here
+  std::string outputDirectory = "bench/out";
+  // allowed slowdown of the mean frame time against the baseline
+  double regressionThreshold = 0.10;
+  // largest per-channel difference that still counts as a matching pixel
+  uint32_t pixelTolerance = 2;
+  // fraction of pixels allowed to differ by more than pixelTolerance
+  double maxMismatchedPixels = 0.001;
+  uint32_t warmupFrames = 20;
+  uint32_t measuredFrames = 300;
+  // write the current results as the new goldens / baseline instead of
+  // comparing against them
+  bool updateGolden = false;
+  bool updateBaseline = false;
+  // run every scene at each depth from 1 to MAX_FRAMES_IN_FLIGHT instead,
+  // reporting frame time against latency without golden or baseline checks
+  bool depthSweep = false;
+};
+
+struct ServerSettings
+{
+  // job files are picked up from here, empty disables the server, see
+  // RenderServer
+  std::string spoolDirectory;
+  // jobs claimed at once, they are rendered back to back sorted by size
+  uint32_t batchSize = 32;
+  // how long to sleep while the spool directory is empty
+  uint32_t pollMilliseconds = 10;
+};
+
+struct AppOptions
+{
+  // render into offscreen images instead of a window, no GLFW and no
+  // surface or swapchain extensions are needed
+  bool headless = false;
+  // frames rendered by a headless run outside of --bench
+  uint32_t headlessFrames = 100;
+  // frames the CPU may record ahead of the GPU, 1 to MAX_FRAMES_IN_FLIGHT.
+  // More keeps both busy, fewer shows input sooner.
+  uint32_t framesInFlight = 2;
+  // windows sharing one device, all presented together every frame, up to
+  // MAX_WINDOWS
+  uint32_t windowCount = 1;
+  // OBJ drawn instead of the triangle, empty keeps the triangle
+  std::string meshPath;
+  // optimized meshes are cached here, see loadMesh
+  std::string meshCacheDirectory = "cache";
+  VertexFormat vertexFormat = VertexFormat::Quantized;
+  // pipelines requested by the last run, precompiled at startup and
+  // rewritten at exit, empty disables it
+  std::string pipelineManifest = "cache/pipelines.manifest";
+  // split pipelines into fast-linked libraries when the device supports
+  // VK_EXT_graphics_pipeline_library
+  bool pipelineLibrary = true;
+  // CSV with per-heap device memory and per-object-type host allocations,
+  // a row group every memoryStatsInterval frames, empty disables it
+  std::string memoryStatsPath;
+  uint32_t memoryStatsInterval = 60;
+  // render below the output resolution to hold a GPU frame time, off by
+  // default so captures and the bench stay at full resolution
+  ResolutionScalerSettings resolution;
+  // start frames later while they queue up in front of the display, see
+  // PresentLatency
+  bool framePacing = true;
+  // windows only render when the scene, their size or the animation
+  // changed, and only re-present when the window system asks for it
+  bool redrawOnDemand = false;
+  // draw only the mesh instances that pass a frustum and depth pyramid test
+  // on the GPU, see OcclusionCuller
+  bool occlusionCulling = false;
+  // leave mesh instances outside every view out of the draws, tested on the
+  // CPU, see FrustumCuller. Occlusion culling takes over where it runs.
+  bool cpuCulling = false;
+  // mesh levels of detail are switched while their error stays below this
+  // many pixels, 0 always draws the full mesh
+  float lodErrorPixels = 1.0f;
+  // Scene::quadCount of the scene the app starts with
+  uint32_t quadCount = 0;
+  // Scene::particleCount of the scene the app starts with
+  uint32_t particleCount = 0;
+  // frame times, latency and memory drawn over the windows, see HudOverlay.
+  // Headless runs never draw it, captures stay comparable.
+  bool hud = true;
+  // Khronos validation layer and debug messenger, defaults to
+  // VULKAN_VALIDATION=0|1 from the environment or else to debug builds only
+  bool validation = false;
+  LoggerSettings log;
+  FrameCaptureSettings capture;
+  BenchSettings bench;
+  ServerSettings server;
+};
+
+// Throws std::runtime_error with a usage message on unknown or malformed
+// arguments
+AppOptions parseOptions (int argc, char **argv);
+} // namespace VulkanApp
@@ -0,0 +1,67 @@
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+
+#include "app_options.hpp"
+#include "scene.hpp"
+
+namespace VulkanApp
+{
+class VulkanTriangleApplication;
+
+struct SceneResult
+{
+  std::string name;
+  // wall time of each measured frame in milliseconds, sorted
+  std::vector<double> frameTimes;
+  double mean = 0.0;
+  // mean acquire to fence latency of the measured frames, see
+  // PresentLatency
+  double latency = 0.0;
+  // fraction of pixels outside pixelTolerance of the golden image
+  double mismatchedPixels = 0.0;
+  bool imageChecked = false;
+  bool imagePassed = false;
+  bool timingChecked = false;
+  bool timingPassed = false;
+};
+
+// Renders a fixed set of scenes through a headless application and checks
+// each one's last frame against a golden image and its mean frame time
+// against the stored baseline. Frame times are measured on the host around
+// renderFrame, so with more than one frame in flight they are throughput
+// numbers, not GPU latencies. The depth sweep reports both for every
+// number of frames in flight.
+class BenchRunner
+{
+public:
+  BenchRunner (VulkanTriangleApplication &app, const BenchSettings &settings);
+
+  // Returns false if any scene regressed or no longer matches its golden
+  bool run ();
+
+private:
+  struct BenchScene
+  {
+    Scene scene;
+    // resize the targets every few frames, 0 keeps them fixed
+    uint32_t resizeInterval = 0;
+  };
+
+  SceneResult runScene (const BenchScene &benchScene);
+  void measureFrames (const BenchScene &benchScene, SceneResult &result);
+  bool runDepthSweep ();
+  void checkImage (SceneResult &result);
+  void checkTiming (SceneResult &result);
+  void writeFrameTimes (const SceneResult &result);
+
+  void loadBaseline ();
+  void saveBaseline (const std::vector<SceneResult> &results);
+
+  VulkanTriangleApplication &app;
+  BenchSettings settings;
+  std::vector<BenchScene> scenes;
+  std::map<std::string, double> baseline;
+};
+} // namespace VulkanApp
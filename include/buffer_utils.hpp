@@ -0,0 +1,42 @@
+#pragma once
+#include <vulkan/vulkan_core.h>
+
+namespace VulkanApp
+{
+struct GpuBuffer
+{
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize size = 0;
+  VkMemoryPropertyFlags properties = 0;
+  // only set for host visible buffers created with persistent mapping
+  void *mapped = nullptr;
+};
+
+// Returns the first memory type allowed by typeFilter with all of the
+// required property flags, throws if there is none
+uint32_t findMemoryType (VkPhysicalDevice physicalDevice, uint32_t typeFilter,
+                         VkMemoryPropertyFlags properties);
+
+// Like findMemoryType but tries the preferred flags first and falls back to
+// the required ones, e.g. HOST_CACHED is nice to have for readback
+uint32_t findMemoryType (VkPhysicalDevice physicalDevice, uint32_t typeFilter,
+                         VkMemoryPropertyFlags required,
+                         VkMemoryPropertyFlags preferred);
+
+// allocator is used for both the buffer and its memory and has to be given
+// to destroyBuffer again
+GpuBuffer createBuffer (VkPhysicalDevice physicalDevice, VkDevice device,
+                        VkDeviceSize size, VkBufferUsageFlags usage,
+                        VkMemoryPropertyFlags required,
+                        VkMemoryPropertyFlags preferred = 0,
+                        bool persistentMap = false,
+                        const VkAllocationCallbacks *allocator = nullptr);
+
+void destroyBuffer (VkDevice device, GpuBuffer &buffer,
+                    const VkAllocationCallbacks *allocator = nullptr);
+
+// Makes device writes visible to the host for non-coherent memory, a no-op
+// for coherent memory
+void invalidateBuffer (VkDevice device, const GpuBuffer &buffer);
+} // namespace VulkanApp
@@ -0,0 +1,113 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+#include "sort_keys.hpp"
+
+namespace VulkanApp
+{
+// Buffers a mesh is drawn from. A null vertexBuffer means the vertices are
+// generated in the shader (like the hardcoded triangle) and nothing is bound.
+struct MeshBinding
+{
+  VkBuffer vertexBuffer = VK_NULL_HANDLE;
+  VkDeviceSize vertexOffset = 0;
+  VkBuffer indexBuffer = VK_NULL_HANDLE;
+  VkDeviceSize indexOffset = 0;
+  VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+  // index count when indexBuffer is set, vertex count otherwise
+  uint32_t elementCount = 0;
+};
+
+// Indirect draw commands written on the GPU, tightly packed
+// VkDrawIndexedIndirectCommand for indexed meshes, VkDrawIndirectCommand
+// otherwise. They replace the command's own instance count.
+struct IndirectBinding
+{
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  uint32_t drawCount = 0;
+};
+
+struct DrawCommand
+{
+  uint32_t pipeline = 0;
+  // 0 means no descriptor set is bound for the draw
+  uint32_t descriptorSet = 0;
+  uint32_t mesh = 0;
+  float depth = 0.0f;
+  uint32_t instanceCount = 1;
+  uint32_t firstInstance = 0;
+  // 0 means a direct draw, anything else the indirect binding it is drawn
+  // with
+  uint32_t indirect = 0;
+};
+
+struct DrawListStats
+{
+  uint32_t draws = 0;
+  uint32_t pipelineBinds = 0;
+  uint32_t descriptorSetBinds = 0;
+  uint32_t meshBinds = 0;
+  // draws recorded as indirect draw calls, counted in draws as well
+  uint32_t indirectDraws = 0;
+};
+
+// Per-frame draw submission stage. Pipelines, descriptor sets and meshes are
+// registered once and referred to by index; draws are pushed every frame,
+// sorted by their key and recorded with redundant binds skipped.
+class DrawList
+{
+public:
+  DrawList ();
+
+  uint32_t addPipeline (VkPipeline pipeline, VkPipelineLayout layout);
+  // swaps the pipeline behind an id, e.g. for a better compiled variant
+  void setPipeline (uint32_t id, VkPipeline pipeline);
+  uint32_t addDescriptorSet (VkDescriptorSet set);
+  uint32_t addMesh (const MeshBinding &mesh);
+  void setMesh (uint32_t id, const MeshBinding &mesh);
+  // Indirect bindings usually change every frame, e.g. when culling on the
+  // GPU picks another part of the buffer
+  uint32_t addIndirect (const IndirectBinding &indirect);
+  void setIndirect (uint32_t id, const IndirectBinding &indirect);
+
+  // drops the frame's draws, registered resources are kept
+  void clear ();
+  void push (const DrawCommand &command);
+  void sort ();
+  void record (VkCommandBuffer buffer);
+
+  size_t
+  size () const
+  {
+    return commands.size ();
+  }
+
+  const DrawListStats &
+  lastStats () const
+  {
+    return stats;
+  }
+
+private:
+  struct PipelineBinding
+  {
+    VkPipeline pipeline;
+    VkPipelineLayout layout;
+  };
+
+  std::vector<PipelineBinding> pipelines;
+  std::vector<VkDescriptorSet> descriptorSets;
+  std::vector<MeshBinding> meshes;
+  std::vector<IndirectBinding> indirects;
+
+  std::vector<DrawCommand> commands;
+  std::vector<uint64_t> keys;
+  std::vector<uint32_t> order;
+  RadixSorter sorter;
+  DrawListStats stats;
+};
+} // namespace VulkanApp
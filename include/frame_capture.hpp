@@ -0,0 +1,145 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+#include "buffer_utils.hpp"
+#include "image_writer.hpp"
+#include "job_system.hpp"
+#include "logger.hpp"
+
+namespace VulkanApp
+{
+struct FrameCaptureSettings
+{
+  // every presented frame is written here, empty disables it
+  std::string directory;
+  ImageFileFormat format = ImageFileFormat::PPM;
+  // frames handed to the encoders but not yet on disk before the render
+  // loop is held back, bounds the host memory used when disks are slow
+  uint32_t maxQueuedFrames = 8;
+  // keep the readback ring around for requestCapture even when not
+  // capturing continuously
+  bool onDemand = false;
+};
+
+struct FrameCaptureStats
+{
+  uint64_t framesCaptured = 0;
+  // times the render loop had to wait for the encoders to catch up
+  uint64_t encoderStalls = 0;
+};
+
+// How a capture asked for with requestCapture ended
+struct CaptureResult
+{
+  std::string path;
+  bool written = false;
+  std::string error;
+};
+
+// Copies presented images into a ring of host visible readback buffers, one
+// per frame in flight. A slot is only read back once the fence of the frame
+// that filled it has signaled, which drawFrame waits for anyway before
+// reusing the frame, so capture never adds a GPU wait. The pixels are then
+// encoded by background jobs on the shared JobSystem, which stream them to
+// disk.
+class FrameCapture
+{
+public:
+  FrameCapture () = default;
+  ~FrameCapture ();
+
+  // imageLayout is the layout captured images are in after the render
+  // pass, they are returned to it after the copy
+  void init (VkPhysicalDevice physicalDevice, VkDevice device,
+             uint32_t ringSize, VkImageLayout imageLayout,
+             const FrameCaptureSettings &settings,
+             const VkAllocationCallbacks *allocator = nullptr,
+             Logger *logger = nullptr);
+
+  bool
+  enabled () const
+  {
+    return !settings.directory.empty () || settings.onDemand;
+  }
+
+  // Captures the next recorded frame to path in the configured format
+  void requestCapture (const std::string &path);
+
+  // Whether the frame being recorded needs recordCopy
+  bool
+  wantsCopy () const
+  {
+    return !settings.directory.empty () || !requestedPath.empty ();
+  }
+
+  // (Re)creates the readback buffers for the current swapchain. Pending
+  // slots have to be collected first.
+  void resize (VkExtent2D extent, VkFormat format);
+
+  // Records the copy after the render pass
+  void recordCopy (VkCommandBuffer buffer, uint32_t slot, VkImage image,
+                   uint64_t frameNumber);
+
+  // Must only be called once the fence of the submission that recorded the
+  // slot's copy has signaled
+  void collect (uint32_t slot);
+  // Collects every pending slot, the device has to be idle
+  void collectAll ();
+  // collectAll and wait until every frame is on disk
+  void finish ();
+
+  // Waits for the encoders and frees the readback buffers
+  void cleanup ();
+
+  FrameCaptureStats stats () const;
+
+  // Requested captures that are on disk or failed since the last call, in
+  // the order the encoders finished them
+  std::vector<CaptureResult> takeResults ();
+
+private:
+  struct Slot
+  {
+    GpuBuffer buffer;
+    bool pending = false;
+    std::string path;
+    // from requestCapture, reported through takeResults
+    bool requested = false;
+  };
+
+  std::vector<uint8_t> acquireHostFrame ();
+  void releaseHostFrame (std::vector<uint8_t> pixels);
+
+  VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+  VkDevice device = VK_NULL_HANDLE;
+  const VkAllocationCallbacks *allocator = nullptr;
+  // failed continuous captures are reported here, if set
+  Logger *logger = nullptr;
+  FrameCaptureSettings settings;
+  VkImageLayout imageLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  std::string requestedPath;
+
+  std::vector<Slot> slots;
+  VkExtent2D extent{};
+  PixelLayout layout = PixelLayout::BGRA8;
+  VkDeviceSize frameSize = 0;
+
+  // encodes still running on the shared job system
+  JobCounter encodes;
+
+  // host copies of frames queued for encoding, recycled between frames
+  mutable std::mutex hostFramesMutex;
+  std::condition_variable hostFrameReleased;
+  std::vector<std::vector<uint8_t> > freeHostFrames;
+  uint32_t queuedFrames = 0;
+  FrameCaptureStats counters;
+  // filled by the encoders, also guarded by hostFramesMutex
+  std::vector<CaptureResult> results;
+};
+} // namespace VulkanApp
@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+#include "app_options.hpp"
+#include "buffer_utils.hpp"
+
+namespace VulkanApp
+{
+// Part of a frame's upload ring, valid until the frame's fence signals
+struct UploadAllocation
+{
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  // persistently mapped and coherent, no flush needed
+  void *data = nullptr;
+};
+
+// Everything one frame in flight owns. The render thread cycles through
+// AppOptions::framesInFlight of these, and once a context's fence has
+// signalled all of it is free again: the command pool is reset as a whole,
+// the upload ring starts over and the deferred deletions run. Contexts sit
+// in one array, each on its own cache lines.
+struct alignas (64) FrameContext
+{
+  VkFence inFlightFence = VK_NULL_HANDLE;
+  VkCommandPool commandPool = VK_NULL_HANDLE;
+  // indexed by WindowView::index
+  VkCommandBuffer commandBuffers[MAX_WINDOWS] = {};
+  VkSemaphore imageAvailableSemaphores[MAX_WINDOWS] = {};
+  VkSemaphore renderFinishedSemaphores[MAX_WINDOWS] = {};
+
+  // host visible scratch for data written once per frame
+  GpuBuffer uploadBuffer;
+  VkDeviceSize uploadOffset = 0;
+  // the timestamp queries of the frame were written, see readFrameTime
+  bool timed = false;
+
+  // Resources the frame, or one before it, may still use. They run once
+  // the frame's fence has signalled, which also covers every earlier
+  // submit.
+  std::vector<std::function<void ()> > deletions;
+
+  // alignment is a power of two. Returns a null buffer once the ring is
+  // full, the caller has to fall back to something else.
+  UploadAllocation allocateUpload (VkDeviceSize size,
+                                   VkDeviceSize alignment);
+  void defer (std::function<void ()> deletion);
+  // Call after waiting for the fence, runs the deletions and rewinds the
+  // upload ring
+  void retire ();
+};
+} // namespace VulkanApp
@@ -0,0 +1,80 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "linear_math.hpp"
+
+namespace VulkanApp
+{
+// Instruction sets FrustumCuller tests objects with, 1, 4, 8 and 16 at a
+// time
+enum class CullIsa : uint8_t
+{
+  Scalar,
+  Sse2,
+  Avx2,
+  Avx512
+};
+
+const char *cullIsaName (CullIsa isa);
+// Compiled in and supported by the CPU running it
+bool cullIsaSupported (CullIsa isa);
+// The widest supported one, checked once
+CullIsa bestCullIsa ();
+
+// Planes facing inwards, normalized so distances are in world units
+struct Frustum
+{
+  float planes[6][4] = {};
+};
+
+// Of a Vulkan viewProjection, depth from 0 to 1
+Frustum extractFrustum (const Mat4 &viewProjection);
+
+// World space bounds of many objects, a sphere and an axis aligned box
+// each, stored as one array per component so a whole register of objects
+// is tested against a plane at once. An object is culled once either of
+// its bounds is outside a plane, which is as tight as the tighter of the
+// two for every plane. AVX2 and AVX-512 are compiled in with target
+// attributes and picked at runtime, SSE2 is the x86-64 baseline.
+class FrustumCuller
+{
+public:
+  void clear ();
+  void reserve (size_t count);
+
+  // The box is center +- extent, returns the object's index
+  uint32_t add (const float center[3], float radius, const float extent[3]);
+
+  size_t
+  size () const
+  {
+    return centerX.size ();
+  }
+
+  // Moves every object by an affine transform. Boxes grow to stay axis
+  // aligned around the transformed ones, spheres by the largest scale.
+  void transform (const Mat4 &transform);
+
+  // Writes the indices of the objects inside any of the frustums to
+  // visible in ascending order, which needs room for size () of them.
+  // Returns how many there are, every isa gives the same list.
+  uint32_t cull (const Frustum *frustums, uint32_t frustumCount,
+                 uint32_t *visible, CullIsa isa = bestCullIsa ()) const;
+  // Only the objects from begin to end, visible needs room for end - begin
+  // of them. Ranges are independent, so they can be culled in parallel.
+  uint32_t cull (const Frustum *frustums, uint32_t frustumCount,
+                 uint32_t begin, uint32_t end, uint32_t *visible,
+                 CullIsa isa = bestCullIsa ()) const;
+
+private:
+  std::vector<float> centerX;
+  std::vector<float> centerY;
+  std::vector<float> centerZ;
+  std::vector<float> radius;
+  std::vector<float> extentX;
+  std::vector<float> extentY;
+  std::vector<float> extentZ;
+};
+} // namespace VulkanApp
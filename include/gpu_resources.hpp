@@ -0,0 +1,44 @@
+#pragma once
+#include <vulkan/vulkan_core.h>
+
+#include "resource_pool.hpp"
+
+namespace VulkanApp
+{
+// Images the frame loop renders into, copies from and presents. The view is
+// null until one is created for it.
+struct ImageHot
+{
+  VkImage image = VK_NULL_HANDLE;
+  VkImageView view = VK_NULL_HANDLE;
+};
+
+struct ImageCold
+{
+  // null for images owned by a swap chain
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize memoryOffset = 0;
+  VkDeviceSize size = 0;
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  VkExtent2D extent{};
+};
+
+struct FramebufferHot
+{
+  VkFramebuffer framebuffer = VK_NULL_HANDLE;
+};
+
+struct FramebufferCold
+{
+  VkRenderPass renderPass = VK_NULL_HANDLE;
+  VkExtent2D extent{};
+};
+
+struct ImageTag;
+struct FramebufferTag;
+using ImagePool = ResourcePool<ImageTag, ImageHot, ImageCold>;
+using ImageHandle = ImagePool::Handle;
+using FramebufferPool
+    = ResourcePool<FramebufferTag, FramebufferHot, FramebufferCold>;
+using FramebufferHandle = FramebufferPool::Handle;
+} // namespace VulkanApp
@@ -0,0 +1,121 @@
+#pragma once
+#include <cstdint>
+#include <vulkan/vulkan_core.h>
+
+#include "frame_context.hpp"
+#include "pipeline_manager.hpp"
+#include "texture.hpp"
+
+namespace VulkanApp
+{
+// What the HUD shows, gathered by the frame loop
+struct HudStats
+{
+  uint64_t frame = 0;
+  // the FrameContext recording this frame, of framesInFlight
+  uint32_t frameSlot = 0;
+  uint32_t framesInFlight = 0;
+  // start of the last frame to the start of this one
+  double intervalMilliseconds = 0.0;
+  // render thread work of the last frame, waiting for its fence excluded
+  double cpuMilliseconds = 0.0;
+  // of the last timed frame, negative without timestamp queries
+  double gpuMilliseconds = -1.0;
+  double latencyMilliseconds = 0.0;
+  float resolutionScale = 1.0f;
+  // over the device local heaps, 0 without VK_EXT_memory_budget
+  VkDeviceSize deviceUsage = 0;
+  VkDeviceSize deviceBudget = 0;
+};
+
+// Matches the vertex input of hud.vert, one instance of the HUD quad
+struct HudGlyph
+{
+  // top left corner and size in canvas pixels
+  int16_t position[2];
+  uint16_t size[2];
+  // ASCII code, 127 is a solid block for panels and bars
+  uint32_t glyph;
+  // RGBA8, red in the lowest byte
+  uint32_t color;
+};
+
+// Frame, CPU and GPU times, latency and memory as text over a graph of the
+// last frame intervals, in the top left corner. Every character and bar is
+// an instance of the same quad. A frame's instances go into its upload
+// ring as one vertex stream and a single instanced draw covers the whole
+// HUD. The glyphs come from an atlas baked from a compiled-in 5x7 font at
+// init.
+class HudOverlay
+{
+public:
+  // frames the graph goes back
+  static const uint32_t HISTORY = 120;
+
+  HudOverlay () = default;
+  ~HudOverlay ();
+
+  HudOverlay (const HudOverlay &) = delete;
+  HudOverlay &operator= (const HudOverlay &) = delete;
+
+  // commandPool and queue upload the atlas, waiting for the queue. The
+  // pipeline is compatible with renderPass and draws without depth
+  // testing.
+  void init (VkPhysicalDevice physicalDevice, VkDevice device,
+             VkCommandPool commandPool, VkQueue queue,
+             VkPipelineCache pipelineCache, VkRenderPass renderPass,
+             const VkAllocationCallbacks *allocator = nullptr);
+
+  // Lays the HUD out into frame's upload ring, once per frame. Nothing is
+  // drawn this frame if the ring is full.
+  void build (const HudStats &stats, FrameContext &frame);
+
+  // Draws the last build inside a render pass compatible with init's, for
+  // as many views as needed. canvas is the size the HUD is laid out in,
+  // mapped onto the whole viewport. Binds its own pipeline, descriptor set
+  // and push constants.
+  void record (VkCommandBuffer buffer, VkExtent2D canvas);
+
+  // CPU time of the last build
+  double
+  buildMilliseconds () const
+  {
+    return lastBuild;
+  }
+
+  // the device has to be idle
+  void cleanup ();
+
+private:
+  void createAtlas (VkCommandPool commandPool, VkQueue queue);
+  void createPipeline (VkPipelineCache pipelineCache,
+                       VkRenderPass renderPass);
+  // Appends a glyph per character of text from x, y on
+  static HudGlyph *text (HudGlyph *out, int x, int y, const char *text,
+                         uint32_t color);
+  static HudGlyph *solid (HudGlyph *out, int x, int y, int width, int height,
+                          uint32_t color);
+
+  VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+  VkDevice device = VK_NULL_HANDLE;
+  const VkAllocationCallbacks *allocator = nullptr;
+
+  GpuImage atlas;
+  VkSampler sampler = VK_NULL_HANDLE;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  VkDescriptorSet atlasSet = VK_NULL_HANDLE;
+  VkPipelineLayout layout = VK_NULL_HANDLE;
+  PipelineManager pipelines;
+  VkPipeline pipeline = VK_NULL_HANDLE;
+
+  // frame intervals in milliseconds, a ring starting at historyNext
+  float history[HISTORY] = {};
+  uint32_t historyNext = 0;
+
+  // the last build's glyphs, in the upload ring of its frame
+  UploadAllocation glyphs;
+  uint32_t glyphCount = 0;
+  double lastBuild = 0.0;
+};
+} // namespace VulkanApp
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace VulkanApp
+{
+enum class ImageFileFormat
+{
+  PPM,
+  PNG
+};
+
+// Byte order of a 4 byte pixel as it comes out of vkCmdCopyImageToBuffer
+enum class PixelLayout
+{
+  RGBA8,
+  BGRA8
+};
+
+struct ImageData
+{
+  const uint8_t *pixels = nullptr;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  // bytes between the start of two rows
+  uint32_t rowPitch = 0;
+  PixelLayout layout = PixelLayout::RGBA8;
+};
+
+const char *fileExtension (ImageFileFormat format);
+
+// Writes the image as 8-bit RGB one row at a time, so nothing but a single
+// converted row is held on top of the source pixels. PNG output uses stored
+// (uncompressed) deflate blocks, trading file size for encode speed and no
+// zlib dependency.
+void writeImage (const std::string &path, ImageFileFormat format,
+                 const ImageData &image);
+
+// Reads a binary 8-bit PPM as written by writeImage into tightly packed RGB.
+// Returns false if the file is missing or not in that format.
+bool readPpm (const std::string &path, std::vector<uint8_t> &rgb,
+              uint32_t &width, uint32_t &height);
+} // namespace VulkanApp
@@ -0,0 +1,187 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "logger.hpp"
+
+namespace VulkanApp
+{
+class JobCounter;
+
+enum class JobPriority : uint8_t
+{
+  // what a waiter is waiting for, taken before anything else
+  Normal,
+  // long running work nothing waits for right away, like encoding captured
+  // frames. Only idle workers take it, waiters never run it themselves.
+  Background
+};
+
+struct Job
+{
+  std::function<void ()> work;
+  JobCounter *counter = nullptr;
+  JobPriority priority = JobPriority::Normal;
+  bool mainThread = false;
+};
+
+// Jobs still to finish, and the jobs waiting for them. Waited for with
+// JobSystem::wait, which rethrows the first exception one of them threw.
+class JobCounter
+{
+public:
+  JobCounter () = default;
+
+  JobCounter (const JobCounter &) = delete;
+  JobCounter &operator= (const JobCounter &) = delete;
+
+  bool
+  done () const
+  {
+    return pending.load (std::memory_order_acquire) == 0;
+  }
+
+private:
+  friend class JobSystem;
+
+  std::atomic<uint32_t> pending{ 0 };
+  std::mutex mutex;
+  std::condition_variable finished;
+  // scheduled once pending drops to zero, see runAfter
+  std::vector<Job *> continuations;
+  std::exception_ptr error;
+};
+
+// Chase-Lev work-stealing deque of a fixed capacity. Only the owning worker
+// pushes and pops, at the bottom, any thread steals from the top.
+class WorkDeque
+{
+public:
+  static const int64_t CAPACITY = 4096;
+
+  // false once full
+  bool push (Job *job);
+  Job *pop ();
+  // null when empty or when another thief got there first
+  Job *steal ();
+
+private:
+  alignas (64) std::atomic<int64_t> top{ 0 };
+  alignas (64) std::atomic<int64_t> bottom{ 0 };
+  std::atomic<Job *> jobs[CAPACITY] = {};
+};
+
+// Work-stealing scheduler every subsystem shares, startup and frame work
+// alike. Each worker owns a deque it pushes the jobs it spawns to and pops
+// them from newest first, idle workers steal the oldest ones from the
+// others. Jobs from threads that aren't workers go through a shared queue.
+// A thread waiting for a counter runs jobs itself until it is done,
+// nothing blocks a core while there is work.
+//
+// Jobs with main thread affinity, like GLFW calls, only ever run on the
+// thread that created the system, in runMainThreadJobs or while it waits.
+class JobSystem
+{
+public:
+  // 0 workers is one per core but the calling thread's, at least one. The
+  // calling thread is the main thread.
+  explicit JobSystem (size_t workerCount = 0);
+  // Drains every queued job first
+  ~JobSystem ();
+
+  JobSystem (const JobSystem &) = delete;
+  JobSystem &operator= (const JobSystem &) = delete;
+
+  // The one the application and its subsystems share. The first call has
+  // to come from the main thread, VulkanTriangleApplication's constructor
+  // makes it.
+  static JobSystem &shared ();
+
+  // counter, if any, has to outlive the job
+  void run (std::function<void ()> work, JobCounter *counter = nullptr,
+            JobPriority priority = JobPriority::Normal);
+  // Runs work once dependency drops to zero, right away when it already
+  // is. counter counts it from now on.
+  void runAfter (JobCounter &dependency, std::function<void ()> work,
+                 JobCounter *counter = nullptr);
+  void runOnMainThread (std::function<void ()> work,
+                        JobCounter *counter = nullptr);
+
+  // Runs jobs until counter drops to zero, then rethrows the first
+  // exception its jobs threw
+  void wait (JobCounter &counter);
+
+  // Splits [0, count) into ranges of at most grain and runs
+  // body (begin, end) on them, the calling thread included
+  template <typename Body>
+  void
+  parallelFor (uint32_t count, uint32_t grain, Body body)
+  {
+    grain = std::max (grain, 1u);
+    JobCounter counter;
+    for (uint32_t begin = 0; begin < count;)
+      {
+        uint32_t end = count - begin > grain ? begin + grain : count;
+        run ([&body, begin, end] () { body (begin, end); }, &counter);
+        begin = end;
+      }
+    wait (counter);
+  }
+
+  // The main thread's share, returns how many jobs ran
+  size_t runMainThreadJobs ();
+  // Where failures of jobs without a counter are reported, nullptr drops
+  // them. It has to outlive every job that may fail.
+  void setLogger (Logger *logger);
+  // Called whenever a main thread job is queued, e.g. to post an event
+  // the main loop wakes up for
+  void setMainThreadWakeup (std::function<void ()> wakeup);
+  bool onMainThread () const;
+
+  size_t
+  workerCount () const
+  {
+    return workers.size ();
+  }
+
+private:
+  void schedule (Job *job);
+  void execute (Job *job);
+  // of a job nobody waits for
+  void report (std::exception_ptr error);
+  void finish (JobCounter *counter);
+  // A normal priority job, from the calling worker's deque first
+  Job *findJob ();
+  Job *findBackgroundJob ();
+  void workerLoop (size_t index);
+
+  std::thread::id mainThread;
+  std::vector<std::thread> workers;
+  std::vector<std::unique_ptr<WorkDeque> > deques;
+
+  // jobs from outside the workers, and the ones that didn't fit a deque
+  std::mutex queueMutex;
+  std::deque<Job *> injected;
+  std::deque<Job *> background;
+  std::mutex mainMutex;
+  std::deque<Job *> mainJobs;
+  std::function<void ()> mainWakeup;
+  std::atomic<Logger *> logger{ nullptr };
+
+  // normal and background jobs queued anywhere, idle workers sleep on it
+  std::atomic<size_t> queued{ 0 };
+  std::mutex sleepMutex;
+  std::condition_variable jobAvailable;
+  bool stopping = false;
+};
+} // namespace VulkanApp
@@ -0,0 +1,141 @@
+#pragma once
+#include <cmath>
+
+namespace VulkanApp
+{
+struct Vec3
+{
+  float x = 0.0f;
+  float y = 0.0f;
+  float z = 0.0f;
+};
+
+inline Vec3
+operator+ (Vec3 a, Vec3 b)
+{
+  return { a.x + b.x, a.y + b.y, a.z + b.z };
+}
+
+inline Vec3
+operator- (Vec3 a, Vec3 b)
+{
+  return { a.x - b.x, a.y - b.y, a.z - b.z };
+}
+
+inline Vec3
+operator* (Vec3 a, float s)
+{
+  return { a.x * s, a.y * s, a.z * s };
+}
+
+inline float
+dot (Vec3 a, Vec3 b)
+{
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline Vec3
+cross (Vec3 a, Vec3 b)
+{
+  return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z,
+           a.x * b.y - a.y * b.x };
+}
+
+inline float
+length (Vec3 a)
+{
+  return std::sqrt (dot (a, a));
+}
+
+inline Vec3
+normalize (Vec3 a)
+{
+  float l = length (a);
+  return l > 0.0f ? a * (1.0f / l) : a;
+}
+
+// Column major like GLSL, m[column * 4 + row]
+struct Mat4
+{
+  float m[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+};
+
+inline Mat4
+operator* (const Mat4 &a, const Mat4 &b)
+{
+  Mat4 result;
+  for (int column = 0; column < 4; column++)
+    {
+      for (int row = 0; row < 4; row++)
+        {
+          float sum = 0.0f;
+          for (int k = 0; k < 4; k++)
+            {
+              sum += a.m[k * 4 + row] * b.m[column * 4 + k];
+            }
+          result.m[column * 4 + row] = sum;
+        }
+    }
+  return result;
+}
+
+inline Mat4
+translate (Vec3 offset)
+{
+  Mat4 result;
+  result.m[12] = offset.x;
+  result.m[13] = offset.y;
+  result.m[14] = offset.z;
+  return result;
+}
+
+inline Mat4
+scale (Vec3 factors)
+{
+  Mat4 result;
+  result.m[0] = factors.x;
+  result.m[5] = factors.y;
+  result.m[10] = factors.z;
+  return result;
+}
+
+// Right handed view space looking down -z
+inline Mat4
+lookAt (Vec3 eye, Vec3 center, Vec3 up)
+{
+  Vec3 f = normalize (center - eye);
+  Vec3 s = normalize (cross (f, up));
+  Vec3 u = cross (s, f);
+
+  Mat4 result;
+  result.m[0] = s.x;
+  result.m[4] = s.y;
+  result.m[8] = s.z;
+  result.m[1] = u.x;
+  result.m[5] = u.y;
+  result.m[9] = u.z;
+  result.m[2] = -f.x;
+  result.m[6] = -f.y;
+  result.m[10] = -f.z;
+  result.m[12] = -dot (s, eye);
+  result.m[13] = -dot (u, eye);
+  result.m[14] = dot (f, eye);
+  return result;
+}
+
+// Vulkan clip space: y points down and depth goes from 0 to 1
+inline Mat4
+perspective (float fovY, float aspect, float nearPlane, float farPlane)
+{
+  float f = 1.0f / std::tan (fovY * 0.5f);
+
+  Mat4 result;
+  result.m[0] = f / aspect;
+  result.m[5] = -f;
+  result.m[10] = farPlane / (nearPlane - farPlane);
+  result.m[11] = -1.0f;
+  result.m[14] = nearPlane * farPlane / (nearPlane - farPlane);
+  result.m[15] = 0.0f;
+  return result;
+}
+} // namespace VulkanApp
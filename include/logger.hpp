@@ -0,0 +1,112 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+namespace VulkanApp
+{
+enum class LogSeverity : uint8_t
+{
+  Verbose,
+  Info,
+  Warning,
+  Error
+};
+
+const size_t LOG_SEVERITY_COUNT = 4;
+
+struct LoggerSettings
+{
+  LogSeverity minimumSeverity = LogSeverity::Warning;
+  // distinct messages per second written for each severity, Verbose to
+  // Error, the rest is only counted
+  uint32_t rateLimits[LOG_SEVERITY_COUNT] = { 5, 10, 20, 100 };
+  // how often repeat and drop counts are written
+  uint32_t summaryIntervalMs = 2000;
+  // queued messages, rounded up to a power of two
+  size_t capacity = 1024;
+};
+
+struct LoggerStats
+{
+  uint64_t written = 0;
+  // repeats of a message id that was already written
+  uint64_t duplicates = 0;
+  uint64_t rateLimited = 0;
+  // the queue was full, the message never reached the logger thread
+  uint64_t dropped = 0;
+};
+
+// Messages are copied into a fixed size lock-free ring and written to stderr
+// by a background thread, so logging from a driver callback costs a copy
+// and never allocates or flushes. It only takes a lock to wake the thread
+// up when it sleeps on an empty queue. The logger thread writes the
+// first occurrence of every message id and only counts the repeats, and
+// limits how many distinct messages per second each severity may write. Ids
+// that stop coming up are forgotten after a while, so the bookkeeping stays
+// bounded however many distinct messages go through.
+class Logger
+{
+public:
+  explicit Logger (const LoggerSettings &settings = LoggerSettings ());
+  ~Logger ();
+
+  Logger (const Logger &) = delete;
+  Logger &operator= (const Logger &) = delete;
+
+  bool
+  enabled (LogSeverity severity) const
+  {
+    return severity >= settings.minimumSeverity;
+  }
+
+  // Safe to call from any thread. messageId groups repeats of a message, 0
+  // groups by text instead. Returns false if the message was dropped because
+  // the queue was full. Text longer than MAX_MESSAGE_LENGTH is truncated.
+  bool log (LogSeverity severity, int32_t messageId, const char *text);
+
+  // Writes everything queued and the final counts, later messages are
+  // dropped
+  void stop ();
+
+  LoggerStats stats () const;
+
+  static const size_t MAX_MESSAGE_LENGTH = 1024;
+
+private:
+  struct Slot
+  {
+    std::atomic<uint64_t> sequence;
+    LogSeverity severity;
+    int32_t messageId;
+    uint32_t length;
+    char text[MAX_MESSAGE_LENGTH];
+  };
+
+  struct State;
+
+  void run ();
+  // wakes the logger thread up if it is waiting for messages
+  void wake ();
+
+  LoggerSettings settings;
+  size_t mask;
+  std::unique_ptr<Slot[]> slots;
+  // producers claim slots here, padded so they don't share a cache line with
+  // the consumer
+  alignas (64) std::atomic<uint64_t> tail{ 0 };
+  alignas (64) uint64_t head = 0;
+  std::atomic<uint64_t> dropped{ 0 };
+  std::atomic<uint64_t> written{ 0 };
+  std::atomic<uint64_t> duplicates{ 0 };
+  std::atomic<uint64_t> rateLimited{ 0 };
+  std::atomic<bool> running{ true };
+
+  std::unique_ptr<State> state;
+  std::thread thread;
+};
+
+const char *severityName (LogSeverity severity);
+} // namespace VulkanApp
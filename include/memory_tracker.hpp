@@ -0,0 +1,131 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+namespace VulkanApp
+{
+// Groups of Vulkan objects host allocations are counted for
+enum class HostAllocationType : uint8_t
+{
+  // instance, surfaces and the debug messenger
+  Instance,
+  Device,
+  Swapchain,
+  // images, their views and memory
+  Image,
+  // buffers and their memory
+  Buffer,
+  // pipelines, layouts, the pipeline cache and shader modules
+  Pipeline,
+  // render passes and framebuffers
+  RenderPass,
+  // fences and semaphores
+  Sync,
+  Command
+};
+
+const size_t HOST_ALLOCATION_TYPE_COUNT = 9;
+
+const char *hostAllocationTypeName (HostAllocationType type);
+
+struct HostAllocationStats
+{
+  uint64_t allocations = 0;
+  uint64_t liveBytes = 0;
+  uint64_t peakBytes = 0;
+  // reported by the driver through the internal allocation notifications,
+  // e.g. executable memory for pipelines
+  uint64_t internalBytes = 0;
+};
+
+struct HeapBudget
+{
+  VkDeviceSize size = 0;
+  // what the whole process uses of the heap and what it can use before
+  // the driver has to start paging, both 0 without VK_EXT_memory_budget
+  VkDeviceSize usage = 0;
+  VkDeviceSize budget = 0;
+  bool deviceLocal = false;
+};
+
+// Host and device memory telemetry. Host allocations made by the driver go
+// through callbacks(type), which counts them per object type; the same
+// callbacks have to be used to create and destroy an object. Device memory
+// is reported per heap by VK_EXT_memory_budget.
+class MemoryTracker
+{
+public:
+  MemoryTracker ();
+
+  MemoryTracker (const MemoryTracker &) = delete;
+  MemoryTracker &operator= (const MemoryTracker &) = delete;
+
+  const VkAllocationCallbacks *
+  callbacks (HostAllocationType type) const
+  {
+    return &allocationCallbacks[static_cast<size_t> (type)];
+  }
+
+  HostAllocationStats hostStats (HostAllocationType type) const;
+
+  // budgetExtension is whether VK_EXT_memory_budget is enabled on the
+  // device, without it heaps only report their size
+  void initBudget (VkPhysicalDevice physicalDevice, bool budgetExtension);
+  void updateBudget ();
+
+  bool
+  hasBudget () const
+  {
+    return budgetExtension;
+  }
+
+  const std::vector<HeapBudget> &
+  heaps () const
+  {
+    return heapBudgets;
+  }
+
+  // Highest usage / budget of the device local heaps as of the last
+  // updateBudget, extraBytes are added to the usage of each of them
+  double deviceLocalPressure (VkDeviceSize extraBytes = 0) const;
+
+  // One CSV row per heap and per host allocation type
+  static void writeReportHeader (std::ostream &out);
+  void writeReport (std::ostream &out, uint64_t frame) const;
+
+private:
+  struct Counters
+  {
+    std::atomic<uint64_t> allocations{ 0 };
+    std::atomic<uint64_t> liveBytes{ 0 };
+    std::atomic<uint64_t> peakBytes{ 0 };
+    std::atomic<uint64_t> internalBytes{ 0 };
+  };
+
+  static VKAPI_ATTR void *VKAPI_CALL
+  allocate (void *userData, size_t size, size_t alignment,
+            VkSystemAllocationScope scope);
+  static VKAPI_ATTR void *VKAPI_CALL
+  reallocate (void *userData, void *original, size_t size, size_t alignment,
+              VkSystemAllocationScope scope);
+  static VKAPI_ATTR void VKAPI_CALL release (void *userData, void *memory);
+  static VKAPI_ATTR void VKAPI_CALL
+  internalAllocation (void *userData, size_t size,
+                      VkInternalAllocationType type,
+                      VkSystemAllocationScope scope);
+  static VKAPI_ATTR void VKAPI_CALL
+  internalFree (void *userData, size_t size, VkInternalAllocationType type,
+                VkSystemAllocationScope scope);
+
+  Counters counters[HOST_ALLOCATION_TYPE_COUNT];
+  VkAllocationCallbacks allocationCallbacks[HOST_ALLOCATION_TYPE_COUNT];
+
+  VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+  bool budgetExtension = false;
+  std::vector<HeapBudget> heapBudgets;
+};
+} // namespace VulkanApp
@@ -0,0 +1,68 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace VulkanApp
+{
+// Full precision vertex, what the importer and optimizer work on and what
+// VertexFormat::Full uploads as is
+struct Vertex
+{
+  float position[3];
+  float normal[3];
+  float uv[2];
+  float color[4];
+};
+
+// VertexFormat::Quantized, 20 instead of 48 bytes:
+// - position as 16-bit UNORM relative to the mesh bounds, the w component is
+//   padding so the attribute stays 4 byte aligned
+// - normal octahedral encoded as 16-bit SNORM
+// - color as 8-bit UNORM
+// - uv as half floats so repeating uvs outside 0..1 survive
+struct PackedVertex
+{
+  uint16_t position[4];
+  int16_t normal[2];
+  uint8_t color[4];
+  uint16_t uv[2];
+};
+
+enum class VertexFormat : uint32_t
+{
+  Full,
+  Quantized
+};
+
+struct MeshBounds
+{
+  float min[3] = { 0.0f, 0.0f, 0.0f };
+  float max[3] = { 0.0f, 0.0f, 0.0f };
+};
+
+// Levels of detail a mesh cache holds at most
+const uint32_t MAX_MESH_LODS = 8;
+
+// One level of detail, a range of the mesh's index buffer. Every level
+// draws from the same vertices.
+struct MeshLod
+{
+  uint32_t firstIndex = 0;
+  uint32_t indexCount = 0;
+  // how far the level's surface may be off from the full mesh, in mesh
+  // units
+  float error = 0.0f;
+};
+
+// Indexed triangle list
+struct MeshData
+{
+  std::vector<Vertex> vertices;
+  std::vector<uint32_t> indices;
+  // Finest first, back to back in indices. Empty means indices is the full
+  // mesh and nothing else, see buildLods.
+  std::vector<MeshLod> lods;
+};
+
+MeshBounds computeBounds (const std::vector<Vertex> &vertices);
+} // namespace VulkanApp
@@ -0,0 +1,96 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "mesh.hpp"
+
+namespace VulkanApp
+{
+// Bump whenever the header, the vertex formats or the optimizer output change
+const uint32_t MESH_CACHE_VERSION = 3;
+
+// The vertex and index arrays follow the header exactly as they are
+// uploaded, so loading a cached mesh is an mmap and a copy into the staging
+// buffer
+struct MeshCacheHeader
+{
+  char magic[4];
+  uint32_t version;
+  VertexFormat vertexFormat;
+  // size of a Vertex / PackedVertex and of an index when the file was
+  // written
+  uint32_t vertexStride;
+  uint32_t indexSize;
+  uint64_t vertexCount;
+  // over every level of detail
+  uint64_t indexCount;
+  // from the start of the file, both 64 byte aligned
+  uint64_t vertexOffset;
+  uint64_t indexOffset;
+  // the source file the cache was built from, a mismatch means it is stale
+  uint64_t sourceSize;
+  int64_t sourceModified;
+  // quantized positions are relative to these
+  MeshBounds bounds;
+  // finest first, at least the full mesh
+  uint32_t lodCount;
+  MeshLod lods[MAX_MESH_LODS];
+};
+
+uint32_t vertexStride (VertexFormat format);
+
+// Quantizes the vertices first for VertexFormat::Quantized
+void writeMeshCache (const std::string &path, const MeshData &mesh,
+                     VertexFormat format, uint64_t sourceSize,
+                     int64_t sourceModified);
+
+// Read-only mapping of a mesh cache file
+class MappedMesh
+{
+public:
+  MappedMesh () = default;
+  ~MappedMesh ();
+
+  MappedMesh (MappedMesh &&other) noexcept;
+  MappedMesh &operator= (MappedMesh &&other) noexcept;
+  MappedMesh (const MappedMesh &) = delete;
+  MappedMesh &operator= (const MappedMesh &) = delete;
+
+  // Returns false if the file is missing, truncated or from another version
+  bool open (const std::string &path);
+  void close ();
+
+  const MeshCacheHeader &
+  header () const
+  {
+    return *static_cast<const MeshCacheHeader *> (data);
+  }
+
+  // Vertex or PackedVertex depending on header ().vertexFormat
+  const void *vertexData () const;
+  const uint32_t *indices () const;
+
+  size_t
+  vertexBytes () const
+  {
+    return header ().vertexCount * header ().vertexStride;
+  }
+
+  size_t
+  indexBytes () const
+  {
+    return header ().indexCount * sizeof (uint32_t);
+  }
+
+private:
+  void *data = nullptr;
+  size_t size = 0;
+};
+
+// Maps the cache of sourcePath from cacheDirectory, importing, optimizing,
+// simplifying into levels of detail and caching the source first if there
+// is no up to date cache in format
+MappedMesh loadMesh (const std::string &sourcePath,
+                     const std::string &cacheDirectory, VertexFormat format);
+} // namespace VulkanApp
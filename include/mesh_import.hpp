@@ -0,0 +1,13 @@
+#pragma once
+#include <string>
+
+#include "mesh.hpp"
+
+namespace VulkanApp
+{
+// Parses a Wavefront OBJ into an unoptimized triangle list. Polygons are fan
+// triangulated, every face corner gets its own vertex (optimizeMesh merges
+// them again) and smooth normals are generated when the file has none.
+// Throws std::runtime_error if the file can't be read or is malformed.
+MeshData importObj (const std::string &path);
+} // namespace VulkanApp
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "mesh.hpp"
+
+namespace VulkanApp
+{
+// Post-transform cache size the orderings are tuned for, a reasonable
+// middle ground between older and current GPUs
+const uint32_t VERTEX_CACHE_SIZE = 16;
+
+// Merges bitwise identical vertices and rewrites the indices to match
+void deduplicateVertices (MeshData &mesh);
+
+// Reorders triangles so vertices are reused while still in the post-transform
+// cache (Forsyth, "Linear-Speed Vertex Cache Optimisation")
+void optimizeVertexCache (std::vector<uint32_t> &indices, size_t vertexCount);
+
+// Reorders the clusters produced by optimizeVertexCache so outward facing
+// clusters on the outside of the mesh are drawn first, which cuts overdraw
+// without giving up the cache friendly order inside a cluster (Sander et
+// al., "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw")
+void optimizeOverdraw (std::vector<uint32_t> &indices,
+                       const std::vector<Vertex> &vertices);
+
+// Sorts vertices by first use in the index buffer so vertex fetch walks
+// memory linearly, unreferenced vertices are dropped
+void optimizeVertexFetch (MeshData &mesh);
+
+// All of the above in the order they have to run in
+void optimizeMesh (MeshData &mesh);
+
+// Average transformed vertices per triangle for a FIFO cache of cacheSize,
+// 0.5 is the best possible and 3 means no reuse at all
+float averageCacheMissRatio (const std::vector<uint32_t> &indices,
+                             size_t vertexCount,
+                             uint32_t cacheSize = VERTEX_CACHE_SIZE);
+} // namespace VulkanApp
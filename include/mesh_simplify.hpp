@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "mesh.hpp"
+
+namespace VulkanApp
+{
+// Collapses edges of an indexed triangle list, cheapest first by quadric
+// error (Garland and Heckbert, "Surface Simplification Using Quadric Error
+// Metrics"), until at most targetIndexCount indices are left or no collapse
+// is possible. A vertex only ever moves onto a neighbour, so the result
+// indexes the same vertices. Vertices on open borders and attribute seams
+// stay where they are, and collapses that flip a triangle are skipped.
+//
+// error receives how far the result is off from the input in mesh units,
+// the largest root mean square distance of a moved vertex to the planes of
+// the triangles it was collapsed from.
+std::vector<uint32_t> simplifyIndices (const std::vector<Vertex> &vertices,
+                                       const std::vector<uint32_t> &indices,
+                                       size_t targetIndexCount,
+                                       float *error = nullptr);
+
+// Appends a chain of coarser levels of detail to mesh.indices, each about
+// half the triangles of the one before and cache optimized, and fills
+// mesh.lods. Runs after optimizeMesh, which only knows the full mesh.
+void buildLods (MeshData &mesh);
+
+// Coarsest of lods (finest first) whose error stays below one pixel at
+// distance from the camera. pixelsPerUnit is how many pixels one mesh unit
+// covers at distance 1 divided by the error allowed in pixels, 0 always
+// picks the finest.
+uint32_t selectLod (const MeshLod *lods, uint32_t lodCount, float distance,
+                    float pixelsPerUnit);
+} // namespace VulkanApp
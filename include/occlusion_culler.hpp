@@ -0,0 +1,188 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+#include "app_options.hpp"
+#include "buffer_utils.hpp"
+#include "draw_list.hpp"
+#include "linear_math.hpp"
+#include "mesh.hpp"
+
+namespace VulkanApp
+{
+// What one view draws this frame, in the space the mesh's vertices are in
+struct CullInput
+{
+  // the matrix the mesh is drawn with
+  Mat4 viewProjection;
+  float boundsMin[3] = {};
+  float boundsMax[3] = {};
+  // instance i sits at (i % columns, i / columns) * spacing on the XZ
+  // plane, see mesh.vert
+  float spacingX = 0.0f;
+  float spacingZ = 0.0f;
+  uint32_t columns = 1;
+  uint32_t instanceCount = 0;
+  // picks every instance's level of detail like selectLod, by the depth of
+  // its closest corner, 0 always draws the full mesh
+  float lodPixelsPerUnit = 0.0f;
+  // rendered part of the depth buffer, the viewport
+  VkExtent2D viewport{};
+};
+
+// Instances of the last collected frame, summed over every view
+struct OcclusionCullStats
+{
+  uint64_t instances = 0;
+  // drawn because they were visible the frame before
+  uint64_t earlyDraws = 0;
+  // newly visible once tested against this frame's depth
+  uint64_t lateDraws = 0;
+  // of every drawn instance at the level of detail it was drawn at
+  uint64_t triangles = 0;
+};
+
+// Culls mesh instances on the GPU against the frustum and a hierarchical
+// depth buffer, in two phases per view:
+//
+// recordEarly writes draws for the instances visible last frame that are
+// still in the frustum. The caller draws them, which fills the depth
+// buffer with this frame's most likely occluders. recordLate downsamples
+// that depth into a pyramid of farthest depths, tests every instance's
+// bounding box against it and writes draws for the visible ones the early
+// pass didn't draw. The result is next frame's visible set.
+//
+// Draws are one indexed indirect command per instance, culled ones get no
+// instances. Each draws the range of the index buffer of the level of
+// detail picked for it, see setLods. Visible sets, draws and pyramids exist
+// once per view and are shared by every frame in flight like the depth
+// buffer, the barriers in recordEarly order them against the previous
+// frame's use.
+class OcclusionCuller
+{
+public:
+  OcclusionCuller () = default;
+  ~OcclusionCuller ();
+
+  OcclusionCuller (const OcclusionCuller &) = delete;
+  OcclusionCuller &operator= (const OcclusionCuller &) = delete;
+
+  // Whether the device can cull: indirect draws need multiDrawIndirect and
+  // drawIndirectFirstInstance, the depth format has to be sampleable and
+  // R32_SFLOAT a storage image
+  static bool supported (VkPhysicalDevice physicalDevice,
+                         VkFormat depthFormat);
+
+  void init (VkPhysicalDevice physicalDevice, VkDevice device,
+             uint32_t viewCount, VkPipelineCache pipelineCache,
+             const VkAllocationCallbacks *allocator = nullptr);
+
+  // (Re)builds a view's depth pyramid around its depth buffer, which needs
+  // VK_IMAGE_USAGE_SAMPLED_BIT. The device has to be idle.
+  void resize (uint32_t view, VkImageView depthView, VkExtent2D extent);
+
+  // Grows the per instance buffers of every view. Scene changes are rare,
+  // so growing waits for the device.
+  void reserve (uint32_t instanceCount);
+
+  // The mesh's levels of detail, finest first, at least the full mesh.
+  // Draws take their index range from these.
+  void setLods (const MeshLod *lods, uint32_t lodCount);
+
+  // Both outside of a render pass. The depth buffer has to be in
+  // DEPTH_STENCIL_READ_ONLY_OPTIMAL for recordLate. frame picks the stats
+  // slot, collect reads it back after the frame's fence.
+  void recordEarly (VkCommandBuffer buffer, uint32_t view, uint32_t frame,
+                    const CullInput &input);
+  void recordLate (VkCommandBuffer buffer, uint32_t view, uint32_t frame,
+                   const CullInput &input);
+
+  // The draws written by recordEarly or recordLate, for DrawList
+  IndirectBinding draws (uint32_t view, bool late,
+                         uint32_t instanceCount) const;
+
+  // most instances one indirect draw call can cover on this device
+  uint32_t
+  maxInstances () const
+  {
+    return maxDraws;
+  }
+
+  void collect (uint32_t frame);
+  const OcclusionCullStats &
+  stats () const
+  {
+    return lastStats;
+  }
+
+  // the device has to be idle
+  void cleanup ();
+
+private:
+  // enough for a 65536 pixel wide depth buffer
+  static const uint32_t MAX_LEVELS = 16;
+
+  struct ViewResources
+  {
+    VkImage pyramid = VK_NULL_HANDLE;
+    VkDeviceMemory pyramidMemory = VK_NULL_HANDLE;
+    // every level on its own for the downsample, and all of them for the
+    // test
+    VkImageView levelViews[MAX_LEVELS] = {};
+    VkImageView pyramidView = VK_NULL_HANDLE;
+    uint32_t levels = 0;
+    VkExtent2D extent{};
+    VkImageView depthView = VK_NULL_HANDLE;
+
+    // a uint per instance, whether it passed the last late test
+    GpuBuffer visibility;
+    // early draws, then late draws, capacity commands each
+    GpuBuffer drawCommands;
+    // per frame in flight the early and the late draws, then the draws at
+    // each level of detail
+    GpuBuffer counters;
+    // the visible set starts out empty, cleared by the next recordEarly
+    bool cleared = false;
+    // whether a frame slot's counters were recorded and not yet collected
+    bool counted[MAX_FRAMES_IN_FLIGHT] = {};
+
+    VkDescriptorSet cullSet = VK_NULL_HANDLE;
+    VkDescriptorSet levelSets[MAX_LEVELS] = {};
+  };
+
+  void createPipelines (VkPipelineCache pipelineCache);
+  void destroyPyramid (ViewResources &resources);
+  void writeCullSet (ViewResources &resources);
+  void recordCull (VkCommandBuffer buffer, ViewResources &resources,
+                   uint32_t frame, const CullInput &input, bool late);
+  void recordPyramid (VkCommandBuffer buffer, ViewResources &resources,
+                      const CullInput &input);
+
+  VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+  VkDevice device = VK_NULL_HANDLE;
+  const VkAllocationCallbacks *allocator = nullptr;
+
+  VkSampler sampler = VK_NULL_HANDLE;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  VkDescriptorSetLayout pyramidSetLayout = VK_NULL_HANDLE;
+  VkDescriptorSetLayout cullSetLayout = VK_NULL_HANDLE;
+  VkPipelineLayout pyramidLayout = VK_NULL_HANDLE;
+  VkPipelineLayout cullLayout = VK_NULL_HANDLE;
+  VkPipeline pyramidPipeline = VK_NULL_HANDLE;
+  VkPipeline cullPipeline = VK_NULL_HANDLE;
+
+  std::vector<ViewResources> views;
+  // lodCount and lods as occlusion_cull.comp reads them, shared by every
+  // view
+  GpuBuffer lodTable;
+  MeshLod lods[MAX_MESH_LODS];
+  uint32_t lodCount = 0;
+  uint32_t maxDraws = 0;
+  // instances the buffers of every view have room for
+  uint32_t capacity = 0;
+  // instances culled per frame slot, over every view
+  uint64_t frameInstances[MAX_FRAMES_IN_FLIGHT] = {};
+  OcclusionCullStats lastStats;
+};
+} // namespace VulkanApp
@@ -0,0 +1,103 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace VulkanApp
+{
+// Particles are stored attribute-major, structure of arrays: attribute a of
+// particle i is at a * capacity + i. particles.comp and particle.vert use
+// the same layout and the same constants.
+namespace Particles
+{
+enum Attribute : uint32_t
+{
+  POSITION_X,
+  POSITION_Y,
+  POSITION_Z,
+  VELOCITY_X,
+  VELOCITY_Y,
+  VELOCITY_Z,
+  AGE,
+  LIFETIME,
+  ATTRIBUTE_COUNT
+};
+
+// Compaction scans in blocks of GROUP_SIZE, one workgroup each on the GPU
+const uint32_t GROUP_SIZE = 256;
+// a dispatch can't have more than 65535 groups along x
+const uint32_t MAX_PARTICLES = 65535 * GROUP_SIZE;
+
+// Motion in emitter scales per second, see ParticleEmitter
+const float GRAVITY = 1.5f;
+// fraction of the velocity lost per second
+const float DRAG = 0.1f;
+// fraction of the vertical velocity kept when bouncing off the floor
+const float BOUNCE = 0.4f;
+const float SPREAD = 0.5f;
+const float LAUNCH_SPEED = 1.6f;
+const float LAUNCH_JITTER = 0.5f;
+// in seconds, each particle lives between half of it and all of it
+const float MAX_LIFETIME = 4.0f;
+// one step per frame, the simulation doesn't depend on the frame rate
+const float TIME_STEP = 1.0f / 60.0f;
+
+// New particles per step that keep capacity particles alive once the
+// system has filled up
+uint32_t emitRate (uint32_t capacity);
+} // namespace Particles
+
+// A fountain on a floor: particles start at position, the floor, and are
+// thrown up and out at speeds proportional to scale
+struct ParticleEmitter
+{
+  float position[3] = {};
+  float scale = 1.0f;
+};
+
+// CPU version of the steps particles.comp runs on the GPU, for validation
+// and as a baseline. It does the same arithmetic in the same order, the
+// simulation four particles at a time with SSE2. Capacity is clamped to
+// MAX_PARTICLES like on the GPU.
+class ParticleReference
+{
+public:
+  explicit ParticleReference (uint32_t capacity);
+
+  ParticleReference (const ParticleReference &) = delete;
+  ParticleReference &operator= (const ParticleReference &) = delete;
+
+  // Appends up to count particles after the live ones, seed picks their
+  // random launch
+  void emit (const ParticleEmitter &emitter, uint32_t count, uint32_t seed);
+  // Moves every particle by one TIME_STEP. simd = false takes the scalar
+  // loop, both give the same result.
+  void simulate (const ParticleEmitter &emitter, bool simd = true);
+  // Moves the particles still alive to the front of the other buffer in
+  // their current order, by an exclusive prefix sum over blocks of
+  // GROUP_SIZE like the GPU, and makes it the current one
+  void compact ();
+
+  uint32_t
+  aliveCount () const
+  {
+    return alive;
+  }
+
+  // capacity values of the current buffer, the first aliveCount are live
+  const float *
+  attribute (Particles::Attribute attribute) const
+  {
+    return current->data () + attribute * capacity;
+  }
+
+private:
+  uint32_t capacity;
+  uint32_t alive = 0;
+  std::vector<float> buffers[2];
+  std::vector<float> *current;
+  std::vector<float> *other;
+  // per particle offset within its block, and per block offset
+  std::vector<uint32_t> offsets;
+  std::vector<uint32_t> blockOffsets;
+};
+} // namespace VulkanApp
@@ -0,0 +1,95 @@
+#pragma once
+#include <cstdint>
+#include <vulkan/vulkan_core.h>
+
+#include "buffer_utils.hpp"
+#include "linear_math.hpp"
+#include "particle_reference.hpp"
+#include "pipeline_manager.hpp"
+
+namespace VulkanApp
+{
+// Emits, moves and draws particles without the CPU ever reading them back.
+//
+// Particles live in two storage buffers laid out as structure of arrays,
+// see ParticleReference for the layout and for the same steps on the CPU.
+// A step is four compute dispatches: emit appends new particles after the
+// live ones, simulate moves them all and prefix-sums which survive within
+// each workgroup, scan turns the workgroup totals into offsets and compact
+// scatters the survivors into the other buffer, keeping them packed at the
+// front. The scan also writes the live count into an indirect draw, the
+// particles are drawn as one instanced quad each without the count ever
+// reaching the CPU.
+class ParticleSystem
+{
+public:
+  ParticleSystem () = default;
+  ~ParticleSystem ();
+
+  ParticleSystem (const ParticleSystem &) = delete;
+  ParticleSystem &operator= (const ParticleSystem &) = delete;
+
+  // The pipeline is compatible with renderPass, depth tested against it
+  // but not writing depth, blended additively
+  void init (VkPhysicalDevice physicalDevice, VkDevice device,
+             VkPipelineCache pipelineCache, VkRenderPass renderPass,
+             const VkAllocationCallbacks *allocator = nullptr);
+
+  // Holds up to capacity particles, clamped to MAX_PARTICLES. Waits for
+  // the device and starts over empty when the capacity changes.
+  void reserve (uint32_t capacity);
+
+  uint32_t
+  capacity () const
+  {
+    return particleCapacity;
+  }
+
+  // Records one step outside of a render pass, once a frame. The step of
+  // the frame before is waited for on the GPU, the buffers are shared by
+  // every frame in flight.
+  void recordSimulation (VkCommandBuffer buffer,
+                         const ParticleEmitter &emitter, uint32_t seed);
+
+  // Draws the live particles inside a render pass compatible with init's.
+  // viewport is the rendered extent, sprites keep their size in pixels.
+  void record (VkCommandBuffer buffer, const Mat4 &viewProjection,
+               VkExtent2D viewport);
+
+  // the device has to be idle
+  void cleanup ();
+
+private:
+  void createPipelines (VkPipelineCache pipelineCache,
+                        VkRenderPass renderPass);
+  void destroyBuffers ();
+
+  VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+  VkDevice device = VK_NULL_HANDLE;
+  const VkAllocationCallbacks *allocator = nullptr;
+
+  PipelineManager pipelines;
+  VkPipeline drawPipeline = VK_NULL_HANDLE;
+  VkPipelineLayout drawLayout = VK_NULL_HANDLE;
+  VkPipelineLayout computeLayout = VK_NULL_HANDLE;
+  VkPipeline emitPipeline = VK_NULL_HANDLE;
+  VkPipeline simulatePipeline = VK_NULL_HANDLE;
+  VkPipeline scanPipeline = VK_NULL_HANDLE;
+  VkPipeline compactPipeline = VK_NULL_HANDLE;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+
+  // Set i simulates particles[i] and compacts into the other one
+  GpuBuffer particles[2];
+  VkDescriptorSet sets[2] = {};
+  GpuBuffer offsets;
+  GpuBuffer blockOffsets;
+  // counts, dispatch and draw arguments, see ParticleState
+  GpuBuffer state;
+  // the buffer holding the live particles
+  uint32_t current = 0;
+  uint32_t particleCapacity = 0;
+  // state is written once after the buffers are created
+  bool cleared = false;
+};
+} // namespace VulkanApp
@@ -0,0 +1,366 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+#include "job_system.hpp"
+#include "logger.hpp"
+
+namespace VulkanApp
+{
+const uint32_t MAX_SPECIALIZATION_CONSTANTS = 4;
+// Bump whenever PipelineKey or the manifest layout changes
+const uint32_t PIPELINE_MANIFEST_VERSION = 1;
+
+// Reads a compiled shader, throws if it can't be opened
+std::vector<char> readSpirv (const std::string &path);
+
+enum class BlendMode : uint8_t
+{
+  Opaque,
+  Alpha,
+  Additive
+};
+
+// Everything that tells two graphics pipelines apart, packed into 32 bytes
+// so it can be hashed and compared as plain data. Shaders and vertex inputs
+// are ids registered with the PipelineManager. Keys are built with the
+// constexpr with* functions, so keys known at compile time, their hashes
+// included, cost nothing at runtime:
+//
+//   constexpr PipelineKey KEY
+//       = PipelineKey ().withShaders (VERT, FRAG).withBlend (Alpha);
+//
+// Specialization constant i is constant_id i in both stages, every
+// constant is 32 bits.
+struct PipelineKey
+{
+  uint16_t vertexShader = 0;
+  uint16_t fragmentShader = 0;
+  uint16_t vertexInput = 0;
+  uint8_t topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  uint8_t polygonMode = VK_POLYGON_MODE_FILL;
+  uint8_t cullMode = VK_CULL_MODE_BACK_BIT;
+  uint8_t frontFace = VK_FRONT_FACE_CLOCKWISE;
+  uint8_t samples = VK_SAMPLE_COUNT_1_BIT;
+  BlendMode blend = BlendMode::Opaque;
+  uint8_t depthTest = 0;
+  uint8_t depthWrite = 0;
+  uint8_t depthCompare = VK_COMPARE_OP_LESS;
+  uint8_t specializationCount = 0;
+  uint32_t specialization[MAX_SPECIALIZATION_CONSTANTS] = {};
+
+  constexpr PipelineKey
+  withShaders (uint16_t vertex, uint16_t fragment) const
+  {
+    PipelineKey key = *this;
+    key.vertexShader = vertex;
+    key.fragmentShader = fragment;
+    return key;
+  }
+
+  constexpr PipelineKey
+  withVertexInput (uint16_t id) const
+  {
+    PipelineKey key = *this;
+    key.vertexInput = id;
+    return key;
+  }
+
+  constexpr PipelineKey
+  withTopology (VkPrimitiveTopology value) const
+  {
+    PipelineKey key = *this;
+    key.topology = static_cast<uint8_t> (value);
+    return key;
+  }
+
+  constexpr PipelineKey
+  withRasterizer (VkPolygonMode polygon, VkCullModeFlags cull,
+                  VkFrontFace front) const
+  {
+    PipelineKey key = *this;
+    key.polygonMode = static_cast<uint8_t> (polygon);
+    key.cullMode = static_cast<uint8_t> (cull);
+    key.frontFace = static_cast<uint8_t> (front);
+    return key;
+  }
+
+  constexpr PipelineKey
+  withSamples (VkSampleCountFlagBits value) const
+  {
+    PipelineKey key = *this;
+    key.samples = static_cast<uint8_t> (value);
+    return key;
+  }
+
+  constexpr PipelineKey
+  withBlend (BlendMode value) const
+  {
+    PipelineKey key = *this;
+    key.blend = value;
+    return key;
+  }
+
+  constexpr PipelineKey
+  withDepth (bool test, bool write,
+             VkCompareOp compare = VK_COMPARE_OP_LESS) const
+  {
+    PipelineKey key = *this;
+    key.depthTest = test;
+    key.depthWrite = write;
+    key.depthCompare = static_cast<uint8_t> (compare);
+    return key;
+  }
+
+  template <typename... Values>
+  constexpr PipelineKey
+  withSpecialization (Values... values) const
+  {
+    static_assert (sizeof...(Values) <= MAX_SPECIALIZATION_CONSTANTS,
+                   "Too many specialization constants");
+    PipelineKey key = *this;
+    const uint32_t constants[] = { 0u, static_cast<uint32_t> (values)... };
+    key.specializationCount = sizeof...(Values);
+    for (uint32_t i = 0; i < sizeof...(Values); i++)
+      {
+        key.specialization[i] = constants[i + 1];
+      }
+    return key;
+  }
+
+  // FNV-1a over the fields, evaluated by the compiler for constexpr keys
+  constexpr uint64_t
+  hash () const
+  {
+    uint64_t h = 14695981039346656037ull;
+    const uint32_t words[] = {
+      vertexShader | static_cast<uint32_t> (fragmentShader) << 16,
+      vertexInput | static_cast<uint32_t> (topology) << 16
+          | static_cast<uint32_t> (polygonMode) << 24,
+      cullMode | static_cast<uint32_t> (frontFace) << 8
+          | static_cast<uint32_t> (samples) << 16
+          | static_cast<uint32_t> (blend) << 24,
+      depthTest | static_cast<uint32_t> (depthWrite) << 8
+          | static_cast<uint32_t> (depthCompare) << 16
+          | static_cast<uint32_t> (specializationCount) << 24,
+      specialization[0],
+      specialization[1],
+      specialization[2],
+      specialization[3],
+    };
+    for (uint32_t word : words)
+      {
+        h = (h ^ word) * 1099511628211ull;
+      }
+    return h;
+  }
+
+  constexpr bool
+  operator== (const PipelineKey &other) const
+  {
+    if (vertexShader != other.vertexShader
+        || fragmentShader != other.fragmentShader
+        || vertexInput != other.vertexInput || topology != other.topology
+        || polygonMode != other.polygonMode || cullMode != other.cullMode
+        || frontFace != other.frontFace || samples != other.samples
+        || blend != other.blend || depthTest != other.depthTest
+        || depthWrite != other.depthWrite
+        || depthCompare != other.depthCompare
+        || specializationCount != other.specializationCount)
+      {
+        return false;
+      }
+    for (uint32_t i = 0; i < MAX_SPECIALIZATION_CONSTANTS; i++)
+      {
+        if (specialization[i] != other.specialization[i])
+          {
+            return false;
+          }
+      }
+    return true;
+  }
+};
+
+static_assert (sizeof (PipelineKey) == 32, "PipelineKey should stay packed");
+static_assert (std::is_trivially_copyable<PipelineKey>::value,
+               "PipelineKey is hashed and stored as plain data");
+
+struct PipelineKeyHash
+{
+  size_t
+  operator() (const PipelineKey &key) const
+  {
+    return static_cast<size_t> (key.hash ());
+  }
+};
+
+struct VertexInputLayout
+{
+  std::vector<VkVertexInputBindingDescription> bindings;
+  std::vector<VkVertexInputAttributeDescription> attributes;
+};
+
+struct PipelineManagerStats
+{
+  uint64_t hits = 0;
+  uint64_t compiles = 0;
+  // compiles done ahead of time from a manifest
+  uint64_t precompiles = 0;
+  // with pipeline libraries, parts compiled and optimized pipelines that
+  // replaced a fast-linked one
+  uint64_t libraries = 0;
+  uint64_t optimizedLinks = 0;
+};
+
+// Keys requested by an earlier run, earliest first request first. The
+// fingerprint covers the registered shaders and vertex inputs, since keys
+// only refer to them by id.
+struct PipelineManifestHeader
+{
+  char magic[4];
+  uint32_t version;
+  uint64_t fingerprint;
+  uint64_t keyCount;
+};
+
+// Creates graphics pipelines on first request and hands out the same
+// pipeline for every later request of an equal key. Lookups only take a
+// shared lock on one of several shards, a compile happens outside of any
+// lock and threads asking for a key that is being compiled wait for that
+// compile instead of starting their own. Every pipeline uses the layout and
+// render pass given to init, viewport and scissor are dynamic state.
+//
+// Every key requested through get is remembered, saveManifest writes them
+// out so the next run can precompile them on worker threads while the
+// first frames are being set up and rendered.
+//
+// With VK_EXT_graphics_pipeline_library a key is split into its vertex
+// input, pre-rasterization, fragment shader and fragment output parts.
+// Each part is compiled into a library once and shared by every key using
+// it, a new key only costs a fast link of four libraries. An optimized
+// link then runs in the background and get returns it once it is done,
+// the stats' optimizedLinks tells callers holding on to pipelines when to
+// ask again.
+class PipelineManager
+{
+public:
+  PipelineManager () = default;
+  ~PipelineManager ();
+
+  PipelineManager (const PipelineManager &) = delete;
+  PipelineManager &operator= (const PipelineManager &) = delete;
+
+  // useLibraries needs the graphicsPipelineLibrary feature enabled,
+  // allocator is used for pipelines and shader modules alike. Failed
+  // background compiles are reported to logger, if any.
+  void init (VkDevice device, VkPipelineCache pipelineCache,
+             VkPipelineLayout layout, VkRenderPass renderPass,
+             bool useLibraries = false,
+             const VkAllocationCallbacks *allocator = nullptr,
+             Logger *logger = nullptr);
+
+  // SPIR-V file for a shader id, loaded on the first compile that uses it.
+  // Ids have to be registered before requesting keys that use them.
+  void setShader (uint16_t id, const std::string &path);
+  // Vertex input id 0 is the empty layout unless replaced
+  void setVertexInput (uint16_t id, const VertexInputLayout &layout);
+
+  // Safe to call from any thread. Throws std::runtime_error if the
+  // pipeline can't be created.
+  VkPipeline get (const PipelineKey &key);
+
+  // Queues the keys of a manifest for compiling on background threads in
+  // the order they were first requested. Call it once every shader and
+  // vertex input is registered. A missing, stale or broken manifest is
+  // ignored. Returns the number of keys queued.
+  size_t precompile (const std::string &manifestPath);
+  // Writes every key requested through get so far, false if the file
+  // couldn't be written
+  bool saveManifest (const std::string &manifestPath);
+
+  PipelineManagerStats stats () const;
+
+  // Stops precompiling and optimizing and destroys every pipeline, library
+  // and shader module, the device has to be idle
+  void cleanup ();
+
+private:
+  static const size_t SHARD_COUNT = 16;
+  static const size_t LIBRARY_PART_COUNT = 4;
+
+  struct Entry
+  {
+    std::shared_future<VkPipeline> pipeline;
+    // set on the first get, precompiled keys nobody asked for aren't
+    // written to the next manifest
+    std::atomic<bool> requested{ false };
+    std::atomic<uint64_t> firstRequest{ 0 };
+    // replaces the fast-linked pipeline once the background link is done
+    std::atomic<VkPipeline> optimized{ VK_NULL_HANDLE };
+  };
+
+  struct Shard
+  {
+    std::shared_mutex mutex;
+    std::unordered_map<PipelineKey, Entry, PipelineKeyHash> pipelines;
+  };
+
+  VkPipeline lookup (const PipelineKey &key, bool request);
+  void markRequested (Entry &entry);
+  VkPipeline compile (const PipelineKey &key);
+  // parts is 0 for a complete pipeline, else the library parts to create
+  VkPipeline create (const PipelineKey &key,
+                     VkGraphicsPipelineLibraryFlagsEXT parts);
+  VkPipeline library (size_t part, const PipelineKey &key);
+  VkPipeline link (const PipelineKey &key, bool optimize);
+  void optimize (const PipelineKey &key);
+  // a background priority job, its failure is logged
+  void runBackground (std::function<void ()> work);
+  VkShaderModule shaderModule (uint16_t id);
+  uint64_t fingerprint ();
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+  VkPipelineLayout layout = VK_NULL_HANDLE;
+  VkRenderPass renderPass = VK_NULL_HANDLE;
+  bool useLibraries = false;
+  const VkAllocationCallbacks *allocator = nullptr;
+  Logger *logger = nullptr;
+
+  Shard shards[SHARD_COUNT];
+
+  // shader and vertex input tables, only touched when compiling
+  std::mutex tablesMutex;
+  std::unordered_map<uint16_t, std::string> shaderPaths;
+  std::unordered_map<uint16_t, VkShaderModule> shaderModules;
+  std::unordered_map<uint16_t, VertexInputLayout> vertexInputs;
+
+  // keyed by the part's fields only, see libraryKey
+  std::mutex librariesMutex;
+  std::unordered_map<PipelineKey, std::shared_future<VkPipeline>,
+                     PipelineKeyHash>
+      libraries[LIBRARY_PART_COUNT];
+
+  // precompiles and optimized links on the shared job system
+  JobCounter background;
+  // stops queued precompiles and optimized links at cleanup
+  std::atomic<bool> cancelBackground{ false };
+  std::atomic<uint64_t> requestCount{ 0 };
+
+  std::atomic<uint64_t> hits{ 0 };
+  std::atomic<uint64_t> compiles{ 0 };
+  std::atomic<uint64_t> precompiles{ 0 };
+  std::atomic<uint64_t> libraryCount{ 0 };
+  std::atomic<uint64_t> optimizedLinks{ 0 };
+};
+} // namespace VulkanApp
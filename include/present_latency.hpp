@@ -0,0 +1,119 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vulkan/vulkan_core.h>
+
+namespace VulkanApp
+{
+struct PresentLatencyStats
+{
+  // acquire to the image being on screen, smoothed. Estimated from the
+  // frame's fence when measured is false.
+  double latencyMilliseconds = 0.0;
+  // unsmoothed, over all frames, for the mean latency of a run
+  double latencySumMilliseconds = 0.0;
+  // time between two frames reaching the screen, smoothed
+  double intervalMilliseconds = 0.0;
+  // how long frames are held back before they start
+  double delayMilliseconds = 0.0;
+  uint64_t frames = 0;
+  bool measured = false;
+};
+
+// Measures how long a frame takes from acquiring its image until it is
+// shown and paces frames so they don't queue up in front of the display.
+//
+// With VK_KHR_present_id and VK_KHR_present_wait presents are tagged with
+// increasing ids, and the render thread polls whether they were shown with
+// a zero timeout around each acquire and present. The swap chain is
+// externally synchronized for all three calls, so no other thread may wait
+// on it. A frame counts as shown when a poll sees it, which is at most one
+// frame late.
+// Without them a frame counts as shown once the render thread sees its
+// fence signalled. That is the latest the GPU finished it, so the estimate
+// is off by the compositor's part but still grows with every queued frame.
+// Headless frames are never presented and always measured that way.
+//
+// Latency beyond one present interval plus the time a frame needs on its
+// own means frames wait in a queue. frameDelay grows then, starting the
+// next frame later, with its input sampled later, without presenting any
+// later.
+class PresentLatency
+{
+public:
+  PresentLatency () = default;
+  ~PresentLatency ();
+
+  PresentLatency (const PresentLatency &) = delete;
+  PresentLatency &operator= (const PresentLatency &) = delete;
+
+  // presentWait is whether both extensions and their features are enabled,
+  // pacing false only measures
+  void init (VkDevice device, bool presentWait, bool pacing);
+
+  bool
+  waitsForPresent () const
+  {
+    return waitForPresent != nullptr;
+  }
+
+  // Swap chain whose presents are polled. Set it to VK_NULL_HANDLE before
+  // destroying the swap chain. Everything but stats and frameDelay is
+  // render thread only.
+  void setSwapchain (VkSwapchainKHR swapchain);
+
+  // Right before acquiring the image of frame slot. Returns the id to
+  // present the image with, 0 for none.
+  uint64_t beginFrame (uint32_t slot);
+  // after the frame begun in slot was queued for presenting
+  void presented (uint32_t slot);
+  // after waiting for slot's fence, feeds the estimate without present wait
+  void retired (uint32_t slot);
+
+  // how long the render thread should wait before the next frame
+  std::chrono::microseconds frameDelay () const;
+
+  PresentLatencyStats stats () const;
+
+  // Forgets the presents still polled for
+  void cleanup ();
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  // one per frame slot, generously sized
+  static const uint32_t MAX_SLOTS = 8;
+
+  struct Frame
+  {
+    uint64_t presentId = 0;
+    Clock::time_point start;
+    bool pending = false;
+  };
+
+  // records every queued present that has been shown by now
+  void poll ();
+  void record (Clock::time_point start, Clock::time_point shown);
+
+  VkDevice device = VK_NULL_HANDLE;
+  PFN_vkWaitForPresentKHR waitForPresent = nullptr;
+  bool pacing = false;
+
+  Frame frames[MAX_SLOTS];
+  uint64_t nextPresentId = 1;
+
+  // frames queued for presenting, oldest first, and the swap chain they
+  // were presented to
+  std::deque<Frame> queued;
+  VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+
+  // written by the render thread, read by whoever asks for stats
+  mutable std::mutex statsMutex;
+  PresentLatencyStats current;
+  Clock::time_point lastShown;
+  std::atomic<int64_t> delayMicroseconds{ 0 };
+};
+} // namespace VulkanApp
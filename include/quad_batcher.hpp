@@ -0,0 +1,120 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+#include "app_options.hpp"
+#include "buffer_utils.hpp"
+#include "pipeline_manager.hpp"
+#include "quad_stream.hpp"
+
+namespace VulkanApp
+{
+// Of the last end
+struct QuadBatcherStats
+{
+  uint32_t quads = 0;
+  uint32_t draws = 0;
+  uint32_t textureBinds = 0;
+  uint32_t dropped = 0;
+};
+
+// Draws textured, tinted and rotated screen space quads with alpha
+// blending, written straight into GPU memory every frame.
+//
+// Every frame slot has its own persistently mapped stream buffer, so
+// filling one never waits for the GPU to read another. The vertex shader
+// pulls its quad out of the stream by gl_VertexIndex / 4, there is no
+// vertex buffer and nothing is copied. A static index buffer holding six
+// indices per quad serves every batch through the draw's vertex offset,
+// which makes a batch a single vkCmdDrawIndexed.
+class QuadBatcher
+{
+public:
+  // textures addTexture takes
+  static const uint32_t MAX_TEXTURES = 64;
+
+  QuadBatcher () = default;
+  ~QuadBatcher ();
+
+  QuadBatcher (const QuadBatcher &) = delete;
+  QuadBatcher &operator= (const QuadBatcher &) = delete;
+
+  // Pipelines are compatible with renderPass and draw without depth
+  // testing
+  void init (VkPhysicalDevice physicalDevice, VkDevice device,
+             VkPipelineCache pipelineCache, VkRenderPass renderPass,
+             const VkAllocationCallbacks *allocator = nullptr);
+
+  // Sampled with linear filtering and clamped, in
+  // SHADER_READ_ONLY_OPTIMAL. The view has to outlive the batcher.
+  // Returns the id add takes.
+  uint32_t addTexture (VkImageView view);
+
+  // Makes room for quadCount quads a frame over the textures added so far,
+  // every frame slot grows to it on its next begin
+  void reserve (uint32_t quadCount);
+
+  uint32_t
+  capacity () const
+  {
+    return quadCapacity;
+  }
+
+  // Starts filling frame's stream. The GPU has to be done with the last
+  // frame recorded in that slot, its fence waited for.
+  void begin (uint32_t frame);
+
+  Quad *
+  add (uint32_t texture)
+  {
+    return stream.add (texture);
+  }
+
+  void end ();
+
+  // Draws the quads between the last begin and end inside a render pass
+  // compatible with init's, for as many views as needed. canvas is the
+  // size quad positions are given in, mapped onto the whole viewport.
+  // Binds its own pipeline, descriptor sets and push constants.
+  void record (VkCommandBuffer buffer, VkExtent2D canvas);
+
+  const QuadBatcherStats &
+  stats () const
+  {
+    return lastStats;
+  }
+
+  // the device has to be idle
+  void cleanup ();
+
+private:
+  void createPipeline (VkPipelineCache pipelineCache,
+                       VkRenderPass renderPass);
+  void createIndexBuffer ();
+
+  VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+  VkDevice device = VK_NULL_HANDLE;
+  const VkAllocationCallbacks *allocator = nullptr;
+
+  PipelineManager pipelines;
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  VkPipelineLayout layout = VK_NULL_HANDLE;
+  VkSampler sampler = VK_NULL_HANDLE;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  VkDescriptorSetLayout streamSetLayout = VK_NULL_HANDLE;
+  VkDescriptorSetLayout textureSetLayout = VK_NULL_HANDLE;
+
+  // per frame slot, mapped and bound as a storage buffer
+  GpuBuffer streams[MAX_FRAMES_IN_FLIGHT];
+  VkDescriptorSet streamSets[MAX_FRAMES_IN_FLIGHT] = {};
+  std::vector<VkDescriptorSet> textureSets;
+  // 16 bit, six per quad for QuadStream::MAX_CHUNK_QUADS quads
+  GpuBuffer indices;
+
+  QuadStream stream;
+  uint32_t quadCapacity = 0;
+  uint32_t frame = 0;
+  QuadBatcherStats lastStats;
+};
+} // namespace VulkanApp
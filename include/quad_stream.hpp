@@ -0,0 +1,118 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace VulkanApp
+{
+// Matches the Quad struct in quad.vert. 32 bytes, so a quad is half a
+// cache line and 1M of them are 32 MB per frame.
+struct Quad
+{
+  // top left corner and size in canvas pixels, see QuadBatcher::record
+  float position[2];
+  float size[2];
+  // texture rectangle as UNORM16, left, top, right, bottom
+  uint16_t uv[4];
+  // RGBA8, red in the lowest byte, multiplied with the texture
+  uint32_t color;
+  // radians, clockwise on screen around the quad's center
+  float rotation;
+};
+
+static_assert (sizeof (Quad) == 32, "Quad has to match quad.vert");
+
+// Quads of one texture, contiguous in the stream
+struct QuadBatch
+{
+  uint32_t texture;
+  uint32_t firstQuad;
+  uint32_t quadCount;
+};
+
+// Hands out slots of a quad array for the caller to write into directly,
+// grouped by texture without ever moving a quad. Every texture fills its
+// own chunk of the array, a full chunk gets a new one twice its size, so a
+// texture drawn a lot ends up in few batches and one drawn a little wastes
+// little room. end orders the batches by texture and merges neighbouring
+// chunks.
+//
+// The array may be write-combined GPU memory: write every field of a quad
+// once and never read it back.
+class QuadStream
+{
+public:
+  static const uint32_t MIN_CHUNK_QUADS = 256;
+  // also the most quads one batch covers, QuadBatcher's index buffer has
+  // room for this many
+  static const uint32_t MAX_CHUNK_QUADS = 16384;
+
+  // Array size that always fits quadCount quads spread over up to
+  // textureCount textures. Every texture's last chunk may end up mostly
+  // empty, which costs at most a chunk per texture and never more than
+  // quadCount again.
+  static uint32_t capacityFor (uint32_t quadCount, uint32_t textureCount);
+
+  void begin (Quad *quads, uint32_t capacity);
+
+  // A slot for a quad with texture. Never fails, once the array is full
+  // the quad lands in a scratch slot and is counted as dropped.
+  Quad *
+  add (uint32_t texture)
+  {
+    if (texture < chunks.size ())
+      {
+        Chunk &chunk = chunks[texture];
+        if (chunk.next != chunk.end)
+          {
+            return quads + chunk.next++;
+          }
+      }
+    return addChunk (texture);
+  }
+
+  // The batches stay valid until the next begin
+  const std::vector<QuadBatch> &end ();
+
+  const std::vector<QuadBatch> &
+  batches () const
+  {
+    return frameBatches;
+  }
+
+  // over the batches of the last end
+  uint32_t
+  quadCount () const
+  {
+    return count;
+  }
+
+  uint32_t
+  dropped () const
+  {
+    return droppedCount;
+  }
+
+private:
+  struct Chunk
+  {
+    uint32_t next = 0;
+    uint32_t end = 0;
+    uint32_t size = 0;
+    // index into frameBatches
+    uint32_t batch = 0;
+  };
+
+  Quad *addChunk (uint32_t texture);
+
+  Quad *quads = nullptr;
+  uint32_t capacity = 0;
+  // quads handed to chunks so far
+  uint32_t allocated = 0;
+  // the open chunk per texture
+  std::vector<Chunk> chunks;
+  std::vector<QuadBatch> frameBatches;
+  uint32_t count = 0;
+  uint32_t droppedCount = 0;
+  Quad overflow;
+};
+} // namespace VulkanApp
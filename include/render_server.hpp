@@ -0,0 +1,99 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "app_options.hpp"
+#include "scene.hpp"
+
+namespace VulkanApp
+{
+class VulkanTriangleApplication;
+
+// One frame to render, read from a job file
+struct RenderJob
+{
+  // the claimed job file, renamed to .done or .failed once the image is
+  // written
+  std::filesystem::path file;
+  Scene scene;
+  float cameraAngle = 0.0f;
+  uint64_t frame = 0;
+  uint32_t width = 800;
+  uint32_t height = 600;
+  std::string output;
+};
+
+struct RenderServerStats
+{
+  uint64_t done = 0;
+  uint64_t failed = 0;
+  // times the targets were recreated for another job size
+  uint64_t resizes = 0;
+};
+
+// Keeps a headless application around and renders the jobs spooled as
+// <name>.job files into a directory, so the instance, device and pipelines
+// are created once for any number of jobs. A job file holds one
+// "key value" pair per line:
+//
+//   output PATH     image to write, in the --capture-format (required)
+//   width N         render size, 800x600 by default
+//   height N
+//   instances N     Scene::instanceCount, on a grid of columns N
+//   columns N
+//   scale S
+//   quads N         Scene::quadCount
+//   particles N     Scene::particleCount
+//   camera RADIANS  added to the orbit, see setCamera
+//   frame N         position along the orbit and of the quads
+//
+// A job is claimed by renaming it to <name>.running, which lets several
+// servers share a directory, and ends up as <name>.done or <name>.failed
+// once its image is on disk. A job that fails doesn't stop the server.
+// Claimed jobs are rendered back to back with
+// every frame in flight busy and the readback and encoding running behind
+// them. Creating a file named "shutdown" in the directory stops the server
+// after the jobs it claimed.
+class RenderServer
+{
+public:
+  RenderServer (VulkanTriangleApplication &app,
+                const ServerSettings &settings);
+
+  // Returns once the directory asks for a shutdown
+  void run ();
+
+  const RenderServerStats &
+  stats () const
+  {
+    return counters;
+  }
+
+private:
+  // Claims up to batchSize jobs in name order. Jobs that fail to parse, or
+  // write to the output of a job still in flight, are failed right away.
+  std::vector<RenderJob> claimJobs ();
+  // Throws when the frame can't be rendered, the job is then failed
+  void render (const RenderJob &job);
+  // Finishes the jobs whose images the encoders are done with
+  void reap ();
+  void finishJob (const std::filesystem::path &file, bool written,
+                  const std::string &error);
+
+  VulkanTriangleApplication &app;
+  ServerSettings settings;
+  std::filesystem::path spool;
+  // rendered, waiting for their image
+  std::vector<RenderJob> pending;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  RenderServerStats counters;
+};
+
+// Reads a job file, throws std::runtime_error naming the offending line.
+// Sizes above maxSize, the device's limit, are rejected.
+RenderJob parseRenderJob (const std::filesystem::path &file,
+                          uint32_t maxSize);
+} // namespace VulkanApp
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+
+namespace VulkanApp
+{
+struct ResolutionScalerSettings
+{
+  // GPU time a frame should take, 0 disables dynamic resolution
+  double targetMilliseconds = 0.0;
+  // lower bound of the per-axis scale, the upper bound is always 1
+  float minScale = 0.5f;
+};
+
+// Picks the fraction of the output resolution to render at from the GPU
+// time of finished frames. GPU time is taken to grow with the pixel count,
+// i.e. with the square of the scale. Measurements are smoothed and the
+// scale only moves by a few percent per frame, a frame rendered at a new
+// scale takes a while to be measured and a jumpy scale is more visible than
+// a slightly missed target.
+class ResolutionScaler
+{
+public:
+  explicit ResolutionScaler (
+      const ResolutionScalerSettings &settings = ResolutionScalerSettings ());
+
+  bool
+  enabled () const
+  {
+    return settings.targetMilliseconds > 0.0;
+  }
+
+  // Feeds the GPU time of one finished frame, returns the scale to render
+  // the next one at
+  float update (double gpuMilliseconds);
+
+  float
+  scale () const
+  {
+    return currentScale;
+  }
+
+  double
+  smoothedMilliseconds () const
+  {
+    return smoothed;
+  }
+
+  // size * scale, at least 1 and never more than size
+  uint32_t scaled (uint32_t size) const;
+
+private:
+  ResolutionScalerSettings settings;
+  float currentScale = 1.0f;
+  // 0 until the first measurement
+  double smoothed = 0.0;
+};
+} // namespace VulkanApp
@@ -0,0 +1,218 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace VulkanApp
+{
+// 32 bit reference into a ResourcePool, the low INDEX_BITS pick the slot
+// and the rest hold the slot's generation when the handle was handed out.
+// Tag keeps handles of different pools apart, 0 is never a live handle.
+template <typename Tag> class ResourceHandle
+{
+public:
+  static const uint32_t INDEX_BITS = 20;
+  static const uint32_t INDEX_MASK = (1u << INDEX_BITS) - 1;
+  static const uint32_t MAX_GENERATION = (1u << (32 - INDEX_BITS)) - 1;
+
+  constexpr ResourceHandle () = default;
+  constexpr ResourceHandle (uint32_t index, uint32_t generation)
+      : value (generation << INDEX_BITS | index)
+  {
+  }
+
+  uint32_t
+  index () const
+  {
+    return value & INDEX_MASK;
+  }
+
+  uint32_t
+  generation () const
+  {
+    return value >> INDEX_BITS;
+  }
+
+  explicit
+  operator bool () const
+  {
+    return value != 0;
+  }
+
+  bool
+  operator== (ResourceHandle other) const
+  {
+    return value == other.value;
+  }
+
+  bool
+  operator!= (ResourceHandle other) const
+  {
+    return value != other.value;
+  }
+
+  uint32_t value = 0;
+};
+
+// Resources of one type behind generational handles. The fields the frame
+// loop reads (Hot) and the ones only needed to create and destroy a
+// resource (Cold) live in two dense arrays, so walking the pool only
+// touches the hot ones. A sparse slot table maps handles to dense indices:
+// lookups are O(1) and return null for handles whose resource was
+// destroyed, until a slot has been reused MAX_GENERATION times. Destroying
+// moves the last resource into the hole, dense indices are only stable
+// between destroys. Not thread safe.
+template <typename Tag, typename Hot, typename Cold> class ResourcePool
+{
+public:
+  using Handle = ResourceHandle<Tag>;
+
+  static const uint32_t MAX_RESOURCES = Handle::INDEX_MASK + 1;
+
+  Handle
+  create (const Hot &hot, const Cold &cold)
+  {
+    uint32_t slot = freeSlot;
+    if (slot != NONE)
+      {
+        freeSlot = slots[slot].dense;
+      }
+    else if (slots.size () < MAX_RESOURCES)
+      {
+        slot = static_cast<uint32_t> (slots.size ());
+        slots.push_back ({ 1, NONE });
+      }
+    else
+      {
+        throw std::runtime_error ("Resource pool is full!");
+      }
+
+    slots[slot].dense = static_cast<uint32_t> (hotValues.size ());
+    hotValues.push_back (hot);
+    coldValues.push_back (cold);
+    denseSlots.push_back (slot);
+    return Handle (slot, slots[slot].generation);
+  }
+
+  // Returns false for handles that are not live, the caller releases
+  // whatever the resource owns before
+  bool
+  destroy (Handle handle)
+  {
+    if (!contains (handle))
+      {
+        return false;
+      }
+
+    Slot &slot = slots[handle.index ()];
+    uint32_t last = static_cast<uint32_t> (hotValues.size () - 1);
+    if (slot.dense != last)
+      {
+        hotValues[slot.dense] = hotValues[last];
+        coldValues[slot.dense] = coldValues[last];
+        denseSlots[slot.dense] = denseSlots[last];
+        slots[denseSlots[last]].dense = slot.dense;
+      }
+    hotValues.pop_back ();
+    coldValues.pop_back ();
+    denseSlots.pop_back ();
+
+    // Handles to the old resource stop matching right away
+    slot.generation = slot.generation % Handle::MAX_GENERATION + 1;
+    slot.dense = freeSlot;
+    freeSlot = handle.index ();
+    return true;
+  }
+
+  bool
+  contains (Handle handle) const
+  {
+    uint32_t index = handle.index ();
+    // A free slot already holds the generation of its next resource,
+    // which no handle has yet
+    return index < slots.size ()
+           && slots[index].generation == handle.generation ();
+  }
+
+  // null for handles that are not live
+  Hot *
+  hot (Handle handle)
+  {
+    return contains (handle) ? &hotValues[slots[handle.index ()].dense]
+                             : nullptr;
+  }
+
+  const Hot *
+  hot (Handle handle) const
+  {
+    return contains (handle) ? &hotValues[slots[handle.index ()].dense]
+                             : nullptr;
+  }
+
+  Cold *
+  cold (Handle handle)
+  {
+    return contains (handle) ? &coldValues[slots[handle.index ()].dense]
+                             : nullptr;
+  }
+
+  const Cold *
+  cold (Handle handle) const
+  {
+    return contains (handle) ? &coldValues[slots[handle.index ()].dense]
+                             : nullptr;
+  }
+
+  // The dense arrays, size () elements each
+  size_t
+  size () const
+  {
+    return hotValues.size ();
+  }
+
+  Hot *
+  hotData ()
+  {
+    return hotValues.data ();
+  }
+
+  const Hot *
+  hotData () const
+  {
+    return hotValues.data ();
+  }
+
+  const Cold *
+  coldData () const
+  {
+    return coldValues.data ();
+  }
+
+  Handle
+  handleAt (size_t dense) const
+  {
+    uint32_t slot = denseSlots[dense];
+    return Handle (slot, slots[slot].generation);
+  }
+
+private:
+  static const uint32_t NONE = UINT32_MAX;
+
+  struct Slot
+  {
+    // of the live resource, or of the next one while the slot is free
+    uint32_t generation;
+    // into the dense arrays, or the next free slot while the slot is free
+    uint32_t dense;
+  };
+
+  std::vector<Slot> slots;
+  uint32_t freeSlot = NONE;
+
+  std::vector<Hot> hotValues;
+  std::vector<Cold> coldValues;
+  // the slot of each dense element, to patch it when it moves
+  std::vector<uint32_t> denseSlots;
+};
+} // namespace VulkanApp
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+#include "linear_math.hpp"
+
+namespace VulkanApp
+{
+// Matches the push constant blocks in shader.vert and mesh.vert
+struct ScenePushConstants
+{
+  float scale = 1.0f;
+  // Triangle instances are laid out on a columns x columns grid, wrapping
+  // around once it is full. Mesh instances fill rows of columns on the XZ
+  // plane without wrapping.
+  uint32_t columns = 1;
+  // distance between mesh instances along x and z in the mesh's vertex
+  // space, set per frame from the mesh bounds
+  float instanceSpacing[2] = {};
+  // only used by meshes, the triangle is already in clip space
+  Mat4 viewProjection;
+};
+
+// What the frame loop draws. The default is the original single triangle.
+struct Scene
+{
+  std::string name = "triangle";
+  uint32_t instanceCount = 1;
+  ScenePushConstants constants;
+  // animated sprites drawn over the scene, rewritten every frame, see
+  // QuadBatcher
+  uint32_t quadCount = 0;
+  // simulated and drawn on the GPU around the bottom of the scene, see
+  // ParticleSystem
+  uint32_t particleCount = 0;
+  // orbit the camera around a mesh, toggled with space
+  bool animating = true;
+};
+} // namespace VulkanApp
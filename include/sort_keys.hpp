@@ -0,0 +1,75 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace VulkanApp
+{
+// 64-bit draw sort key, most significant field first so that an ascending
+// sort groups draws by pipeline, then descriptor set, then mesh and finally
+// front-to-back depth inside each group.
+//
+//   63        54 53          40 39            24 23                 0
+//  ┌────────────┬──────────────┬────────────────┬────────────────────┐
+//  │ pipeline   │ desc. set    │ mesh           │ depth              │
+//  └────────────┴──────────────┴────────────────┴────────────────────┘
+namespace DrawKey
+{
+const uint32_t PIPELINE_BITS = 10;
+const uint32_t DESCRIPTOR_SET_BITS = 14;
+const uint32_t MESH_BITS = 16;
+const uint32_t DEPTH_BITS = 24;
+
+const uint32_t DEPTH_SHIFT = 0;
+const uint32_t MESH_SHIFT = DEPTH_SHIFT + DEPTH_BITS;
+const uint32_t DESCRIPTOR_SET_SHIFT = MESH_SHIFT + MESH_BITS;
+const uint32_t PIPELINE_SHIFT = DESCRIPTOR_SET_SHIFT + DESCRIPTOR_SET_BITS;
+
+// depth is expected in [0, 1], anything outside is clamped
+inline uint64_t
+make (uint32_t pipeline, uint32_t descriptorSet, uint32_t mesh, float depth)
+{
+  const uint32_t depthMax = (1u << DEPTH_BITS) - 1;
+  float clamped = depth < 0.0f ? 0.0f : (depth > 1.0f ? 1.0f : depth);
+  uint64_t quantized = static_cast<uint64_t> (clamped * depthMax);
+
+  return (static_cast<uint64_t> (pipeline) << PIPELINE_SHIFT)
+         | (static_cast<uint64_t> (descriptorSet) << DESCRIPTOR_SET_SHIFT)
+         | (static_cast<uint64_t> (mesh) << MESH_SHIFT)
+         | (quantized << DEPTH_SHIFT);
+}
+
+inline uint32_t
+pipeline (uint64_t key)
+{
+  return static_cast<uint32_t> (key >> PIPELINE_SHIFT)
+         & ((1u << PIPELINE_BITS) - 1);
+}
+
+inline uint32_t
+descriptorSet (uint64_t key)
+{
+  return static_cast<uint32_t> (key >> DESCRIPTOR_SET_SHIFT)
+         & ((1u << DESCRIPTOR_SET_BITS) - 1);
+}
+
+inline uint32_t
+mesh (uint64_t key)
+{
+  return static_cast<uint32_t> (key >> MESH_SHIFT) & ((1u << MESH_BITS) - 1);
+}
+} // namespace DrawKey
+
+// LSD radix sort of 64-bit keys carrying a 32-bit payload, 8 bits per pass.
+// The scratch arrays are kept between calls so sorting every frame does not
+// allocate once the list has reached its steady size.
+class RadixSorter
+{
+public:
+  void sort (uint64_t *keys, uint32_t *values, size_t count);
+
+private:
+  std::vector<uint64_t> keysScratch;
+  std::vector<uint32_t> valuesScratch;
+};
+} // namespace VulkanApp
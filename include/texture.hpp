@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vulkan/vulkan_core.h>
+
+namespace VulkanApp
+{
+struct GpuImage
+{
+  VkImage image = VK_NULL_HANDLE;
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkImageView view = VK_NULL_HANDLE;
+  VkExtent2D extent{};
+  VkFormat format = VK_FORMAT_UNDEFINED;
+};
+
+// Creates a device local 2D image with a single level and uploads pixels,
+// rows of width tightly packed texels, through a staging buffer. The copy
+// is recorded into a command buffer from commandPool and the queue is
+// waited for, so this is for load time. The image ends up in
+// SHADER_READ_ONLY_OPTIMAL.
+GpuImage createTexture (VkPhysicalDevice physicalDevice, VkDevice device,
+                        VkCommandPool commandPool, VkQueue queue,
+                        VkFormat format, uint32_t width, uint32_t height,
+                        const void *pixels, size_t size,
+                        const VkAllocationCallbacks *allocator = nullptr);
+
+void destroyTexture (VkDevice device, GpuImage &texture,
+                     const VkAllocationCallbacks *allocator = nullptr);
+} // namespace VulkanApp
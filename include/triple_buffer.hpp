@@ -0,0 +1,67 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+namespace VulkanApp
+{
+// Lock-free single producer / single consumer handoff of the latest value.
+// The producer fills back () and publishes it, the consumer picks up the
+// most recently published value with update (). Neither side ever waits for
+// the other, values published in between two updates are skipped.
+template <typename T> class TripleBuffer
+{
+public:
+  // Producer side. Holds whatever was in the slot before, so write the
+  // whole value before publishing.
+  T &
+  back ()
+  {
+    return slots[backIndex].value;
+  }
+
+  void
+  publish ()
+  {
+    uint8_t previous
+        = middle.exchange (backIndex | FRESH, std::memory_order_acq_rel);
+    backIndex = previous & INDEX_MASK;
+  }
+
+  // Consumer side. Returns true if front () changed since the last call.
+  bool
+  update ()
+  {
+    if (!(middle.load (std::memory_order_relaxed) & FRESH))
+      {
+        return false;
+      }
+
+    uint8_t previous = middle.exchange (frontIndex, std::memory_order_acq_rel);
+    frontIndex = previous & INDEX_MASK;
+    return true;
+  }
+
+  const T &
+  front () const
+  {
+    return slots[frontIndex].value;
+  }
+
+private:
+  static const uint8_t INDEX_MASK = 3;
+  // set while the middle slot holds a value the consumer hasn't taken
+  static const uint8_t FRESH = 4;
+
+  // Each slot and index on its own cache line, so the two threads only
+  // share the middle index
+  struct alignas (64) Slot
+  {
+    T value{};
+  };
+
+  Slot slots[3];
+  alignas (64) std::atomic<uint8_t> middle{ 1 };
+  alignas (64) uint8_t backIndex = 0;
+  alignas (64) uint8_t frontIndex = 2;
+};
+} // namespace VulkanApp
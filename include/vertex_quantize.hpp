@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "mesh.hpp"
+
+namespace VulkanApp
+{
+// Encodes vertices into PackedVertex, see there for the formats. Positions
+// are stored relative to bounds, which the shader undoes through the model
+// matrix (see positionDecodeMatrix). Uses SSE2 and F16C when available,
+// useSimd = false forces the scalar reference path.
+void quantizeVertices (const Vertex *vertices, size_t count,
+                       const MeshBounds &bounds, PackedVertex *packed,
+                       bool useSimd = true);
+
+// Inverse of quantizeVertices for a single vertex
+Vertex dequantizeVertex (const PackedVertex &packed, const MeshBounds &bounds);
+
+// Scale and offset taking quantized positions back to mesh space, in the
+// order of a column major matrix's diagonal and translation
+void positionDecodeTransform (const MeshBounds &bounds, float scale[3],
+                              float offset[3]);
+
+uint16_t floatToHalf (float value);
+float halfToFloat (uint16_t value);
+
+struct QuantizationError
+{
+  // largest position error relative to the bounds diagonal
+  float maxPosition = 0.0f;
+  float meanPosition = 0.0f;
+  // normal error in degrees
+  float maxNormalDegrees = 0.0f;
+  float meanNormalDegrees = 0.0f;
+  float maxUv = 0.0f;
+  float maxColor = 0.0f;
+};
+
+QuantizationError measureQuantizationError (const Vertex *vertices,
+                                            const PackedVertex *packed,
+                                            size_t count,
+                                            const MeshBounds &bounds);
+} // namespace VulkanApp
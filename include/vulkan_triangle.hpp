@@ -1,54 +1,345 @@
 #pragma once
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <fstream>
+#include <mutex>
 #include <optional>
+#include <thread>
 #include <vector>
 
+#include "app_options.hpp"
+#include "buffer_utils.hpp"
+#include "draw_list.hpp"
+#include "frame_capture.hpp"
+#include "frame_context.hpp"
+#include "frustum_culler.hpp"
+#include "gpu_resources.hpp"
+#include "hud_overlay.hpp"
+#include "job_system.hpp"
+#include "logger.hpp"
+#include "memory_tracker.hpp"
+#include "mesh.hpp"
+#include "mesh_cache.hpp"
+#include "occlusion_culler.hpp"
+#include "particle_system.hpp"
+#include "pipeline_manager.hpp"
+#include "present_latency.hpp"
+#include "quad_batcher.hpp"
+#include "resolution_scaler.hpp"
+#include "scene.hpp"
+#include "texture.hpp"
+#include "triple_buffer.hpp"
+
 namespace VulkanApp
 {
-const int MAX_FRAMES_IN_FLIGHT = 2;
 const uint32_t WIDTH = 800;
 const uint32_t HEIGHT = 600;
+// procedural sprites Scene::quadCount quads cycle through
+const uint32_t QUAD_TEXTURE_COUNT = 4;
+
+// Everything that exists once per window. The device, render pass,
+// pipelines and frame contexts are shared by all of them.
+struct WindowView
+{
+  // position in views, indexes the per-view arrays of FrameContext
+  uint32_t index = 0;
+  // null in headless mode
+  GLFWwindow *window = nullptr;
+  VkSurfaceKHR surface = VK_NULL_HANDLE;
+  VkSwapchainKHR swapChain = VK_NULL_HANDLE;
+  VkExtent2D swapChainExtent{};
+  // Into the application's pools, one per swap chain image. Headless mode
+  // renders into images of its own instead, see createOffscreenTargets.
+  std::vector<ImageHandle> swapChainImages;
+  std::vector<FramebufferHandle> swapChainFramebuffers;
+
+  VkImage depthImage;
+  VkDeviceMemory depthImageMemory;
+  VkImageView depthImageView;
+
+  // With dynamic resolution the scene is drawn into this at a fraction of
+  // the swap chain extent and blitted into the swap chain image. It has the
+  // full extent, so changing the scale never reallocates it.
+  VkImage renderImage = VK_NULL_HANDLE;
+  VkDeviceMemory renderImageMemory = VK_NULL_HANDLE;
+  VkImageView renderImageView = VK_NULL_HANDLE;
+  // renderImage holds the view's current frame, so a redraw with nothing
+  // changed only has to blit it again
+  bool targetValid = false;
+
+  // Main thread only, written by the window callbacks and handed to the
+  // render thread through FrameSnapshot
+  uint32_t resizeCount = 0;
+  VkExtent2D windowFramebufferSize{};
+  // the window system lost the window's contents
+  uint32_t refreshCount = 0;
+  uint32_t animationToggles = 0;
+
+  // Render thread's copy of the above. GLFW may only be queried from the
+  // main thread, so swap chains are sized from this.
+  uint32_t seenResizeCount = 0;
+  VkExtent2D framebufferSize{};
+  uint32_t seenRefreshCount = 0;
+  // has to be presented again even if the scene didn't change
+  bool damaged = true;
+
+  // image acquired for the frame being recorded, only valid when acquired
+  uint32_t imageIndex = 0;
+  bool acquired = false;
+  bool framebufferResized = false;
+  // added to the camera's orbit so every window shows the mesh from
+  // another side
+  float cameraAngle = 0.0f;
+};
+
+// What the main thread hands the render thread every time it has polled
+// events
+struct FrameSnapshot
+{
+  uint32_t instanceCount = 1;
+  ScenePushConstants constants;
+  uint32_t resizeCounts[MAX_WINDOWS] = {};
+  VkExtent2D framebufferSizes[MAX_WINDOWS] = {};
+  uint32_t refreshCounts[MAX_WINDOWS] = {};
+  // space presses in any window, each one toggles the animation
+  uint32_t animationToggles = 0;
+};
+
 class VulkanTriangleApplication
 {
 
 public:
+  explicit VulkanTriangleApplication (
+      const AppOptions &options = AppOptions ());
+  ~VulkanTriangleApplication ();
+
   uint32_t currentFrame = 0;
-  bool framebufferResized = false;
   void run ();
 
+  // Used by the bench runner to drive the frame loop itself
+  void setScene (const Scene &newScene);
+  void renderFrame ();
+  void resizeTargets (uint32_t width, uint32_t height);
+  // writes the next rendered frame to path, see FrameCapture
+  void requestCapture (const std::string &path);
+  // requested captures on disk or failed since the last call
+  std::vector<CaptureResult> takeCaptureResults ();
+  // Puts the first view's camera at frame of its orbit plus angle radians,
+  // pair it with a scene that doesn't animate to keep it there
+  void setCamera (float angle, uint64_t frame);
+  // waits for the GPU and for every requested capture to be on disk
+  void finishFrames ();
+  // Waits for the device and rebuilds everything sized by the number of
+  // frames in flight, n is clamped to 1..MAX_FRAMES_IN_FLIGHT. Returns the
+  // previous number.
+  uint32_t setFramesInFlight (uint32_t n);
+  // acquire to present latency, or to the fence signalling when headless
+  PresentLatencyStats frameLatency () const;
+  // largest width and height resizeTargets can make the targets
+  uint32_t maxTargetSize () const;
+
 private:
-  VkDebugUtilsMessengerEXT debugMessenger;
-  GLFWwindow *window;
+  AppOptions options;
+  // frames submitted since startup, used to name captured frames
+  uint64_t frameNumber = 0;
+  // frames rendered while the scene was animating, drives the orbit
+  uint64_t animationFrame = 0;
+
+  // validation messages go through here, see debugCallback
+  Logger logger;
+  // every Vulkan object is created with its callbacks, see manageMemory
+  MemoryTracker memoryTracker;
+  std::ofstream memoryStats;
+  VkDebugUtilsMessengerEXT debugMessenger = VK_NULL_HANDLE;
   VkInstance instance;
   VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
   VkDevice device;
   VkQueue graphicsQueue;
   VkQueue presentQueue;
-  VkSurfaceKHR surface;
-  VkSwapchainKHR swapChain;
-  VkFormat swapChainImageFormat;
-  VkExtent2D swapChainExtent;
+
+  // Sized once in initWindow and never resized, GLFW keeps pointers to the
+  // elements. The first view is the one captured and resized by the bench.
+  std::vector<WindowView> views;
+  // the views' swap chain images, their views and framebuffers
+  ImagePool images;
+  FramebufferPool framebuffers;
+  // shared by every view since they share the render pass, undefined until
+  // the first swap chain picks it
+  VkFormat swapChainImageFormat = VK_FORMAT_UNDEFINED;
   VkRenderPass renderPass;
+  // With occlusion culling the scene is drawn in two passes: this one
+  // clears and draws last frame's visible instances, renderPass then loads
+  // its results and draws the rest
+  VkRenderPass earlyRenderPass = VK_NULL_HANDLE;
+  VkPipelineCache pipelineCache;
+  // owns every pipeline, see createGraphicsPipeline for the keys
+  PipelineManager pipelines;
   VkPipeline graphicsPipeline;
+  // only created when a mesh is loaded
+  VkPipeline meshPipeline = VK_NULL_HANDLE;
+  PipelineKey meshPipelineKey;
+  // VK_EXT_graphics_pipeline_library with fast linking, see PipelineManager
+  bool pipelineLibraries = false;
+  // VK_EXT_memory_budget, heaps report usage and budget
+  bool memoryBudget = false;
+  // Views draw into their renderImage and blit it to the acquired image,
+  // needed by dynamic resolution and by on-demand redraws
+  bool renderTargets = false;
+  // Render at a resolution that holds options.resolution's GPU frame
+  // time, needs timestamp queries on the graphics queue
+  bool dynamicResolution = false;
+  ResolutionScaler resolutionScaler;
+  // Frames are timed on the GPU, for dynamic resolution or the HUD.
+  // gpuMilliseconds is the last timed frame's, negative before the first.
+  bool gpuTimed = false;
+  double gpuMilliseconds = -1.0;
+  // a start and an end timestamp per frame in flight
+  VkQueryPool timestampPool = VK_NULL_HANDLE;
+  float timestampPeriod = 0.0f;
+  // timestamps wrap at the queue's timestampValidBits
+  uint64_t timestampMask = 0;
+  // VK_KHR_present_id and VK_KHR_present_wait, presentLatency measures
+  // instead of estimating
+  bool presentWait = false;
+  // acquire to present latency of the first view, also paces renderLoop.
+  // Headless runs only estimate it, from the fences.
+  PresentLatency presentLatency;
+  // Mesh instances are culled on the GPU, needs a mesh and
+  // OcclusionCuller::supported
+  bool occlusionCulling = false;
+  OcclusionCuller occlusionCuller;
+  // whether this frame's mesh draw goes through the culler, see
+  // buildDrawList
+  bool frameCulled = false;
+  // Mesh instance bounds for options.cpuCulling, rebuilt with the grid
+  FrustumCuller frustumCuller;
+  uint32_t cullerColumns = 0;
+  // ascending, the instances this frame draws when frameCpuCulled
+  std::vector<uint32_t> visibleInstances;
+  uint32_t visibleCount = 0;
+  // visible instances each CULL_CHUNK instances culled
+  std::vector<uint32_t> chunkVisible;
+  bool frameCpuCulled = false;
+  // pipelines in the draw list are refreshed whenever this changes
+  uint64_t seenOptimizedLinks = 0;
   VkPipelineLayout pipelineLayout;
+  // one time uploads, frames record from their FrameContext's pool
   VkCommandPool commandPool;
 
-  std::vector<VkCommandBuffer> commandBuffers;
-  std::vector<VkSemaphore> imageAvailableSemaphores;
-  std::vector<VkSemaphore> renderFinishedSemaphores;
-  std::vector<VkFence> inFlightFences;
-  std::vector<VkFramebuffer> swapChainFramebuffers;
+  VkExtent2D headlessExtent = { WIDTH, HEIGHT };
+
+  VkFormat depthFormat;
+
+  GpuBuffer meshVertexBuffer;
+  GpuBuffer meshIndexBuffer;
+  MeshBounds meshBounds;
+  // 0 when no mesh is loaded, the full mesh's indices
+  uint32_t meshIndexCount = 0;
+  // finest first, ranges of meshIndexBuffer
+  std::array<MeshLod, MAX_MESH_LODS> meshLods;
+  uint32_t meshLodCount = 0;
+  // false while the mesh buffers are evicted to stay within the memory
+  // budget, the mesh isn't drawn then
+  bool meshResident = false;
+  VkDeviceSize meshBytes = 0;
+  // The mesh cache being mapped into loadedMesh, by initVulkan for
+  // createMeshBuffers or by manageMemory for restoreMeshBuffers
+  bool meshDecoding = false;
+  JobCounter meshLoad;
+  MappedMesh loadedMesh;
+  // staging copy of a restored mesh, recorded by the frame's first view
+  GpuBuffer meshUpload;
+
+  // Scene::quadCount quads, set up by the first frame that draws any
+  QuadBatcher quadBatcher;
+  bool quadsReady = false;
+  std::array<GpuImage, QUAD_TEXTURE_COUNT> quadTextures;
+  // quad positions are in the first view's pixels, see buildQuads
+  VkExtent2D quadCanvas{};
+
+  // Scene::particleCount particles, set up like the quads
+  ParticleSystem particleSystem;
+  bool particlesReady = false;
+  // on the floor of the instance grid, see buildParticles
+  ParticleEmitter particleEmitter;
+
+  // options.hud with a window to draw it in
+  bool hudEnabled = false;
+  HudOverlay hud;
+  // Frame loop timing shown by the HUD. The interval is between the starts
+  // of the last two frames, the CPU time from the fence wait to the submit
+  // of the last one.
+  std::chrono::steady_clock::time_point frameStart;
+  double frameInterval = 0.0;
+  double frameCpuTime = 0.0;
+
+  // The first framesInFlight are used, currentFrame cycles through them.
+  // One submit covers every view, so one fence per context does too.
+  uint32_t framesInFlight = 2;
+  std::array<FrameContext, MAX_FRAMES_IN_FLIGHT> frames;
+
+  // Scratch for batching every view into one submit and one present,
+  // reused between frames
+  struct FrameBatch
+  {
+    std::vector<WindowView *> views;
+    std::vector<VkCommandBuffer> commandBuffers;
+    std::vector<VkSemaphore> waitSemaphores;
+    std::vector<VkPipelineStageFlags> waitStages;
+    std::vector<VkSemaphore> signalSemaphores;
+    std::vector<VkSwapchainKHR> swapChains;
+    std::vector<uint32_t> imageIndices;
+    std::vector<VkResult> presentResults;
+    std::vector<uint64_t> presentIds;
+
+    void clear ();
+    // upscaled views first touch the acquired image with the blit
+    void add (WindowView &view, const FrameContext &frame, bool headless,
+              bool upscaled);
+  } batch;
+
+  DrawList drawList;
+  uint32_t trianglePipelineId;
+  uint32_t triangleMeshId;
+  uint32_t meshPipelineId;
+  // a mesh per level of detail, the full mesh first
+  std::array<uint32_t, MAX_MESH_LODS> meshIds;
+  // the culler's draws, pointed at the early or the late ones while
+  // recording
+  uint32_t meshDrawsId = 0;
+
+  // Owned by the render thread while it runs, the main thread only sees
+  // the snapshot it started from
+  Scene scene;
+  FrameCapture frameCapture;
+
+  // Windowed runs render on their own thread, so waiting on fences never
+  // holds up event handling and a burst of events never delays a frame
+  std::thread renderThread;
+  std::atomic<bool> rendering{ false };
+  std::exception_ptr renderError;
+  TripleBuffer<FrameSnapshot> snapshots;
+  // On-demand redraws sleep on this until the next snapshot
+  std::mutex snapshotMutex;
+  std::condition_variable snapshotPublished;
+  uint64_t publishedSnapshots = 0;
+  uint64_t seenSnapshots = 0;
+  uint32_t seenAnimationToggles = 0;
+  // render thread only, the scene changed since the last frame
+  bool sceneDirty = true;
 
   const std::vector<const char *> validationLayers
       = { "VK_LAYER_KHRONOS_validation" };
 
-  const std::vector<const char *> deviceExtensions
+  // headless mode drops the swapchain extension
+  std::vector<const char *> deviceExtensions
       = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
 
-  std::vector<VkImage> swapChainImages;
-  std::vector<VkImageView> swapChainImageViews;
-
   struct QueueFamilyIndices
   {
     std::optional<uint32_t> graphicsFamily;
@@ -80,35 +371,90 @@ private:
   void createSurface ();
 
   void createLogicalDevice ();
+  bool pipelineLibrariesSupported ();
+  bool presentWaitSupported ();
+
+  void createSwapChain (WindowView &view);
+  void createOffscreenTargets (WindowView &view);
+  void recreateSwapChain (WindowView &view);
+  void cleanupSwapChain (WindowView &view);
 
-  void createSwapChain ();
-  void recreateSwapChain ();
-  void cleanupSwapChain ();
+  void createImageViews (WindowView &view);
 
-  void createImageViews ();
+  VkFormat findDepthFormat ();
+  void createDepthResources (WindowView &view);
+  void createRenderTarget (WindowView &view);
+  VkExtent2D renderExtent (const WindowView &view) const;
 
+  void createPipelineCache ();
   void createGraphicsPipeline ();
+  VertexInputLayout meshVertexInput ();
+
+  void createMeshBuffers ();
+  void restoreMeshBuffers ();
+  GpuBuffer stageMesh (MappedMesh &mesh);
+  void recordMeshUpload (VkCommandBuffer buffer, const GpuBuffer &staging);
+  void releaseMeshBuffers ();
+  MeshBinding meshBinding (uint32_t lod) const;
+  void setupMemoryTracking ();
+  void manageMemory (bool report);
+  void gridBounds (Vec3 &min, Vec3 &max) const;
+  void cameraPosition (const WindowView &view, Vec3 &eye, Vec3 &center,
+                       float &radius) const;
+  Mat4 worldViewProjection (const WindowView &view) const;
+  Mat4 cameraViewProjection (const WindowView &view);
+  void instanceSpacing (float spacing[2]) const;
+  CullInput cullInput (const WindowView &view,
+                       const ScenePushConstants &constants) const;
+
+  void setupDrawList ();
+  void buildDrawList ();
+  void pushMeshRows (DrawCommand command);
+  void cullInstances ();
+  void pushVisible (DrawCommand command);
+  void createQuads ();
+  void buildQuads ();
+  void buildParticles ();
+  void buildHud ();
 
   void createRenderPass ();
+  void createEarlyRenderPass (VkAttachmentDescription colorAttachment,
+                              VkAttachmentDescription depthAttachment,
+                              const VkSubpassDescription &subpass,
+                              const VkSubpassDependency &dependency);
 
-  void createFramebuffers ();
+  void createFramebuffers (WindowView &view);
 
   void createCommandPool ();
 
-  void createCommandBuffers ();
-  void recordCommandBuffer (VkCommandBuffer buffer, uint32_t imageIndex);
+  void createFrameContexts ();
+  void destroyFrameContexts ();
+  void recordCommandBuffer (WindowView &view);
+  void recordScene (VkCommandBuffer buffer, WindowView &view);
+  void beginScenePass (VkCommandBuffer buffer, WindowView &view,
+                       VkRenderPass pass,
+                       const ScenePushConstants &constants);
+  // depth tested against the scene, before the overlays
+  void recordParticles (VkCommandBuffer buffer, WindowView &view);
+  // the quads and the HUD, over the scene in its last render pass
+  void recordOverlays (VkCommandBuffer buffer, WindowView &view);
+  void recordUpscale (VkCommandBuffer buffer, WindowView &view);
 
-  void createSyncObjects ();
+  void createTimestampQueries ();
+  void readFrameTime ();
+
+  void createFrameCapture ();
 
   void drawFrame ();
 
-  bool verifyExtensions (const char **glfwExtensions,
-                         uint32_t glfwExtensionCount);
+  bool verifyExtensions (const std::vector<const char *> &requiredExtensions);
   bool checkValidationLayerSupport ();
 
   bool isDeviceSuitable (VkPhysicalDevice device);
 
   bool checkDeviceExtensionSupport (VkPhysicalDevice device);
+  bool deviceExtensionSupported (VkPhysicalDevice device,
+                                 const char *extension);
 
   VkSurfaceFormatKHR chooseSwapSurfaceFormat (
       const std::vector<VkSurfaceFormatKHR> &availableFormats);
@@ -116,17 +462,21 @@ private:
   VkPresentModeKHR chooseSwapPresentMode (
       const std::vector<VkPresentModeKHR> &availablePresentModes);
 
-  VkExtent2D chooseSwapExtent (const VkSurfaceCapabilitiesKHR &capabilities);
-
-  VkShaderModule createShaderModule (const std::vector<char> &code);
+  VkExtent2D chooseSwapExtent (const VkSurfaceCapabilitiesKHR &capabilities,
+                               VkExtent2D framebufferSize);
 
   void findQueueFamilies (VkPhysicalDevice device);
 
-  void querySwapChainSupport (VkPhysicalDevice device);
+  void querySwapChainSupport (VkPhysicalDevice device, VkSurfaceKHR surface);
 
   void pickPhysicalDevice ();
 
   void mainLoop ();
+  void renderLoop ();
+  void publishSnapshot (FrameSnapshot &snapshot);
+  void applySnapshot (const FrameSnapshot &snapshot);
+  bool needsFrame () const;
+  void waitForSnapshot ();
 
   void cleanup ();
 };
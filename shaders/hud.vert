@@ -0,0 +1,29 @@
+#version 450
+
+// One instance per glyph or bar, a strip of four vertices each. See
+// HudOverlay.
+
+layout(location = 0) in ivec2 inPosition;
+layout(location = 1) in uvec2 inSize;
+layout(location = 2) in uint inGlyph;
+layout(location = 3) in vec4 inColor;
+
+layout(push_constant) uniform HudConstants {
+  vec2 pixelToClip;
+} constants;
+
+layout(location = 0) out vec2 fragUv;
+layout(location = 1) out vec4 fragColor;
+
+// Cells of the atlas, ASCII 32 to 127
+const vec2 ATLAS_CELLS = vec2(16.0, 6.0);
+
+void main() {
+  vec2 unit = vec2(gl_VertexIndex & 1, gl_VertexIndex >> 1);
+  vec2 pixel = vec2(inPosition) + unit * vec2(inSize);
+  gl_Position = vec4(pixel * constants.pixelToClip - 1.0, 0.0, 1.0);
+
+  uint cell = inGlyph - 32u;
+  fragUv = (vec2(cell % 16u, cell / 16u) + unit) / ATLAS_CELLS;
+  fragColor = inColor;
+}
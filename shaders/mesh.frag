@@ -0,0 +1,13 @@
+#version 450
+
+layout(location = 0) in vec3 fragNormal;
+layout(location = 1) in vec4 fragColor;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+  // Fixed light from the upper front, enough to see the shape
+  vec3 light = normalize(vec3(0.4, 0.8, 0.6));
+  float diffuse = max(dot(normalize(fragNormal), light), 0.0);
+  outColor = vec4(fragColor.rgb * (0.15 + 0.85 * diffuse), fragColor.a);
+}
@@ -0,0 +1,42 @@
+#version 450
+
+// Set for VertexFormat::Quantized, see createGraphicsPipeline
+layout(constant_id = 0) const bool OCTAHEDRAL_NORMALS = false;
+
+layout(push_constant) uniform SceneConstants {
+  layout(offset = 4) uint columns;
+  vec2 instanceSpacing;
+  mat4 viewProjection;
+} scene;
+
+// Quantized positions are 0..1 within the mesh bounds, viewProjection
+// already includes the decode
+layout(location = 0) in vec3 inPosition;
+// xyz, or the octahedral encoding in xy
+layout(location = 1) in vec3 inNormal;
+layout(location = 2) in vec2 inUv;
+layout(location = 3) in vec4 inColor;
+
+layout(location = 0) out vec3 fragNormal;
+layout(location = 1) out vec4 fragColor;
+
+vec3 decodeOctahedral(vec2 e) {
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.x += n.x >= 0.0 ? -t : t;
+  n.y += n.y >= 0.0 ? -t : t;
+  return normalize(n);
+}
+
+void main() {
+  // Rows of columns instances on the XZ plane, occlusion_cull.comp places
+  // the bounding boxes the same way
+  uint instance = uint(gl_InstanceIndex);
+  vec2 cell = vec2(instance % scene.columns, instance / scene.columns);
+  vec2 offset = cell * scene.instanceSpacing;
+  vec3 position = inPosition + vec3(offset.x, 0.0, offset.y);
+
+  gl_Position = scene.viewProjection * vec4(position, 1.0);
+  fragNormal = OCTAHEDRAL_NORMALS ? decodeOctahedral(inNormal.xy) : inNormal;
+  fragColor = inColor;
+}
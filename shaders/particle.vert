@@ -0,0 +1,37 @@
+#version 450
+
+// One instance per live particle, a strip of four vertices each. The
+// indirect draw's instance count is written by the scan step, see
+// ParticleSystem.
+
+// The compacted particles, attribute-major
+layout(std430, set = 0, binding = 0) readonly buffer Particles {
+  float particles[];
+};
+
+layout(push_constant) uniform ParticleDrawConstants {
+  mat4 viewProjection;
+  // half a sprite in clip space at w = 1
+  vec2 halfSize;
+  uint capacity;
+} constants;
+
+layout(location = 0) out vec2 fragCorner;
+layout(location = 1) out vec4 fragColor;
+
+void main() {
+  uint i = gl_InstanceIndex;
+  uint c = constants.capacity;
+  vec3 position = vec3(particles[i], particles[c + i], particles[2u * c + i]);
+  float life = clamp(particles[6u * c + i] / particles[7u * c + i], 0.0, 1.0);
+
+  vec2 corner = vec2(gl_VertexIndex & 1, gl_VertexIndex >> 1) * 2.0 - 1.0;
+  vec4 clip = constants.viewProjection * vec4(position, 1.0);
+  clip.xy += corner * constants.halfSize * clip.w;
+  gl_Position = clip;
+
+  // White hot at launch, cooling down to a fading red
+  fragCorner = corner;
+  fragColor = vec4(mix(vec3(1.0, 0.9, 0.6), vec3(0.9, 0.2, 0.05), life),
+                   1.0 - life);
+}
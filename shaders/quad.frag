@@ -0,0 +1,12 @@
+#version 450
+
+layout(set = 1, binding = 0) uniform sampler2D quadTexture;
+
+layout(location = 0) in vec2 fragUv;
+layout(location = 1) in vec4 fragColor;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+  outColor = texture(quadTexture, fragUv) * fragColor;
+}
@@ -0,0 +1,44 @@
+#version 450
+
+// Pulls its quad out of the frame's stream, four vertices per quad. The
+// index buffer is the same for every batch, the draw's vertex offset picks
+// the batch's first quad, see QuadBatcher.
+
+// Matches Quad in quad_stream.hpp
+struct Quad {
+  // top left corner and size in canvas pixels
+  vec4 rect;
+  // UNORM16 left, top and right, bottom
+  uvec2 uv;
+  uint color;
+  float rotation;
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer Quads {
+  Quad quads[];
+};
+
+layout(push_constant) uniform QuadConstants {
+  vec2 pixelToClip;
+} constants;
+
+layout(location = 0) out vec2 fragUv;
+layout(location = 1) out vec4 fragColor;
+
+void main() {
+  Quad quad = quads[gl_VertexIndex >> 2];
+  uint corner = uint(gl_VertexIndex) & 3u;
+  vec2 unit = vec2(corner & 1u, corner >> 1);
+
+  // Rotated around the center, y points down like on screen
+  vec2 local = (unit - 0.5) * quad.rect.zw;
+  float c = cos(quad.rotation);
+  float s = sin(quad.rotation);
+  vec2 pixel = quad.rect.xy + 0.5 * quad.rect.zw
+               + vec2(c * local.x - s * local.y, s * local.x + c * local.y);
+  gl_Position = vec4(pixel * constants.pixelToClip - 1.0, 0.0, 1.0);
+
+  vec4 uvRect = vec4(unpackUnorm2x16(quad.uv.x), unpackUnorm2x16(quad.uv.y));
+  fragUv = mix(uvRect.xy, uvRect.zw, unit);
+  fragColor = unpackUnorm4x8(quad.color);
+}
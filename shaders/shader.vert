@@ -1,5 +1,10 @@
 #version 450
 
+layout(push_constant) uniform SceneConstants {
+  float scale;
+  uint columns;
+} scene;
+
 layout(location = 0) out vec3 fragColor;
 
 vec2 pos[3] = vec2[](
@@ -15,6 +20,14 @@ vec3 colors[3] = vec3[](
 );
 
 void main() {
-  gl_Position = vec4(pos[gl_VertexIndex], 0.0, 1.0);
+  // One cell per instance, with a single column every instance lands on
+  // top of the last which is what the overdraw scene wants
+  uint column = uint(gl_InstanceIndex) % scene.columns;
+  uint row = (uint(gl_InstanceIndex) / scene.columns) % scene.columns;
+  float cell = 2.0 / float(scene.columns);
+  vec2 center = vec2(-1.0) + cell * (vec2(column, row) + 0.5);
+
+  gl_Position = vec4(center + pos[gl_VertexIndex] * scene.scale * cell * 0.5,
+                     0.0, 1.0);
   fragColor = colors[gl_VertexIndex];
 }
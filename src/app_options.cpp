@@ -0,0 +1,344 @@
+#include "../include/app_options.hpp"
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+using namespace VulkanApp;
+
+static const char *USAGE
+    = "usage: VulkanTest [options]\n"
+      "  --mesh FILE              draw the OBJ FILE instead of the triangle\n"
+      "  --mesh-cache DIR         where optimized meshes are cached\n"
+      "  --vertex-format FORMAT   quantized (default) or full\n"
+      "  --pipeline-manifest FILE pipelines to precompile, empty disables\n"
+      "  --no-pipeline-library    always create whole pipelines\n"
+      "  --validation             enable the Khronos validation layer\n"
+      "  --no-validation          disable it, even in debug builds\n"
+      "  --log-level LEVEL        verbose, info, warning (default) or error\n"
+      "  --capture DIR            write every presented frame into DIR\n"
+      "  --capture-format FORMAT  ppm (default) or png\n"
+      "  --memory-stats FILE      write memory usage as CSV to FILE\n"
+      "  --memory-interval N      frames between --memory-stats rows\n"
+      "  --target-frame-ms MS     lower the resolution to hold MS GPU time\n"
+      "  --min-resolution SCALE   lowest --target-frame-ms scale, 0.1 to 1\n"
+      "  --no-frame-pacing        never hold frames back to cut latency\n"
+      "  --on-demand              only redraw windows when something changed\n"
+      "  --occlusion-culling      cull hidden mesh instances on the GPU\n"
+      "  --cpu-culling            cull mesh instances outside the views on "
+      "the CPU\n"
+      "  --lod-error PIXELS       screen error of mesh levels of detail\n"
+      "  --quads N                draw N animated sprites over the scene\n"
+      "  --particles N            simulate a fountain of N particles\n"
+      "  --no-hud                 hide the performance overlay\n"
+      "  --frames-in-flight N     frames recorded ahead of the GPU, 1 to 4\n"
+      "  --windows N              open N windows rendering the same scene\n"
+      "  --headless               render offscreen without a window\n"
+      "  --frames N               frames rendered by --headless\n"
+      "  --bench                  run the headless benchmark suite\n"
+      "  --golden DIR             golden images for --bench\n"
+      "  --baseline FILE          frame time baseline for --bench\n"
+      "  --bench-output DIR       captured frames and timings of --bench\n"
+      "  --bench-threshold RATIO  allowed mean frame time regression\n"
+      "  --bench-frames N         measured frames per scene\n"
+      "  --update-golden          store the --bench output as golden images\n"
+      "  --update-baseline        store the --bench timings as baseline\n"
+      "  --bench-depth-sweep      time --bench at every --frames-in-flight\n"
+      "  --serve DIR              render the job files spooled in DIR\n"
+      "  --serve-batch N          jobs --serve claims at once\n";
+
+static std::string
+requireValue (int argc, char **argv, int &i)
+{
+  if (i + 1 >= argc)
+    {
+      throw std::runtime_error (std::string ("Missing value for ") + argv[i]
+                                + "\n" + USAGE);
+    }
+  return argv[++i];
+}
+
+static double
+requireNumber (int argc, char **argv, int &i)
+{
+  const char *option = argv[i];
+  std::string value = requireValue (argc, argv, i);
+  try
+    {
+      return std::stod (value);
+    }
+  catch (const std::exception &)
+    {
+      throw std::runtime_error (std::string ("Expected a number for ")
+                                + option + "\n" + USAGE);
+    }
+}
+
+AppOptions
+VulkanApp::parseOptions (int argc, char **argv)
+{
+  AppOptions options;
+
+#ifndef NDEBUG
+  options.validation = true;
+#endif
+  if (const char *validation = std::getenv ("VULKAN_VALIDATION"))
+    {
+      options.validation = std::string (validation) != "0";
+    }
+
+  for (int i = 1; i < argc; i++)
+    {
+      std::string arg = argv[i];
+
+      if (arg == "--mesh")
+        {
+          options.meshPath = requireValue (argc, argv, i);
+        }
+      else if (arg == "--mesh-cache")
+        {
+          options.meshCacheDirectory = requireValue (argc, argv, i);
+        }
+      else if (arg == "--vertex-format")
+        {
+          std::string format = requireValue (argc, argv, i);
+          if (format == "quantized")
+            {
+              options.vertexFormat = VertexFormat::Quantized;
+            }
+          else if (format == "full")
+            {
+              options.vertexFormat = VertexFormat::Full;
+            }
+          else
+            {
+              throw std::runtime_error ("Unknown vertex format " + format
+                                        + "\n" + USAGE);
+            }
+        }
+      else if (arg == "--pipeline-manifest")
+        {
+          options.pipelineManifest = requireValue (argc, argv, i);
+        }
+      else if (arg == "--no-pipeline-library")
+        {
+          options.pipelineLibrary = false;
+        }
+      else if (arg == "--validation")
+        {
+          options.validation = true;
+        }
+      else if (arg == "--no-validation")
+        {
+          options.validation = false;
+        }
+      else if (arg == "--log-level")
+        {
+          std::string level = requireValue (argc, argv, i);
+          if (level == "verbose")
+            {
+              options.log.minimumSeverity = LogSeverity::Verbose;
+            }
+          else if (level == "info")
+            {
+              options.log.minimumSeverity = LogSeverity::Info;
+            }
+          else if (level == "warning")
+            {
+              options.log.minimumSeverity = LogSeverity::Warning;
+            }
+          else if (level == "error")
+            {
+              options.log.minimumSeverity = LogSeverity::Error;
+            }
+          else
+            {
+              throw std::runtime_error ("Unknown log level " + level + "\n"
+                                        + USAGE);
+            }
+        }
+      else if (arg == "--capture")
+        {
+          options.capture.directory = requireValue (argc, argv, i);
+        }
+      else if (arg == "--capture-format")
+        {
+          std::string format = requireValue (argc, argv, i);
+          if (format == "ppm")
+            {
+              options.capture.format = ImageFileFormat::PPM;
+            }
+          else if (format == "png")
+            {
+              options.capture.format = ImageFileFormat::PNG;
+            }
+          else
+            {
+              throw std::runtime_error ("Unknown capture format " + format
+                                        + "\n" + USAGE);
+            }
+        }
+      else if (arg == "--memory-stats")
+        {
+          options.memoryStatsPath = requireValue (argc, argv, i);
+        }
+      else if (arg == "--memory-interval")
+        {
+          options.memoryStatsInterval
+              = static_cast<uint32_t> (requireNumber (argc, argv, i));
+          if (options.memoryStatsInterval < 1)
+            {
+              throw std::runtime_error (
+                  "--memory-interval expects at least 1\n"
+                  + std::string (USAGE));
+            }
+        }
+      else if (arg == "--target-frame-ms")
+        {
+          options.resolution.targetMilliseconds
+              = requireNumber (argc, argv, i);
+        }
+      else if (arg == "--min-resolution")
+        {
+          options.resolution.minScale
+              = static_cast<float> (requireNumber (argc, argv, i));
+          if (options.resolution.minScale < 0.1f
+              || options.resolution.minScale > 1.0f)
+            {
+              throw std::runtime_error ("--min-resolution expects 0.1 to 1\n"
+                                        + std::string (USAGE));
+            }
+        }
+      else if (arg == "--no-frame-pacing")
+        {
+          options.framePacing = false;
+        }
+      else if (arg == "--on-demand")
+        {
+          options.redrawOnDemand = true;
+        }
+      else if (arg == "--occlusion-culling")
+        {
+          options.occlusionCulling = true;
+        }
+      else if (arg == "--cpu-culling")
+        {
+          options.cpuCulling = true;
+        }
+      else if (arg == "--lod-error")
+        {
+          options.lodErrorPixels
+              = static_cast<float> (requireNumber (argc, argv, i));
+          if (options.lodErrorPixels < 0.0f)
+            {
+              throw std::runtime_error ("--lod-error expects at least 0\n"
+                                        + std::string (USAGE));
+            }
+        }
+      else if (arg == "--quads")
+        {
+          options.quadCount
+              = static_cast<uint32_t> (requireNumber (argc, argv, i));
+        }
+      else if (arg == "--particles")
+        {
+          options.particleCount
+              = static_cast<uint32_t> (requireNumber (argc, argv, i));
+        }
+      else if (arg == "--no-hud")
+        {
+          options.hud = false;
+        }
+      else if (arg == "--frames-in-flight")
+        {
+          options.framesInFlight
+              = static_cast<uint32_t> (requireNumber (argc, argv, i));
+          if (options.framesInFlight < 1
+              || options.framesInFlight > MAX_FRAMES_IN_FLIGHT)
+            {
+              throw std::runtime_error ("--frames-in-flight expects 1 to "
+                                        + std::to_string (MAX_FRAMES_IN_FLIGHT)
+                                        + "\n" + USAGE);
+            }
+        }
+      else if (arg == "--windows")
+        {
+          options.windowCount
+              = static_cast<uint32_t> (requireNumber (argc, argv, i));
+          if (options.windowCount < 1 || options.windowCount > MAX_WINDOWS)
+            {
+              throw std::runtime_error ("--windows expects 1 to "
+                                        + std::to_string (MAX_WINDOWS)
+                                        + "\n" + USAGE);
+            }
+        }
+      else if (arg == "--headless")
+        {
+          options.headless = true;
+        }
+      else if (arg == "--frames")
+        {
+          options.headlessFrames
+              = static_cast<uint32_t> (requireNumber (argc, argv, i));
+        }
+      else if (arg == "--bench")
+        {
+          options.bench.enabled = true;
+          options.headless = true;
+        }
+      else if (arg == "--golden")
+        {
+          options.bench.goldenDirectory = requireValue (argc, argv, i);
+        }
+      else if (arg == "--baseline")
+        {
+          options.bench.baselinePath = requireValue (argc, argv, i);
+        }
+      else if (arg == "--bench-output")
+        {
+          options.bench.outputDirectory = requireValue (argc, argv, i);
+        }
+      else if (arg == "--bench-threshold")
+        {
+          options.bench.regressionThreshold = requireNumber (argc, argv, i);
+        }
+      else if (arg == "--bench-frames")
+        {
+          options.bench.measuredFrames
+              = static_cast<uint32_t> (requireNumber (argc, argv, i));
+        }
+      else if (arg == "--update-golden")
+        {
+          options.bench.updateGolden = true;
+        }
+      else if (arg == "--update-baseline")
+        {
+          options.bench.updateBaseline = true;
+        }
+      else if (arg == "--bench-depth-sweep")
+        {
+          options.bench.enabled = true;
+          options.bench.depthSweep = true;
+          options.headless = true;
+        }
+      else if (arg == "--serve")
+        {
+          options.server.spoolDirectory = requireValue (argc, argv, i);
+          options.headless = true;
+        }
+      else if (arg == "--serve-batch")
+        {
+          options.server.batchSize
+              = static_cast<uint32_t> (requireNumber (argc, argv, i));
+          if (options.server.batchSize < 1)
+            {
+              throw std::runtime_error ("--serve-batch expects at least 1\n"
+                                        + std::string (USAGE));
+            }
+        }
+      else
+        {
+          throw std::runtime_error ("Unknown option " + arg + "\n" + USAGE);
+        }
+    }
+
+  return options;
+}
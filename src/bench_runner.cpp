@@ -0,0 +1,374 @@
+#include "../include/bench_runner.hpp"
+#include "../include/image_writer.hpp"
+#include "../include/vulkan_triangle.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+using namespace VulkanApp;
+
+// Sizes cycled through by the resize churn scene, it ends on the default
+// size again so its golden image stays comparable
+static const VkExtent2D CHURN_SIZES[] = {
+  { 640, 480 }, { 1280, 720 }, { 333, 217 }, { 1024, 1024 }, { 96, 64 },
+};
+
+static double
+percentile (const std::vector<double> &sorted, double p)
+{
+  if (sorted.empty ())
+    {
+      return 0.0;
+    }
+  return sorted[static_cast<size_t> (p * (sorted.size () - 1) + 0.5)];
+}
+
+BenchRunner::BenchRunner (VulkanTriangleApplication &app,
+                          const BenchSettings &settings)
+    : app (app), settings (settings)
+{
+  BenchScene triangle;
+  triangle.scene.name = "triangle";
+  scenes.push_back (triangle);
+
+  // Small triangles, bound by per-instance vertex work
+  BenchScene instances;
+  instances.scene.name = "instances";
+  instances.scene.instanceCount = 10000;
+  instances.scene.constants.columns = 100;
+  scenes.push_back (instances);
+
+  // Screen filling triangles stacked on top of each other, bound by fill
+  // rate
+  BenchScene overdraw;
+  overdraw.scene.name = "overdraw";
+  overdraw.scene.instanceCount = 200;
+  overdraw.scene.constants.scale = 2.5f;
+  scenes.push_back (overdraw);
+
+  // A million sprites rewritten every frame, bound by streaming them into
+  // GPU memory
+  BenchScene quads;
+  quads.scene.name = "quads";
+  quads.scene.quadCount = 1000000;
+  scenes.push_back (quads);
+
+  // A million particles stepped and compacted on the GPU every frame
+  BenchScene particles;
+  particles.scene.name = "particles";
+  particles.scene.particleCount = 1000000;
+  scenes.push_back (particles);
+
+  BenchScene resizeChurn;
+  resizeChurn.scene.name = "resize_churn";
+  resizeChurn.resizeInterval = 4;
+  scenes.push_back (resizeChurn);
+}
+
+bool
+BenchRunner::run ()
+{
+  std::filesystem::create_directories (settings.outputDirectory);
+  if (settings.depthSweep)
+    {
+      return runDepthSweep ();
+    }
+  loadBaseline ();
+
+  std::vector<SceneResult> results;
+  for (const BenchScene &benchScene : scenes)
+    {
+      results.push_back (runScene (benchScene));
+    }
+
+  if (settings.updateBaseline)
+    {
+      saveBaseline (results);
+    }
+
+  bool passed = true;
+  printf ("%-14s %9s %9s %9s %9s %9s  %-10s %s\n", "scene", "mean ms",
+          "p50", "p95", "p99", "max", "image", "timing");
+  for (const SceneResult &result : results)
+    {
+      const char *image = !result.imageChecked ? "updated"
+                          : result.imagePassed ? "ok"
+                                               : "MISMATCH";
+      const char *timing = !result.timingChecked ? "updated"
+                           : result.timingPassed ? "ok"
+                                                 : "REGRESSED";
+
+      printf ("%-14s %9.3f %9.3f %9.3f %9.3f %9.3f  %-10s %s\n",
+              result.name.c_str (), result.mean,
+              percentile (result.frameTimes, 0.50),
+              percentile (result.frameTimes, 0.95),
+              percentile (result.frameTimes, 0.99),
+              result.frameTimes.empty () ? 0.0 : result.frameTimes.back (),
+              image, timing);
+
+      if ((result.imageChecked && !result.imagePassed)
+          || (result.timingChecked && !result.timingPassed))
+        {
+          passed = false;
+        }
+    }
+
+  return passed;
+}
+
+SceneResult
+BenchRunner::runScene (const BenchScene &benchScene)
+{
+  SceneResult result;
+  result.name = benchScene.scene.name;
+  measureFrames (benchScene, result);
+
+  // The captured frame is rendered at the default size in every scene
+  app.resizeTargets (WIDTH, HEIGHT);
+  app.requestCapture (settings.outputDirectory + "/" + result.name + ".ppm");
+  app.renderFrame ();
+  app.finishFrames ();
+
+  writeFrameTimes (result);
+  std::sort (result.frameTimes.begin (), result.frameTimes.end ());
+
+  checkImage (result);
+  checkTiming (result);
+  return result;
+}
+
+void
+BenchRunner::measureFrames (const BenchScene &benchScene,
+                            SceneResult &result)
+{
+  app.setScene (benchScene.scene);
+  app.resizeTargets (WIDTH, HEIGHT);
+
+  const uint32_t totalFrames = settings.warmupFrames + settings.measuredFrames;
+  const size_t sizeCount = sizeof (CHURN_SIZES) / sizeof (CHURN_SIZES[0]);
+  result.frameTimes.reserve (settings.measuredFrames);
+
+  PresentLatencyStats latencyBefore = app.frameLatency ();
+  for (uint32_t frame = 0; frame < totalFrames; frame++)
+    {
+      if (frame == settings.warmupFrames)
+        {
+          latencyBefore = app.frameLatency ();
+        }
+      auto start = std::chrono::steady_clock::now ();
+
+      // Resizing is part of what the churn scene measures
+      if (benchScene.resizeInterval != 0
+          && frame % benchScene.resizeInterval == 0)
+        {
+          const VkExtent2D &size
+              = CHURN_SIZES[(frame / benchScene.resizeInterval) % sizeCount];
+          app.resizeTargets (size.width, size.height);
+        }
+      app.renderFrame ();
+
+      auto end = std::chrono::steady_clock::now ();
+      if (frame >= settings.warmupFrames)
+        {
+          result.frameTimes.push_back (
+              std::chrono::duration<double, std::milli> (end - start)
+                  .count ());
+        }
+    }
+
+  // NOTE: The last few frames are still in flight and not counted, their
+  // latency is only known once their fences are waited on
+  PresentLatencyStats latencyAfter = app.frameLatency ();
+  if (latencyAfter.frames > latencyBefore.frames)
+    {
+      result.latency = (latencyAfter.latencySumMilliseconds
+                        - latencyBefore.latencySumMilliseconds)
+                       / (latencyAfter.frames - latencyBefore.frames);
+    }
+
+  if (!result.frameTimes.empty ())
+    {
+      result.mean = std::accumulate (result.frameTimes.begin (),
+                                     result.frameTimes.end (), 0.0)
+                    / result.frameTimes.size ();
+    }
+}
+
+bool
+BenchRunner::runDepthSweep ()
+{
+  std::string path = settings.outputDirectory + "/depth_sweep.csv";
+  std::ofstream file (path, std::ios::trunc);
+  if (!file.is_open ())
+    {
+      throw std::runtime_error ("Failed to open " + path + " for writing!");
+    }
+  file << "scene,frames_in_flight,mean_ms,p95_ms,latency_ms\n";
+
+  // Deeper queues should raise throughput until the CPU and GPU overlap
+  // fully, and raise latency by about a frame for every extra frame
+  printf ("%-14s %6s %9s %9s %9s %11s\n", "scene", "depth", "mean ms", "p95",
+          "fps", "latency ms");
+  uint32_t previous = app.setFramesInFlight (1);
+  for (uint32_t depth = 1; depth <= MAX_FRAMES_IN_FLIGHT; depth++)
+    {
+      app.setFramesInFlight (depth);
+      for (const BenchScene &benchScene : scenes)
+        {
+          SceneResult result;
+          result.name = benchScene.scene.name;
+          measureFrames (benchScene, result);
+          app.finishFrames ();
+          std::sort (result.frameTimes.begin (), result.frameTimes.end ());
+
+          double p95 = percentile (result.frameTimes, 0.95);
+          printf ("%-14s %6u %9.3f %9.3f %9.1f %11.3f\n",
+                  result.name.c_str (), depth, result.mean, p95,
+                  result.mean > 0.0 ? 1000.0 / result.mean : 0.0,
+                  result.latency);
+          file << result.name << "," << depth << "," << result.mean << ","
+               << p95 << "," << result.latency << "\n";
+        }
+    }
+  app.setFramesInFlight (previous);
+  return true;
+}
+
+void
+BenchRunner::checkImage (SceneResult &result)
+{
+  std::string outputPath
+      = settings.outputDirectory + "/" + result.name + ".ppm";
+  std::string goldenPath
+      = settings.goldenDirectory + "/" + result.name + ".ppm";
+
+  if (settings.updateGolden)
+    {
+      std::filesystem::create_directories (settings.goldenDirectory);
+      std::filesystem::copy_file (
+          outputPath, goldenPath,
+          std::filesystem::copy_options::overwrite_existing);
+      return;
+    }
+
+  result.imageChecked = true;
+
+  std::vector<uint8_t> output;
+  std::vector<uint8_t> golden;
+  uint32_t outputWidth, outputHeight, goldenWidth, goldenHeight;
+  if (!readPpm (outputPath, output, outputWidth, outputHeight))
+    {
+      throw std::runtime_error ("Failed to read captured frame " + outputPath
+                                + "!");
+    }
+  if (!readPpm (goldenPath, golden, goldenWidth, goldenHeight))
+    {
+      std::cerr << "Missing golden image " << goldenPath
+                << ", run with --update-golden to create it" << std::endl;
+      result.mismatchedPixels = 1.0;
+      return;
+    }
+  if (outputWidth != goldenWidth || outputHeight != goldenHeight)
+    {
+      result.mismatchedPixels = 1.0;
+      return;
+    }
+
+  // Different drivers round slightly differently at triangle edges, so a
+  // few pixels are allowed to be off by more than the tolerance
+  size_t mismatched = 0;
+  for (size_t i = 0; i < output.size (); i += 3)
+    {
+      for (size_t c = 0; c < 3; c++)
+        {
+          if (static_cast<uint32_t> (std::abs (output[i + c] - golden[i + c]))
+              > settings.pixelTolerance)
+            {
+              mismatched++;
+              break;
+            }
+        }
+    }
+
+  result.mismatchedPixels
+      = static_cast<double> (mismatched) / (output.size () / 3);
+  result.imagePassed = result.mismatchedPixels <= settings.maxMismatchedPixels;
+}
+
+void
+BenchRunner::checkTiming (SceneResult &result)
+{
+  if (settings.updateBaseline)
+    {
+      return;
+    }
+
+  result.timingChecked = true;
+  auto entry = baseline.find (result.name);
+  if (entry == baseline.end ())
+    {
+      std::cerr << "No baseline for " << result.name
+                << ", run with --update-baseline to create it" << std::endl;
+      return;
+    }
+
+  result.timingPassed
+      = result.mean <= entry->second * (1.0 + settings.regressionThreshold);
+}
+
+void
+BenchRunner::writeFrameTimes (const SceneResult &result)
+{
+  // In submission order, so stalls from resizes stay visible
+  std::string path = settings.outputDirectory + "/" + result.name + ".csv";
+  std::ofstream file (path, std::ios::trunc);
+  if (!file.is_open ())
+    {
+      throw std::runtime_error ("Failed to open " + path + " for writing!");
+    }
+
+  file << "frame,ms\n";
+  for (size_t i = 0; i < result.frameTimes.size (); i++)
+    {
+      file << i << "," << result.frameTimes[i] << "\n";
+    }
+}
+
+void
+BenchRunner::loadBaseline ()
+{
+  std::ifstream file (settings.baselinePath);
+  std::string name;
+  double mean;
+  while (file >> name >> mean)
+    {
+      baseline[name] = mean;
+    }
+}
+
+void
+BenchRunner::saveBaseline (const std::vector<SceneResult> &results)
+{
+  std::filesystem::path path (settings.baselinePath);
+  if (path.has_parent_path ())
+    {
+      std::filesystem::create_directories (path.parent_path ());
+    }
+
+  std::ofstream file (settings.baselinePath, std::ios::trunc);
+  if (!file.is_open ())
+    {
+      throw std::runtime_error ("Failed to open " + settings.baselinePath
+                                + " for writing!");
+    }
+
+  for (const SceneResult &result : results)
+    {
+      file << result.name << " " << result.mean << "\n";
+    }
+}
@@ -0,0 +1,130 @@
+#include "../include/buffer_utils.hpp"
+#include <stdexcept>
+using namespace VulkanApp;
+
+uint32_t
+VulkanApp::findMemoryType (VkPhysicalDevice physicalDevice,
+                           uint32_t typeFilter,
+                           VkMemoryPropertyFlags properties)
+{
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  vkGetPhysicalDeviceMemoryProperties (physicalDevice, &memoryProperties);
+
+  for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+    {
+      if ((typeFilter & (1 << i))
+          && (memoryProperties.memoryTypes[i].propertyFlags & properties)
+                 == properties)
+        {
+          return i;
+        }
+    }
+
+  throw std::runtime_error ("Failed to find suitable memory type!");
+}
+
+uint32_t
+VulkanApp::findMemoryType (VkPhysicalDevice physicalDevice,
+                           uint32_t typeFilter, VkMemoryPropertyFlags required,
+                           VkMemoryPropertyFlags preferred)
+{
+  try
+    {
+      return findMemoryType (physicalDevice, typeFilter,
+                             required | preferred);
+    }
+  catch (const std::runtime_error &)
+    {
+      return findMemoryType (physicalDevice, typeFilter, required);
+    }
+}
+
+GpuBuffer
+VulkanApp::createBuffer (VkPhysicalDevice physicalDevice, VkDevice device,
+                         VkDeviceSize size, VkBufferUsageFlags usage,
+                         VkMemoryPropertyFlags required,
+                         VkMemoryPropertyFlags preferred, bool persistentMap,
+                         const VkAllocationCallbacks *allocator)
+{
+  GpuBuffer result{};
+  result.size = size;
+
+  VkBufferCreateInfo bufferInfo{};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = size;
+  bufferInfo.usage = usage;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  if (vkCreateBuffer (device, &bufferInfo, allocator, &result.buffer)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to create buffer!");
+    }
+
+  VkMemoryRequirements memRequirements;
+  vkGetBufferMemoryRequirements (device, result.buffer, &memRequirements);
+
+  uint32_t memoryType
+      = findMemoryType (physicalDevice, memRequirements.memoryTypeBits,
+                        required, preferred);
+
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  vkGetPhysicalDeviceMemoryProperties (physicalDevice, &memoryProperties);
+  result.properties = memoryProperties.memoryTypes[memoryType].propertyFlags;
+
+  VkMemoryAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = memRequirements.size;
+  allocInfo.memoryTypeIndex = memoryType;
+
+  if (vkAllocateMemory (device, &allocInfo, allocator, &result.memory)
+      != VK_SUCCESS)
+    {
+      vkDestroyBuffer (device, result.buffer, allocator);
+      throw std::runtime_error ("Failed to allocate buffer memory!");
+    }
+
+  vkBindBufferMemory (device, result.buffer, result.memory, 0);
+
+  if (persistentMap)
+    {
+      if (vkMapMemory (device, result.memory, 0, VK_WHOLE_SIZE, 0,
+                       &result.mapped)
+          != VK_SUCCESS)
+        {
+          destroyBuffer (device, result, allocator);
+          throw std::runtime_error ("Failed to map buffer memory!");
+        }
+    }
+
+  return result;
+}
+
+void
+VulkanApp::destroyBuffer (VkDevice device, GpuBuffer &buffer,
+                          const VkAllocationCallbacks *allocator)
+{
+  if (buffer.mapped != nullptr)
+    {
+      vkUnmapMemory (device, buffer.memory);
+    }
+  vkDestroyBuffer (device, buffer.buffer, allocator);
+  vkFreeMemory (device, buffer.memory, allocator);
+  buffer = {};
+}
+
+void
+VulkanApp::invalidateBuffer (VkDevice device, const GpuBuffer &buffer)
+{
+  if (buffer.properties & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+    {
+      return;
+    }
+
+  VkMappedMemoryRange range{};
+  range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+  range.memory = buffer.memory;
+  range.offset = 0;
+  range.size = VK_WHOLE_SIZE;
+  vkInvalidateMappedMemoryRanges (device, 1, &range);
+}
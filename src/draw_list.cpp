@@ -0,0 +1,189 @@
+#include "../include/draw_list.hpp"
+#include <stdexcept>
+using namespace VulkanApp;
+
+DrawList::DrawList ()
+{
+  // descriptor set 0 is reserved for draws that don't bind one
+  descriptorSets.push_back (VK_NULL_HANDLE);
+  // and indirect binding 0 for direct draws
+  indirects.push_back ({});
+}
+
+uint32_t
+DrawList::addPipeline (VkPipeline pipeline, VkPipelineLayout layout)
+{
+  if (pipelines.size () >= (1u << DrawKey::PIPELINE_BITS))
+    {
+      throw std::runtime_error ("Too many pipelines for the draw sort key!");
+    }
+
+  pipelines.push_back ({ pipeline, layout });
+  return static_cast<uint32_t> (pipelines.size () - 1);
+}
+
+void
+DrawList::setPipeline (uint32_t id, VkPipeline pipeline)
+{
+  pipelines[id].pipeline = pipeline;
+}
+
+uint32_t
+DrawList::addDescriptorSet (VkDescriptorSet set)
+{
+  if (descriptorSets.size () >= (1u << DrawKey::DESCRIPTOR_SET_BITS))
+    {
+      throw std::runtime_error (
+          "Too many descriptor sets for the draw sort key!");
+    }
+
+  descriptorSets.push_back (set);
+  return static_cast<uint32_t> (descriptorSets.size () - 1);
+}
+
+uint32_t
+DrawList::addMesh (const MeshBinding &mesh)
+{
+  if (meshes.size () >= (1u << DrawKey::MESH_BITS))
+    {
+      throw std::runtime_error ("Too many meshes for the draw sort key!");
+    }
+
+  meshes.push_back (mesh);
+  return static_cast<uint32_t> (meshes.size () - 1);
+}
+
+void
+DrawList::setMesh (uint32_t id, const MeshBinding &mesh)
+{
+  meshes[id] = mesh;
+}
+
+uint32_t
+DrawList::addIndirect (const IndirectBinding &indirect)
+{
+  indirects.push_back (indirect);
+  return static_cast<uint32_t> (indirects.size () - 1);
+}
+
+void
+DrawList::setIndirect (uint32_t id, const IndirectBinding &indirect)
+{
+  indirects[id] = indirect;
+}
+
+void
+DrawList::clear ()
+{
+  commands.clear ();
+  keys.clear ();
+  order.clear ();
+}
+
+void
+DrawList::push (const DrawCommand &command)
+{
+  keys.push_back (DrawKey::make (command.pipeline, command.descriptorSet,
+                                 command.mesh, command.depth));
+  order.push_back (static_cast<uint32_t> (commands.size ()));
+  commands.push_back (command);
+}
+
+void
+DrawList::sort ()
+{
+  sorter.sort (keys.data (), order.data (), keys.size ());
+}
+
+void
+DrawList::record (VkCommandBuffer buffer)
+{
+  stats = {};
+
+  // UINT32_MAX never matches a real index so the first draw binds everything
+  uint32_t boundPipeline = UINT32_MAX;
+  uint32_t boundDescriptorSet = UINT32_MAX;
+  uint32_t boundMesh = UINT32_MAX;
+  VkPipelineLayout boundLayout = VK_NULL_HANDLE;
+
+  for (uint32_t index : order)
+    {
+      const DrawCommand &command = commands[index];
+
+      if (command.pipeline != boundPipeline)
+        {
+          const PipelineBinding &binding = pipelines[command.pipeline];
+          vkCmdBindPipeline (buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                             binding.pipeline);
+          stats.pipelineBinds++;
+          boundPipeline = command.pipeline;
+
+          // Sets bound under a different layout aren't guaranteed to stay
+          // valid, so force a rebind
+          if (binding.layout != boundLayout)
+            {
+              boundLayout = binding.layout;
+              boundDescriptorSet = UINT32_MAX;
+            }
+        }
+
+      if (command.descriptorSet != boundDescriptorSet)
+        {
+          if (command.descriptorSet != 0)
+            {
+              vkCmdBindDescriptorSets (buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                       boundLayout, 0, 1,
+                                       &descriptorSets[command.descriptorSet],
+                                       0, nullptr);
+              stats.descriptorSetBinds++;
+            }
+          boundDescriptorSet = command.descriptorSet;
+        }
+
+      const MeshBinding &mesh = meshes[command.mesh];
+      if (command.mesh != boundMesh)
+        {
+          if (mesh.vertexBuffer != VK_NULL_HANDLE)
+            {
+              vkCmdBindVertexBuffers (buffer, 0, 1, &mesh.vertexBuffer,
+                                      &mesh.vertexOffset);
+              stats.meshBinds++;
+            }
+          if (mesh.indexBuffer != VK_NULL_HANDLE)
+            {
+              vkCmdBindIndexBuffer (buffer, mesh.indexBuffer,
+                                    mesh.indexOffset, mesh.indexType);
+            }
+          boundMesh = command.mesh;
+        }
+
+      if (command.indirect != 0)
+        {
+          const IndirectBinding &indirect = indirects[command.indirect];
+          if (mesh.indexBuffer != VK_NULL_HANDLE)
+            {
+              vkCmdDrawIndexedIndirect (
+                  buffer, indirect.buffer, indirect.offset,
+                  indirect.drawCount, sizeof (VkDrawIndexedIndirectCommand));
+            }
+          else
+            {
+              vkCmdDrawIndirect (buffer, indirect.buffer, indirect.offset,
+                                 indirect.drawCount,
+                                 sizeof (VkDrawIndirectCommand));
+            }
+          stats.indirectDraws++;
+        }
+      else if (mesh.indexBuffer != VK_NULL_HANDLE)
+        {
+          vkCmdDrawIndexed (buffer, mesh.elementCount, command.instanceCount,
+                            0, 0, command.firstInstance);
+        }
+      else
+        {
+          vkCmdDraw (buffer, mesh.elementCount, command.instanceCount, 0,
+                     command.firstInstance);
+        }
+      stats.draws++;
+    }
+}
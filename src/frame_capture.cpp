@@ -0,0 +1,338 @@
+#include "../include/frame_capture.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+using namespace VulkanApp;
+
+FrameCapture::~FrameCapture ()
+{
+  if (device != VK_NULL_HANDLE && !slots.empty ())
+    {
+      cleanup ();
+    }
+}
+
+void
+FrameCapture::init (VkPhysicalDevice physicalDevice, VkDevice device,
+                    uint32_t ringSize, VkImageLayout imageLayout,
+                    const FrameCaptureSettings &settings,
+                    const VkAllocationCallbacks *allocator, Logger *logger)
+{
+  this->physicalDevice = physicalDevice;
+  this->device = device;
+  this->allocator = allocator;
+  this->logger = logger;
+  this->imageLayout = imageLayout;
+  this->settings = settings;
+
+  if (!enabled ())
+    {
+      return;
+    }
+
+  if (!settings.directory.empty ())
+    {
+      std::filesystem::create_directories (settings.directory);
+    }
+  slots.resize (ringSize);
+}
+
+void
+FrameCapture::resize (VkExtent2D extent, VkFormat format)
+{
+  if (!enabled ())
+    {
+      return;
+    }
+
+  switch (format)
+    {
+    case VK_FORMAT_B8G8R8A8_SRGB:
+    case VK_FORMAT_B8G8R8A8_UNORM:
+      layout = PixelLayout::BGRA8;
+      break;
+    case VK_FORMAT_R8G8B8A8_SRGB:
+    case VK_FORMAT_R8G8B8A8_UNORM:
+      layout = PixelLayout::RGBA8;
+      break;
+    default:
+      throw std::runtime_error ("Frame capture needs an 8-bit RGBA or BGRA "
+                                "swap chain format!");
+    }
+
+  VkDeviceSize newSize = static_cast<VkDeviceSize> (extent.width)
+                         * extent.height * 4;
+  this->extent = extent;
+
+  if (newSize == frameSize)
+    {
+      return;
+    }
+
+  {
+    std::lock_guard<std::mutex> lock (hostFramesMutex);
+    frameSize = newSize;
+    freeHostFrames.clear ();
+  }
+
+  for (auto &slot : slots)
+    {
+      if (slot.buffer.buffer != VK_NULL_HANDLE)
+        {
+          destroyBuffer (device, slot.buffer, allocator);
+        }
+
+      // HOST_CACHED makes the memcpy out of the mapping run at full speed,
+      // uncached reads are an order of magnitude slower
+      slot.buffer = createBuffer (
+          physicalDevice, device, newSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+          VK_MEMORY_PROPERTY_HOST_CACHED_BIT, true, allocator);
+      slot.pending = false;
+    }
+}
+
+void
+FrameCapture::requestCapture (const std::string &path)
+{
+  requestedPath = path;
+}
+
+void
+FrameCapture::recordCopy (VkCommandBuffer buffer, uint32_t slot, VkImage image,
+                          uint64_t frameNumber)
+{
+  Slot &target = slots[slot];
+
+  if (!requestedPath.empty ())
+    {
+      target.path = requestedPath;
+      target.requested = true;
+      requestedPath.clear ();
+    }
+  else
+    {
+      target.requested = false;
+      char name[32];
+      snprintf (name, sizeof (name), "/frame_%06llu.",
+                static_cast<unsigned long long> (frameNumber));
+      target.path = settings.directory + name
+                    + fileExtension (settings.format);
+    }
+
+  VkImageMemoryBarrier toTransfer{};
+  toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  // written by the render pass, or by the upscale blit with dynamic
+  // resolution
+  toTransfer.srcAccessMask
+      = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+  toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  toTransfer.oldLayout = imageLayout;
+  toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  toTransfer.image = image;
+  toTransfer.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  toTransfer.subresourceRange.levelCount = 1;
+  toTransfer.subresourceRange.layerCount = 1;
+
+  vkCmdPipelineBarrier (buffer,
+                        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+                            | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                        nullptr, 1, &toTransfer);
+
+  // bufferRowLength 0 means tightly packed rows
+  VkBufferImageCopy region{};
+  region.bufferOffset = 0;
+  region.bufferRowLength = 0;
+  region.bufferImageHeight = 0;
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.mipLevel = 0;
+  region.imageSubresource.baseArrayLayer = 0;
+  region.imageSubresource.layerCount = 1;
+  region.imageOffset = { 0, 0, 0 };
+  region.imageExtent = { extent.width, extent.height, 1 };
+
+  vkCmdCopyImageToBuffer (buffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                          target.buffer.buffer, 1, &region);
+
+  VkImageMemoryBarrier toPresent = toTransfer;
+  toPresent.srcAccessMask = 0;
+  toPresent.dstAccessMask = 0;
+  toPresent.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  toPresent.newLayout = imageLayout;
+
+  VkBufferMemoryBarrier toHost{};
+  toHost.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  toHost.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  toHost.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  toHost.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  toHost.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  toHost.buffer = target.buffer.buffer;
+  toHost.offset = 0;
+  toHost.size = VK_WHOLE_SIZE;
+
+  vkCmdPipelineBarrier (buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT
+                            | VK_PIPELINE_STAGE_HOST_BIT,
+                        0, 0, nullptr, 1, &toHost, 1, &toPresent);
+
+  target.pending = true;
+}
+
+void
+FrameCapture::collect (uint32_t slot)
+{
+  if (!enabled () || !slots[slot].pending)
+    {
+      return;
+    }
+
+  Slot &source = slots[slot];
+  source.pending = false;
+
+  invalidateBuffer (device, source.buffer);
+
+  // Copying out frees the slot for the next frame right away, the encoders
+  // can then take as long as the disk needs
+  std::vector<uint8_t> pixels = acquireHostFrame ();
+  std::memcpy (pixels.data (), source.buffer.mapped, pixels.size ());
+
+  std::string path = std::move (source.path);
+  ImageFileFormat format = settings.format;
+  VkExtent2D size = extent;
+  PixelLayout pixelLayout = layout;
+  bool requested = source.requested;
+
+  // Background priority, only workers with nothing else to do encode
+  auto encode = [this, path, format, size, pixelLayout, requested,
+                 pixels = std::move (pixels)] () mutable {
+    ImageData image{};
+    image.pixels = pixels.data ();
+    image.width = size.width;
+    image.height = size.height;
+    image.rowPitch = size.width * 4;
+    image.layout = pixelLayout;
+
+    try
+      {
+        writeImage (path, format, image);
+      }
+    catch (const std::exception &e)
+      {
+        if (requested)
+          {
+            std::lock_guard<std::mutex> lock (hostFramesMutex);
+            results.push_back ({ path, false, e.what () });
+          }
+        else if (logger != nullptr)
+          {
+            std::string message = "Failed to write " + path + ": ";
+            message += e.what ();
+            logger->log (LogSeverity::Warning, 0, message.c_str ());
+          }
+        releaseHostFrame (std::move (pixels));
+        return;
+      }
+    if (requested)
+      {
+        std::lock_guard<std::mutex> lock (hostFramesMutex);
+        results.push_back ({ path, true, std::string () });
+      }
+    releaseHostFrame (std::move (pixels));
+  };
+  JobSystem::shared ().run (std::move (encode), &encodes,
+                            JobPriority::Background);
+}
+
+void
+FrameCapture::collectAll ()
+{
+  for (uint32_t i = 0; i < slots.size (); i++)
+    {
+      collect (i);
+    }
+}
+
+void
+FrameCapture::finish ()
+{
+  collectAll ();
+  JobSystem::shared ().wait (encodes);
+}
+
+void
+FrameCapture::cleanup ()
+{
+  JobSystem::shared ().wait (encodes);
+
+  for (auto &slot : slots)
+    {
+      if (slot.buffer.buffer != VK_NULL_HANDLE)
+        {
+          destroyBuffer (device, slot.buffer, allocator);
+        }
+    }
+  slots.clear ();
+  frameSize = 0;
+}
+
+FrameCaptureStats
+FrameCapture::stats () const
+{
+  std::lock_guard<std::mutex> lock (hostFramesMutex);
+  return counters;
+}
+
+std::vector<CaptureResult>
+FrameCapture::takeResults ()
+{
+  std::lock_guard<std::mutex> lock (hostFramesMutex);
+  std::vector<CaptureResult> finished;
+  finished.swap (results);
+  return finished;
+}
+
+std::vector<uint8_t>
+FrameCapture::acquireHostFrame ()
+{
+  std::unique_lock<std::mutex> lock (hostFramesMutex);
+
+  if (queuedFrames >= settings.maxQueuedFrames)
+    {
+      counters.encoderStalls++;
+      hostFrameReleased.wait (
+          lock, [this] { return queuedFrames < settings.maxQueuedFrames; });
+    }
+
+  queuedFrames++;
+  counters.framesCaptured++;
+
+  if (!freeHostFrames.empty ())
+    {
+      std::vector<uint8_t> frame = std::move (freeHostFrames.back ());
+      freeHostFrames.pop_back ();
+      return frame;
+    }
+
+  return std::vector<uint8_t> (frameSize);
+}
+
+void
+FrameCapture::releaseHostFrame (std::vector<uint8_t> pixels)
+{
+  {
+    std::lock_guard<std::mutex> lock (hostFramesMutex);
+    queuedFrames--;
+
+    // frames from before a resize are simply dropped
+    if (pixels.size () == frameSize)
+      {
+        freeHostFrames.push_back (std::move (pixels));
+      }
+  }
+  hostFrameReleased.notify_one ();
+}
@@ -0,0 +1,36 @@
+#include "../include/frame_context.hpp"
+using namespace VulkanApp;
+
+UploadAllocation
+FrameContext::allocateUpload (VkDeviceSize size, VkDeviceSize alignment)
+{
+  UploadAllocation allocation;
+  VkDeviceSize offset = (uploadOffset + alignment - 1) & ~(alignment - 1);
+  if (uploadBuffer.mapped == nullptr || offset + size > uploadBuffer.size)
+    {
+      return allocation;
+    }
+
+  allocation.buffer = uploadBuffer.buffer;
+  allocation.offset = offset;
+  allocation.data = static_cast<char *> (uploadBuffer.mapped) + offset;
+  uploadOffset = offset + size;
+  return allocation;
+}
+
+void
+FrameContext::defer (std::function<void ()> deletion)
+{
+  deletions.push_back (std::move (deletion));
+}
+
+void
+FrameContext::retire ()
+{
+  for (auto &deletion : deletions)
+    {
+      deletion ();
+    }
+  deletions.clear ();
+  uploadOffset = 0;
+}
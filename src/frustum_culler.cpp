@@ -0,0 +1,568 @@
+#include "../include/frustum_culler.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+using namespace VulkanApp;
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#endif
+
+// AVX2 and AVX-512 aren't part of the x86-64 baseline, so they are compiled
+// in with target attributes and only used after checking the CPU at runtime
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_AVX 1
+#endif
+
+namespace
+{
+// A plane with the absolute values of its normal, which project an
+// object's box extent onto it
+struct CullPlane
+{
+  float a, b, c, w;
+  float absA, absB, absC;
+};
+
+struct CullStreams
+{
+  const float *centerX;
+  const float *centerY;
+  const float *centerZ;
+  const float *radius;
+  const float *extentX;
+  const float *extentY;
+  const float *extentZ;
+};
+} // namespace
+
+const char *
+VulkanApp::cullIsaName (CullIsa isa)
+{
+  switch (isa)
+    {
+    case CullIsa::Scalar:
+      return "scalar";
+    case CullIsa::Sse2:
+      return "sse2";
+    case CullIsa::Avx2:
+      return "avx2";
+    case CullIsa::Avx512:
+      return "avx512";
+    }
+  return "unknown";
+}
+
+bool
+VulkanApp::cullIsaSupported (CullIsa isa)
+{
+  switch (isa)
+    {
+    case CullIsa::Scalar:
+      return true;
+    case CullIsa::Sse2:
+#if HAVE_SSE2
+      return true;
+#else
+      return false;
+#endif
+    case CullIsa::Avx2:
+#if HAVE_AVX
+      return __builtin_cpu_supports ("avx2");
+#else
+      return false;
+#endif
+    case CullIsa::Avx512:
+#if HAVE_AVX
+      return __builtin_cpu_supports ("avx512f");
+#else
+      return false;
+#endif
+    }
+  return false;
+}
+
+CullIsa
+VulkanApp::bestCullIsa ()
+{
+  static const CullIsa best = [] {
+    for (CullIsa isa : { CullIsa::Avx512, CullIsa::Avx2, CullIsa::Sse2 })
+      {
+        if (cullIsaSupported (isa))
+          {
+            return isa;
+          }
+      }
+    return CullIsa::Scalar;
+  }();
+  return best;
+}
+
+Frustum
+VulkanApp::extractFrustum (const Mat4 &viewProjection)
+{
+  // Rows of the matrix, clip space is -w <= x, y <= w and 0 <= z <= w
+  float rows[4][4];
+  for (int row = 0; row < 4; row++)
+    {
+      for (int column = 0; column < 4; column++)
+        {
+          rows[row][column] = viewProjection.m[column * 4 + row];
+        }
+    }
+
+  Frustum frustum;
+  for (int k = 0; k < 4; k++)
+    {
+      frustum.planes[0][k] = rows[3][k] + rows[0][k];
+      frustum.planes[1][k] = rows[3][k] - rows[0][k];
+      frustum.planes[2][k] = rows[3][k] + rows[1][k];
+      frustum.planes[3][k] = rows[3][k] - rows[1][k];
+      frustum.planes[4][k] = rows[2][k];
+      frustum.planes[5][k] = rows[3][k] - rows[2][k];
+    }
+  for (float *plane : frustum.planes)
+    {
+      float length = std::sqrt (plane[0] * plane[0] + plane[1] * plane[1]
+                                + plane[2] * plane[2]);
+      if (length > 0.0f)
+        {
+          for (int k = 0; k < 4; k++)
+            {
+              plane[k] /= length;
+            }
+        }
+    }
+  return frustum;
+}
+
+void
+FrustumCuller::clear ()
+{
+  for (std::vector<float> *stream : { &centerX, &centerY, &centerZ, &radius,
+                                      &extentX, &extentY, &extentZ })
+    {
+      stream->clear ();
+    }
+}
+
+void
+FrustumCuller::reserve (size_t count)
+{
+  for (std::vector<float> *stream : { &centerX, &centerY, &centerZ, &radius,
+                                      &extentX, &extentY, &extentZ })
+    {
+      stream->reserve (count);
+    }
+}
+
+uint32_t
+FrustumCuller::add (const float center[3], float radius, const float extent[3])
+{
+  centerX.push_back (center[0]);
+  centerY.push_back (center[1]);
+  centerZ.push_back (center[2]);
+  this->radius.push_back (radius);
+  extentX.push_back (extent[0]);
+  extentY.push_back (extent[1]);
+  extentZ.push_back (extent[2]);
+  return static_cast<uint32_t> (centerX.size () - 1);
+}
+
+void
+FrustumCuller::transform (const Mat4 &transform)
+{
+  const float *m = transform.m;
+  float scale = 0.0f;
+  for (int column = 0; column < 3; column++)
+    {
+      const float *axis = m + column * 4;
+      scale = std::max (scale, std::sqrt (axis[0] * axis[0]
+                                          + axis[1] * axis[1]
+                                          + axis[2] * axis[2]));
+    }
+  float abs[12];
+  for (int k = 0; k < 12; k++)
+    {
+      abs[k] = std::fabs (m[k]);
+    }
+
+  size_t count = size ();
+  size_t i = 0;
+#if HAVE_SSE2
+  // The same operations in the same order as the scalar loop below
+  __m128 columns[4][3];
+  __m128 absColumns[3][3];
+  for (int column = 0; column < 4; column++)
+    {
+      for (int row = 0; row < 3; row++)
+        {
+          columns[column][row] = _mm_set1_ps (m[column * 4 + row]);
+          if (column < 3)
+            {
+              absColumns[column][row] = _mm_set1_ps (abs[column * 4 + row]);
+            }
+        }
+    }
+  __m128 scale4 = _mm_set1_ps (scale);
+  for (; i + 4 <= count; i += 4)
+    {
+      __m128 x = _mm_loadu_ps (&centerX[i]);
+      __m128 y = _mm_loadu_ps (&centerY[i]);
+      __m128 z = _mm_loadu_ps (&centerZ[i]);
+      __m128 ex = _mm_loadu_ps (&extentX[i]);
+      __m128 ey = _mm_loadu_ps (&extentY[i]);
+      __m128 ez = _mm_loadu_ps (&extentZ[i]);
+      __m128 center[3], extent[3];
+      for (int row = 0; row < 3; row++)
+        {
+          center[row] = _mm_add_ps (
+              _mm_add_ps (_mm_add_ps (_mm_mul_ps (columns[0][row], x),
+                                      _mm_mul_ps (columns[1][row], y)),
+                          _mm_mul_ps (columns[2][row], z)),
+              columns[3][row]);
+          extent[row] = _mm_add_ps (
+              _mm_add_ps (_mm_mul_ps (absColumns[0][row], ex),
+                          _mm_mul_ps (absColumns[1][row], ey)),
+              _mm_mul_ps (absColumns[2][row], ez));
+        }
+      _mm_storeu_ps (&centerX[i], center[0]);
+      _mm_storeu_ps (&centerY[i], center[1]);
+      _mm_storeu_ps (&centerZ[i], center[2]);
+      _mm_storeu_ps (&extentX[i], extent[0]);
+      _mm_storeu_ps (&extentY[i], extent[1]);
+      _mm_storeu_ps (&extentZ[i], extent[2]);
+      _mm_storeu_ps (&radius[i], _mm_mul_ps (_mm_loadu_ps (&radius[i]),
+                                             scale4));
+    }
+#endif
+
+  for (; i < count; i++)
+    {
+      float x = centerX[i], y = centerY[i], z = centerZ[i];
+      float ex = extentX[i], ey = extentY[i], ez = extentZ[i];
+      float center[3], extent[3];
+      for (int row = 0; row < 3; row++)
+        {
+          center[row] = ((m[row] * x + m[4 + row] * y) + m[8 + row] * z)
+                        + m[12 + row];
+          extent[row]
+              = (abs[row] * ex + abs[4 + row] * ey) + abs[8 + row] * ez;
+        }
+      centerX[i] = center[0];
+      centerY[i] = center[1];
+      centerZ[i] = center[2];
+      extentX[i] = extent[0];
+      extentY[i] = extent[1];
+      extentZ[i] = extent[2];
+      radius[i] *= scale;
+    }
+}
+
+// Tests objects begin to end, also the tail of every SIMD kernel. The
+// kernels do the same operations in the same order so every path culls
+// the same objects.
+static uint32_t
+cullScalar (const CullStreams &s, const CullPlane *planes,
+            uint32_t frustumCount, uint32_t begin, uint32_t end,
+            uint32_t *visible, uint32_t visibleCount)
+{
+  for (uint32_t i = begin; i < end; i++)
+    {
+      bool any = false;
+      for (uint32_t f = 0; f < frustumCount; f++)
+        {
+          bool inside = true;
+          for (uint32_t p = 0; p < 6; p++)
+            {
+              const CullPlane &plane = planes[f * 6 + p];
+              float distance = ((plane.a * s.centerX[i]
+                                 + plane.b * s.centerY[i])
+                                + plane.c * s.centerZ[i])
+                               + plane.w;
+              float reach = (plane.absA * s.extentX[i]
+                             + plane.absB * s.extentY[i])
+                            + plane.absC * s.extentZ[i];
+              reach = s.radius[i] < reach ? s.radius[i] : reach;
+              inside &= distance + reach >= 0.0f;
+            }
+          any |= inside;
+        }
+      // written either way, only kept when visible
+      visible[visibleCount] = i;
+      visibleCount += any ? 1 : 0;
+    }
+  return visibleCount;
+}
+
+#if HAVE_SSE2
+static uint32_t
+cullSse2 (const CullStreams &s, const CullPlane *planes,
+          uint32_t frustumCount, uint32_t begin, uint32_t end,
+          uint32_t *visible)
+{
+  const __m128 zero = _mm_setzero_ps ();
+  uint32_t visibleCount = 0;
+  for (uint32_t i = begin; i + 4 <= end; i += 4)
+    {
+      __m128 x = _mm_loadu_ps (s.centerX + i);
+      __m128 y = _mm_loadu_ps (s.centerY + i);
+      __m128 z = _mm_loadu_ps (s.centerZ + i);
+      __m128 r = _mm_loadu_ps (s.radius + i);
+      __m128 ex = _mm_loadu_ps (s.extentX + i);
+      __m128 ey = _mm_loadu_ps (s.extentY + i);
+      __m128 ez = _mm_loadu_ps (s.extentZ + i);
+
+      __m128 any = zero;
+      for (uint32_t f = 0; f < frustumCount; f++)
+        {
+          __m128 inside = _mm_cmpeq_ps (zero, zero);
+          for (uint32_t p = 0; p < 6; p++)
+            {
+              const CullPlane &plane = planes[f * 6 + p];
+              __m128 distance = _mm_add_ps (
+                  _mm_add_ps (
+                      _mm_add_ps (_mm_mul_ps (_mm_set1_ps (plane.a), x),
+                                  _mm_mul_ps (_mm_set1_ps (plane.b), y)),
+                      _mm_mul_ps (_mm_set1_ps (plane.c), z)),
+                  _mm_set1_ps (plane.w));
+              __m128 reach = _mm_add_ps (
+                  _mm_add_ps (_mm_mul_ps (_mm_set1_ps (plane.absA), ex),
+                              _mm_mul_ps (_mm_set1_ps (plane.absB), ey)),
+                  _mm_mul_ps (_mm_set1_ps (plane.absC), ez));
+              reach = _mm_min_ps (r, reach);
+              inside = _mm_and_ps (
+                  inside, _mm_cmpge_ps (_mm_add_ps (distance, reach), zero));
+            }
+          any = _mm_or_ps (any, inside);
+        }
+
+      int mask = _mm_movemask_ps (any);
+      while (mask != 0)
+        {
+          visible[visibleCount++] = i + __builtin_ctz (mask);
+          mask &= mask - 1;
+        }
+    }
+  return visibleCount;
+}
+#endif
+
+#if HAVE_AVX
+// For every 8 bit mask the lanes set in it, packed to the front as 3 bit
+// lane numbers in consecutive nibbles
+static const std::array<uint32_t, 256> &
+compactTable ()
+{
+  static const std::array<uint32_t, 256> table = [] {
+    std::array<uint32_t, 256> lanes{};
+    for (uint32_t mask = 0; mask < 256; mask++)
+      {
+        uint32_t packed = 0;
+        uint32_t count = 0;
+        for (uint32_t lane = 0; lane < 8; lane++)
+          {
+            if (mask & (1u << lane))
+              {
+                packed |= lane << (4 * count++);
+              }
+          }
+        lanes[mask] = packed;
+      }
+    return lanes;
+  }();
+  return table;
+}
+
+__attribute__ ((target ("avx2"))) static uint32_t
+cullAvx2 (const CullStreams &s, const CullPlane *planes,
+          uint32_t frustumCount, uint32_t begin, uint32_t end,
+          uint32_t *visible)
+{
+  const std::array<uint32_t, 256> &table = compactTable ();
+  const __m256 zero = _mm256_setzero_ps ();
+  const __m256i nibbles = _mm256_setr_epi32 (0, 4, 8, 12, 16, 20, 24, 28);
+  const __m256i lanes = _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7);
+  uint32_t visibleCount = 0;
+  for (uint32_t i = begin; i + 8 <= end; i += 8)
+    {
+      __m256 x = _mm256_loadu_ps (s.centerX + i);
+      __m256 y = _mm256_loadu_ps (s.centerY + i);
+      __m256 z = _mm256_loadu_ps (s.centerZ + i);
+      __m256 r = _mm256_loadu_ps (s.radius + i);
+      __m256 ex = _mm256_loadu_ps (s.extentX + i);
+      __m256 ey = _mm256_loadu_ps (s.extentY + i);
+      __m256 ez = _mm256_loadu_ps (s.extentZ + i);
+
+      __m256 any = zero;
+      for (uint32_t f = 0; f < frustumCount; f++)
+        {
+          __m256 inside = _mm256_cmp_ps (zero, zero, _CMP_EQ_OQ);
+          for (uint32_t p = 0; p < 6; p++)
+            {
+              const CullPlane &plane = planes[f * 6 + p];
+              __m256 distance = _mm256_add_ps (
+                  _mm256_add_ps (
+                      _mm256_add_ps (
+                          _mm256_mul_ps (_mm256_set1_ps (plane.a), x),
+                          _mm256_mul_ps (_mm256_set1_ps (plane.b), y)),
+                      _mm256_mul_ps (_mm256_set1_ps (plane.c), z)),
+                  _mm256_set1_ps (plane.w));
+              __m256 reach = _mm256_add_ps (
+                  _mm256_add_ps (
+                      _mm256_mul_ps (_mm256_set1_ps (plane.absA), ex),
+                      _mm256_mul_ps (_mm256_set1_ps (plane.absB), ey)),
+                  _mm256_mul_ps (_mm256_set1_ps (plane.absC), ez));
+              reach = _mm256_min_ps (r, reach);
+              inside = _mm256_and_ps (
+                  inside, _mm256_cmp_ps (_mm256_add_ps (distance, reach),
+                                         zero, _CMP_GE_OQ));
+            }
+          any = _mm256_or_ps (any, inside);
+        }
+
+      // Permutes the visible lanes' indices to the front and stores all
+      // eight, the ones past the visible count are overwritten next
+      int mask = _mm256_movemask_ps (any);
+      __m256i order = _mm256_and_si256 (
+          _mm256_srlv_epi32 (_mm256_set1_epi32 (table[mask]), nibbles),
+          _mm256_set1_epi32 (7));
+      __m256i indices = _mm256_add_epi32 (_mm256_set1_epi32 (i), lanes);
+      _mm256_storeu_si256 (
+          reinterpret_cast<__m256i *> (visible + visibleCount),
+          _mm256_permutevar8x32_epi32 (indices, order));
+      visibleCount += __builtin_popcount (mask);
+    }
+  return visibleCount;
+}
+
+__attribute__ ((target ("avx512f"))) static uint32_t
+cullAvx512 (const CullStreams &s, const CullPlane *planes,
+            uint32_t frustumCount, uint32_t begin, uint32_t end,
+            uint32_t *visible)
+{
+  const __m512 zero = _mm512_setzero_ps ();
+  const __m512i lanes = _mm512_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+                                           11, 12, 13, 14, 15);
+  uint32_t visibleCount = 0;
+  for (uint32_t i = begin; i + 16 <= end; i += 16)
+    {
+      __m512 x = _mm512_loadu_ps (s.centerX + i);
+      __m512 y = _mm512_loadu_ps (s.centerY + i);
+      __m512 z = _mm512_loadu_ps (s.centerZ + i);
+      __m512 r = _mm512_loadu_ps (s.radius + i);
+      __m512 ex = _mm512_loadu_ps (s.extentX + i);
+      __m512 ey = _mm512_loadu_ps (s.extentY + i);
+      __m512 ez = _mm512_loadu_ps (s.extentZ + i);
+
+      __mmask16 any = 0;
+      for (uint32_t f = 0; f < frustumCount; f++)
+        {
+          __mmask16 inside = 0xffff;
+          for (uint32_t p = 0; p < 6; p++)
+            {
+              const CullPlane &plane = planes[f * 6 + p];
+              __m512 distance = _mm512_add_ps (
+                  _mm512_add_ps (
+                      _mm512_add_ps (
+                          _mm512_mul_ps (_mm512_set1_ps (plane.a), x),
+                          _mm512_mul_ps (_mm512_set1_ps (plane.b), y)),
+                      _mm512_mul_ps (_mm512_set1_ps (plane.c), z)),
+                  _mm512_set1_ps (plane.w));
+              __m512 reach = _mm512_add_ps (
+                  _mm512_add_ps (
+                      _mm512_mul_ps (_mm512_set1_ps (plane.absA), ex),
+                      _mm512_mul_ps (_mm512_set1_ps (plane.absB), ey)),
+                  _mm512_mul_ps (_mm512_set1_ps (plane.absC), ez));
+              reach = _mm512_min_ps (r, reach);
+              inside = _mm512_mask_cmp_ps_mask (
+                  inside, _mm512_add_ps (distance, reach), zero, _CMP_GE_OQ);
+            }
+          any |= inside;
+        }
+
+      _mm512_mask_compressstoreu_epi32 (
+          visible + visibleCount, any,
+          _mm512_add_epi32 (_mm512_set1_epi32 (i), lanes));
+      visibleCount += __builtin_popcount (any);
+    }
+  return visibleCount;
+}
+#endif
+
+uint32_t
+FrustumCuller::cull (const Frustum *frustums, uint32_t frustumCount,
+                     uint32_t *visible, CullIsa isa) const
+{
+  return cull (frustums, frustumCount, 0, static_cast<uint32_t> (size ()),
+               visible, isa);
+}
+
+uint32_t
+FrustumCuller::cull (const Frustum *frustums, uint32_t frustumCount,
+                     uint32_t begin, uint32_t end, uint32_t *visible,
+                     CullIsa isa) const
+{
+  std::vector<CullPlane> planes (frustumCount * 6);
+  for (uint32_t f = 0; f < frustumCount; f++)
+    {
+      for (uint32_t p = 0; p < 6; p++)
+        {
+          const float *plane = frustums[f].planes[p];
+          planes[f * 6 + p] = { plane[0],
+                                plane[1],
+                                plane[2],
+                                plane[3],
+                                std::fabs (plane[0]),
+                                std::fabs (plane[1]),
+                                std::fabs (plane[2]) };
+        }
+    }
+
+  CullStreams streams{ centerX.data (), centerY.data (), centerZ.data (),
+                       radius.data (), extentX.data (), extentY.data (),
+                       extentZ.data () };
+  end = std::min (end, static_cast<uint32_t> (size ()));
+  if (begin >= end)
+    {
+      return 0;
+    }
+  uint32_t count = end - begin;
+  if (!cullIsaSupported (isa))
+    {
+      isa = CullIsa::Scalar;
+    }
+
+  // Each kernel takes whole registers of objects, the rest go through the
+  // scalar loop
+  uint32_t done = begin;
+  uint32_t visibleCount = 0;
+  switch (isa)
+    {
+#if HAVE_AVX
+    case CullIsa::Avx512:
+      visibleCount = cullAvx512 (streams, planes.data (), frustumCount,
+                                 begin, end, visible);
+      done = begin + (count & ~15u);
+      break;
+    case CullIsa::Avx2:
+      visibleCount = cullAvx2 (streams, planes.data (), frustumCount, begin,
+                               end, visible);
+      done = begin + (count & ~7u);
+      break;
+#endif
+#if HAVE_SSE2
+    case CullIsa::Sse2:
+      visibleCount = cullSse2 (streams, planes.data (), frustumCount, begin,
+                               end, visible);
+      done = begin + (count & ~3u);
+      break;
+#endif
+    default:
+      break;
+    }
+  return cullScalar (streams, planes.data (), frustumCount, done, end,
+                     visible, visibleCount);
+}
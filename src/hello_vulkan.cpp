@@ -6,12 +6,11 @@
 using namespace VulkanApp;
 
 int
-main ()
+main (int argc, char **argv)
 {
-  VulkanTriangleApplication app;
-
   try
     {
+      VulkanTriangleApplication app (parseOptions (argc, argv));
       app.run ();
     }
   catch (const std::exception &e)
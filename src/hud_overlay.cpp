@@ -0,0 +1,473 @@
+#include "../include/hud_overlay.hpp"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+using namespace VulkanApp;
+
+// Ids registered with the HUD's own pipeline manager
+enum : uint16_t
+{
+  SHADER_HUD_VERT,
+  SHADER_HUD_FRAG,
+};
+
+enum : uint16_t
+{
+  VERTEX_INPUT_NONE,
+  VERTEX_INPUT_HUD,
+};
+
+static constexpr PipelineKey HUD_PIPELINE
+    = PipelineKey ()
+          .withShaders (SHADER_HUD_VERT, SHADER_HUD_FRAG)
+          .withVertexInput (VERTEX_INPUT_HUD)
+          .withTopology (VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP)
+          .withRasterizer (VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE,
+                           VK_FRONT_FACE_CLOCKWISE)
+          .withBlend (BlendMode::Alpha);
+
+// The atlas holds ASCII 32 to 127 in rows of ATLAS_COLUMNS cells, a 5x7
+// glyph in the top left of each 6x8 cell leaves the spacing to the next
+static const uint32_t CELL_WIDTH = 6;
+static const uint32_t CELL_HEIGHT = 8;
+static const uint32_t ATLAS_COLUMNS = 16;
+static const uint32_t ATLAS_ROWS = 6;
+static const uint32_t SOLID_GLYPH = 127;
+
+// Layout in canvas pixels, glyphs are drawn at twice the atlas size
+static const int GLYPH_SCALE = 2;
+static const int ADVANCE = CELL_WIDTH * GLYPH_SCALE;
+static const int LINE_HEIGHT = CELL_HEIGHT * GLYPH_SCALE + 2;
+static const int MARGIN = 8;
+static const int PADDING = 8;
+static const int LINE_CHARS = 30;
+static const int TEXT_LINES = 6;
+static const int BAR_WIDTH = 3;
+static const int GRAPH_HEIGHT = 60;
+// frame intervals at the top of the graph, the budget line marks 60 Hz
+static const float GRAPH_MILLISECONDS = 1000.0f / 30.0f;
+static const float BUDGET_MILLISECONDS = 1000.0f / 60.0f;
+static const int PANEL_WIDTH = LINE_CHARS * ADVANCE + 2 * PADDING;
+static const int PANEL_HEIGHT
+    = TEXT_LINES * LINE_HEIGHT + GRAPH_HEIGHT + 3 * PADDING;
+// panel, text, graph bars and the budget line
+static const uint32_t MAX_GLYPHS
+    = 1 + TEXT_LINES * LINE_CHARS + HudOverlay::HISTORY + 1;
+
+static const uint32_t PANEL_COLOR = 0xb0000000u;
+static const uint32_t TEXT_COLOR = 0xffffffffu;
+static const uint32_t FAST_COLOR = 0xff40d040u;
+static const uint32_t SLOW_COLOR = 0xff4040e0u;
+static const uint32_t BUDGET_COLOR = 0x80ffffffu;
+
+// Rows top to bottom, bit 4 is the leftmost column. Lower case is drawn as
+// upper case, anything else missing stays blank.
+struct FontGlyph
+{
+  char character;
+  uint8_t rows[7];
+};
+
+static const FontGlyph FONT[] = {
+  { '0', { 0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e } },
+  { '1', { 0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e } },
+  { '2', { 0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f } },
+  { '3', { 0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e } },
+  { '4', { 0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02 } },
+  { '5', { 0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e } },
+  { '6', { 0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e } },
+  { '7', { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 } },
+  { '8', { 0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e } },
+  { '9', { 0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c } },
+  { 'A', { 0x0e, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 } },
+  { 'B', { 0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e } },
+  { 'C', { 0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e } },
+  { 'D', { 0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c } },
+  { 'E', { 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f } },
+  { 'F', { 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10 } },
+  { 'G', { 0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f } },
+  { 'H', { 0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 } },
+  { 'I', { 0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e } },
+  { 'J', { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c } },
+  { 'K', { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 } },
+  { 'L', { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f } },
+  { 'M', { 0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11 } },
+  { 'N', { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 } },
+  { 'O', { 0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e } },
+  { 'P', { 0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10 } },
+  { 'Q', { 0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d } },
+  { 'R', { 0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11 } },
+  { 'S', { 0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e } },
+  { 'T', { 0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 } },
+  { 'U', { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e } },
+  { 'V', { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04 } },
+  { 'W', { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a } },
+  { 'X', { 0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11 } },
+  { 'Y', { 0x11, 0x11, 0x11, 0x0a, 0x04, 0x04, 0x04 } },
+  { 'Z', { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f } },
+  { '.', { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c } },
+  { ':', { 0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00 } },
+  { '/', { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 } },
+  { '%', { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 } },
+  { '-', { 0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00 } },
+  { '+', { 0x00, 0x04, 0x04, 0x1f, 0x04, 0x04, 0x00 } },
+  { '=', { 0x00, 0x00, 0x1f, 0x00, 0x1f, 0x00, 0x00 } },
+  { '(', { 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02 } },
+  { ')', { 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08 } },
+};
+
+// Matches the push constant block in hud.vert
+struct HudConstants
+{
+  // 2 / canvas size, canvas pixels to clip space
+  float pixelToClip[2];
+};
+
+static double
+millisecondsSince (std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli> (
+             std::chrono::steady_clock::now () - start)
+      .count ();
+}
+
+HudOverlay::~HudOverlay ()
+{
+  if (device != VK_NULL_HANDLE)
+    {
+      cleanup ();
+    }
+}
+
+void
+HudOverlay::init (VkPhysicalDevice physicalDevice, VkDevice device,
+                  VkCommandPool commandPool, VkQueue queue,
+                  VkPipelineCache pipelineCache, VkRenderPass renderPass,
+                  const VkAllocationCallbacks *allocator)
+{
+  this->physicalDevice = physicalDevice;
+  this->device = device;
+  this->allocator = allocator;
+
+  createAtlas (commandPool, queue);
+  createPipeline (pipelineCache, renderPass);
+}
+
+void
+HudOverlay::createAtlas (VkCommandPool commandPool, VkQueue queue)
+{
+  uint32_t width = ATLAS_COLUMNS * CELL_WIDTH;
+  uint32_t height = ATLAS_ROWS * CELL_HEIGHT;
+  std::vector<uint8_t> pixels (width * height, 0);
+
+  auto cellOrigin = [&] (uint32_t character) {
+    uint32_t cell = character - 32;
+    return (cell / ATLAS_COLUMNS) * CELL_HEIGHT * width
+           + (cell % ATLAS_COLUMNS) * CELL_WIDTH;
+  };
+  for (const FontGlyph &glyph : FONT)
+    {
+      uint32_t origin = cellOrigin (static_cast<uint8_t> (glyph.character));
+      for (uint32_t y = 0; y < 7; y++)
+        {
+          for (uint32_t x = 0; x < 5; x++)
+            {
+              if (glyph.rows[y] & (0x10 >> x))
+                {
+                  pixels[origin + y * width + x] = 0xff;
+                }
+            }
+        }
+    }
+  uint32_t solid = cellOrigin (SOLID_GLYPH);
+  for (uint32_t y = 0; y < CELL_HEIGHT; y++)
+    {
+      std::fill_n (pixels.begin () + solid + y * width, CELL_WIDTH, 0xff);
+    }
+
+  atlas = createTexture (physicalDevice, device, commandPool, queue,
+                         VK_FORMAT_R8_UNORM, width, height, pixels.data (),
+                         pixels.size (), allocator);
+
+  // Glyphs are drawn at whole multiples of their size, texels stay sharp
+  VkSamplerCreateInfo samplerInfo{};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_NEAREST;
+  samplerInfo.minFilter = VK_FILTER_NEAREST;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  if (vkCreateSampler (device, &samplerInfo, allocator, &sampler)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to create HUD sampler!");
+    }
+}
+
+void
+HudOverlay::createPipeline (VkPipelineCache pipelineCache,
+                            VkRenderPass renderPass)
+{
+  VkDescriptorSetLayoutBinding binding{};
+  binding.binding = 0;
+  binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  binding.descriptorCount = 1;
+  binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = 1;
+  layoutInfo.pBindings = &binding;
+  if (vkCreateDescriptorSetLayout (device, &layoutInfo, allocator,
+                                   &setLayout)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to create HUD descriptor set layout!");
+    }
+
+  VkDescriptorPoolSize poolSize{};
+  poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSize.descriptorCount = 1;
+
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.maxSets = 1;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+  if (vkCreateDescriptorPool (device, &poolInfo, allocator, &descriptorPool)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to create HUD descriptor pool!");
+    }
+
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &setLayout;
+  if (vkAllocateDescriptorSets (device, &allocInfo, &atlasSet) != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to allocate HUD descriptor set!");
+    }
+
+  VkDescriptorImageInfo imageInfo{};
+  imageInfo.sampler = sampler;
+  imageInfo.imageView = atlas.view;
+  imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+  VkWriteDescriptorSet write{};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstSet = atlasSet;
+  write.dstBinding = 0;
+  write.descriptorCount = 1;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  write.pImageInfo = &imageInfo;
+  vkUpdateDescriptorSets (device, 1, &write, 0, nullptr);
+
+  VkPushConstantRange pushConstantRange{};
+  pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  pushConstantRange.size = sizeof (HudConstants);
+
+  VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutInfo.setLayoutCount = 1;
+  pipelineLayoutInfo.pSetLayouts = &setLayout;
+  pipelineLayoutInfo.pushConstantRangeCount = 1;
+  pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+  if (vkCreatePipelineLayout (device, &pipelineLayoutInfo, allocator,
+                              &layout)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to create HUD pipeline layout!");
+    }
+
+  // One instance per glyph, the four corners of the strip come from the
+  // vertex index
+  VertexInputLayout glyphInput;
+  glyphInput.bindings.resize (1);
+  glyphInput.bindings[0].binding = 0;
+  glyphInput.bindings[0].stride = sizeof (HudGlyph);
+  glyphInput.bindings[0].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+  glyphInput.attributes.resize (4);
+  glyphInput.attributes[0].location = 0;
+  glyphInput.attributes[0].format = VK_FORMAT_R16G16_SINT;
+  glyphInput.attributes[0].offset = offsetof (HudGlyph, position);
+  glyphInput.attributes[1].location = 1;
+  glyphInput.attributes[1].format = VK_FORMAT_R16G16_UINT;
+  glyphInput.attributes[1].offset = offsetof (HudGlyph, size);
+  glyphInput.attributes[2].location = 2;
+  glyphInput.attributes[2].format = VK_FORMAT_R32_UINT;
+  glyphInput.attributes[2].offset = offsetof (HudGlyph, glyph);
+  glyphInput.attributes[3].location = 3;
+  glyphInput.attributes[3].format = VK_FORMAT_R8G8B8A8_UNORM;
+  glyphInput.attributes[3].offset = offsetof (HudGlyph, color);
+
+  pipelines.init (device, pipelineCache, layout, renderPass, false,
+                  allocator);
+  pipelines.setShader (SHADER_HUD_VERT, "shaders/hud_vert.spv");
+  pipelines.setShader (SHADER_HUD_FRAG, "shaders/hud_frag.spv");
+  pipelines.setVertexInput (VERTEX_INPUT_HUD, glyphInput);
+  pipeline = pipelines.get (HUD_PIPELINE);
+}
+
+HudGlyph *
+HudOverlay::text (HudGlyph *out, int x, int y, const char *text,
+                  uint32_t color)
+{
+  for (int i = 0; text[i] != '\0' && i < LINE_CHARS; i++, x += ADVANCE)
+    {
+      uint32_t character = static_cast<uint8_t> (
+          std::toupper (static_cast<unsigned char> (text[i])));
+      if (character <= ' ' || character >= SOLID_GLYPH)
+        {
+          continue;
+        }
+      out->position[0] = static_cast<int16_t> (x);
+      out->position[1] = static_cast<int16_t> (y);
+      out->size[0] = CELL_WIDTH * GLYPH_SCALE;
+      out->size[1] = CELL_HEIGHT * GLYPH_SCALE;
+      out->glyph = character;
+      out->color = color;
+      out++;
+    }
+  return out;
+}
+
+HudGlyph *
+HudOverlay::solid (HudGlyph *out, int x, int y, int width, int height,
+                   uint32_t color)
+{
+  out->position[0] = static_cast<int16_t> (x);
+  out->position[1] = static_cast<int16_t> (y);
+  out->size[0] = static_cast<uint16_t> (width);
+  out->size[1] = static_cast<uint16_t> (height);
+  out->glyph = SOLID_GLYPH;
+  out->color = color;
+  return out + 1;
+}
+
+void
+HudOverlay::build (const HudStats &stats, FrameContext &frame)
+{
+  auto start = std::chrono::steady_clock::now ();
+  history[historyNext] = static_cast<float> (stats.intervalMilliseconds);
+  historyNext = (historyNext + 1) % HISTORY;
+
+  glyphCount = 0;
+  glyphs = frame.allocateUpload (MAX_GLYPHS * sizeof (HudGlyph),
+                                 alignof (HudGlyph));
+  if (glyphs.buffer == VK_NULL_HANDLE)
+    {
+      return;
+    }
+
+  // Written front to back and never read, the ring may be write-combined
+  HudGlyph *out = static_cast<HudGlyph *> (glyphs.data);
+  HudGlyph *first = out;
+  out = solid (out, MARGIN, MARGIN, PANEL_WIDTH, PANEL_HEIGHT, PANEL_COLOR);
+
+  char lines[TEXT_LINES][LINE_CHARS + 1];
+  snprintf (lines[0], sizeof (lines[0]), "FRAME %llu  SLOT %u/%u",
+            static_cast<unsigned long long> (stats.frame), stats.frameSlot,
+            stats.framesInFlight);
+  snprintf (lines[1], sizeof (lines[1]), "INTERVAL %6.2f MS %5.0f FPS",
+            stats.intervalMilliseconds,
+            stats.intervalMilliseconds > 0.0
+                ? 1000.0 / stats.intervalMilliseconds
+                : 0.0);
+  if (stats.gpuMilliseconds < 0.0)
+    {
+      snprintf (lines[2], sizeof (lines[2]), "CPU %6.2f MS  GPU   -- MS",
+                stats.cpuMilliseconds);
+    }
+  else
+    {
+      snprintf (lines[2], sizeof (lines[2]), "CPU %6.2f MS  GPU %6.2f MS",
+                stats.cpuMilliseconds, stats.gpuMilliseconds);
+    }
+  snprintf (lines[3], sizeof (lines[3]), "LATENCY %5.1f MS  SCALE %3.0f%%",
+            stats.latencyMilliseconds, stats.resolutionScale * 100.0f);
+  if (stats.deviceBudget == 0)
+    {
+      snprintf (lines[4], sizeof (lines[4]), "VRAM --");
+    }
+  else
+    {
+      snprintf (lines[4], sizeof (lines[4]), "VRAM %llu/%llu MB",
+                static_cast<unsigned long long> (stats.deviceUsage >> 20),
+                static_cast<unsigned long long> (stats.deviceBudget >> 20));
+    }
+  snprintf (lines[5], sizeof (lines[5]), "HUD %6.3f MS", lastBuild);
+
+  int x = MARGIN + PADDING;
+  int y = MARGIN + PADDING;
+  for (int line = 0; line < TEXT_LINES; line++, y += LINE_HEIGHT)
+    {
+      out = text (out, x, y, lines[line], TEXT_COLOR);
+    }
+
+  // Oldest interval on the left, bars grow up from the graph's bottom
+  int bottom = y + PADDING + GRAPH_HEIGHT;
+  for (uint32_t i = 0; i < HISTORY; i++)
+    {
+      float milliseconds = history[(historyNext + i) % HISTORY];
+      int height = static_cast<int> (
+          std::min (milliseconds / GRAPH_MILLISECONDS, 1.0f) * GRAPH_HEIGHT
+          + 0.5f);
+      if (height > 0)
+        {
+          out = solid (out, x + i * BAR_WIDTH, bottom - height, BAR_WIDTH - 1,
+                       height,
+                       milliseconds > BUDGET_MILLISECONDS ? SLOW_COLOR
+                                                          : FAST_COLOR);
+        }
+    }
+  int budget = static_cast<int> (BUDGET_MILLISECONDS / GRAPH_MILLISECONDS
+                                 * GRAPH_HEIGHT);
+  out = solid (out, x, bottom - budget, HISTORY * BAR_WIDTH, 1, BUDGET_COLOR);
+
+  glyphCount = static_cast<uint32_t> (out - first);
+  lastBuild = millisecondsSince (start);
+}
+
+void
+HudOverlay::record (VkCommandBuffer buffer, VkExtent2D canvas)
+{
+  if (glyphCount == 0)
+    {
+      return;
+    }
+
+  vkCmdBindPipeline (buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+  vkCmdBindDescriptorSets (buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout,
+                           0, 1, &atlasSet, 0, nullptr);
+  vkCmdBindVertexBuffers (buffer, 0, 1, &glyphs.buffer, &glyphs.offset);
+
+  HudConstants constants;
+  constants.pixelToClip[0] = 2.0f / std::max (canvas.width, 1u);
+  constants.pixelToClip[1] = 2.0f / std::max (canvas.height, 1u);
+  vkCmdPushConstants (buffer, layout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                      sizeof (constants), &constants);
+
+  vkCmdDraw (buffer, 4, glyphCount, 0, 0);
+}
+
+void
+HudOverlay::cleanup ()
+{
+  pipelines.cleanup ();
+  pipeline = VK_NULL_HANDLE;
+  // frees the descriptor set with it
+  vkDestroyDescriptorPool (device, descriptorPool, allocator);
+  vkDestroyPipelineLayout (device, layout, allocator);
+  vkDestroyDescriptorSetLayout (device, setLayout, allocator);
+  vkDestroySampler (device, sampler, allocator);
+  destroyTexture (device, atlas, allocator);
+  glyphCount = 0;
+  device = VK_NULL_HANDLE;
+}
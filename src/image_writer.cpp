@@ -0,0 +1,249 @@
+#include "../include/image_writer.hpp"
+#include <array>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+using namespace VulkanApp;
+
+// Big enough that a full HD frame goes out in a handful of write calls
+static const size_t STREAM_BUFFER_SIZE = 1 << 20;
+
+// Largest payload of a single stored deflate block
+static const uint32_t MAX_STORED_BLOCK = 65535;
+
+static void
+convertRow (const ImageData &image, uint32_t y, uint8_t *rgb)
+{
+  const uint8_t *src = image.pixels + static_cast<size_t> (y) * image.rowPitch;
+  const int red = image.layout == PixelLayout::BGRA8 ? 2 : 0;
+  const int blue = 2 - red;
+
+  for (uint32_t x = 0; x < image.width; x++)
+    {
+      rgb[x * 3 + 0] = src[x * 4 + red];
+      rgb[x * 3 + 1] = src[x * 4 + 1];
+      rgb[x * 3 + 2] = src[x * 4 + blue];
+    }
+}
+
+static const std::array<uint32_t, 256> &
+crcTable ()
+{
+  static const std::array<uint32_t, 256> table = [] {
+    std::array<uint32_t, 256> result{};
+    for (uint32_t n = 0; n < 256; n++)
+      {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++)
+          {
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+          }
+        result[n] = c;
+      }
+    return result;
+  }();
+  return table;
+}
+
+static uint32_t
+updateCrc (uint32_t crc, const uint8_t *data, size_t length)
+{
+  const auto &table = crcTable ();
+  for (size_t i = 0; i < length; i++)
+    {
+      crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+  return crc;
+}
+
+static void
+updateAdler (uint32_t &a, uint32_t &b, const uint8_t *data, size_t length)
+{
+  // 5552 is the most bytes that can be summed before b may overflow
+  while (length > 0)
+    {
+      size_t block = length < 5552 ? length : 5552;
+      length -= block;
+      while (block--)
+        {
+          a += *data++;
+          b += a;
+        }
+      a %= 65521;
+      b %= 65521;
+    }
+}
+
+static void
+putBigEndian (uint8_t *out, uint32_t value)
+{
+  out[0] = static_cast<uint8_t> (value >> 24);
+  out[1] = static_cast<uint8_t> (value >> 16);
+  out[2] = static_cast<uint8_t> (value >> 8);
+  out[3] = static_cast<uint8_t> (value);
+}
+
+static void
+writeChunk (std::ofstream &out, const char *type, const uint8_t *data,
+            size_t length)
+{
+  uint8_t header[8];
+  putBigEndian (header, static_cast<uint32_t> (length));
+  header[4] = type[0];
+  header[5] = type[1];
+  header[6] = type[2];
+  header[7] = type[3];
+
+  uint32_t crc = updateCrc (0xffffffffu, header + 4, 4);
+  crc = updateCrc (crc, data, length) ^ 0xffffffffu;
+
+  uint8_t footer[4];
+  putBigEndian (footer, crc);
+
+  out.write (reinterpret_cast<const char *> (header), sizeof (header));
+  out.write (reinterpret_cast<const char *> (data), length);
+  out.write (reinterpret_cast<const char *> (footer), sizeof (footer));
+}
+
+static void
+writePpm (std::ofstream &out, const ImageData &image)
+{
+  out << "P6\n" << image.width << " " << image.height << "\n255\n";
+
+  std::vector<uint8_t> row (image.width * 3);
+  for (uint32_t y = 0; y < image.height; y++)
+    {
+      convertRow (image, y, row.data ());
+      out.write (reinterpret_cast<const char *> (row.data ()), row.size ());
+    }
+}
+
+static void
+writePng (std::ofstream &out, const ImageData &image)
+{
+  static const uint8_t signature[8]
+      = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  out.write (reinterpret_cast<const char *> (signature), sizeof (signature));
+
+  uint8_t ihdr[13];
+  putBigEndian (ihdr, image.width);
+  putBigEndian (ihdr + 4, image.height);
+  ihdr[8] = 8;  // bit depth
+  ihdr[9] = 2;  // color type RGB
+  ihdr[10] = 0; // deflate
+  ihdr[11] = 0; // adaptive filtering
+  ihdr[12] = 0; // no interlace
+  writeChunk (out, "IHDR", ihdr, sizeof (ihdr));
+
+  // Every row becomes its own IDAT chunk holding the row's stored deflate
+  // blocks, the zlib header goes in front of the first one
+  const uint32_t rowBytes = 1 + image.width * 3;
+  const uint32_t blocksPerRow
+      = (rowBytes + MAX_STORED_BLOCK - 1) / MAX_STORED_BLOCK;
+  std::vector<uint8_t> row (rowBytes);
+  std::vector<uint8_t> chunk (2 + rowBytes + blocksPerRow * 5);
+  uint32_t adlerA = 1;
+  uint32_t adlerB = 0;
+
+  for (uint32_t y = 0; y < image.height; y++)
+    {
+      row[0] = 0; // filter type None
+      convertRow (image, y, row.data () + 1);
+      updateAdler (adlerA, adlerB, row.data (), rowBytes);
+
+      size_t length = 0;
+      if (y == 0)
+        {
+          // zlib header: deflate with a 32K window, no preset dictionary
+          chunk[length++] = 0x78;
+          chunk[length++] = 0x01;
+        }
+
+      for (uint32_t offset = 0; offset < rowBytes;)
+        {
+          uint32_t blockSize = rowBytes - offset < MAX_STORED_BLOCK
+                                   ? rowBytes - offset
+                                   : MAX_STORED_BLOCK;
+          bool last = y == image.height - 1 && offset + blockSize == rowBytes;
+
+          chunk[length++] = last ? 1 : 0;
+          chunk[length++] = static_cast<uint8_t> (blockSize);
+          chunk[length++] = static_cast<uint8_t> (blockSize >> 8);
+          chunk[length++] = static_cast<uint8_t> (~blockSize);
+          chunk[length++] = static_cast<uint8_t> (~blockSize >> 8);
+          std::copy (row.begin () + offset,
+                     row.begin () + offset + blockSize,
+                     chunk.begin () + length);
+          length += blockSize;
+          offset += blockSize;
+        }
+
+      writeChunk (out, "IDAT", chunk.data (), length);
+    }
+
+  uint8_t adler[4];
+  putBigEndian (adler, (adlerB << 16) | adlerA);
+  writeChunk (out, "IDAT", adler, sizeof (adler));
+  writeChunk (out, "IEND", nullptr, 0);
+}
+
+const char *
+VulkanApp::fileExtension (ImageFileFormat format)
+{
+  return format == ImageFileFormat::PNG ? "png" : "ppm";
+}
+
+void
+VulkanApp::writeImage (const std::string &path, ImageFileFormat format,
+                       const ImageData &image)
+{
+  std::vector<char> streamBuffer (STREAM_BUFFER_SIZE);
+  std::ofstream out;
+  out.rdbuf ()->pubsetbuf (streamBuffer.data (), streamBuffer.size ());
+  out.open (path, std::ios::binary | std::ios::trunc);
+
+  if (!out.is_open ())
+    {
+      throw std::runtime_error ("Failed to open " + path + " for writing!");
+    }
+
+  if (format == ImageFileFormat::PNG)
+    {
+      writePng (out, image);
+    }
+  else
+    {
+      writePpm (out, image);
+    }
+
+  out.close ();
+  if (out.fail ())
+    {
+      throw std::runtime_error ("Failed to write " + path + "!");
+    }
+}
+
+bool
+VulkanApp::readPpm (const std::string &path, std::vector<uint8_t> &rgb,
+                    uint32_t &width, uint32_t &height)
+{
+  std::ifstream file (path, std::ios::binary);
+  if (!file.is_open ())
+    {
+      return false;
+    }
+
+  std::string magic;
+  uint32_t maxValue = 0;
+  file >> magic >> width >> height >> maxValue;
+  if (!file || magic != "P6" || maxValue != 255)
+    {
+      return false;
+    }
+  // exactly one whitespace byte separates the header from the pixels
+  file.get ();
+
+  rgb.resize (static_cast<size_t> (width) * height * 3);
+  file.read (reinterpret_cast<char *> (rgb.data ()), rgb.size ());
+  return static_cast<size_t> (file.gcount ()) == rgb.size ();
+}
@@ -0,0 +1,441 @@
+#include "../include/job_system.hpp"
+#include <chrono>
+#include <string>
+using namespace VulkanApp;
+
+// The system and deque of the worker running on this thread, if any
+static thread_local JobSystem *currentSystem = nullptr;
+static thread_local size_t currentWorker = 0;
+
+// How long a waiter with nothing to run sleeps before looking for jobs
+// again, it is woken right away when its counter drops to zero
+static const std::chrono::microseconds WAIT_POLL (500);
+
+bool
+WorkDeque::push (Job *job)
+{
+  int64_t b = bottom.load (std::memory_order_relaxed);
+  int64_t t = top.load (std::memory_order_acquire);
+  if (b - t >= CAPACITY)
+    {
+      return false;
+    }
+  jobs[b & (CAPACITY - 1)].store (job, std::memory_order_relaxed);
+  // publishes the job to thieves acquiring bottom
+  bottom.store (b + 1, std::memory_order_release);
+  return true;
+}
+
+Job *
+WorkDeque::pop ()
+{
+  int64_t b = bottom.load (std::memory_order_relaxed) - 1;
+  bottom.store (b, std::memory_order_relaxed);
+  std::atomic_thread_fence (std::memory_order_seq_cst);
+  int64_t t = top.load (std::memory_order_relaxed);
+  if (t > b)
+    {
+      // empty
+      bottom.store (b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+
+  Job *job = jobs[b & (CAPACITY - 1)].load (std::memory_order_relaxed);
+  if (t == b)
+    {
+      // The last job, a thief may be taking it at the same time
+      if (!top.compare_exchange_strong (t, t + 1, std::memory_order_seq_cst,
+                                        std::memory_order_relaxed))
+        {
+          job = nullptr;
+        }
+      bottom.store (b + 1, std::memory_order_relaxed);
+    }
+  return job;
+}
+
+Job *
+WorkDeque::steal ()
+{
+  int64_t t = top.load (std::memory_order_acquire);
+  std::atomic_thread_fence (std::memory_order_seq_cst);
+  int64_t b = bottom.load (std::memory_order_acquire);
+  if (t >= b)
+    {
+      return nullptr;
+    }
+
+  Job *job = jobs[t & (CAPACITY - 1)].load (std::memory_order_relaxed);
+  if (!top.compare_exchange_strong (t, t + 1, std::memory_order_seq_cst,
+                                    std::memory_order_relaxed))
+    {
+      return nullptr;
+    }
+  return job;
+}
+
+JobSystem::JobSystem (size_t workerCount)
+    : mainThread (std::this_thread::get_id ())
+{
+  if (workerCount == 0)
+    {
+      unsigned cores = std::thread::hardware_concurrency ();
+      workerCount = cores > 1 ? cores - 1 : 1;
+    }
+
+  for (size_t i = 0; i < workerCount; i++)
+    {
+      deques.push_back (std::make_unique<WorkDeque> ());
+    }
+  // Every deque exists before any worker steals from them
+  for (size_t i = 0; i < workerCount; i++)
+    {
+      workers.emplace_back (&JobSystem::workerLoop, this, i);
+    }
+}
+
+JobSystem::~JobSystem ()
+{
+  {
+    std::lock_guard<std::mutex> lock (sleepMutex);
+    stopping = true;
+  }
+  jobAvailable.notify_all ();
+
+  // Queued jobs are still drained before the workers exit
+  for (std::thread &worker : workers)
+    {
+      worker.join ();
+    }
+  if (onMainThread ())
+    {
+      runMainThreadJobs ();
+    }
+}
+
+JobSystem &
+JobSystem::shared ()
+{
+  static JobSystem system;
+  return system;
+}
+
+void
+JobSystem::run (std::function<void ()> work, JobCounter *counter,
+                JobPriority priority)
+{
+  if (counter != nullptr)
+    {
+      counter->pending.fetch_add (1, std::memory_order_relaxed);
+    }
+  schedule (new Job{ std::move (work), counter, priority, false });
+}
+
+void
+JobSystem::runAfter (JobCounter &dependency, std::function<void ()> work,
+                     JobCounter *counter)
+{
+  if (counter != nullptr)
+    {
+      counter->pending.fetch_add (1, std::memory_order_relaxed);
+    }
+  Job *job = new Job{ std::move (work), counter, JobPriority::Normal, false };
+
+  {
+    // finish takes the continuations under the same lock, once the count
+    // it drops is zero
+    std::lock_guard<std::mutex> lock (dependency.mutex);
+    if (dependency.pending.load (std::memory_order_acquire) != 0)
+      {
+        dependency.continuations.push_back (job);
+        return;
+      }
+  }
+  schedule (job);
+}
+
+void
+JobSystem::runOnMainThread (std::function<void ()> work, JobCounter *counter)
+{
+  if (counter != nullptr)
+    {
+      counter->pending.fetch_add (1, std::memory_order_relaxed);
+    }
+  schedule (new Job{ std::move (work), counter, JobPriority::Normal, true });
+}
+
+void
+JobSystem::schedule (Job *job)
+{
+  if (job->mainThread)
+    {
+      std::function<void ()> wakeup;
+      {
+        std::lock_guard<std::mutex> lock (mainMutex);
+        mainJobs.push_back (job);
+        wakeup = mainWakeup;
+      }
+      if (wakeup)
+        {
+          wakeup ();
+        }
+      return;
+    }
+
+  // Counted first, a worker finding the job before it is counted would
+  // wrap the count around
+  queued.fetch_add (1, std::memory_order_seq_cst);
+  if (job->priority == JobPriority::Background)
+    {
+      std::lock_guard<std::mutex> lock (queueMutex);
+      background.push_back (job);
+    }
+  else if (currentSystem != this || !deques[currentWorker]->push (job))
+    {
+      std::lock_guard<std::mutex> lock (queueMutex);
+      injected.push_back (job);
+    }
+
+  {
+    std::lock_guard<std::mutex> lock (sleepMutex);
+  }
+  jobAvailable.notify_one ();
+}
+
+void
+JobSystem::execute (Job *job)
+{
+  JobCounter *counter = job->counter;
+  try
+    {
+      job->work ();
+    }
+  catch (...)
+    {
+      if (counter != nullptr)
+        {
+          std::lock_guard<std::mutex> lock (counter->mutex);
+          if (!counter->error)
+            {
+              counter->error = std::current_exception ();
+            }
+        }
+      else
+        {
+          // Nobody waits for it, a failed job must not take the whole
+          // system down with it
+          report (std::current_exception ());
+        }
+    }
+  delete job;
+
+  if (counter != nullptr)
+    {
+      finish (counter);
+    }
+}
+
+void
+JobSystem::report (std::exception_ptr error)
+{
+  Logger *target = logger.load (std::memory_order_acquire);
+  if (target == nullptr)
+    {
+      return;
+    }
+
+  std::string message = "Job failed: ";
+  try
+    {
+      std::rethrow_exception (error);
+    }
+  catch (const std::exception &e)
+    {
+      message += e.what ();
+    }
+  catch (...)
+    {
+      message += "unknown exception";
+    }
+  target->log (LogSeverity::Error, 0, message.c_str ());
+}
+
+void
+JobSystem::finish (JobCounter *counter)
+{
+  std::vector<Job *> ready;
+  {
+    // NOTE: The count drops under the lock. A waiter only returns, and
+    // may destroy the counter, once it got the lock after seeing zero.
+    std::lock_guard<std::mutex> lock (counter->mutex);
+    if (counter->pending.fetch_sub (1, std::memory_order_acq_rel) != 1)
+      {
+        return;
+      }
+    ready.swap (counter->continuations);
+    counter->finished.notify_all ();
+  }
+
+  for (Job *job : ready)
+    {
+      schedule (job);
+    }
+}
+
+Job *
+JobSystem::findJob ()
+{
+  Job *job = nullptr;
+  bool worker = currentSystem == this;
+  if (worker)
+    {
+      job = deques[currentWorker]->pop ();
+    }
+
+  if (job == nullptr)
+    {
+      std::lock_guard<std::mutex> lock (queueMutex);
+      if (!injected.empty ())
+        {
+          job = injected.front ();
+          injected.pop_front ();
+        }
+    }
+
+  // The other workers' oldest jobs, starting from the next one over so
+  // thieves spread out
+  size_t start = worker ? currentWorker + 1 : 0;
+  for (size_t i = 0; job == nullptr && i < deques.size (); i++)
+    {
+      size_t victim = (start + i) % deques.size ();
+      if (!worker || victim != currentWorker)
+        {
+          job = deques[victim]->steal ();
+        }
+    }
+
+  if (job != nullptr)
+    {
+      queued.fetch_sub (1, std::memory_order_relaxed);
+    }
+  return job;
+}
+
+Job *
+JobSystem::findBackgroundJob ()
+{
+  std::lock_guard<std::mutex> lock (queueMutex);
+  if (background.empty ())
+    {
+      return nullptr;
+    }
+  Job *job = background.front ();
+  background.pop_front ();
+  queued.fetch_sub (1, std::memory_order_relaxed);
+  return job;
+}
+
+void
+JobSystem::wait (JobCounter &counter)
+{
+  bool main = onMainThread ();
+  while (counter.pending.load (std::memory_order_acquire) != 0)
+    {
+      Job *job = findJob ();
+      if (job == nullptr && main)
+        {
+          std::lock_guard<std::mutex> lock (mainMutex);
+          if (!mainJobs.empty ())
+            {
+              job = mainJobs.front ();
+              mainJobs.pop_front ();
+            }
+        }
+      if (job != nullptr)
+        {
+          execute (job);
+          continue;
+        }
+
+      std::unique_lock<std::mutex> lock (counter.mutex);
+      counter.finished.wait_for (lock, WAIT_POLL, [&counter] () {
+        return counter.pending.load (std::memory_order_acquire) == 0;
+      });
+    }
+
+  std::exception_ptr error;
+  {
+    std::lock_guard<std::mutex> lock (counter.mutex);
+    error = counter.error;
+    counter.error = nullptr;
+  }
+  if (error)
+    {
+      std::rethrow_exception (error);
+    }
+}
+
+size_t
+JobSystem::runMainThreadJobs ()
+{
+  // Only the ones queued so far, jobs they queue wait for the next call
+  std::deque<Job *> jobs;
+  {
+    std::lock_guard<std::mutex> lock (mainMutex);
+    jobs.swap (mainJobs);
+  }
+  for (Job *job : jobs)
+    {
+      execute (job);
+    }
+  return jobs.size ();
+}
+
+void
+JobSystem::setLogger (Logger *logger)
+{
+  this->logger.store (logger, std::memory_order_release);
+}
+
+void
+JobSystem::setMainThreadWakeup (std::function<void ()> wakeup)
+{
+  std::lock_guard<std::mutex> lock (mainMutex);
+  mainWakeup = std::move (wakeup);
+}
+
+bool
+JobSystem::onMainThread () const
+{
+  return std::this_thread::get_id () == mainThread;
+}
+
+void
+JobSystem::workerLoop (size_t index)
+{
+  currentSystem = this;
+  currentWorker = index;
+
+  while (true)
+    {
+      Job *job = findJob ();
+      if (job == nullptr)
+        {
+          job = findBackgroundJob ();
+        }
+      if (job != nullptr)
+        {
+          execute (job);
+          continue;
+        }
+
+      std::unique_lock<std::mutex> lock (sleepMutex);
+      if (stopping && queued.load (std::memory_order_seq_cst) == 0)
+        {
+          return;
+        }
+      jobAvailable.wait (lock, [this] () {
+        return stopping || queued.load (std::memory_order_seq_cst) != 0;
+      });
+    }
+}
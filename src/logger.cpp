@@ -0,0 +1,393 @@
+#include "../include/logger.hpp"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+using namespace VulkanApp;
+
+// Message ids that haven't come up for this long are forgotten, so text
+// with varying payloads doesn't pile up in the seen map
+static const std::chrono::seconds SEEN_EXPIRY (60);
+// Ids remembered at most, the oldest go first. New ids are rate limited,
+// so the map can't outgrow this by much between two summaries.
+static const size_t MAX_SEEN = 4096;
+
+struct Logger::State
+{
+  struct Repeats
+  {
+    LogSeverity severity;
+    // since the last summary
+    uint64_t count = 0;
+    std::chrono::steady_clock::time_point lastSeen;
+    // start of the message, to tell what the count belongs to
+    std::string preview;
+  };
+
+  // Token bucket per severity, refilled at the severity's rate limit
+  double tokens[LOG_SEVERITY_COUNT] = {};
+  uint64_t rateLimitedSinceSummary[LOG_SEVERITY_COUNT] = {};
+  std::chrono::steady_clock::time_point lastRefill;
+  std::chrono::steady_clock::time_point lastSummary;
+
+  std::unordered_map<uint64_t, Repeats> seen;
+  // scratch for evicting the oldest ids
+  std::vector<std::pair<std::chrono::steady_clock::time_point, uint64_t> >
+      oldest;
+  uint64_t droppedReported = 0;
+  // repeats or skipped messages the next summary reports
+  bool summaryPending = false;
+  std::string output;
+
+  // The logger thread blocks on wakeup while the queue is empty. Producers
+  // only take the lock when sleeping is set, so a busy logger costs them
+  // nothing.
+  std::mutex wakeMutex;
+  std::condition_variable wakeup;
+  std::atomic<bool> sleeping{ false };
+};
+
+const char *
+VulkanApp::severityName (LogSeverity severity)
+{
+  static const char *names[LOG_SEVERITY_COUNT]
+      = { "verbose", "info", "warning", "error" };
+  return names[static_cast<size_t> (severity)];
+}
+
+static uint64_t
+groupKey (int32_t messageId, const char *text, uint32_t length)
+{
+  if (messageId != 0)
+    {
+      return static_cast<uint32_t> (messageId);
+    }
+
+  // Loader and driver messages usually have no id, group them by text and
+  // keep them apart from real ids with the top bit
+  uint64_t hash = 14695981039346656037ull;
+  for (uint32_t i = 0; i < length; i++)
+    {
+      hash = (hash ^ static_cast<uint8_t> (text[i])) * 1099511628211ull;
+    }
+  return hash | (1ull << 63);
+}
+
+Logger::Logger (const LoggerSettings &settings)
+    : settings (settings), state (new State ())
+{
+  size_t capacity = 1;
+  while (capacity < settings.capacity)
+    {
+      capacity *= 2;
+    }
+  mask = capacity - 1;
+  slots.reset (new Slot[capacity]);
+  for (size_t i = 0; i < capacity; i++)
+    {
+      slots[i].sequence.store (i, std::memory_order_relaxed);
+    }
+
+  auto now = std::chrono::steady_clock::now ();
+  state->lastRefill = now;
+  state->lastSummary = now;
+  for (size_t i = 0; i < LOG_SEVERITY_COUNT; i++)
+    {
+      state->tokens[i] = settings.rateLimits[i];
+    }
+
+  thread = std::thread (&Logger::run, this);
+}
+
+Logger::~Logger ()
+{
+  stop ();
+}
+
+bool
+Logger::log (LogSeverity severity, int32_t messageId, const char *text)
+{
+  if (!enabled (severity) || !running.load (std::memory_order_relaxed))
+    {
+      return false;
+    }
+
+  // Bounded MPSC queue after Vyukov: a slot's sequence says whether it is
+  // free for the producer at that position or filled for the consumer
+  uint64_t position = tail.load (std::memory_order_relaxed);
+  Slot *slot;
+  for (;;)
+    {
+      slot = &slots[position & mask];
+      uint64_t sequence = slot->sequence.load (std::memory_order_acquire);
+      int64_t difference = static_cast<int64_t> (sequence - position);
+
+      if (difference == 0)
+        {
+          if (tail.compare_exchange_weak (position, position + 1,
+                                          std::memory_order_relaxed))
+            {
+              break;
+            }
+        }
+      else if (difference < 0)
+        {
+          dropped.fetch_add (1, std::memory_order_relaxed);
+          return false;
+        }
+      else
+        {
+          position = tail.load (std::memory_order_relaxed);
+        }
+    }
+
+  size_t length = strnlen (text, MAX_MESSAGE_LENGTH);
+  std::memcpy (slot->text, text, length);
+  slot->length = static_cast<uint32_t> (length);
+  slot->severity = severity;
+  slot->messageId = messageId;
+  slot->sequence.store (position + 1, std::memory_order_release);
+
+  // Orders the store above before reading sleeping, the logger thread sets
+  // sleeping before it looks at the slot one last time
+  std::atomic_thread_fence (std::memory_order_seq_cst);
+  if (state->sleeping.load (std::memory_order_relaxed))
+    {
+      wake ();
+    }
+  return true;
+}
+
+void
+Logger::stop ()
+{
+  if (running.exchange (false) && thread.joinable ())
+    {
+      wake ();
+      thread.join ();
+    }
+}
+
+void
+Logger::wake ()
+{
+  {
+    std::lock_guard<std::mutex> lock (state->wakeMutex);
+    state->sleeping.store (false, std::memory_order_relaxed);
+  }
+  state->wakeup.notify_one ();
+}
+
+LoggerStats
+Logger::stats () const
+{
+  LoggerStats result;
+  result.written = written.load (std::memory_order_relaxed);
+  result.duplicates = duplicates.load (std::memory_order_relaxed);
+  result.rateLimited = rateLimited.load (std::memory_order_relaxed);
+  result.dropped = dropped.load (std::memory_order_relaxed);
+  return result;
+}
+
+void
+Logger::run ()
+{
+  State &s = *state;
+
+  auto writeSummary = [&] (std::chrono::steady_clock::time_point now) {
+    char line[160];
+    for (auto entry = s.seen.begin (); entry != s.seen.end ();)
+      {
+        State::Repeats &repeats = entry->second;
+        if (repeats.count != 0)
+          {
+            snprintf (line, sizeof (line), "[%s] repeated %llu more times: ",
+                      severityName (repeats.severity),
+                      static_cast<unsigned long long> (repeats.count));
+            s.output += line;
+            s.output += repeats.preview;
+            s.output += '\n';
+            repeats.count = 0;
+          }
+        if (now - repeats.lastSeen >= SEEN_EXPIRY)
+          {
+            entry = s.seen.erase (entry);
+          }
+        else
+          {
+            ++entry;
+          }
+      }
+    s.summaryPending = false;
+
+    if (s.seen.size () > MAX_SEEN)
+      {
+        s.oldest.clear ();
+        for (const auto &entry : s.seen)
+          {
+            s.oldest.emplace_back (entry.second.lastSeen, entry.first);
+          }
+        auto last = s.oldest.begin () + (s.seen.size () - MAX_SEEN);
+        std::nth_element (s.oldest.begin (), last, s.oldest.end ());
+        for (auto evicted = s.oldest.begin (); evicted != last; ++evicted)
+          {
+            s.seen.erase (evicted->second);
+          }
+      }
+
+    for (size_t i = 0; i < LOG_SEVERITY_COUNT; i++)
+      {
+        if (s.rateLimitedSinceSummary[i] != 0)
+          {
+            snprintf (line, sizeof (line),
+                      "[%s] %llu messages over the rate limit skipped\n",
+                      severityName (static_cast<LogSeverity> (i)),
+                      static_cast<unsigned long long> (
+                          s.rateLimitedSinceSummary[i]));
+            s.output += line;
+            s.rateLimitedSinceSummary[i] = 0;
+          }
+      }
+
+    uint64_t totalDropped = dropped.load (std::memory_order_relaxed);
+    if (totalDropped != s.droppedReported)
+      {
+        snprintf (line, sizeof (line),
+                  "[logger] %llu messages dropped, the queue was full\n",
+                  static_cast<unsigned long long> (totalDropped
+                                                   - s.droppedReported));
+        s.output += line;
+        s.droppedReported = totalDropped;
+      }
+  };
+
+  for (;;)
+    {
+      // Read before draining, so nothing queued before stop () is missed
+      bool stopping = !running.load (std::memory_order_acquire);
+      auto now = std::chrono::steady_clock::now ();
+
+      double elapsed
+          = std::chrono::duration<double> (now - s.lastRefill).count ();
+      s.lastRefill = now;
+      for (size_t i = 0; i < LOG_SEVERITY_COUNT; i++)
+        {
+          s.tokens[i] = std::min<double> (
+              s.tokens[i] + elapsed * settings.rateLimits[i],
+              settings.rateLimits[i]);
+        }
+
+      size_t drained = 0;
+      for (;;)
+        {
+          Slot &slot = slots[head & mask];
+          if (slot.sequence.load (std::memory_order_acquire) != head + 1)
+            {
+              break;
+            }
+
+          size_t severity = static_cast<size_t> (slot.severity);
+          uint64_t key = groupKey (slot.messageId, slot.text, slot.length);
+          auto found = s.seen.find (key);
+
+          if (found != s.seen.end ())
+            {
+              found->second.count++;
+              found->second.lastSeen = now;
+              s.summaryPending = true;
+              duplicates.fetch_add (1, std::memory_order_relaxed);
+            }
+          else if (s.tokens[severity] < 1.0)
+            {
+              // Not remembered as seen, so it can still get through once the
+              // bucket refills
+              s.rateLimitedSinceSummary[severity]++;
+              s.summaryPending = true;
+              rateLimited.fetch_add (1, std::memory_order_relaxed);
+            }
+          else
+            {
+              s.tokens[severity] -= 1.0;
+
+              State::Repeats &repeats = s.seen[key];
+              repeats.severity = slot.severity;
+              repeats.lastSeen = now;
+              repeats.preview.assign (slot.text,
+                                      std::min<uint32_t> (slot.length, 80));
+
+              s.output += '[';
+              s.output += severityName (slot.severity);
+              s.output += "] ";
+              s.output.append (slot.text, slot.length);
+              s.output += '\n';
+              written.fetch_add (1, std::memory_order_relaxed);
+            }
+
+          slot.sequence.store (head + mask + 1, std::memory_order_release);
+          head++;
+          drained++;
+        }
+
+      if (stopping
+          || now - s.lastSummary
+                 >= std::chrono::milliseconds (settings.summaryIntervalMs))
+        {
+          writeSummary (now);
+          s.lastSummary = now;
+        }
+
+      // One write and flush per batch instead of one per message
+      if (!s.output.empty ())
+        {
+          fwrite (s.output.data (), 1, s.output.size (), stderr);
+          fflush (stderr);
+          s.output.clear ();
+        }
+
+      if (stopping)
+        {
+          return;
+        }
+      if (drained != 0)
+        {
+          continue;
+        }
+
+      // Nothing queued: sleep until a message comes in, or until the next
+      // summary is due when there is one to write
+      std::unique_lock<std::mutex> lock (s.wakeMutex);
+      s.sleeping.store (true, std::memory_order_relaxed);
+      std::atomic_thread_fence (std::memory_order_seq_cst);
+      bool queued = slots[head & mask].sequence.load (
+                        std::memory_order_acquire)
+                    == head + 1;
+      if (!queued && running.load (std::memory_order_acquire))
+        {
+          auto awake = [&s] () {
+            return !s.sleeping.load (std::memory_order_relaxed);
+          };
+          bool pending = s.summaryPending
+                         || dropped.load (std::memory_order_relaxed)
+                                != s.droppedReported;
+          if (pending)
+            {
+              s.wakeup.wait_until (
+                  lock,
+                  s.lastSummary
+                      + std::chrono::milliseconds (settings.summaryIntervalMs),
+                  awake);
+            }
+          else
+            {
+              s.wakeup.wait (lock, awake);
+            }
+        }
+      s.sleeping.store (false, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,233 @@
+#include "../include/memory_tracker.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+using namespace VulkanApp;
+
+// Stored right in front of every block handed to the driver, realloc and
+// free only get the pointer but need the size and what malloc returned
+struct BlockHeader
+{
+  void *base;
+  size_t size;
+};
+
+static const char *HOST_ALLOCATION_TYPE_NAMES[HOST_ALLOCATION_TYPE_COUNT]
+    = { "instance", "device",      "swapchain", "image",  "buffer",
+        "pipeline", "render_pass", "sync",      "command" };
+
+const char *
+VulkanApp::hostAllocationTypeName (HostAllocationType type)
+{
+  return HOST_ALLOCATION_TYPE_NAMES[static_cast<size_t> (type)];
+}
+
+static BlockHeader *
+headerOf (void *memory)
+{
+  return static_cast<BlockHeader *> (memory) - 1;
+}
+
+MemoryTracker::MemoryTracker ()
+{
+  for (size_t i = 0; i < HOST_ALLOCATION_TYPE_COUNT; i++)
+    {
+      VkAllocationCallbacks &callbacks = allocationCallbacks[i];
+      callbacks.pUserData = &counters[i];
+      callbacks.pfnAllocation = &MemoryTracker::allocate;
+      callbacks.pfnReallocation = &MemoryTracker::reallocate;
+      callbacks.pfnFree = &MemoryTracker::release;
+      callbacks.pfnInternalAllocation = &MemoryTracker::internalAllocation;
+      callbacks.pfnInternalFree = &MemoryTracker::internalFree;
+    }
+}
+
+VKAPI_ATTR void *VKAPI_CALL
+MemoryTracker::allocate (void *userData, size_t size, size_t alignment,
+                         VkSystemAllocationScope)
+{
+  if (size == 0)
+    {
+      return nullptr;
+    }
+
+  // alignment is a power of two, the header sits in the padding in front
+  alignment = std::max (alignment, alignof (std::max_align_t));
+  char *base = static_cast<char *> (
+      std::malloc (size + alignment + sizeof (BlockHeader)));
+  if (base == nullptr)
+    {
+      return nullptr;
+    }
+
+  uintptr_t start = reinterpret_cast<uintptr_t> (base + sizeof (BlockHeader));
+  void *memory = reinterpret_cast<void *> ((start + alignment - 1)
+                                           & ~(uintptr_t (alignment) - 1));
+  BlockHeader *header = headerOf (memory);
+  header->base = base;
+  header->size = size;
+
+  Counters &counters = *static_cast<Counters *> (userData);
+  counters.allocations.fetch_add (1, std::memory_order_relaxed);
+  uint64_t live
+      = counters.liveBytes.fetch_add (size, std::memory_order_relaxed) + size;
+  uint64_t peak = counters.peakBytes.load (std::memory_order_relaxed);
+  while (live > peak
+         && !counters.peakBytes.compare_exchange_weak (
+             peak, live, std::memory_order_relaxed))
+    {
+    }
+  return memory;
+}
+
+VKAPI_ATTR void *VKAPI_CALL
+MemoryTracker::reallocate (void *userData, void *original, size_t size,
+                           size_t alignment, VkSystemAllocationScope scope)
+{
+  if (original == nullptr)
+    {
+      return allocate (userData, size, alignment, scope);
+    }
+  if (size == 0)
+    {
+      release (userData, original);
+      return nullptr;
+    }
+
+  void *memory = allocate (userData, size, alignment, scope);
+  if (memory == nullptr)
+    {
+      // the original stays valid, as with realloc
+      return nullptr;
+    }
+  std::memcpy (memory, original, std::min (size, headerOf (original)->size));
+  release (userData, original);
+  return memory;
+}
+
+VKAPI_ATTR void VKAPI_CALL
+MemoryTracker::release (void *userData, void *memory)
+{
+  if (memory == nullptr)
+    {
+      return;
+    }
+
+  BlockHeader *header = headerOf (memory);
+  Counters &counters = *static_cast<Counters *> (userData);
+  counters.liveBytes.fetch_sub (header->size, std::memory_order_relaxed);
+  std::free (header->base);
+}
+
+VKAPI_ATTR void VKAPI_CALL
+MemoryTracker::internalAllocation (void *userData, size_t size,
+                                   VkInternalAllocationType,
+                                   VkSystemAllocationScope)
+{
+  Counters &counters = *static_cast<Counters *> (userData);
+  counters.internalBytes.fetch_add (size, std::memory_order_relaxed);
+}
+
+VKAPI_ATTR void VKAPI_CALL
+MemoryTracker::internalFree (void *userData, size_t size,
+                             VkInternalAllocationType,
+                             VkSystemAllocationScope)
+{
+  Counters &counters = *static_cast<Counters *> (userData);
+  counters.internalBytes.fetch_sub (size, std::memory_order_relaxed);
+}
+
+HostAllocationStats
+MemoryTracker::hostStats (HostAllocationType type) const
+{
+  const Counters &typeCounters = counters[static_cast<size_t> (type)];
+  HostAllocationStats result;
+  result.allocations
+      = typeCounters.allocations.load (std::memory_order_relaxed);
+  result.liveBytes = typeCounters.liveBytes.load (std::memory_order_relaxed);
+  result.peakBytes = typeCounters.peakBytes.load (std::memory_order_relaxed);
+  result.internalBytes
+      = typeCounters.internalBytes.load (std::memory_order_relaxed);
+  return result;
+}
+
+void
+MemoryTracker::initBudget (VkPhysicalDevice physicalDevice,
+                           bool budgetExtension)
+{
+  this->physicalDevice = physicalDevice;
+  this->budgetExtension = budgetExtension;
+  updateBudget ();
+}
+
+void
+MemoryTracker::updateBudget ()
+{
+  VkPhysicalDeviceMemoryBudgetPropertiesEXT budget{};
+  budget.sType
+      = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+  VkPhysicalDeviceMemoryProperties2 properties{};
+  properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+  if (budgetExtension)
+    {
+      properties.pNext = &budget;
+    }
+  vkGetPhysicalDeviceMemoryProperties2 (physicalDevice, &properties);
+
+  const VkPhysicalDeviceMemoryProperties &memoryProperties
+      = properties.memoryProperties;
+  heapBudgets.resize (memoryProperties.memoryHeapCount);
+  for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+    {
+      HeapBudget &heap = heapBudgets[i];
+      heap.size = memoryProperties.memoryHeaps[i].size;
+      heap.deviceLocal = memoryProperties.memoryHeaps[i].flags
+                         & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+      heap.usage = budget.heapUsage[i];
+      heap.budget = budget.heapBudget[i];
+    }
+}
+
+double
+MemoryTracker::deviceLocalPressure (VkDeviceSize extraBytes) const
+{
+  double pressure = 0.0;
+  for (const HeapBudget &heap : heapBudgets)
+    {
+      if (heap.deviceLocal && heap.budget != 0)
+        {
+          pressure = std::max (pressure,
+                               static_cast<double> (heap.usage + extraBytes)
+                                   / heap.budget);
+        }
+    }
+  return pressure;
+}
+
+void
+MemoryTracker::writeReportHeader (std::ostream &out)
+{
+  // Heap rows leave peak and allocations at 0, host rows the budget
+  out << "frame,kind,name,bytes,budget,peak,allocations,internal\n";
+}
+
+void
+MemoryTracker::writeReport (std::ostream &out, uint64_t frame) const
+{
+  for (size_t i = 0; i < heapBudgets.size (); i++)
+    {
+      const HeapBudget &heap = heapBudgets[i];
+      out << frame << ",heap," << i << (heap.deviceLocal ? "_device" : "_host")
+          << "," << heap.usage << "," << heap.budget << ",0,0,0\n";
+    }
+
+  for (size_t i = 0; i < HOST_ALLOCATION_TYPE_COUNT; i++)
+    {
+      HostAllocationType type = static_cast<HostAllocationType> (i);
+      HostAllocationStats stats = hostStats (type);
+      out << frame << ",host," << hostAllocationTypeName (type) << ","
+          << stats.liveBytes << ",0," << stats.peakBytes << ","
+          << stats.allocations << "," << stats.internalBytes << "\n";
+    }
+  out.flush ();
+}
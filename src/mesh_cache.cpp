@@ -0,0 +1,258 @@
+#include "../include/mesh_cache.hpp"
+#include "../include/mesh_import.hpp"
+#include "../include/mesh_optimizer.hpp"
+#include "../include/mesh_simplify.hpp"
+#include "../include/vertex_quantize.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+using namespace VulkanApp;
+
+static const char MAGIC[4] = { 'V', 'K', 'M', 'C' };
+static const uint64_t SECTION_ALIGNMENT = 64;
+
+static uint64_t
+alignUp (uint64_t value, uint64_t alignment)
+{
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+uint32_t
+VulkanApp::vertexStride (VertexFormat format)
+{
+  return format == VertexFormat::Quantized ? sizeof (PackedVertex)
+                                           : sizeof (Vertex);
+}
+
+void
+VulkanApp::writeMeshCache (const std::string &path, const MeshData &mesh,
+                           VertexFormat format, uint64_t sourceSize,
+                           int64_t sourceModified)
+{
+  MeshCacheHeader header{};
+  std::memcpy (header.magic, MAGIC, sizeof (MAGIC));
+  header.version = MESH_CACHE_VERSION;
+  header.vertexFormat = format;
+  header.vertexStride = vertexStride (format);
+  header.indexSize = sizeof (uint32_t);
+  header.vertexCount = mesh.vertices.size ();
+  header.indexCount = mesh.indices.size ();
+  header.vertexOffset = alignUp (sizeof (header), SECTION_ALIGNMENT);
+  header.sourceSize = sourceSize;
+  header.sourceModified = sourceModified;
+  header.bounds = computeBounds (mesh.vertices);
+  if (mesh.lods.empty ())
+    {
+      header.lodCount = 1;
+      header.lods[0].indexCount
+          = static_cast<uint32_t> (mesh.indices.size ());
+    }
+  else
+    {
+      header.lodCount = static_cast<uint32_t> (
+          std::min<size_t> (mesh.lods.size (), MAX_MESH_LODS));
+      std::copy (mesh.lods.begin (), mesh.lods.begin () + header.lodCount,
+                 header.lods);
+    }
+
+  const void *vertexData = mesh.vertices.data ();
+  size_t vertexBytes = mesh.vertices.size () * sizeof (Vertex);
+  std::vector<PackedVertex> packed;
+  if (format == VertexFormat::Quantized)
+    {
+      packed.resize (mesh.vertices.size ());
+      quantizeVertices (mesh.vertices.data (), mesh.vertices.size (),
+                        header.bounds, packed.data ());
+      vertexData = packed.data ();
+      vertexBytes = packed.size () * sizeof (PackedVertex);
+    }
+  header.indexOffset
+      = alignUp (header.vertexOffset + vertexBytes, SECTION_ALIGNMENT);
+
+  // Written next to the target and renamed over it, so a crash or a second
+  // instance never sees a half written cache
+  std::string temporaryPath = path + ".tmp";
+  {
+    std::ofstream file (temporaryPath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open ())
+      {
+        throw std::runtime_error ("Failed to open " + temporaryPath
+                                  + " for writing!");
+      }
+
+    static const char padding[SECTION_ALIGNMENT] = {};
+    file.write (reinterpret_cast<const char *> (&header), sizeof (header));
+    file.write (padding, header.vertexOffset - sizeof (header));
+    file.write (static_cast<const char *> (vertexData), vertexBytes);
+    file.write (padding,
+                header.indexOffset - header.vertexOffset - vertexBytes);
+    file.write (reinterpret_cast<const char *> (mesh.indices.data ()),
+                mesh.indices.size () * sizeof (uint32_t));
+
+    file.close ();
+    if (file.fail ())
+      {
+        throw std::runtime_error ("Failed to write " + temporaryPath + "!");
+      }
+  }
+  std::filesystem::rename (temporaryPath, path);
+}
+
+MappedMesh::~MappedMesh ()
+{
+  close ();
+}
+
+MappedMesh::MappedMesh (MappedMesh &&other) noexcept
+    : data (other.data), size (other.size)
+{
+  other.data = nullptr;
+  other.size = 0;
+}
+
+MappedMesh &
+MappedMesh::operator= (MappedMesh &&other) noexcept
+{
+  if (this != &other)
+    {
+      close ();
+      data = other.data;
+      size = other.size;
+      other.data = nullptr;
+      other.size = 0;
+    }
+  return *this;
+}
+
+bool
+MappedMesh::open (const std::string &path)
+{
+  close ();
+
+  int fd = ::open (path.c_str (), O_RDONLY);
+  if (fd < 0)
+    {
+      return false;
+    }
+
+  struct stat info;
+  if (fstat (fd, &info) != 0
+      || static_cast<size_t> (info.st_size) < sizeof (MeshCacheHeader))
+    {
+      ::close (fd);
+      return false;
+    }
+
+  size = static_cast<size_t> (info.st_size);
+  void *mapping = mmap (nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping keeps the file alive on its own
+  ::close (fd);
+  if (mapping == MAP_FAILED)
+    {
+      size = 0;
+      return false;
+    }
+  data = mapping;
+
+  // Everything gets copied into a staging buffer front to back right away
+  madvise (data, size, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+  const MeshCacheHeader &cached = header ();
+  bool valid = std::memcmp (cached.magic, MAGIC, sizeof (MAGIC)) == 0
+               && cached.version == MESH_CACHE_VERSION
+               && (cached.vertexFormat == VertexFormat::Full
+                   || cached.vertexFormat == VertexFormat::Quantized)
+               && cached.vertexStride == vertexStride (cached.vertexFormat)
+               && cached.indexSize == sizeof (uint32_t)
+               && cached.vertexOffset + vertexBytes () <= size
+               && cached.indexOffset + indexBytes () <= size
+               && cached.lodCount >= 1 && cached.lodCount <= MAX_MESH_LODS;
+  for (uint32_t i = 0; valid && i < cached.lodCount; i++)
+    {
+      valid = uint64_t (cached.lods[i].firstIndex) + cached.lods[i].indexCount
+              <= cached.indexCount;
+    }
+  if (!valid)
+    {
+      close ();
+    }
+  return valid;
+}
+
+void
+MappedMesh::close ()
+{
+  if (data != nullptr)
+    {
+      munmap (data, size);
+      data = nullptr;
+      size = 0;
+    }
+}
+
+const void *
+MappedMesh::vertexData () const
+{
+  return static_cast<const char *> (data) + header ().vertexOffset;
+}
+
+const uint32_t *
+MappedMesh::indices () const
+{
+  return reinterpret_cast<const uint32_t *> (
+      static_cast<const char *> (data) + header ().indexOffset);
+}
+
+MappedMesh
+VulkanApp::loadMesh (const std::string &sourcePath,
+                     const std::string &cacheDirectory, VertexFormat format)
+{
+  std::filesystem::path source (sourcePath);
+  uint64_t sourceSize = std::filesystem::file_size (source);
+  int64_t sourceModified = static_cast<int64_t> (
+      std::filesystem::last_write_time (source).time_since_epoch ().count ());
+
+  // Same named files from different directories must not share a cache
+  std::string absolute = std::filesystem::absolute (source).string ();
+  uint32_t pathHash = 2166136261u;
+  for (char c : absolute)
+    {
+      pathHash = (pathHash ^ static_cast<uint8_t> (c)) * 16777619u;
+    }
+  char suffix[32];
+  snprintf (suffix, sizeof (suffix), ".%08x.%s.meshcache", pathHash,
+            format == VertexFormat::Quantized ? "quantized" : "full");
+  std::string cachePath
+      = cacheDirectory + "/" + source.filename ().string () + suffix;
+
+  MappedMesh mesh;
+  if (mesh.open (cachePath) && mesh.header ().sourceSize == sourceSize
+      && mesh.header ().sourceModified == sourceModified
+      && mesh.header ().vertexFormat == format)
+    {
+      return mesh;
+    }
+  mesh.close ();
+
+  MeshData imported = importObj (sourcePath);
+  optimizeMesh (imported);
+  buildLods (imported);
+
+  std::filesystem::create_directories (cacheDirectory);
+  writeMeshCache (cachePath, imported, format, sourceSize, sourceModified);
+
+  if (!mesh.open (cachePath))
+    {
+      throw std::runtime_error ("Failed to map mesh cache " + cachePath
+                                + "!");
+    }
+  return mesh;
+}
@@ -0,0 +1,346 @@
+#include "../include/mesh_import.hpp"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+using namespace VulkanApp;
+
+static std::vector<char>
+readText (const std::string &path)
+{
+  std::ifstream file (path, std::ios::ate | std::ios::binary);
+  if (!file.is_open ())
+    {
+      throw std::runtime_error ("Failed to open " + path + "!");
+    }
+
+  size_t size = static_cast<size_t> (file.tellg ());
+  // terminated so strtof/strtol can never run past the end
+  std::vector<char> text (size + 1, '\0');
+  file.seekg (0);
+  file.read (text.data (), size);
+  return text;
+}
+
+static bool
+isBlank (char c)
+{
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+static const char *
+skipBlanks (const char *p)
+{
+  while (isBlank (*p))
+    {
+      p++;
+    }
+  return p;
+}
+
+static const char *
+nextLine (const char *p)
+{
+  while (*p != '\0' && *p != '\n')
+    {
+      p++;
+    }
+  return *p == '\n' ? p + 1 : p;
+}
+
+// Returns how many of the count floats were there
+static int
+parseFloats (const char *&p, float *out, int count)
+{
+  for (int i = 0; i < count; i++)
+    {
+      char *end;
+      out[i] = std::strtof (p, &end);
+      if (end == p)
+        {
+          return i;
+        }
+      p = end;
+    }
+  return count;
+}
+
+// OBJ indices are 1-based and negative ones count back from the end
+static bool
+resolveIndex (long index, size_t count, uint32_t &out)
+{
+  long resolved = index < 0 ? static_cast<long> (count) + index : index - 1;
+  if (resolved < 0 || static_cast<size_t> (resolved) >= count)
+    {
+      return false;
+    }
+  out = static_cast<uint32_t> (resolved);
+  return true;
+}
+
+struct Corner
+{
+  uint32_t position;
+  // UINT32_MAX when the corner has no uv / normal
+  uint32_t uv = UINT32_MAX;
+  uint32_t normal = UINT32_MAX;
+};
+
+static void
+generateNormals (MeshData &mesh)
+{
+  for (Vertex &vertex : mesh.vertices)
+    {
+      std::memset (vertex.normal, 0, sizeof (vertex.normal));
+    }
+
+  // Unnormalized cross products weight each face by its area
+  for (size_t i = 0; i + 2 < mesh.indices.size (); i += 3)
+    {
+      Vertex &a = mesh.vertices[mesh.indices[i]];
+      Vertex &b = mesh.vertices[mesh.indices[i + 1]];
+      Vertex &c = mesh.vertices[mesh.indices[i + 2]];
+
+      float e1[3], e2[3];
+      for (int k = 0; k < 3; k++)
+        {
+          e1[k] = b.position[k] - a.position[k];
+          e2[k] = c.position[k] - a.position[k];
+        }
+      float n[3] = { e1[1] * e2[2] - e1[2] * e2[1],
+                     e1[2] * e2[0] - e1[0] * e2[2],
+                     e1[0] * e2[1] - e1[1] * e2[0] };
+
+      for (int k = 0; k < 3; k++)
+        {
+          a.normal[k] += n[k];
+          b.normal[k] += n[k];
+          c.normal[k] += n[k];
+        }
+    }
+
+  for (Vertex &vertex : mesh.vertices)
+    {
+      float *n = vertex.normal;
+      float length = std::sqrt (n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+      if (length > 0.0f)
+        {
+          n[0] /= length;
+          n[1] /= length;
+          n[2] /= length;
+        }
+      else
+        {
+          n[2] = 1.0f;
+        }
+    }
+}
+
+MeshData
+VulkanApp::importObj (const std::string &path)
+{
+  std::vector<char> text = readText (path);
+
+  std::vector<float> positions;
+  // per position, white unless the file uses the "v x y z r g b" extension
+  std::vector<float> colors;
+  std::vector<float> normals;
+  std::vector<float> uvs;
+  std::vector<Corner> corners;
+  std::vector<Corner> face;
+  size_t lineNumber = 0;
+
+  auto malformed = [&] () {
+    return std::runtime_error ("Malformed OBJ " + path + " at line "
+                               + std::to_string (lineNumber) + "!");
+  };
+
+  for (const char *p = text.data (); *p != '\0'; p = nextLine (p))
+    {
+      lineNumber++;
+      p = skipBlanks (p);
+
+      if (p[0] == 'v' && isBlank (p[1]))
+        {
+          p += 2;
+          float value[3];
+          parseFloats (p, value, 3);
+          positions.insert (positions.end (), value, value + 3);
+
+          float color[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+          if (parseFloats (p, color, 3) != 3)
+            {
+              color[0] = color[1] = color[2] = 1.0f;
+            }
+          colors.insert (colors.end (), color, color + 4);
+        }
+      else if (p[0] == 'v' && p[1] == 'n' && isBlank (p[2]))
+        {
+          p += 3;
+          float value[3];
+          parseFloats (p, value, 3);
+          normals.insert (normals.end (), value, value + 3);
+        }
+      else if (p[0] == 'v' && p[1] == 't' && isBlank (p[2]))
+        {
+          p += 3;
+          float value[2];
+          parseFloats (p, value, 2);
+          uvs.insert (uvs.end (), value, value + 2);
+        }
+      else if (p[0] == 'f' && isBlank (p[1]))
+        {
+          face.clear ();
+          p = skipBlanks (p + 2);
+
+          // v, v/vt, v//vn or v/vt/vn
+          while (*p != '\0' && *p != '\n' && *p != '#')
+            {
+              Corner corner;
+              char *end;
+              long index = std::strtol (p, &end, 10);
+              if (end == p
+                  || !resolveIndex (index, positions.size () / 3,
+                                    corner.position))
+                {
+                  throw malformed ();
+                }
+              p = end;
+
+              if (*p == '/')
+                {
+                  p++;
+                  if (*p != '/')
+                    {
+                      index = std::strtol (p, &end, 10);
+                      if (!resolveIndex (index, uvs.size () / 2, corner.uv))
+                        {
+                          throw malformed ();
+                        }
+                      p = end;
+                    }
+                  if (*p == '/')
+                    {
+                      p++;
+                      index = std::strtol (p, &end, 10);
+                      if (!resolveIndex (index, normals.size () / 3,
+                                         corner.normal))
+                        {
+                          throw malformed ();
+                        }
+                      p = end;
+                    }
+                }
+
+              face.push_back (corner);
+              p = skipBlanks (p);
+            }
+
+          if (face.size () < 3)
+            {
+              throw malformed ();
+            }
+          for (size_t i = 1; i + 1 < face.size (); i++)
+            {
+              corners.push_back (face[0]);
+              corners.push_back (face[i]);
+              corners.push_back (face[i + 1]);
+            }
+        }
+      // Materials, groups, smoothing groups etc. don't affect the geometry
+    }
+
+  MeshData mesh;
+  mesh.vertices.resize (corners.size ());
+  mesh.indices.resize (corners.size ());
+
+  for (size_t i = 0; i < corners.size (); i++)
+    {
+      const Corner &corner = corners[i];
+      Vertex &vertex = mesh.vertices[i];
+
+      std::memcpy (vertex.position, &positions[corner.position * 3],
+                   sizeof (vertex.position));
+      std::memcpy (vertex.color, &colors[corner.position * 4],
+                   sizeof (vertex.color));
+
+      if (corner.normal != UINT32_MAX)
+        {
+          std::memcpy (vertex.normal, &normals[corner.normal * 3],
+                       sizeof (vertex.normal));
+        }
+      else
+        {
+          std::memset (vertex.normal, 0, sizeof (vertex.normal));
+        }
+
+      if (corner.uv != UINT32_MAX)
+        {
+          // OBJ has v pointing up, Vulkan samples with v pointing down
+          vertex.uv[0] = uvs[corner.uv * 2];
+          vertex.uv[1] = 1.0f - uvs[corner.uv * 2 + 1];
+        }
+      else
+        {
+          vertex.uv[0] = 0.0f;
+          vertex.uv[1] = 0.0f;
+        }
+
+      mesh.indices[i] = static_cast<uint32_t> (i);
+    }
+
+  if (normals.empty ())
+    {
+      // Corners sharing a position have to be merged first, otherwise every
+      // vertex would just get its face normal
+      MeshData merged;
+      merged.indices.resize (corners.size ());
+      std::vector<uint32_t> positionVertex (positions.size () / 3,
+                                            UINT32_MAX);
+      for (size_t i = 0; i < corners.size (); i++)
+        {
+          uint32_t &vertex = positionVertex[corners[i].position];
+          if (vertex == UINT32_MAX)
+            {
+              vertex = static_cast<uint32_t> (merged.vertices.size ());
+              merged.vertices.push_back (mesh.vertices[i]);
+            }
+          merged.indices[i] = vertex;
+        }
+      generateNormals (merged);
+
+      for (size_t i = 0; i < corners.size (); i++)
+        {
+          std::memcpy (mesh.vertices[i].normal,
+                       merged.vertices[merged.indices[i]].normal,
+                       sizeof (mesh.vertices[i].normal));
+        }
+    }
+
+  return mesh;
+}
+
+MeshBounds
+VulkanApp::computeBounds (const std::vector<Vertex> &vertices)
+{
+  MeshBounds bounds;
+  if (vertices.empty ())
+    {
+      return bounds;
+    }
+
+  for (int k = 0; k < 3; k++)
+    {
+      bounds.min[k] = bounds.max[k] = vertices[0].position[k];
+    }
+  for (const Vertex &vertex : vertices)
+    {
+      for (int k = 0; k < 3; k++)
+        {
+          bounds.min[k] = std::fmin (bounds.min[k], vertex.position[k]);
+          bounds.max[k] = std::fmax (bounds.max[k], vertex.position[k]);
+        }
+    }
+  return bounds;
+}
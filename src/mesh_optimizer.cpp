@@ -0,0 +1,398 @@
+#include "../include/mesh_optimizer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+using namespace VulkanApp;
+
+static uint32_t
+hashVertex (const Vertex &vertex)
+{
+  // FNV-1a over the raw bytes, identical vertices are identical bytes
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *> (&vertex);
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < sizeof (Vertex); i++)
+    {
+      hash = (hash ^ bytes[i]) * 16777619u;
+    }
+  return hash;
+}
+
+void
+VulkanApp::deduplicateVertices (MeshData &mesh)
+{
+  // Open addressing keeps this a flat array instead of millions of
+  // unordered_map nodes
+  size_t tableSize = 1;
+  while (tableSize < mesh.vertices.size () * 2)
+    {
+      tableSize *= 2;
+    }
+  std::vector<uint32_t> table (tableSize, UINT32_MAX);
+  std::vector<uint32_t> remap (mesh.vertices.size ());
+  std::vector<Vertex> unique;
+  unique.reserve (mesh.vertices.size ());
+
+  for (size_t i = 0; i < mesh.vertices.size (); i++)
+    {
+      const Vertex &vertex = mesh.vertices[i];
+      size_t slot = hashVertex (vertex) & (tableSize - 1);
+
+      while (table[slot] != UINT32_MAX
+             && std::memcmp (&unique[table[slot]], &vertex, sizeof (Vertex))
+                    != 0)
+        {
+          slot = (slot + 1) & (tableSize - 1);
+        }
+
+      if (table[slot] == UINT32_MAX)
+        {
+          table[slot] = static_cast<uint32_t> (unique.size ());
+          unique.push_back (vertex);
+        }
+      remap[i] = table[slot];
+    }
+
+  for (uint32_t &index : mesh.indices)
+    {
+      index = remap[index];
+    }
+  mesh.vertices = std::move (unique);
+}
+
+// Scoring constants from Forsyth's article
+static const float CACHE_DECAY_POWER = 1.5f;
+static const float LAST_TRIANGLE_SCORE = 0.75f;
+static const float VALENCE_BOOST_SCALE = 2.0f;
+static const float VALENCE_BOOST_POWER = 0.5f;
+
+static float
+vertexScore (int cachePosition, uint32_t remainingTriangles)
+{
+  if (remainingTriangles == 0)
+    {
+      return -1.0f;
+    }
+
+  float score = 0.0f;
+  if (cachePosition >= 0)
+    {
+      if (cachePosition < 3)
+        {
+          // The triangle just emitted, using it again right away doesn't
+          // help as much as the position suggests
+          score = LAST_TRIANGLE_SCORE;
+        }
+      else
+        {
+          float scale = 1.0f / (VERTEX_CACHE_SIZE - 3);
+          score = std::pow (1.0f - (cachePosition - 3) * scale,
+                            CACHE_DECAY_POWER);
+        }
+    }
+
+  // Prefer vertices with few triangles left so they don't get stranded
+  score += VALENCE_BOOST_SCALE
+           * std::pow (static_cast<float> (remainingTriangles),
+                       -VALENCE_BOOST_POWER);
+  return score;
+}
+
+void
+VulkanApp::optimizeVertexCache (std::vector<uint32_t> &indices,
+                                size_t vertexCount)
+{
+  const size_t triangleCount = indices.size () / 3;
+  if (triangleCount == 0)
+    {
+      return;
+    }
+
+  // Triangles using each vertex, compressed into one array
+  std::vector<uint32_t> adjacencyOffsets (vertexCount + 1, 0);
+  for (uint32_t index : indices)
+    {
+      adjacencyOffsets[index + 1]++;
+    }
+  std::partial_sum (adjacencyOffsets.begin (), adjacencyOffsets.end (),
+                    adjacencyOffsets.begin ());
+
+  std::vector<uint32_t> adjacency (indices.size ());
+  std::vector<uint32_t> remaining (vertexCount, 0);
+  for (size_t i = 0; i < indices.size (); i++)
+    {
+      uint32_t vertex = indices[i];
+      adjacency[adjacencyOffsets[vertex] + remaining[vertex]++]
+          = static_cast<uint32_t> (i / 3);
+    }
+
+  std::vector<int> cachePosition (vertexCount, -1);
+  std::vector<float> vertexScores (vertexCount);
+  for (size_t v = 0; v < vertexCount; v++)
+    {
+      vertexScores[v] = vertexScore (-1, remaining[v]);
+    }
+
+  std::vector<float> triangleScores (triangleCount);
+  std::vector<bool> emitted (triangleCount, false);
+  for (size_t t = 0; t < triangleCount; t++)
+    {
+      triangleScores[t] = vertexScores[indices[t * 3]]
+                          + vertexScores[indices[t * 3 + 1]]
+                          + vertexScores[indices[t * 3 + 2]];
+    }
+
+  // Three extra entries hold vertices pushed out by the newest triangle
+  // until their scores are updated
+  std::vector<uint32_t> cache;
+  std::vector<uint32_t> newCache;
+  cache.reserve (VERTEX_CACHE_SIZE + 3);
+  newCache.reserve (VERTEX_CACHE_SIZE + 3);
+
+  std::vector<uint32_t> result;
+  result.reserve (indices.size ());
+  size_t cursor = 0;
+  int64_t best = -1;
+
+  while (result.size () < indices.size ())
+    {
+      if (best < 0)
+        {
+          // Nothing in the cache has triangles left, start somewhere new
+          while (emitted[cursor])
+            {
+              cursor++;
+            }
+          best = static_cast<int64_t> (cursor);
+        }
+
+      const uint32_t *triangle = &indices[best * 3];
+      emitted[best] = true;
+      result.insert (result.end (), triangle, triangle + 3);
+
+      newCache.assign (triangle, triangle + 3);
+      for (int k = 0; k < 3; k++)
+        {
+          // Drop the triangle from the vertex's remaining list
+          uint32_t vertex = triangle[k];
+          uint32_t *begin = &adjacency[adjacencyOffsets[vertex]];
+          uint32_t *end = begin + remaining[vertex];
+          std::swap (*std::find (begin, end, static_cast<uint32_t> (best)),
+                     end[-1]);
+          remaining[vertex]--;
+        }
+      for (uint32_t vertex : cache)
+        {
+          if (vertex != triangle[0] && vertex != triangle[1]
+              && vertex != triangle[2])
+            {
+              newCache.push_back (vertex);
+            }
+        }
+      std::swap (cache, newCache);
+
+      best = -1;
+      float bestScore = -1.0f;
+      for (size_t i = 0; i < cache.size (); i++)
+        {
+          uint32_t vertex = cache[i];
+          int position = i < VERTEX_CACHE_SIZE ? static_cast<int> (i) : -1;
+          cachePosition[vertex] = position;
+
+          float score = vertexScore (position, remaining[vertex]);
+          float delta = score - vertexScores[vertex];
+          vertexScores[vertex] = score;
+
+          const uint32_t *adjacent = &adjacency[adjacencyOffsets[vertex]];
+          for (uint32_t j = 0; j < remaining[vertex]; j++)
+            {
+              uint32_t t = adjacent[j];
+              triangleScores[t] += delta;
+              if (triangleScores[t] > bestScore)
+                {
+                  bestScore = triangleScores[t];
+                  best = t;
+                }
+            }
+        }
+
+      if (cache.size () > VERTEX_CACHE_SIZE)
+        {
+          cache.resize (VERTEX_CACHE_SIZE);
+        }
+    }
+
+  indices = std::move (result);
+}
+
+void
+VulkanApp::optimizeOverdraw (std::vector<uint32_t> &indices,
+                             const std::vector<Vertex> &vertices)
+{
+  const size_t triangleCount = indices.size () / 3;
+  if (triangleCount == 0)
+    {
+      return;
+    }
+
+  // A triangle that misses the cache on all three vertices starts a new
+  // cluster, reordering whole clusters keeps the hits within them
+  std::vector<uint32_t> clusterStarts;
+  std::vector<uint32_t> cacheTime (vertices.size (), 0);
+  uint32_t time = VERTEX_CACHE_SIZE + 1;
+
+  for (size_t t = 0; t < triangleCount; t++)
+    {
+      int misses = 0;
+      for (int k = 0; k < 3; k++)
+        {
+          uint32_t vertex = indices[t * 3 + k];
+          if (time - cacheTime[vertex] > VERTEX_CACHE_SIZE)
+            {
+              cacheTime[vertex] = time++;
+              misses++;
+            }
+        }
+      // The first triangle always starts one, even when it is degenerate
+      // and misses fewer than three times
+      if (misses == 3 || t == 0)
+        {
+          clusterStarts.push_back (static_cast<uint32_t> (t));
+        }
+    }
+  clusterStarts.push_back (static_cast<uint32_t> (triangleCount));
+
+  struct Cluster
+  {
+    uint32_t start;
+    uint32_t end;
+    float centroid[3];
+    float normal[3];
+    float sortKey;
+  };
+  std::vector<Cluster> clusters (clusterStarts.size () - 1);
+  float meshCentroid[3] = { 0.0f, 0.0f, 0.0f };
+  float meshArea = 0.0f;
+
+  for (size_t i = 0; i < clusters.size (); i++)
+    {
+      Cluster &cluster = clusters[i];
+      cluster = Cluster{ clusterStarts[i], clusterStarts[i + 1], {}, {}, 0 };
+      float area = 0.0f;
+
+      for (uint32_t t = cluster.start; t < cluster.end; t++)
+        {
+          const float *a = vertices[indices[t * 3]].position;
+          const float *b = vertices[indices[t * 3 + 1]].position;
+          const float *c = vertices[indices[t * 3 + 2]].position;
+
+          float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+          float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+          float n[3] = { e1[1] * e2[2] - e1[2] * e2[1],
+                         e1[2] * e2[0] - e1[0] * e2[2],
+                         e1[0] * e2[1] - e1[1] * e2[0] };
+          float triangleArea
+              = std::sqrt (n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+          for (int k = 0; k < 3; k++)
+            {
+              cluster.centroid[k]
+                  += (a[k] + b[k] + c[k]) / 3.0f * triangleArea;
+              cluster.normal[k] += n[k];
+            }
+          area += triangleArea;
+        }
+
+      for (int k = 0; k < 3; k++)
+        {
+          meshCentroid[k] += cluster.centroid[k];
+          cluster.centroid[k] /= area > 0.0f ? area : 1.0f;
+        }
+      meshArea += area;
+    }
+
+  for (int k = 0; k < 3; k++)
+    {
+      meshCentroid[k] /= meshArea > 0.0f ? meshArea : 1.0f;
+    }
+
+  for (Cluster &cluster : clusters)
+    {
+      float *n = cluster.normal;
+      float length = std::sqrt (n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+      cluster.sortKey = 0.0f;
+      for (int k = 0; k < 3; k++)
+        {
+          cluster.sortKey += (cluster.centroid[k] - meshCentroid[k]) * n[k];
+        }
+      cluster.sortKey /= length > 0.0f ? length : 1.0f;
+    }
+
+  // Clusters far out along their normal are likely to occlude the rest
+  std::stable_sort (clusters.begin (), clusters.end (),
+                    [] (const Cluster &a, const Cluster &b) {
+                      return a.sortKey > b.sortKey;
+                    });
+
+  std::vector<uint32_t> result;
+  result.reserve (indices.size ());
+  for (const Cluster &cluster : clusters)
+    {
+      result.insert (result.end (), indices.begin () + cluster.start * 3,
+                     indices.begin () + cluster.end * 3);
+    }
+  indices = std::move (result);
+}
+
+void
+VulkanApp::optimizeVertexFetch (MeshData &mesh)
+{
+  std::vector<uint32_t> remap (mesh.vertices.size (), UINT32_MAX);
+  std::vector<Vertex> ordered;
+  ordered.reserve (mesh.vertices.size ());
+
+  for (uint32_t &index : mesh.indices)
+    {
+      if (remap[index] == UINT32_MAX)
+        {
+          remap[index] = static_cast<uint32_t> (ordered.size ());
+          ordered.push_back (mesh.vertices[index]);
+        }
+      index = remap[index];
+    }
+  mesh.vertices = std::move (ordered);
+}
+
+void
+VulkanApp::optimizeMesh (MeshData &mesh)
+{
+  deduplicateVertices (mesh);
+  optimizeVertexCache (mesh.indices, mesh.vertices.size ());
+  optimizeOverdraw (mesh.indices, mesh.vertices);
+  optimizeVertexFetch (mesh);
+}
+
+float
+VulkanApp::averageCacheMissRatio (const std::vector<uint32_t> &indices,
+                                  size_t vertexCount, uint32_t cacheSize)
+{
+  if (indices.size () < 3)
+    {
+      return 0.0f;
+    }
+
+  // A vertex is still cached if fewer than cacheSize misses happened since
+  // it was last loaded
+  std::vector<uint32_t> cacheTime (vertexCount, 0);
+  uint32_t time = cacheSize + 1;
+  size_t misses = 0;
+  for (uint32_t index : indices)
+    {
+      if (time - cacheTime[index] > cacheSize)
+        {
+          cacheTime[index] = time++;
+          misses++;
+        }
+    }
+  return static_cast<float> (misses) / (indices.size () / 3);
+}
@@ -0,0 +1,479 @@
+#include "../include/mesh_simplify.hpp"
+#include "../include/mesh_optimizer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+using namespace VulkanApp;
+
+// The chain ends before a level would have fewer triangles than this
+static const size_t MIN_LOD_TRIANGLES = 64;
+// or keep more than this part of the level before it, borders and seams
+// pin the rest down
+static const float MAX_LOD_RATIO = 0.85f;
+// A collapse may turn a triangle's normal by at most ~75 degrees
+static const double MIN_NORMAL_DOT = 0.25;
+// collapses sorted per pass, relative to how many the pass may make
+static const size_t CANDIDATE_RATIO = 4;
+
+// Sum of squared distances to a set of planes, the upper triangle of a
+// symmetric 4x4 matrix
+struct Quadric
+{
+  double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+  double a11 = 0, a12 = 0, a13 = 0;
+  double a22 = 0, a23 = 0;
+  double a33 = 0;
+  double planes = 0;
+};
+
+static void
+addPlane (Quadric &q, const double n[3], double d)
+{
+  q.a00 += n[0] * n[0];
+  q.a01 += n[0] * n[1];
+  q.a02 += n[0] * n[2];
+  q.a03 += n[0] * d;
+  q.a11 += n[1] * n[1];
+  q.a12 += n[1] * n[2];
+  q.a13 += n[1] * d;
+  q.a22 += n[2] * n[2];
+  q.a23 += n[2] * d;
+  q.a33 += d * d;
+  q.planes += 1.0;
+}
+
+static void
+addQuadric (Quadric &q, const Quadric &other)
+{
+  q.a00 += other.a00;
+  q.a01 += other.a01;
+  q.a02 += other.a02;
+  q.a03 += other.a03;
+  q.a11 += other.a11;
+  q.a12 += other.a12;
+  q.a13 += other.a13;
+  q.a22 += other.a22;
+  q.a23 += other.a23;
+  q.a33 += other.a33;
+  q.planes += other.planes;
+}
+
+static double
+evaluate (const Quadric &q, const float p[3])
+{
+  double x = p[0], y = p[1], z = p[2];
+  return q.a00 * x * x + q.a11 * y * y + q.a22 * z * z
+         + 2.0 * (q.a01 * x * y + q.a02 * x * z + q.a12 * y * z)
+         + 2.0 * (q.a03 * x + q.a13 * y + q.a23 * z) + q.a33;
+}
+
+static void
+triangleNormal (const float *p0, const float *p1, const float *p2,
+                double n[3])
+{
+  double e1[3], e2[3];
+  for (int k = 0; k < 3; k++)
+    {
+      e1[k] = double (p1[k]) - p0[k];
+      e2[k] = double (p2[k]) - p0[k];
+    }
+  n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+  n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+  n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+// For every vertex the first vertex at the same position
+static std::vector<uint32_t>
+positionGroups (const std::vector<Vertex> &vertices)
+{
+  size_t tableSize = 1;
+  while (tableSize < vertices.size () * 2)
+    {
+      tableSize *= 2;
+    }
+  std::vector<uint32_t> table (tableSize, UINT32_MAX);
+  std::vector<uint32_t> groups (vertices.size ());
+
+  for (size_t i = 0; i < vertices.size (); i++)
+    {
+      const float *position = vertices[i].position;
+      const uint8_t *bytes = reinterpret_cast<const uint8_t *> (position);
+      uint32_t hash = 2166136261u;
+      for (size_t b = 0; b < sizeof (vertices[i].position); b++)
+        {
+          hash = (hash ^ bytes[b]) * 16777619u;
+        }
+
+      size_t slot = hash & (tableSize - 1);
+      while (table[slot] != UINT32_MAX
+             && std::memcmp (vertices[table[slot]].position, position,
+                             sizeof (vertices[i].position))
+                    != 0)
+        {
+          slot = (slot + 1) & (tableSize - 1);
+        }
+      if (table[slot] == UINT32_MAX)
+        {
+          table[slot] = static_cast<uint32_t> (i);
+        }
+      groups[i] = table[slot];
+    }
+  return groups;
+}
+
+// Vertices that must not move: attribute seams, where one position has
+// several vertices, and open or non-manifold edges
+static std::vector<uint8_t>
+lockedVertices (const std::vector<Vertex> &vertices,
+                const std::vector<uint32_t> &indices)
+{
+  std::vector<uint32_t> groups = positionGroups (vertices);
+  std::vector<uint32_t> groupSizes (vertices.size (), 0);
+  for (uint32_t group : groups)
+    {
+      groupSizes[group]++;
+    }
+
+  // Edges between positions, an edge shared by exactly two triangles is
+  // inside the surface
+  std::vector<uint64_t> edges;
+  edges.reserve (indices.size ());
+  for (size_t i = 0; i < indices.size (); i += 3)
+    {
+      for (int k = 0; k < 3; k++)
+        {
+          uint64_t a = groups[indices[i + k]];
+          uint64_t b = groups[indices[i + (k + 1) % 3]];
+          if (a != b)
+            {
+              edges.push_back (std::min (a, b) << 32 | std::max (a, b));
+            }
+        }
+    }
+  std::sort (edges.begin (), edges.end ());
+
+  std::vector<uint8_t> lockedGroups (vertices.size (), 0);
+  for (size_t i = 0; i < edges.size ();)
+    {
+      size_t end = i;
+      while (end < edges.size () && edges[end] == edges[i])
+        {
+          end++;
+        }
+      if (end - i != 2)
+        {
+          lockedGroups[edges[i] >> 32] = 1;
+          lockedGroups[edges[i] & 0xffffffffu] = 1;
+        }
+      i = end;
+    }
+
+  std::vector<uint8_t> locked (vertices.size ());
+  for (size_t v = 0; v < vertices.size (); v++)
+    {
+      locked[v] = groupSizes[groups[v]] > 1 || lockedGroups[groups[v]];
+    }
+  return locked;
+}
+
+// Whether moving from onto to turns any of from's other triangles over
+static bool
+flips (const std::vector<Vertex> &vertices,
+       const std::vector<uint32_t> &indices,
+       const std::vector<uint32_t> &adjacencyOffsets,
+       const std::vector<uint32_t> &adjacency, uint32_t from, uint32_t to)
+{
+  for (uint32_t a = adjacencyOffsets[from]; a < adjacencyOffsets[from + 1];
+       a++)
+    {
+      const uint32_t *triangle = &indices[adjacency[a] * 3];
+      if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+        {
+          // collapses into a line and is dropped
+          continue;
+        }
+
+      const float *before[3], *after[3];
+      for (int k = 0; k < 3; k++)
+        {
+          before[k] = vertices[triangle[k]].position;
+          after[k] = triangle[k] == from ? vertices[to].position : before[k];
+        }
+      double n0[3], n1[3];
+      triangleNormal (before[0], before[1], before[2], n0);
+      triangleNormal (after[0], after[1], after[2], n1);
+      double dot = n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2];
+      double lengths
+          = std::sqrt ((n0[0] * n0[0] + n0[1] * n0[1] + n0[2] * n0[2])
+                       * (n1[0] * n1[0] + n1[1] * n1[1] + n1[2] * n1[2]));
+      if (dot <= MIN_NORMAL_DOT * lengths)
+        {
+          return true;
+        }
+    }
+  return false;
+}
+
+static std::vector<uint32_t>
+simplify (const std::vector<Vertex> &vertices,
+          const std::vector<uint32_t> &indices,
+          const std::vector<uint8_t> &locked, size_t targetIndexCount,
+          float *error)
+{
+  const size_t vertexCount = vertices.size ();
+  std::vector<uint32_t> result = indices;
+
+  // Every vertex starts out with the planes of its triangles
+  std::vector<Quadric> quadrics (vertexCount);
+  for (size_t i = 0; i < indices.size (); i += 3)
+    {
+      double n[3];
+      triangleNormal (vertices[indices[i]].position,
+                      vertices[indices[i + 1]].position,
+                      vertices[indices[i + 2]].position, n);
+      double length = std::sqrt (n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+      if (length == 0.0)
+        {
+          continue;
+        }
+      for (int k = 0; k < 3; k++)
+        {
+          n[k] /= length;
+        }
+      const float *p = vertices[indices[i]].position;
+      double d = -(n[0] * p[0] + n[1] * p[1] + n[2] * p[2]);
+      for (int k = 0; k < 3; k++)
+        {
+          addPlane (quadrics[indices[i + k]], n, d);
+        }
+    }
+
+  struct Collapse
+  {
+    double cost;
+    // mean squared distance to the planes involved
+    double error;
+    uint32_t from;
+    uint32_t to;
+  };
+  std::vector<Collapse> collapses;
+  // cost as float bits above the index into collapses, non-negative floats
+  // order like their bits so sorting these sorts by cost
+  std::vector<uint64_t> order;
+  std::vector<uint32_t> adjacencyOffsets (vertexCount + 1);
+  std::vector<uint32_t> adjacency;
+  std::vector<uint32_t> filled (vertexCount);
+  std::vector<uint8_t> touched (vertexCount);
+  std::vector<uint32_t> remap (vertexCount);
+  std::iota (remap.begin (), remap.end (), 0u);
+  double maxError = 0.0;
+
+  // Each pass collapses edges whose neighbourhoods don't overlap, cheapest
+  // first, so costs and flip tests stay exact within the pass
+  while (result.size () > targetIndexCount)
+    {
+      // Triangles using each vertex, compressed into one array
+      std::fill (adjacencyOffsets.begin (), adjacencyOffsets.end (), 0u);
+      for (uint32_t index : result)
+        {
+          adjacencyOffsets[index + 1]++;
+        }
+      std::partial_sum (adjacencyOffsets.begin (), adjacencyOffsets.end (),
+                        adjacencyOffsets.begin ());
+      adjacency.resize (result.size ());
+      std::fill (filled.begin (), filled.end (), 0u);
+      for (size_t i = 0; i < result.size (); i++)
+        {
+          uint32_t vertex = result[i];
+          adjacency[adjacencyOffsets[vertex] + filled[vertex]++]
+              = static_cast<uint32_t> (i / 3);
+        }
+
+      // Every edge once, from the triangle that has it in ascending order,
+      // in the cheaper of its two directions. Edges inside the surface
+      // appear in both orders, locked edges can't collapse anyway.
+      collapses.clear ();
+      for (size_t i = 0; i < result.size (); i += 3)
+        {
+          for (int k = 0; k < 3; k++)
+            {
+              uint32_t a = result[i + k];
+              uint32_t b = result[i + (k + 1) % 3];
+              if (a > b || (locked[a] && locked[b]))
+                {
+                  continue;
+                }
+              double sum[2];
+              for (int end = 0; end < 2; end++)
+                {
+                  const float *target = vertices[end ? a : b].position;
+                  sum[end] = std::max (evaluate (quadrics[a], target)
+                                           + evaluate (quadrics[b], target),
+                                       0.0);
+                }
+              // moving b onto a is only possible or cheaper
+              bool reverse = locked[a] || (!locked[b] && sum[1] < sum[0]);
+              Collapse collapse;
+              collapse.cost = sum[reverse ? 1 : 0];
+              collapse.from = reverse ? b : a;
+              collapse.to = reverse ? a : b;
+              double planes = quadrics[a].planes + quadrics[b].planes;
+              collapse.error = planes > 0.0 ? collapse.cost / planes : 0.0;
+              collapses.push_back (collapse);
+            }
+        }
+      order.clear ();
+      for (size_t i = 0; i < collapses.size (); i++)
+        {
+          float cost = static_cast<float> (collapses[i].cost);
+          if (!std::isfinite (cost))
+            {
+              continue;
+            }
+          uint32_t bits;
+          std::memcpy (&bits, &cost, sizeof (bits));
+          order.push_back (uint64_t (bits) << 32 | i);
+        }
+
+      // A collapse removes about two triangles. Most of the cheapest
+      // collapses that get skipped overlap an earlier one, only the
+      // cheapest few times the limit are ever looked at.
+      size_t limit = std::max<size_t> (
+          (result.size () - targetIndexCount) / 6, 1);
+      size_t considered = std::min (order.size (), limit * CANDIDATE_RATIO);
+      std::nth_element (order.begin (), order.begin () + considered,
+                        order.end ());
+      order.resize (considered);
+      std::sort (order.begin (), order.end ());
+      size_t collapsed = 0;
+      std::fill (touched.begin (), touched.end (), 0);
+      for (uint64_t key : order)
+        {
+          if (collapsed >= limit)
+            {
+              break;
+            }
+          const Collapse &collapse = collapses[key & 0xffffffffu];
+          if (touched[collapse.from] || touched[collapse.to]
+              || flips (vertices, result, adjacencyOffsets, adjacency,
+                        collapse.from, collapse.to))
+            {
+              continue;
+            }
+
+          remap[collapse.from] = collapse.to;
+          addQuadric (quadrics[collapse.to], quadrics[collapse.from]);
+          // Every triangle around from changes shape, none of their
+          // vertices may move again this pass
+          for (uint32_t a = adjacencyOffsets[collapse.from];
+               a < adjacencyOffsets[collapse.from + 1]; a++)
+            {
+              const uint32_t *triangle = &result[adjacency[a] * 3];
+              touched[triangle[0]] = touched[triangle[1]]
+                  = touched[triangle[2]] = 1;
+            }
+          maxError = std::max (maxError, collapse.error);
+          collapsed++;
+        }
+      if (collapsed == 0)
+        {
+          break;
+        }
+
+      // Collapsed edges leave their triangles degenerate
+      size_t write = 0;
+      for (size_t i = 0; i < result.size (); i += 3)
+        {
+          uint32_t a = remap[result[i]];
+          uint32_t b = remap[result[i + 1]];
+          uint32_t c = remap[result[i + 2]];
+          if (a != b && b != c && a != c)
+            {
+              result[write++] = a;
+              result[write++] = b;
+              result[write++] = c;
+            }
+        }
+      result.resize (write);
+    }
+
+  if (error != nullptr)
+    {
+      *error = static_cast<float> (std::sqrt (maxError));
+    }
+  return result;
+}
+
+std::vector<uint32_t>
+VulkanApp::simplifyIndices (const std::vector<Vertex> &vertices,
+                            const std::vector<uint32_t> &indices,
+                            size_t targetIndexCount, float *error)
+{
+  return simplify (vertices, indices, lockedVertices (vertices, indices),
+                   targetIndexCount, error);
+}
+
+void
+VulkanApp::buildLods (MeshData &mesh)
+{
+  MeshLod full;
+  full.indexCount = static_cast<uint32_t> (mesh.indices.size ());
+  mesh.lods.assign (1, full);
+
+  // Every level is simplified from the one before, so errors add up.
+  // Collapses keep borders and seams where they are, the full mesh's are
+  // those of every level.
+  std::vector<uint8_t> locked = lockedVertices (mesh.vertices, mesh.indices);
+  std::vector<uint32_t> previous = mesh.indices;
+  float error = 0.0f;
+  while (mesh.lods.size () < MAX_MESH_LODS)
+    {
+      size_t target = previous.size () / 6 * 3;
+      if (target / 3 < MIN_LOD_TRIANGLES)
+        {
+          break;
+        }
+
+      float levelError = 0.0f;
+      std::vector<uint32_t> simplified
+          = simplify (mesh.vertices, previous, locked, target, &levelError);
+      if (simplified.size () > previous.size () * MAX_LOD_RATIO)
+        {
+          break;
+        }
+      optimizeVertexCache (simplified, mesh.vertices.size ());
+
+      error += levelError;
+      MeshLod lod;
+      lod.firstIndex = static_cast<uint32_t> (mesh.indices.size ());
+      lod.indexCount = static_cast<uint32_t> (simplified.size ());
+      lod.error = error;
+      mesh.lods.push_back (lod);
+      mesh.indices.insert (mesh.indices.end (), simplified.begin (),
+                           simplified.end ());
+      previous = std::move (simplified);
+    }
+}
+
+uint32_t
+VulkanApp::selectLod (const MeshLod *lods, uint32_t lodCount, float distance,
+                      float pixelsPerUnit)
+{
+  if (pixelsPerUnit <= 0.0f)
+    {
+      return 0;
+    }
+
+  // Errors only grow along the chain
+  uint32_t selected = 0;
+  for (uint32_t i = 1; i < lodCount; i++)
+    {
+      if (lods[i].error * pixelsPerUnit > distance)
+        {
+          break;
+        }
+      selected = i;
+    }
+  return selected;
+}
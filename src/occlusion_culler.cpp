@@ -0,0 +1,756 @@
+#include "../include/occlusion_culler.hpp"
+#include "../include/pipeline_manager.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+using namespace VulkanApp;
+
+static const uint32_t PYRAMID_GROUP_SIZE = 8;
+static const uint32_t CULL_GROUP_SIZE = 64;
+// early draws, late draws and draws per level of detail
+static const uint32_t COUNTERS_PER_FRAME = 2 + MAX_MESH_LODS;
+
+// Matches the push constant block in depth_pyramid.comp
+struct PyramidConstants
+{
+  // size of the level read from, for level 0 the rendered part of the
+  // depth buffer
+  uint32_t sourceSize[2];
+  uint32_t level;
+  uint32_t padding;
+};
+
+// Matches the push constant block in occlusion_cull.comp
+struct CullConstants
+{
+  Mat4 viewProjection;
+  // w holds the instance spacing along x and z respectively
+  float boundsMin[4];
+  float boundsMax[4];
+  uint32_t instanceCount;
+  uint32_t columns;
+  // CullInput::lodPixelsPerUnit
+  float lodScale;
+  // bit 0 is set for the late phase, the rest is the frame in flight
+  uint32_t flags;
+  float viewport[2];
+  uint32_t levels;
+  uint32_t padding;
+};
+
+static_assert (sizeof (CullConstants) <= 128,
+               "Push constants beyond 128 bytes aren't guaranteed");
+
+// Matches the Lods block in occlusion_cull.comp
+struct LodTable
+{
+  uint32_t lodCount;
+  MeshLod lods[MAX_MESH_LODS];
+};
+
+static uint32_t
+groupCount (uint32_t size, uint32_t groupSize)
+{
+  return (size + groupSize - 1) / groupSize;
+}
+
+static VkExtent2D
+levelExtent (VkExtent2D extent, uint32_t level)
+{
+  return { std::max (extent.width >> level, 1u),
+           std::max (extent.height >> level, 1u) };
+}
+
+OcclusionCuller::~OcclusionCuller ()
+{
+  if (device != VK_NULL_HANDLE)
+    {
+      cleanup ();
+    }
+}
+
+bool
+OcclusionCuller::supported (VkPhysicalDevice physicalDevice,
+                            VkFormat depthFormat)
+{
+  VkPhysicalDeviceFeatures features;
+  vkGetPhysicalDeviceFeatures (physicalDevice, &features);
+  if (!features.multiDrawIndirect || !features.drawIndirectFirstInstance)
+    {
+      return false;
+    }
+
+  VkFormatProperties depthProperties;
+  vkGetPhysicalDeviceFormatProperties (physicalDevice, depthFormat,
+                                       &depthProperties);
+  VkFormatProperties pyramidProperties;
+  vkGetPhysicalDeviceFormatProperties (physicalDevice, VK_FORMAT_R32_SFLOAT,
+                                       &pyramidProperties);
+  VkFormatFeatureFlags pyramidFeatures
+      = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT
+        | VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT;
+  return (depthProperties.optimalTilingFeatures
+          & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)
+         && (pyramidProperties.optimalTilingFeatures & pyramidFeatures)
+                == pyramidFeatures;
+}
+
+void
+OcclusionCuller::init (VkPhysicalDevice physicalDevice, VkDevice device,
+                       uint32_t viewCount, VkPipelineCache pipelineCache,
+                       const VkAllocationCallbacks *allocator)
+{
+  this->physicalDevice = physicalDevice;
+  this->device = device;
+  this->allocator = allocator;
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties (physicalDevice, &properties);
+  maxDraws = properties.limits.maxDrawIndirectCount;
+
+  // Only ever fetched from, texels are never filtered
+  VkSamplerCreateInfo samplerInfo{};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_NEAREST;
+  samplerInfo.minFilter = VK_FILTER_NEAREST;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.maxLod = static_cast<float> (MAX_LEVELS);
+  if (vkCreateSampler (device, &samplerInfo, allocator, &sampler)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to create depth pyramid sampler!");
+    }
+
+  VkDescriptorPoolSize poolSizes[3]{};
+  poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSizes[0].descriptorCount = viewCount * (MAX_LEVELS + 1);
+  poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  poolSizes[1].descriptorCount = viewCount * MAX_LEVELS;
+  poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  poolSizes[2].descriptorCount = viewCount * 4;
+
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.maxSets = viewCount * (MAX_LEVELS + 1);
+  poolInfo.poolSizeCount = 3;
+  poolInfo.pPoolSizes = poolSizes;
+  if (vkCreateDescriptorPool (device, &poolInfo, allocator, &descriptorPool)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to create culling descriptor pool!");
+    }
+
+  createPipelines (pipelineCache);
+
+  lodTable = createBuffer (
+      physicalDevice, device, sizeof (LodTable),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+          | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      0, true, allocator);
+  setLods (nullptr, 0);
+
+  // Sets are allocated once and rewritten while the device is idle
+  views.resize (viewCount);
+  std::vector<VkDescriptorSetLayout> layouts (MAX_LEVELS, pyramidSetLayout);
+  for (ViewResources &resources : views)
+    {
+      VkDescriptorSetAllocateInfo allocInfo{};
+      allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+      allocInfo.descriptorPool = descriptorPool;
+      allocInfo.descriptorSetCount = MAX_LEVELS;
+      allocInfo.pSetLayouts = layouts.data ();
+      if (vkAllocateDescriptorSets (device, &allocInfo, resources.levelSets)
+          != VK_SUCCESS)
+        {
+          throw std::runtime_error (
+              "Failed to allocate depth pyramid descriptor sets!");
+        }
+
+      allocInfo.descriptorSetCount = 1;
+      allocInfo.pSetLayouts = &cullSetLayout;
+      if (vkAllocateDescriptorSets (device, &allocInfo, &resources.cullSet)
+          != VK_SUCCESS)
+        {
+          throw std::runtime_error (
+              "Failed to allocate culling descriptor set!");
+        }
+
+      resources.counters = createBuffer (
+          physicalDevice, device,
+          MAX_FRAMES_IN_FLIGHT * COUNTERS_PER_FRAME * sizeof (uint32_t),
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+              | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+              | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+          0, true, allocator);
+    }
+}
+
+void
+OcclusionCuller::createPipelines (VkPipelineCache pipelineCache)
+{
+  VkDescriptorSetLayoutBinding pyramidBindings[2]{};
+  pyramidBindings[0].binding = 0;
+  pyramidBindings[0].descriptorType
+      = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  pyramidBindings[0].descriptorCount = 1;
+  pyramidBindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  pyramidBindings[1] = pyramidBindings[0];
+  pyramidBindings[1].binding = 1;
+  pyramidBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+
+  // The pyramid, then visibility, draws, counters and levels of detail
+  VkDescriptorSetLayoutBinding cullBindings[5]{};
+  cullBindings[0] = pyramidBindings[0];
+  for (uint32_t i = 1; i < 5; i++)
+    {
+      cullBindings[i] = pyramidBindings[0];
+      cullBindings[i].binding = i;
+      cullBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    }
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = 2;
+  layoutInfo.pBindings = pyramidBindings;
+  if (vkCreateDescriptorSetLayout (device, &layoutInfo, allocator,
+                                   &pyramidSetLayout)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error (
+          "Failed to create depth pyramid descriptor set layout!");
+    }
+  layoutInfo.bindingCount = 5;
+  layoutInfo.pBindings = cullBindings;
+  if (vkCreateDescriptorSetLayout (device, &layoutInfo, allocator,
+                                   &cullSetLayout)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error (
+          "Failed to create culling descriptor set layout!");
+    }
+
+  struct Stage
+  {
+    const char *path;
+    VkDescriptorSetLayout *setLayout;
+    uint32_t pushConstantSize;
+    VkPipelineLayout *layout;
+    VkPipeline *pipeline;
+  };
+  const Stage stages[] = {
+    { "shaders/depth_pyramid.spv", &pyramidSetLayout,
+      sizeof (PyramidConstants), &pyramidLayout, &pyramidPipeline },
+    { "shaders/occlusion_cull.spv", &cullSetLayout, sizeof (CullConstants),
+      &cullLayout, &cullPipeline },
+  };
+
+  for (const Stage &stage : stages)
+    {
+      VkPushConstantRange pushConstantRange{};
+      pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+      pushConstantRange.size = stage.pushConstantSize;
+
+      VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+      pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+      pipelineLayoutInfo.setLayoutCount = 1;
+      pipelineLayoutInfo.pSetLayouts = stage.setLayout;
+      pipelineLayoutInfo.pushConstantRangeCount = 1;
+      pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+      if (vkCreatePipelineLayout (device, &pipelineLayoutInfo, allocator,
+                                  stage.layout)
+          != VK_SUCCESS)
+        {
+          throw std::runtime_error (
+              "Failed to create culling pipeline layout!");
+        }
+
+      std::vector<char> code = readSpirv (stage.path);
+      VkShaderModuleCreateInfo moduleInfo{};
+      moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+      moduleInfo.codeSize = code.size ();
+      moduleInfo.pCode = reinterpret_cast<const uint32_t *> (code.data ());
+      VkShaderModule module;
+      if (vkCreateShaderModule (device, &moduleInfo, allocator, &module)
+          != VK_SUCCESS)
+        {
+          throw std::runtime_error ("Failed to create shader module!");
+        }
+
+      VkComputePipelineCreateInfo pipelineInfo{};
+      pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+      pipelineInfo.stage.sType
+          = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+      pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+      pipelineInfo.stage.module = module;
+      pipelineInfo.stage.pName = "main";
+      pipelineInfo.layout = *stage.layout;
+      VkResult result
+          = vkCreateComputePipelines (device, pipelineCache, 1, &pipelineInfo,
+                                      allocator, stage.pipeline);
+      vkDestroyShaderModule (device, module, allocator);
+      if (result != VK_SUCCESS)
+        {
+          throw std::runtime_error ("Failed to create culling pipeline!");
+        }
+    }
+}
+
+void
+OcclusionCuller::resize (uint32_t view, VkImageView depthView,
+                         VkExtent2D extent)
+{
+  ViewResources &resources = views[view];
+  destroyPyramid (resources);
+
+  // Level 0 has the depth buffer's size, every further one half the size
+  // of the one before down to a single texel
+  uint32_t levels = 1;
+  while (levels < MAX_LEVELS
+         && std::max (extent.width, extent.height) >> levels != 0)
+    {
+      levels++;
+    }
+  resources.levels = levels;
+  resources.extent = extent;
+  resources.depthView = depthView;
+
+  VkImageCreateInfo imageInfo{};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.format = VK_FORMAT_R32_SFLOAT;
+  imageInfo.extent = { extent.width, extent.height, 1 };
+  imageInfo.mipLevels = levels;
+  imageInfo.arrayLayers = 1;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.usage
+      = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  if (vkCreateImage (device, &imageInfo, allocator, &resources.pyramid)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to create depth pyramid!");
+    }
+
+  VkMemoryRequirements memRequirements;
+  vkGetImageMemoryRequirements (device, resources.pyramid, &memRequirements);
+  VkMemoryAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = memRequirements.size;
+  allocInfo.memoryTypeIndex
+      = findMemoryType (physicalDevice, memRequirements.memoryTypeBits,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  if (vkAllocateMemory (device, &allocInfo, allocator,
+                        &resources.pyramidMemory)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to allocate depth pyramid memory!");
+    }
+  vkBindImageMemory (device, resources.pyramid, resources.pyramidMemory, 0);
+
+  VkImageViewCreateInfo viewInfo{};
+  viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.image = resources.pyramid;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format = VK_FORMAT_R32_SFLOAT;
+  viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  viewInfo.subresourceRange.levelCount = levels;
+  viewInfo.subresourceRange.layerCount = 1;
+  if (vkCreateImageView (device, &viewInfo, allocator,
+                         &resources.pyramidView)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to create depth pyramid view!");
+    }
+
+  viewInfo.subresourceRange.levelCount = 1;
+  for (uint32_t level = 0; level < levels; level++)
+    {
+      viewInfo.subresourceRange.baseMipLevel = level;
+      if (vkCreateImageView (device, &viewInfo, allocator,
+                             &resources.levelViews[level])
+          != VK_SUCCESS)
+        {
+          throw std::runtime_error ("Failed to create depth pyramid view!");
+        }
+    }
+
+  // Level 0 reads the depth buffer, every other level the one above it
+  std::vector<VkDescriptorImageInfo> imageInfos (2 * levels);
+  std::vector<VkWriteDescriptorSet> writes (2 * levels);
+  for (uint32_t level = 0; level < levels; level++)
+    {
+      VkDescriptorImageInfo &source = imageInfos[2 * level];
+      source.sampler = sampler;
+      source.imageView
+          = level == 0 ? depthView : resources.levelViews[level - 1];
+      source.imageLayout
+          = level == 0 ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL
+                       : VK_IMAGE_LAYOUT_GENERAL;
+      VkDescriptorImageInfo &destination = imageInfos[2 * level + 1];
+      destination.imageView = resources.levelViews[level];
+      destination.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+      for (uint32_t binding = 0; binding < 2; binding++)
+        {
+          VkWriteDescriptorSet &write = writes[2 * level + binding];
+          write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+          write.dstSet = resources.levelSets[level];
+          write.dstBinding = binding;
+          write.descriptorCount = 1;
+          write.descriptorType
+              = binding == 0 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER
+                             : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+          write.pImageInfo = &imageInfos[2 * level + binding];
+        }
+    }
+  vkUpdateDescriptorSets (device, static_cast<uint32_t> (writes.size ()),
+                          writes.data (), 0, nullptr);
+
+  writeCullSet (resources);
+}
+
+void
+OcclusionCuller::reserve (uint32_t instanceCount)
+{
+  if (instanceCount <= capacity)
+    {
+      return;
+    }
+
+  vkDeviceWaitIdle (device);
+  capacity = 64;
+  while (capacity < instanceCount)
+    {
+      capacity *= 2;
+    }
+
+  for (ViewResources &resources : views)
+    {
+      destroyBuffer (device, resources.visibility, allocator);
+      destroyBuffer (device, resources.drawCommands, allocator);
+
+      resources.visibility = createBuffer (
+          physicalDevice, device, capacity * sizeof (uint32_t),
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+              | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, false, allocator);
+      resources.drawCommands = createBuffer (
+          physicalDevice, device,
+          2 * capacity * sizeof (VkDrawIndexedIndirectCommand),
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+              | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, false, allocator);
+      resources.cleared = false;
+      writeCullSet (resources);
+    }
+}
+
+void
+OcclusionCuller::setLods (const MeshLod *lods, uint32_t lodCount)
+{
+  // Only written while loading a mesh, which waits for the device
+  lodCount = std::min (lodCount, MAX_MESH_LODS);
+  std::copy (lods, lods + lodCount, this->lods);
+  this->lodCount = lodCount;
+
+  LodTable table{};
+  table.lodCount = lodCount;
+  std::copy (lods, lods + lodCount, table.lods);
+  std::memcpy (lodTable.mapped, &table, sizeof (table));
+}
+
+void
+OcclusionCuller::writeCullSet (ViewResources &resources)
+{
+  // Both resize and reserve have to have run before the first cull, each
+  // writes what it can
+  VkDescriptorImageInfo pyramidInfo{};
+  pyramidInfo.sampler = sampler;
+  pyramidInfo.imageView = resources.pyramidView;
+  pyramidInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+  const GpuBuffer *buffers[4] = { &resources.visibility,
+                                  &resources.drawCommands,
+                                  &resources.counters, &lodTable };
+  VkDescriptorBufferInfo bufferInfos[4]{};
+  VkWriteDescriptorSet writes[5]{};
+  uint32_t writeCount = 0;
+
+  if (resources.pyramidView != VK_NULL_HANDLE)
+    {
+      VkWriteDescriptorSet &write = writes[writeCount++];
+      write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      write.dstSet = resources.cullSet;
+      write.dstBinding = 0;
+      write.descriptorCount = 1;
+      write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      write.pImageInfo = &pyramidInfo;
+    }
+  for (uint32_t i = 0; i < 4; i++)
+    {
+      if (buffers[i]->buffer == VK_NULL_HANDLE)
+        {
+          continue;
+        }
+      bufferInfos[i].buffer = buffers[i]->buffer;
+      bufferInfos[i].range = VK_WHOLE_SIZE;
+
+      VkWriteDescriptorSet &write = writes[writeCount++];
+      write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      write.dstSet = resources.cullSet;
+      write.dstBinding = i + 1;
+      write.descriptorCount = 1;
+      write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      write.pBufferInfo = &bufferInfos[i];
+    }
+  vkUpdateDescriptorSets (device, writeCount, writes, 0, nullptr);
+}
+
+void
+OcclusionCuller::recordEarly (VkCommandBuffer buffer, uint32_t view,
+                              uint32_t frame, const CullInput &input)
+{
+  ViewResources &resources = views[view];
+
+  // The previous frame's late test wrote the visible set and the draws,
+  // its draw calls read them
+  VkMemoryBarrier previousFrame{};
+  previousFrame.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  previousFrame.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  previousFrame.dstAccessMask = VK_ACCESS_SHADER_READ_BIT
+                                | VK_ACCESS_SHADER_WRITE_BIT
+                                | VK_ACCESS_TRANSFER_WRITE_BIT;
+  vkCmdPipelineBarrier (buffer,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+                            | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT
+                            | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                        0, 1, &previousFrame, 0, nullptr, 0, nullptr);
+
+  vkCmdFillBuffer (buffer, resources.counters.buffer,
+                   frame * COUNTERS_PER_FRAME * sizeof (uint32_t),
+                   COUNTERS_PER_FRAME * sizeof (uint32_t), 0);
+  if (!resources.cleared)
+    {
+      vkCmdFillBuffer (buffer, resources.visibility.buffer, 0, VK_WHOLE_SIZE,
+                       0);
+      resources.cleared = true;
+    }
+  resources.counted[frame] = true;
+  frameInstances[frame] += input.instanceCount;
+
+  VkMemoryBarrier cleared{};
+  cleared.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  cleared.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  cleared.dstAccessMask
+      = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier (buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &cleared,
+                        0, nullptr, 0, nullptr);
+
+  recordCull (buffer, resources, frame, input, false);
+}
+
+void
+OcclusionCuller::recordLate (VkCommandBuffer buffer, uint32_t view,
+                             uint32_t frame, const CullInput &input)
+{
+  ViewResources &resources = views[view];
+  recordPyramid (buffer, resources, input);
+  recordCull (buffer, resources, frame, input, true);
+}
+
+void
+OcclusionCuller::recordPyramid (VkCommandBuffer buffer,
+                                ViewResources &resources,
+                                const CullInput &input)
+{
+  // Every level is rebuilt, the previous contents can go. The last frame's
+  // late test may still be reading them.
+  VkImageMemoryBarrier toGeneral{};
+  toGeneral.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  toGeneral.srcAccessMask = 0;
+  toGeneral.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  toGeneral.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  toGeneral.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+  toGeneral.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  toGeneral.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  toGeneral.image = resources.pyramid;
+  toGeneral.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  toGeneral.subresourceRange.levelCount = resources.levels;
+  toGeneral.subresourceRange.layerCount = 1;
+  vkCmdPipelineBarrier (buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr,
+                        0, nullptr, 1, &toGeneral);
+
+  vkCmdBindPipeline (buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pyramidPipeline);
+
+  VkImageMemoryBarrier levelWritten = toGeneral;
+  levelWritten.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  levelWritten.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  levelWritten.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+  levelWritten.subresourceRange.levelCount = 1;
+
+  VkExtent2D source = input.viewport;
+  for (uint32_t level = 0; level < resources.levels; level++)
+    {
+      VkExtent2D size = levelExtent (resources.extent, level);
+      PyramidConstants constants{};
+      constants.sourceSize[0] = source.width;
+      constants.sourceSize[1] = source.height;
+      constants.level = level;
+
+      vkCmdBindDescriptorSets (buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                               pyramidLayout, 0, 1,
+                               &resources.levelSets[level], 0, nullptr);
+      vkCmdPushConstants (buffer, pyramidLayout, VK_SHADER_STAGE_COMPUTE_BIT,
+                          0, sizeof (constants), &constants);
+      vkCmdDispatch (buffer, groupCount (size.width, PYRAMID_GROUP_SIZE),
+                     groupCount (size.height, PYRAMID_GROUP_SIZE), 1);
+
+      // The next level and the test read it
+      levelWritten.subresourceRange.baseMipLevel = level;
+      vkCmdPipelineBarrier (buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0,
+                            nullptr, 0, nullptr, 1, &levelWritten);
+      source = size;
+    }
+}
+
+void
+OcclusionCuller::recordCull (VkCommandBuffer buffer,
+                             ViewResources &resources, uint32_t frame,
+                             const CullInput &input, bool late)
+{
+  CullConstants constants{};
+  constants.viewProjection = input.viewProjection;
+  for (int k = 0; k < 3; k++)
+    {
+      constants.boundsMin[k] = input.boundsMin[k];
+      constants.boundsMax[k] = input.boundsMax[k];
+    }
+  constants.boundsMin[3] = input.spacingX;
+  constants.boundsMax[3] = input.spacingZ;
+  constants.instanceCount = input.instanceCount;
+  constants.columns = std::max (input.columns, 1u);
+  constants.lodScale = input.lodPixelsPerUnit;
+  constants.flags = (late ? 1u : 0u) | frame << 1;
+  constants.viewport[0] = static_cast<float> (input.viewport.width);
+  constants.viewport[1] = static_cast<float> (input.viewport.height);
+  constants.levels = resources.levels;
+
+  vkCmdBindPipeline (buffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+  vkCmdBindDescriptorSets (buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                           cullLayout, 0, 1, &resources.cullSet, 0, nullptr);
+  vkCmdPushConstants (buffer, cullLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                      sizeof (constants), &constants);
+  vkCmdDispatch (buffer, groupCount (input.instanceCount, CULL_GROUP_SIZE),
+                 1, 1);
+
+  // Draws are read by the draw calls, counters by collect once the fence
+  // has signalled
+  VkMemoryBarrier written{};
+  written.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  written.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  written.dstAccessMask
+      = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+  vkCmdPipelineBarrier (buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT
+                            | VK_PIPELINE_STAGE_HOST_BIT,
+                        0, 1, &written, 0, nullptr, 0, nullptr);
+}
+
+IndirectBinding
+OcclusionCuller::draws (uint32_t view, bool late,
+                        uint32_t instanceCount) const
+{
+  IndirectBinding binding;
+  binding.buffer = views[view].drawCommands.buffer;
+  binding.offset
+      = late ? instanceCount * sizeof (VkDrawIndexedIndirectCommand) : 0;
+  binding.drawCount = instanceCount;
+  return binding;
+}
+
+void
+OcclusionCuller::collect (uint32_t frame)
+{
+  if (frameInstances[frame] == 0)
+    {
+      return;
+    }
+
+  OcclusionCullStats stats;
+  stats.instances = frameInstances[frame];
+  for (ViewResources &resources : views)
+    {
+      if (!resources.counted[frame])
+        {
+          continue;
+        }
+      resources.counted[frame] = false;
+      const uint32_t *counts
+          = static_cast<const uint32_t *> (resources.counters.mapped)
+            + frame * COUNTERS_PER_FRAME;
+      stats.earlyDraws += counts[0];
+      stats.lateDraws += counts[1];
+      for (uint32_t lod = 0; lod < lodCount; lod++)
+        {
+          stats.triangles
+              += uint64_t (counts[2 + lod]) * (lods[lod].indexCount / 3);
+        }
+    }
+  frameInstances[frame] = 0;
+  lastStats = stats;
+}
+
+void
+OcclusionCuller::destroyPyramid (ViewResources &resources)
+{
+  for (uint32_t level = 0; level < resources.levels; level++)
+    {
+      vkDestroyImageView (device, resources.levelViews[level], allocator);
+      resources.levelViews[level] = VK_NULL_HANDLE;
+    }
+  vkDestroyImageView (device, resources.pyramidView, allocator);
+  vkDestroyImage (device, resources.pyramid, allocator);
+  vkFreeMemory (device, resources.pyramidMemory, allocator);
+  resources.pyramidView = VK_NULL_HANDLE;
+  resources.pyramid = VK_NULL_HANDLE;
+  resources.pyramidMemory = VK_NULL_HANDLE;
+  resources.levels = 0;
+}
+
+void
+OcclusionCuller::cleanup ()
+{
+  for (ViewResources &resources : views)
+    {
+      destroyPyramid (resources);
+      destroyBuffer (device, resources.visibility, allocator);
+      destroyBuffer (device, resources.drawCommands, allocator);
+      destroyBuffer (device, resources.counters, allocator);
+    }
+  views.clear ();
+  destroyBuffer (device, lodTable, allocator);
+  lodCount = 0;
+  capacity = 0;
+
+  // frees the descriptor sets with it
+  vkDestroyDescriptorPool (device, descriptorPool, allocator);
+  vkDestroyPipeline (device, pyramidPipeline, allocator);
+  vkDestroyPipeline (device, cullPipeline, allocator);
+  vkDestroyPipelineLayout (device, pyramidLayout, allocator);
+  vkDestroyPipelineLayout (device, cullLayout, allocator);
+  vkDestroyDescriptorSetLayout (device, pyramidSetLayout, allocator);
+  vkDestroyDescriptorSetLayout (device, cullSetLayout, allocator);
+  vkDestroySampler (device, sampler, allocator);
+  device = VK_NULL_HANDLE;
+}
@@ -0,0 +1,206 @@
+#include "../include/particle_reference.hpp"
+#include <algorithm>
+#include <cmath>
+using namespace VulkanApp;
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#endif
+
+uint32_t
+Particles::emitRate (uint32_t capacity)
+{
+  // Lifetimes are uniform between half and all of MAX_LIFETIME
+  float meanSteps = 0.75f * MAX_LIFETIME / TIME_STEP;
+  return static_cast<uint32_t> (std::ceil (capacity / meanSteps));
+}
+
+// Same integer hash as particles.comp
+static uint32_t
+hash (uint32_t x)
+{
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+static float
+unitFloat (uint32_t x)
+{
+  return static_cast<float> (x >> 8) * (1.0f / 16777216.0f);
+}
+
+ParticleReference::ParticleReference (uint32_t capacity)
+    : capacity (std::min (capacity, Particles::MAX_PARTICLES))
+{
+  for (std::vector<float> &buffer : buffers)
+    {
+      buffer.assign (size_t (this->capacity) * Particles::ATTRIBUTE_COUNT,
+                     0.0f);
+    }
+  current = &buffers[0];
+  other = &buffers[1];
+  offsets.resize (this->capacity);
+  blockOffsets.resize ((this->capacity + Particles::GROUP_SIZE - 1)
+                       / Particles::GROUP_SIZE);
+}
+
+void
+ParticleReference::emit (const ParticleEmitter &emitter, uint32_t count,
+                         uint32_t seed)
+{
+  using namespace Particles;
+  count = std::min (count, capacity - alive);
+  float *data = current->data ();
+  for (uint32_t i = 0; i < count; i++)
+    {
+      uint32_t h = hash (seed ^ hash (i));
+      float direction = unitFloat (h) * 6.2831853f;
+      h = hash (h);
+      float radial = SPREAD * std::sqrt (unitFloat (h)) * emitter.scale;
+      h = hash (h);
+      float launch = LAUNCH_SPEED + LAUNCH_JITTER * unitFloat (h);
+      h = hash (h);
+      float lifetime = MAX_LIFETIME * (0.5f + 0.5f * unitFloat (h));
+
+      uint32_t p = alive + i;
+      data[POSITION_X * capacity + p] = emitter.position[0];
+      data[POSITION_Y * capacity + p] = emitter.position[1];
+      data[POSITION_Z * capacity + p] = emitter.position[2];
+      data[VELOCITY_X * capacity + p] = std::cos (direction) * radial;
+      data[VELOCITY_Y * capacity + p] = launch * emitter.scale;
+      data[VELOCITY_Z * capacity + p] = std::sin (direction) * radial;
+      data[AGE * capacity + p] = 0.0f;
+      data[LIFETIME * capacity + p] = lifetime;
+    }
+  alive += count;
+}
+
+void
+ParticleReference::simulate (const ParticleEmitter &emitter, bool simd)
+{
+  using namespace Particles;
+  float *px = current->data () + POSITION_X * capacity;
+  float *py = current->data () + POSITION_Y * capacity;
+  float *pz = current->data () + POSITION_Z * capacity;
+  float *vx = current->data () + VELOCITY_X * capacity;
+  float *vy = current->data () + VELOCITY_Y * capacity;
+  float *vz = current->data () + VELOCITY_Z * capacity;
+  float *age = current->data () + AGE * capacity;
+
+  const float dt = TIME_STEP;
+  const float fall = GRAVITY * emitter.scale * dt;
+  const float drag = 1.0f - DRAG * dt;
+  const float floor = emitter.position[1];
+
+  uint32_t i = 0;
+#if HAVE_SSE2
+  if (simd)
+    {
+      const __m128 dt4 = _mm_set1_ps (dt);
+      const __m128 fall4 = _mm_set1_ps (fall);
+      const __m128 drag4 = _mm_set1_ps (drag);
+      const __m128 floor4 = _mm_set1_ps (floor);
+      const __m128 bounce4 = _mm_set1_ps (-BOUNCE);
+      for (; i + 4 <= alive; i += 4)
+        {
+          __m128 x = _mm_mul_ps (_mm_loadu_ps (vx + i), drag4);
+          __m128 y = _mm_mul_ps (_mm_sub_ps (_mm_loadu_ps (vy + i), fall4),
+                                 drag4);
+          __m128 z = _mm_mul_ps (_mm_loadu_ps (vz + i), drag4);
+          __m128 height = _mm_add_ps (_mm_loadu_ps (py + i),
+                                      _mm_mul_ps (y, dt4));
+
+          // Below the floor the particle is put back on it and bounces
+          __m128 below = _mm_cmplt_ps (height, floor4);
+          height = _mm_or_ps (_mm_and_ps (below, floor4),
+                              _mm_andnot_ps (below, height));
+          __m128 bounced = _mm_mul_ps (y, bounce4);
+          y = _mm_or_ps (_mm_and_ps (below, bounced),
+                         _mm_andnot_ps (below, y));
+
+          _mm_storeu_ps (px + i, _mm_add_ps (_mm_loadu_ps (px + i),
+                                             _mm_mul_ps (x, dt4)));
+          _mm_storeu_ps (py + i, height);
+          _mm_storeu_ps (pz + i, _mm_add_ps (_mm_loadu_ps (pz + i),
+                                             _mm_mul_ps (z, dt4)));
+          _mm_storeu_ps (vx + i, x);
+          _mm_storeu_ps (vy + i, y);
+          _mm_storeu_ps (vz + i, z);
+          _mm_storeu_ps (age + i, _mm_add_ps (_mm_loadu_ps (age + i), dt4));
+        }
+    }
+#else
+  (void)simd;
+#endif
+
+  for (; i < alive; i++)
+    {
+      float x = vx[i] * drag;
+      float y = (vy[i] - fall) * drag;
+      float z = vz[i] * drag;
+      float height = py[i] + y * dt;
+      if (height < floor)
+        {
+          height = floor;
+          y = y * -BOUNCE;
+        }
+      px[i] += x * dt;
+      py[i] = height;
+      pz[i] += z * dt;
+      vx[i] = x;
+      vy[i] = y;
+      vz[i] = z;
+      age[i] += dt;
+    }
+}
+
+void
+ParticleReference::compact ()
+{
+  using namespace Particles;
+  const float *age = current->data () + AGE * capacity;
+  const float *lifetime = current->data () + LIFETIME * capacity;
+
+  // Offsets within each block, then the blocks' offsets
+  uint32_t blocks = (alive + GROUP_SIZE - 1) / GROUP_SIZE;
+  for (uint32_t block = 0; block < blocks; block++)
+    {
+      uint32_t sum = 0;
+      uint32_t end = std::min ((block + 1) * GROUP_SIZE, alive);
+      for (uint32_t i = block * GROUP_SIZE; i < end; i++)
+        {
+          offsets[i] = sum;
+          sum += age[i] < lifetime[i] ? 1 : 0;
+        }
+      blockOffsets[block] = sum;
+    }
+  uint32_t total = 0;
+  for (uint32_t block = 0; block < blocks; block++)
+    {
+      uint32_t sum = blockOffsets[block];
+      blockOffsets[block] = total;
+      total += sum;
+    }
+
+  const float *source = current->data ();
+  float *target = other->data ();
+  for (uint32_t i = 0; i < alive; i++)
+    {
+      if (age[i] < lifetime[i])
+        {
+          uint32_t to = blockOffsets[i / GROUP_SIZE] + offsets[i];
+          for (uint32_t a = 0; a < ATTRIBUTE_COUNT; a++)
+            {
+              target[a * capacity + to] = source[a * capacity + i];
+            }
+        }
+    }
+
+  alive = total;
+  std::swap (current, other);
+}
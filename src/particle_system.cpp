@@ -0,0 +1,450 @@
+#include "../include/particle_system.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+using namespace VulkanApp;
+
+// Sprites are this many pixels across whatever their distance
+static const float PARTICLE_SIZE = 4.0f;
+
+// Shader ids registered with the system's own pipeline manager
+enum : uint16_t
+{
+  SHADER_PARTICLE_VERT,
+  SHADER_PARTICLE_FRAG,
+};
+
+static constexpr PipelineKey PARTICLE_PIPELINE
+    = PipelineKey ()
+          .withShaders (SHADER_PARTICLE_VERT, SHADER_PARTICLE_FRAG)
+          .withTopology (VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP)
+          .withRasterizer (VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE,
+                           VK_FRONT_FACE_CLOCKWISE)
+          .withBlend (BlendMode::Additive)
+          .withDepth (true, false);
+
+// Matches the State block in particles.comp
+struct ParticleState
+{
+  uint32_t alive;
+  uint32_t count;
+  uint32_t groups[3];
+  uint32_t padding;
+  VkDrawIndirectCommand draw;
+};
+
+// Matches the push constant block in particles.comp
+struct ParticleConstants
+{
+  // w is the emitter's scale
+  float emitter[4];
+  uint32_t capacity;
+  uint32_t emitCount;
+  uint32_t seed;
+  uint32_t padding;
+};
+
+// Matches the push constant block in particle.vert
+struct ParticleDrawConstants
+{
+  Mat4 viewProjection;
+  float halfSize[2];
+  uint32_t capacity;
+  uint32_t padding;
+};
+
+static uint32_t
+groupCount (uint32_t size, uint32_t groupSize)
+{
+  return (size + groupSize - 1) / groupSize;
+}
+
+static void
+computeBarrier (VkCommandBuffer buffer, VkPipelineStageFlags dstStages,
+                VkAccessFlags dstAccess)
+{
+  VkMemoryBarrier written{};
+  written.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  written.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  written.dstAccessMask = dstAccess;
+  vkCmdPipelineBarrier (buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                        dstStages, 0, 1, &written, 0, nullptr, 0, nullptr);
+}
+
+ParticleSystem::~ParticleSystem ()
+{
+  if (device != VK_NULL_HANDLE)
+    {
+      cleanup ();
+    }
+}
+
+void
+ParticleSystem::init (VkPhysicalDevice physicalDevice, VkDevice device,
+                      VkPipelineCache pipelineCache, VkRenderPass renderPass,
+                      const VkAllocationCallbacks *allocator)
+{
+  this->physicalDevice = physicalDevice;
+  this->device = device;
+  this->allocator = allocator;
+
+  VkDescriptorPoolSize poolSize{};
+  poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  poolSize.descriptorCount = 2 * 5;
+
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.maxSets = 2;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+  if (vkCreateDescriptorPool (device, &poolInfo, allocator, &descriptorPool)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to create particle descriptor pool!");
+    }
+
+  createPipelines (pipelineCache, renderPass);
+
+  // Written whenever the buffers are created
+  VkDescriptorSetLayout layouts[2] = { setLayout, setLayout };
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = 2;
+  allocInfo.pSetLayouts = layouts;
+  if (vkAllocateDescriptorSets (device, &allocInfo, sets) != VK_SUCCESS)
+    {
+      throw std::runtime_error (
+          "Failed to allocate particle descriptor sets!");
+    }
+}
+
+void
+ParticleSystem::createPipelines (VkPipelineCache pipelineCache,
+                                 VkRenderPass renderPass)
+{
+  // Source and target particles, state, offsets and block offsets. The
+  // vertex shader only reads the source.
+  VkDescriptorSetLayoutBinding bindings[5]{};
+  for (uint32_t i = 0; i < 5; i++)
+    {
+      bindings[i].binding = i;
+      bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      bindings[i].descriptorCount = 1;
+      bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+  bindings[0].stageFlags |= VK_SHADER_STAGE_VERTEX_BIT;
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = 5;
+  layoutInfo.pBindings = bindings;
+  if (vkCreateDescriptorSetLayout (device, &layoutInfo, allocator,
+                                   &setLayout)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error (
+          "Failed to create particle descriptor set layout!");
+    }
+
+  VkPushConstantRange pushConstantRange{};
+  pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  pushConstantRange.size = sizeof (ParticleConstants);
+
+  VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutInfo.setLayoutCount = 1;
+  pipelineLayoutInfo.pSetLayouts = &setLayout;
+  pipelineLayoutInfo.pushConstantRangeCount = 1;
+  pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+  if (vkCreatePipelineLayout (device, &pipelineLayoutInfo, allocator,
+                              &computeLayout)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to create particle pipeline layout!");
+    }
+
+  pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  pushConstantRange.size = sizeof (ParticleDrawConstants);
+  if (vkCreatePipelineLayout (device, &pipelineLayoutInfo, allocator,
+                              &drawLayout)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to create particle pipeline layout!");
+    }
+
+  // One shader compiled once per step, see compile_shader.sh
+  struct Stage
+  {
+    const char *path;
+    VkPipeline *pipeline;
+  };
+  const Stage stages[] = {
+    { "shaders/particle_emit.spv", &emitPipeline },
+    { "shaders/particle_simulate.spv", &simulatePipeline },
+    { "shaders/particle_scan.spv", &scanPipeline },
+    { "shaders/particle_compact.spv", &compactPipeline },
+  };
+
+  for (const Stage &stage : stages)
+    {
+      std::vector<char> code = readSpirv (stage.path);
+      VkShaderModuleCreateInfo moduleInfo{};
+      moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+      moduleInfo.codeSize = code.size ();
+      moduleInfo.pCode = reinterpret_cast<const uint32_t *> (code.data ());
+      VkShaderModule module;
+      if (vkCreateShaderModule (device, &moduleInfo, allocator, &module)
+          != VK_SUCCESS)
+        {
+          throw std::runtime_error ("Failed to create shader module!");
+        }
+
+      VkComputePipelineCreateInfo pipelineInfo{};
+      pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+      pipelineInfo.stage.sType
+          = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+      pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+      pipelineInfo.stage.module = module;
+      pipelineInfo.stage.pName = "main";
+      pipelineInfo.layout = computeLayout;
+      VkResult result
+          = vkCreateComputePipelines (device, pipelineCache, 1, &pipelineInfo,
+                                      allocator, stage.pipeline);
+      vkDestroyShaderModule (device, module, allocator);
+      if (result != VK_SUCCESS)
+        {
+          throw std::runtime_error ("Failed to create particle pipeline!");
+        }
+    }
+
+  pipelines.init (device, pipelineCache, drawLayout, renderPass, false,
+                  allocator);
+  pipelines.setShader (SHADER_PARTICLE_VERT, "shaders/particle_vert.spv");
+  pipelines.setShader (SHADER_PARTICLE_FRAG, "shaders/particle_frag.spv");
+  drawPipeline = pipelines.get (PARTICLE_PIPELINE);
+}
+
+void
+ParticleSystem::reserve (uint32_t capacity)
+{
+  capacity = std::min (capacity, Particles::MAX_PARTICLES);
+  if (capacity == particleCapacity)
+    {
+      return;
+    }
+
+  // Every frame in flight reads the buffers, the particles alive so far
+  // are dropped rather than copied over
+  vkDeviceWaitIdle (device);
+  destroyBuffers ();
+  particleCapacity = capacity;
+
+  VkDeviceSize particleSize = VkDeviceSize (capacity)
+                              * Particles::ATTRIBUTE_COUNT * sizeof (float);
+  for (GpuBuffer &buffer : particles)
+    {
+      buffer = createBuffer (physicalDevice, device, particleSize,
+                             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, false,
+                             allocator);
+    }
+  offsets = createBuffer (physicalDevice, device,
+                          VkDeviceSize (capacity) * sizeof (uint32_t),
+                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, false,
+                          allocator);
+  blockOffsets = createBuffer (
+      physicalDevice, device,
+      groupCount (capacity, Particles::GROUP_SIZE) * sizeof (uint32_t),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      0, false, allocator);
+  state = createBuffer (physicalDevice, device, sizeof (ParticleState),
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                            | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+                            | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, false,
+                        allocator);
+  current = 0;
+  cleared = false;
+
+  for (uint32_t i = 0; i < 2; i++)
+    {
+      const GpuBuffer *bound[5]
+          = { &particles[i], &particles[1 - i], &state, &offsets,
+              &blockOffsets };
+      VkDescriptorBufferInfo bufferInfos[5]{};
+      VkWriteDescriptorSet writes[5]{};
+      for (uint32_t b = 0; b < 5; b++)
+        {
+          bufferInfos[b].buffer = bound[b]->buffer;
+          bufferInfos[b].range = VK_WHOLE_SIZE;
+          writes[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+          writes[b].dstSet = sets[i];
+          writes[b].dstBinding = b;
+          writes[b].descriptorCount = 1;
+          writes[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+          writes[b].pBufferInfo = &bufferInfos[b];
+        }
+      vkUpdateDescriptorSets (device, 5, writes, 0, nullptr);
+    }
+}
+
+void
+ParticleSystem::recordSimulation (VkCommandBuffer buffer,
+                                  const ParticleEmitter &emitter,
+                                  uint32_t seed)
+{
+  if (particleCapacity == 0)
+    {
+      return;
+    }
+
+  // The step and the draws of the frame before are done with the buffers,
+  // whichever frame in flight recorded them
+  VkMemoryBarrier previousFrame{};
+  previousFrame.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  previousFrame.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  previousFrame.dstAccessMask = VK_ACCESS_SHADER_READ_BIT
+                                | VK_ACCESS_SHADER_WRITE_BIT
+                                | VK_ACCESS_TRANSFER_WRITE_BIT;
+  vkCmdPipelineBarrier (buffer,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+                            | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT
+                            | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT
+                            | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                        0, 1, &previousFrame, 0, nullptr, 0, nullptr);
+
+  if (!cleared)
+    {
+      ParticleState initial{};
+      initial.groups[1] = 1;
+      initial.groups[2] = 1;
+      initial.draw.vertexCount = 4;
+      vkCmdUpdateBuffer (buffer, state.buffer, 0, sizeof (initial),
+                         &initial);
+
+      VkMemoryBarrier written{};
+      written.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      written.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      written.dstAccessMask
+          = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+      vkCmdPipelineBarrier (buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                            &written, 0, nullptr, 0, nullptr);
+      cleared = true;
+    }
+
+  ParticleConstants constants{};
+  constants.emitter[0] = emitter.position[0];
+  constants.emitter[1] = emitter.position[1];
+  constants.emitter[2] = emitter.position[2];
+  constants.emitter[3] = emitter.scale;
+  constants.capacity = particleCapacity;
+  constants.emitCount = Particles::emitRate (particleCapacity);
+  constants.seed = seed;
+
+  vkCmdBindDescriptorSets (buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                           computeLayout, 0, 1, &sets[current], 0, nullptr);
+  vkCmdPushConstants (buffer, computeLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                      sizeof (constants), &constants);
+
+  // Emit also sizes the dispatches of the steps after it, only the GPU
+  // knows how many particles there are
+  vkCmdBindPipeline (buffer, VK_PIPELINE_BIND_POINT_COMPUTE, emitPipeline);
+  vkCmdDispatch (buffer,
+                 std::max (groupCount (constants.emitCount,
+                                       Particles::GROUP_SIZE),
+                           1u),
+                 1, 1);
+  computeBarrier (buffer,
+                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+                      | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                  VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+                      | VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+
+  VkDeviceSize groups = offsetof (ParticleState, groups);
+  vkCmdBindPipeline (buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                     simulatePipeline);
+  vkCmdDispatchIndirect (buffer, state.buffer, groups);
+  computeBarrier (buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                  VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+  vkCmdBindPipeline (buffer, VK_PIPELINE_BIND_POINT_COMPUTE, scanPipeline);
+  vkCmdDispatch (buffer, 1, 1, 1);
+  computeBarrier (buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                  VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+  vkCmdBindPipeline (buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                     compactPipeline);
+  vkCmdDispatchIndirect (buffer, state.buffer, groups);
+  computeBarrier (buffer,
+                  VK_PIPELINE_STAGE_VERTEX_SHADER_BIT
+                      | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                  VK_ACCESS_SHADER_READ_BIT
+                      | VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+
+  // The survivors are in the other buffer now
+  current = 1 - current;
+}
+
+void
+ParticleSystem::record (VkCommandBuffer buffer, const Mat4 &viewProjection,
+                        VkExtent2D viewport)
+{
+  if (particleCapacity == 0 || !cleared)
+    {
+      return;
+    }
+
+  ParticleDrawConstants constants{};
+  constants.viewProjection = viewProjection;
+  constants.halfSize[0] = PARTICLE_SIZE / std::max (viewport.width, 1u);
+  constants.halfSize[1] = PARTICLE_SIZE / std::max (viewport.height, 1u);
+  constants.capacity = particleCapacity;
+
+  vkCmdBindPipeline (buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, drawPipeline);
+  vkCmdBindDescriptorSets (buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                           drawLayout, 0, 1, &sets[current], 0, nullptr);
+  vkCmdPushConstants (buffer, drawLayout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                      sizeof (constants), &constants);
+  // Four vertices per live particle, the instance count is the scan's
+  vkCmdDrawIndirect (buffer, state.buffer, offsetof (ParticleState, draw), 1,
+                     sizeof (VkDrawIndirectCommand));
+}
+
+void
+ParticleSystem::destroyBuffers ()
+{
+  for (GpuBuffer &buffer : particles)
+    {
+      destroyBuffer (device, buffer, allocator);
+    }
+  destroyBuffer (device, offsets, allocator);
+  destroyBuffer (device, blockOffsets, allocator);
+  destroyBuffer (device, state, allocator);
+  particleCapacity = 0;
+}
+
+void
+ParticleSystem::cleanup ()
+{
+  destroyBuffers ();
+
+  pipelines.cleanup ();
+  drawPipeline = VK_NULL_HANDLE;
+  VkPipeline *computePipelines[] = { &emitPipeline, &simulatePipeline,
+                                     &scanPipeline, &compactPipeline };
+  for (VkPipeline *pipeline : computePipelines)
+    {
+      vkDestroyPipeline (device, *pipeline, allocator);
+      *pipeline = VK_NULL_HANDLE;
+    }
+  // frees the descriptor sets with it
+  vkDestroyDescriptorPool (device, descriptorPool, allocator);
+  vkDestroyPipelineLayout (device, computeLayout, allocator);
+  vkDestroyPipelineLayout (device, drawLayout, allocator);
+  vkDestroyDescriptorSetLayout (device, setLayout, allocator);
+  device = VK_NULL_HANDLE;
+}
@@ -0,0 +1,831 @@
+#include "../include/pipeline_manager.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+using namespace VulkanApp;
+
+static const char MANIFEST_MAGIC[4] = { 'V', 'K', 'P', 'M' };
+// sanity limit for reading a manifest
+static const uint64_t MAX_MANIFEST_KEYS = 1 << 20;
+
+// Library parts in the order they are stored and linked
+static const VkGraphicsPipelineLibraryFlagsEXT LIBRARY_PARTS[] = {
+  VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT,
+  VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT,
+  VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT,
+  VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT,
+};
+
+// Only the fields of key a library part depends on, the rest keep their
+// defaults so every key with the same part shares its library
+static PipelineKey
+libraryKey (VkGraphicsPipelineLibraryFlagsEXT part, const PipelineKey &key)
+{
+  PipelineKey result;
+  if (part == VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT)
+    {
+      result.vertexInput = key.vertexInput;
+      result.topology = key.topology;
+    }
+  else if (part
+           == VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT)
+    {
+      result.samples = key.samples;
+      result.blend = key.blend;
+    }
+  else
+    {
+      // Both shader parts take the specialization constants
+      result.specializationCount = key.specializationCount;
+      for (uint32_t i = 0; i < MAX_SPECIALIZATION_CONSTANTS; i++)
+        {
+          result.specialization[i] = key.specialization[i];
+        }
+      if (part
+          == VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT)
+        {
+          result.vertexShader = key.vertexShader;
+          result.polygonMode = key.polygonMode;
+          result.cullMode = key.cullMode;
+          result.frontFace = key.frontFace;
+        }
+      else
+        {
+          result.fragmentShader = key.fragmentShader;
+          result.samples = key.samples;
+          result.depthTest = key.depthTest;
+          result.depthWrite = key.depthWrite;
+          result.depthCompare = key.depthCompare;
+        }
+    }
+  return result;
+}
+
+std::vector<char>
+VulkanApp::readSpirv (const std::string &path)
+{
+  std::ifstream file (path, std::ios::ate | std::ios::binary);
+  if (!file.is_open ())
+    {
+      throw std::runtime_error ("Failed to open shader " + path + "!");
+    }
+
+  std::vector<char> code (static_cast<size_t> (file.tellg ()));
+  file.seekg (0);
+  file.read (code.data (), code.size ());
+  return code;
+}
+
+PipelineManager::~PipelineManager ()
+{
+  cleanup ();
+}
+
+void
+PipelineManager::init (VkDevice device, VkPipelineCache pipelineCache,
+                       VkPipelineLayout layout, VkRenderPass renderPass,
+                       bool useLibraries,
+                       const VkAllocationCallbacks *allocator,
+                       Logger *logger)
+{
+  this->device = device;
+  this->pipelineCache = pipelineCache;
+  this->layout = layout;
+  this->renderPass = renderPass;
+  this->useLibraries = useLibraries;
+  this->allocator = allocator;
+  this->logger = logger;
+  cancelBackground = false;
+
+  std::lock_guard<std::mutex> lock (tablesMutex);
+  vertexInputs.emplace (0, VertexInputLayout ());
+}
+
+void
+PipelineManager::setShader (uint16_t id, const std::string &path)
+{
+  std::lock_guard<std::mutex> lock (tablesMutex);
+  shaderPaths[id] = path;
+}
+
+void
+PipelineManager::setVertexInput (uint16_t id, const VertexInputLayout &layout)
+{
+  std::lock_guard<std::mutex> lock (tablesMutex);
+  vertexInputs[id] = layout;
+}
+
+VkPipeline
+PipelineManager::get (const PipelineKey &key)
+{
+  return lookup (key, true);
+}
+
+void
+PipelineManager::markRequested (Entry &entry)
+{
+  // Only the first request pays for the exchange
+  if (!entry.requested.load (std::memory_order_relaxed)
+      && !entry.requested.exchange (true, std::memory_order_relaxed))
+    {
+      entry.firstRequest.store (
+          requestCount.fetch_add (1, std::memory_order_relaxed),
+          std::memory_order_relaxed);
+    }
+}
+
+VkPipeline
+PipelineManager::lookup (const PipelineKey &key, bool request)
+{
+  Shard &shard = shards[key.hash () % SHARD_COUNT];
+
+  {
+    std::shared_lock<std::shared_mutex> lock (shard.mutex);
+    auto found = shard.pipelines.find (key);
+    if (found != shard.pipelines.end ())
+      {
+        if (request)
+          {
+            hits.fetch_add (1, std::memory_order_relaxed);
+            markRequested (found->second);
+          }
+        VkPipeline optimized
+            = found->second.optimized.load (std::memory_order_acquire);
+        if (optimized != VK_NULL_HANDLE)
+          {
+            return optimized;
+          }
+        std::shared_future<VkPipeline> pipeline = found->second.pipeline;
+        lock.unlock ();
+        return pipeline.get ();
+      }
+  }
+
+  std::promise<VkPipeline> promise;
+  {
+    std::unique_lock<std::shared_mutex> lock (shard.mutex);
+    Entry &entry = shard.pipelines[key];
+    if (entry.pipeline.valid ())
+      {
+        // Another thread got here first, wait for its compile
+        if (request)
+          {
+            hits.fetch_add (1, std::memory_order_relaxed);
+            markRequested (entry);
+          }
+        std::shared_future<VkPipeline> pipeline = entry.pipeline;
+        lock.unlock ();
+        return pipeline.get ();
+      }
+
+    entry.pipeline = promise.get_future ().share ();
+    if (request)
+      {
+        markRequested (entry);
+      }
+  }
+
+  try
+    {
+      VkPipeline pipeline = compile (key);
+      (request ? compiles : precompiles)
+          .fetch_add (1, std::memory_order_relaxed);
+      promise.set_value (pipeline);
+      if (useLibraries)
+        {
+          // Nothing waits for an optimized link
+          runBackground ([this, key] () { optimize (key); });
+        }
+      return pipeline;
+    }
+  catch (...)
+    {
+      // Waiting threads get the error too, the next request tries again
+      promise.set_exception (std::current_exception ());
+      std::unique_lock<std::shared_mutex> lock (shard.mutex);
+      shard.pipelines.erase (key);
+      throw;
+    }
+}
+
+size_t
+PipelineManager::precompile (const std::string &manifestPath)
+{
+  std::ifstream file (manifestPath, std::ios::binary);
+  PipelineManifestHeader header{};
+  if (!file.read (reinterpret_cast<char *> (&header), sizeof (header))
+      || std::memcmp (header.magic, MANIFEST_MAGIC, sizeof (MANIFEST_MAGIC))
+             != 0
+      || header.version != PIPELINE_MANIFEST_VERSION
+      || header.fingerprint != fingerprint ()
+      || header.keyCount > MAX_MANIFEST_KEYS)
+    {
+      return 0;
+    }
+
+  std::vector<PipelineKey> keys (header.keyCount);
+  if (!file.read (reinterpret_cast<char *> (keys.data ()),
+                  keys.size () * sizeof (PipelineKey)))
+    {
+      return 0;
+    }
+
+  // Background jobs start in submission order, which is the manifest's
+  // order, on whichever workers the frame work leaves idle. A key the
+  // renderer asks for before its job ran is compiled by the renderer, the
+  // job then just finds it.
+  for (const PipelineKey &key : keys)
+    {
+      runBackground ([this, key] () {
+        if (!cancelBackground.load (std::memory_order_relaxed))
+          {
+            lookup (key, false);
+          }
+      });
+    }
+  return keys.size ();
+}
+
+bool
+PipelineManager::saveManifest (const std::string &manifestPath)
+{
+  std::vector<std::pair<uint64_t, PipelineKey> > requested;
+  for (Shard &shard : shards)
+    {
+      std::shared_lock<std::shared_mutex> lock (shard.mutex);
+      for (auto &entry : shard.pipelines)
+        {
+          if (entry.second.requested.load (std::memory_order_relaxed))
+            {
+              requested.emplace_back (
+                  entry.second.firstRequest.load (std::memory_order_relaxed),
+                  entry.first);
+            }
+        }
+    }
+  std::sort (requested.begin (), requested.end (),
+             [] (const std::pair<uint64_t, PipelineKey> &a,
+                 const std::pair<uint64_t, PipelineKey> &b) {
+               return a.first < b.first;
+             });
+
+  PipelineManifestHeader header{};
+  std::memcpy (header.magic, MANIFEST_MAGIC, sizeof (MANIFEST_MAGIC));
+  header.version = PIPELINE_MANIFEST_VERSION;
+  header.fingerprint = fingerprint ();
+  header.keyCount = requested.size ();
+
+  std::filesystem::path path (manifestPath);
+  std::error_code error;
+  if (path.has_parent_path ())
+    {
+      std::filesystem::create_directories (path.parent_path (), error);
+    }
+
+  // Same as the mesh cache, renamed into place once complete
+  std::string temporaryPath = manifestPath + ".tmp";
+  {
+    std::ofstream file (temporaryPath, std::ios::binary | std::ios::trunc);
+    file.write (reinterpret_cast<const char *> (&header), sizeof (header));
+    for (const auto &entry : requested)
+      {
+        file.write (reinterpret_cast<const char *> (&entry.second),
+                    sizeof (PipelineKey));
+      }
+    file.close ();
+    if (file.fail ())
+      {
+        return false;
+      }
+  }
+  std::filesystem::rename (temporaryPath, manifestPath, error);
+  return !error;
+}
+
+PipelineManagerStats
+PipelineManager::stats () const
+{
+  PipelineManagerStats result;
+  result.hits = hits.load (std::memory_order_relaxed);
+  result.compiles = compiles.load (std::memory_order_relaxed);
+  result.precompiles = precompiles.load (std::memory_order_relaxed);
+  result.libraries = libraryCount.load (std::memory_order_relaxed);
+  result.optimizedLinks = optimizedLinks.load (std::memory_order_relaxed);
+  return result;
+}
+
+void
+PipelineManager::cleanup ()
+{
+  // Jobs still queued see the flag and return right away
+  cancelBackground = true;
+  JobSystem::shared ().wait (background);
+
+  if (device == VK_NULL_HANDLE)
+    {
+      return;
+    }
+
+  for (Shard &shard : shards)
+    {
+      std::unique_lock<std::shared_mutex> lock (shard.mutex);
+      for (auto &entry : shard.pipelines)
+        {
+          // The fast-linked pipeline was kept alive for command buffers
+          // recorded before the optimized one replaced it
+          vkDestroyPipeline (device, entry.second.pipeline.get (), allocator);
+          vkDestroyPipeline (device, entry.second.optimized.load (),
+                             allocator);
+        }
+      shard.pipelines.clear ();
+    }
+
+  // Linked pipelines don't depend on their libraries once created
+  {
+    std::lock_guard<std::mutex> lock (librariesMutex);
+    for (auto &part : libraries)
+      {
+        for (auto &entry : part)
+          {
+            vkDestroyPipeline (device, entry.second.get (), allocator);
+          }
+        part.clear ();
+      }
+  }
+
+  std::lock_guard<std::mutex> lock (tablesMutex);
+  for (auto &entry : shaderModules)
+    {
+      vkDestroyShaderModule (device, entry.second, allocator);
+    }
+  shaderModules.clear ();
+  device = VK_NULL_HANDLE;
+}
+
+uint64_t
+PipelineManager::fingerprint ()
+{
+  std::lock_guard<std::mutex> lock (tablesMutex);
+
+  // Sorted by id, the maps' iteration order isn't stable
+  std::map<uint16_t, const std::string *> shaders;
+  for (const auto &entry : shaderPaths)
+    {
+      shaders[entry.first] = &entry.second;
+    }
+  std::map<uint16_t, const VertexInputLayout *> inputs;
+  for (const auto &entry : vertexInputs)
+    {
+      inputs[entry.first] = &entry.second;
+    }
+
+  uint64_t hash = 14695981039346656037ull;
+  auto mix = [&hash] (const void *data, size_t size) {
+    const uint8_t *bytes = static_cast<const uint8_t *> (data);
+    for (size_t i = 0; i < size; i++)
+      {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+      }
+  };
+
+  for (const auto &shader : shaders)
+    {
+      mix (&shader.first, sizeof (shader.first));
+      mix (shader.second->data (), shader.second->size ());
+    }
+  for (const auto &input : inputs)
+    {
+      mix (&input.first, sizeof (input.first));
+      for (const auto &binding : input.second->bindings)
+        {
+          uint32_t fields[]
+              = { binding.binding, binding.stride,
+                  static_cast<uint32_t> (binding.inputRate) };
+          mix (fields, sizeof (fields));
+        }
+      for (const auto &attribute : input.second->attributes)
+        {
+          uint32_t fields[]
+              = { attribute.location, attribute.binding,
+                  static_cast<uint32_t> (attribute.format),
+                  attribute.offset };
+          mix (fields, sizeof (fields));
+        }
+    }
+  return hash;
+}
+
+VkShaderModule
+PipelineManager::shaderModule (uint16_t id)
+{
+  // tablesMutex is held by compile
+  auto found = shaderModules.find (id);
+  if (found != shaderModules.end ())
+    {
+      return found->second;
+    }
+
+  auto path = shaderPaths.find (id);
+  if (path == shaderPaths.end ())
+    {
+      throw std::runtime_error ("Pipeline uses an unregistered shader!");
+    }
+
+  std::vector<char> code = readSpirv (path->second);
+  VkShaderModuleCreateInfo createInfo{};
+  createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  createInfo.codeSize = code.size ();
+  createInfo.pCode = reinterpret_cast<const uint32_t *> (code.data ());
+
+  VkShaderModule module;
+  if (vkCreateShaderModule (device, &createInfo, allocator, &module)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to create shader module!");
+    }
+
+  shaderModules.emplace (id, module);
+  return module;
+}
+
+VkPipeline
+PipelineManager::compile (const PipelineKey &key)
+{
+  if (!useLibraries)
+    {
+      return create (key, 0);
+    }
+  return link (key, false);
+}
+
+VkPipeline
+PipelineManager::library (size_t part, const PipelineKey &key)
+{
+  PipelineKey partKey = libraryKey (LIBRARY_PARTS[part], key);
+
+  std::promise<VkPipeline> promise;
+  {
+    std::unique_lock<std::mutex> lock (librariesMutex);
+    auto found = libraries[part].find (partKey);
+    if (found != libraries[part].end ())
+      {
+        std::shared_future<VkPipeline> pipeline = found->second;
+        lock.unlock ();
+        return pipeline.get ();
+      }
+    libraries[part].emplace (partKey, promise.get_future ().share ());
+  }
+
+  try
+    {
+      VkPipeline pipeline = create (partKey, LIBRARY_PARTS[part]);
+      libraryCount.fetch_add (1, std::memory_order_relaxed);
+      promise.set_value (pipeline);
+      return pipeline;
+    }
+  catch (...)
+    {
+      promise.set_exception (std::current_exception ());
+      std::lock_guard<std::mutex> lock (librariesMutex);
+      libraries[part].erase (partKey);
+      throw;
+    }
+}
+
+VkPipeline
+PipelineManager::link (const PipelineKey &key, bool optimize)
+{
+  VkPipeline parts[LIBRARY_PART_COUNT];
+  for (size_t i = 0; i < LIBRARY_PART_COUNT; i++)
+    {
+      parts[i] = library (i, key);
+    }
+
+  VkPipelineLibraryCreateInfoKHR libraryInfo{};
+  libraryInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR;
+  libraryInfo.libraryCount = LIBRARY_PART_COUNT;
+  libraryInfo.pLibraries = parts;
+
+  VkGraphicsPipelineCreateInfo pipelineInfo{};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipelineInfo.pNext = &libraryInfo;
+  pipelineInfo.layout = layout;
+  pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+  pipelineInfo.basePipelineIndex = -1;
+  // Without the flag the driver only stitches the libraries' code
+  // together, which is what makes the link fast
+  if (optimize)
+    {
+      pipelineInfo.flags = VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT;
+    }
+
+  VkPipeline pipeline;
+  if (vkCreateGraphicsPipelines (device, pipelineCache, 1, &pipelineInfo,
+                                 allocator, &pipeline)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to link graphics pipeline!");
+    }
+  return pipeline;
+}
+
+void
+PipelineManager::optimize (const PipelineKey &key)
+{
+  if (cancelBackground.load (std::memory_order_relaxed))
+    {
+      return;
+    }
+
+  VkPipeline pipeline = link (key, true);
+
+  Shard &shard = shards[key.hash () % SHARD_COUNT];
+  std::shared_lock<std::shared_mutex> lock (shard.mutex);
+  auto found = shard.pipelines.find (key);
+  if (found == shard.pipelines.end ())
+    {
+      vkDestroyPipeline (device, pipeline, allocator);
+      return;
+    }
+  found->second.optimized.store (pipeline, std::memory_order_release);
+  optimizedLinks.fetch_add (1, std::memory_order_relaxed);
+}
+
+void
+PipelineManager::runBackground (std::function<void ()> work)
+{
+  JobSystem::shared ().run (
+      [this, work = std::move (work)] () {
+        try
+          {
+            work ();
+          }
+        catch (const std::exception &e)
+          {
+            // A renderer asking for the key again gets the error itself
+            if (logger != nullptr)
+              {
+                std::string message = "Background pipeline compile failed: ";
+                message += e.what ();
+                logger->log (LogSeverity::Warning, 0, message.c_str ());
+              }
+          }
+      },
+      &background, JobPriority::Background);
+}
+
+VkPipeline
+PipelineManager::create (const PipelineKey &key,
+                         VkGraphicsPipelineLibraryFlagsEXT parts)
+{
+  bool vertexInputPart
+      = parts == 0
+        || (parts
+            & VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT);
+  bool preRasterizationPart
+      = parts == 0
+        || (parts
+            & VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT);
+  bool fragmentShaderPart
+      = parts == 0
+        || (parts & VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT);
+  bool fragmentOutputPart
+      = parts == 0
+        || (parts
+            & VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT);
+
+  VkShaderModule vertexModule = VK_NULL_HANDLE;
+  VkShaderModule fragmentModule = VK_NULL_HANDLE;
+  VertexInputLayout vertexInput;
+  {
+    // Modules stay alive until cleanup, so they can be used unlocked
+    std::lock_guard<std::mutex> lock (tablesMutex);
+    if (preRasterizationPart)
+      {
+        vertexModule = shaderModule (key.vertexShader);
+      }
+    if (fragmentShaderPart)
+      {
+        fragmentModule = shaderModule (key.fragmentShader);
+      }
+
+    if (vertexInputPart)
+      {
+        auto found = vertexInputs.find (key.vertexInput);
+        if (found == vertexInputs.end ())
+          {
+            throw std::runtime_error (
+                "Pipeline uses an unregistered vertex input!");
+          }
+        vertexInput = found->second;
+      }
+  }
+
+  VkSpecializationMapEntry specializationEntries[MAX_SPECIALIZATION_CONSTANTS];
+  for (uint32_t i = 0; i < key.specializationCount; i++)
+    {
+      specializationEntries[i] = { i, i * 4, 4 };
+    }
+  VkSpecializationInfo specialization{};
+  specialization.mapEntryCount = key.specializationCount;
+  specialization.pMapEntries = specializationEntries;
+  specialization.dataSize = key.specializationCount * 4;
+  specialization.pData = key.specialization;
+
+  // NOTE: Constants a stage doesn't declare are ignored, so both stages
+  // get all of them
+  VkPipelineShaderStageCreateInfo shaderStages[2]{};
+  shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+  shaderStages[0].module = vertexModule;
+  shaderStages[0].pName = "main";
+  shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+  shaderStages[1].module = fragmentModule;
+  shaderStages[1].pName = "main";
+  if (key.specializationCount != 0)
+    {
+      shaderStages[0].pSpecializationInfo = &specialization;
+      shaderStages[1].pSpecializationInfo = &specialization;
+    }
+
+  VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+  vertexInputInfo.sType
+      = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+  vertexInputInfo.vertexBindingDescriptionCount
+      = static_cast<uint32_t> (vertexInput.bindings.size ());
+  vertexInputInfo.pVertexBindingDescriptions = vertexInput.bindings.data ();
+  vertexInputInfo.vertexAttributeDescriptionCount
+      = static_cast<uint32_t> (vertexInput.attributes.size ());
+  vertexInputInfo.pVertexAttributeDescriptions
+      = vertexInput.attributes.data ();
+
+  VkDynamicState dynamicStates[]
+      = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+  VkPipelineDynamicStateCreateInfo dynamicState{};
+  dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+  dynamicState.dynamicStateCount = 2;
+  dynamicState.pDynamicStates = dynamicStates;
+
+  VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+  inputAssembly.sType
+      = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+  inputAssembly.topology = static_cast<VkPrimitiveTopology> (key.topology);
+  inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+  // Viewport and scissor are set while recording, only the counts matter
+  VkPipelineViewportStateCreateInfo viewportState{};
+  viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+  viewportState.viewportCount = 1;
+  viewportState.scissorCount = 1;
+
+  VkPipelineRasterizationStateCreateInfo rasterizer{};
+  rasterizer.sType
+      = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+  rasterizer.depthClampEnable = VK_FALSE;
+  rasterizer.rasterizerDiscardEnable = VK_FALSE;
+  // Anything aside from VK_POLYGON_MODE_FILL requires a GPU feature
+  rasterizer.polygonMode = static_cast<VkPolygonMode> (key.polygonMode);
+  rasterizer.lineWidth = 1.0f;
+  rasterizer.cullMode = key.cullMode;
+  rasterizer.frontFace = static_cast<VkFrontFace> (key.frontFace);
+  rasterizer.depthBiasEnable = VK_FALSE;
+
+  VkPipelineMultisampleStateCreateInfo multisampling{};
+  multisampling.sType
+      = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+  multisampling.sampleShadingEnable = VK_FALSE;
+  multisampling.rasterizationSamples
+      = static_cast<VkSampleCountFlagBits> (key.samples);
+  multisampling.minSampleShading = 1.0f;
+
+  VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+  colorBlendAttachment.colorWriteMask
+      = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT
+        | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+  colorBlendAttachment.blendEnable = key.blend != BlendMode::Opaque;
+  colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+  colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+  colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+  colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+  if (key.blend == BlendMode::Alpha)
+    {
+      colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+      colorBlendAttachment.dstColorBlendFactor
+          = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    }
+  else if (key.blend == BlendMode::Additive)
+    {
+      colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+      colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+    }
+
+  VkPipelineColorBlendStateCreateInfo colorBlending{};
+  colorBlending.sType
+      = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+  colorBlending.logicOpEnable = VK_FALSE;
+  colorBlending.attachmentCount = 1;
+  colorBlending.pAttachments = &colorBlendAttachment;
+
+  // NOTE: Every pipeline needs depth state since the render pass has a
+  // depth attachment, even the ones drawn without depth
+  VkPipelineDepthStencilStateCreateInfo depthStencil{};
+  depthStencil.sType
+      = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+  depthStencil.depthTestEnable = key.depthTest ? VK_TRUE : VK_FALSE;
+  depthStencil.depthWriteEnable = key.depthWrite ? VK_TRUE : VK_FALSE;
+  depthStencil.depthCompareOp = static_cast<VkCompareOp> (key.depthCompare);
+  depthStencil.depthBoundsTestEnable = VK_FALSE;
+  depthStencil.stencilTestEnable = VK_FALSE;
+
+  VkGraphicsPipelineCreateInfo pipelineInfo{};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipelineInfo.stageCount = 2;
+  pipelineInfo.pStages = shaderStages;
+  pipelineInfo.pVertexInputState = &vertexInputInfo;
+  pipelineInfo.pInputAssemblyState = &inputAssembly;
+  pipelineInfo.pViewportState = &viewportState;
+  pipelineInfo.pRasterizationState = &rasterizer;
+  pipelineInfo.pMultisampleState = &multisampling;
+  pipelineInfo.pDepthStencilState = &depthStencil;
+  pipelineInfo.pColorBlendState = &colorBlending;
+  pipelineInfo.pDynamicState = &dynamicState;
+  pipelineInfo.layout = layout;
+  pipelineInfo.renderPass = renderPass;
+  pipelineInfo.subpass = 0;
+  pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+  pipelineInfo.basePipelineIndex = -1;
+
+  // A library only gets the state of its own part, link takes the rest
+  // from the other parts' libraries
+  VkGraphicsPipelineLibraryCreateInfoEXT libraryInfo{};
+  if (parts != 0)
+    {
+      libraryInfo.sType
+          = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
+      libraryInfo.flags = parts;
+      pipelineInfo.pNext = &libraryInfo;
+      pipelineInfo.flags
+          = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR
+            | VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
+
+      pipelineInfo.stageCount = 0;
+      pipelineInfo.pStages = nullptr;
+      if (preRasterizationPart)
+        {
+          pipelineInfo.stageCount = 1;
+          pipelineInfo.pStages = &shaderStages[0];
+        }
+      else if (fragmentShaderPart)
+        {
+          pipelineInfo.stageCount = 1;
+          pipelineInfo.pStages = &shaderStages[1];
+        }
+
+      if (!vertexInputPart)
+        {
+          pipelineInfo.pVertexInputState = nullptr;
+          pipelineInfo.pInputAssemblyState = nullptr;
+        }
+      if (!preRasterizationPart)
+        {
+          pipelineInfo.pViewportState = nullptr;
+          pipelineInfo.pRasterizationState = nullptr;
+          pipelineInfo.pDynamicState = nullptr;
+        }
+      if (!fragmentShaderPart)
+        {
+          pipelineInfo.pDepthStencilState = nullptr;
+        }
+      if (!fragmentShaderPart && !fragmentOutputPart)
+        {
+          pipelineInfo.pMultisampleState = nullptr;
+        }
+      if (!fragmentOutputPart)
+        {
+          pipelineInfo.pColorBlendState = nullptr;
+        }
+      if (!preRasterizationPart && !fragmentShaderPart)
+        {
+          pipelineInfo.layout = VK_NULL_HANDLE;
+        }
+      if (vertexInputPart)
+        {
+          pipelineInfo.renderPass = VK_NULL_HANDLE;
+        }
+    }
+
+  // NOTE: vkCreateGraphicsPipelines and the pipeline cache are both safe
+  // to use from several threads at once
+  VkPipeline pipeline;
+  if (vkCreateGraphicsPipelines (device, pipelineCache, 1, &pipelineInfo,
+                                 allocator, &pipeline)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to create graphics pipeline!");
+    }
+  return pipeline;
+}
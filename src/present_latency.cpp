@@ -0,0 +1,184 @@
+#include "../include/present_latency.hpp"
+#include <algorithm>
+using namespace VulkanApp;
+
+// presents still polled for when this many are queued are dropped, oldest
+// first, e.g. while the window is minimized
+static const size_t MAX_QUEUED = 8;
+// weight of the newest frame in the smoothed latency and interval
+static const double SMOOTHING = 0.1;
+// latency a frame may have without counting as queued, in present
+// intervals: one for the frame itself and half of one for waiting on the
+// next vblank
+static const double TARGET_INTERVALS = 1.5;
+// delay change per millisecond of latency above or below the target
+static const double PACING_GAIN = 0.05;
+// frames are never held back for more than this part of an interval
+static const double MAX_DELAY = 0.5;
+
+static double
+milliseconds (std::chrono::steady_clock::duration duration)
+{
+  return std::chrono::duration<double, std::milli> (duration).count ();
+}
+
+PresentLatency::~PresentLatency ()
+{
+  cleanup ();
+}
+
+void
+PresentLatency::init (VkDevice device, bool presentWait, bool pacing)
+{
+  this->device = device;
+  this->pacing = pacing;
+
+  // Not exported by the loader, it comes from an extension
+  if (presentWait)
+    {
+      waitForPresent = reinterpret_cast<PFN_vkWaitForPresentKHR> (
+          vkGetDeviceProcAddr (device, "vkWaitForPresentKHR"));
+    }
+}
+
+void
+PresentLatency::setSwapchain (VkSwapchainKHR swapchain)
+{
+  // Presents to the old swap chain are never polled for again
+  this->swapchain = swapchain;
+  queued.clear ();
+}
+
+uint64_t
+PresentLatency::beginFrame (uint32_t slot)
+{
+  if (waitForPresent != nullptr)
+    {
+      poll ();
+    }
+
+  Frame &frame = frames[slot % MAX_SLOTS];
+  frame.start = Clock::now ();
+  frame.pending = false;
+  frame.presentId = waitForPresent != nullptr ? nextPresentId++ : 0;
+  return frame.presentId;
+}
+
+void
+PresentLatency::presented (uint32_t slot)
+{
+  Frame &frame = frames[slot % MAX_SLOTS];
+  if (waitForPresent == nullptr)
+    {
+      // measured once its fence is seen, see retired
+      frame.pending = true;
+      return;
+    }
+
+  if (queued.size () >= MAX_QUEUED)
+    {
+      queued.pop_front ();
+    }
+  queued.push_back (frame);
+  poll ();
+}
+
+void
+PresentLatency::retired (uint32_t slot)
+{
+  Frame &frame = frames[slot % MAX_SLOTS];
+  if (!frame.pending)
+    {
+      return;
+    }
+  frame.pending = false;
+  record (frame.start, Clock::now ());
+}
+
+std::chrono::microseconds
+PresentLatency::frameDelay () const
+{
+  return std::chrono::microseconds (
+      delayMicroseconds.load (std::memory_order_relaxed));
+}
+
+PresentLatencyStats
+PresentLatency::stats () const
+{
+  std::lock_guard<std::mutex> lock (statsMutex);
+  PresentLatencyStats result = current;
+  result.measured = waitForPresent != nullptr;
+  return result;
+}
+
+void
+PresentLatency::cleanup ()
+{
+  queued.clear ();
+  swapchain = VK_NULL_HANDLE;
+}
+
+void
+PresentLatency::poll ()
+{
+  while (!queued.empty () && swapchain != VK_NULL_HANDLE)
+    {
+      const Frame &frame = queued.front ();
+      VkResult result = waitForPresent (device, swapchain, frame.presentId, 0);
+      if (result == VK_TIMEOUT)
+        {
+          // presents are shown in order, the later ones aren't either
+          return;
+        }
+      Clock::time_point shown = Clock::now ();
+      Clock::time_point start = frame.start;
+      queued.pop_front ();
+
+      // Out of date swap chains never show the frame, it isn't counted
+      if (result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR)
+        {
+          record (start, shown);
+        }
+    }
+}
+
+void
+PresentLatency::record (Clock::time_point start, Clock::time_point shown)
+{
+  std::lock_guard<std::mutex> lock (statsMutex);
+
+  double latency = milliseconds (shown - start);
+  current.latencySumMilliseconds += latency;
+  current.latencyMilliseconds
+      = current.frames == 0
+            ? latency
+            : current.latencyMilliseconds
+                  + (latency - current.latencyMilliseconds) * SMOOTHING;
+
+  if (current.frames > 0)
+    {
+      double interval = milliseconds (shown - lastShown);
+      current.intervalMilliseconds
+          = current.intervalMilliseconds == 0.0
+                ? interval
+                : current.intervalMilliseconds
+                      + (interval - current.intervalMilliseconds)
+                            * SMOOTHING;
+    }
+  lastShown = shown;
+  current.frames++;
+
+  if (!pacing || current.intervalMilliseconds == 0.0)
+    {
+      return;
+    }
+
+  double target = current.intervalMilliseconds * TARGET_INTERVALS;
+  double delay = current.delayMilliseconds
+                 + (current.latencyMilliseconds - target) * PACING_GAIN;
+  delay = std::min (std::max (delay, 0.0),
+                    current.intervalMilliseconds * MAX_DELAY);
+  current.delayMilliseconds = delay;
+  delayMicroseconds.store (static_cast<int64_t> (delay * 1000.0),
+                           std::memory_order_relaxed);
+}
@@ -0,0 +1,342 @@
+#include "../include/quad_batcher.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+using namespace VulkanApp;
+
+// Shader ids registered with the batcher's own pipeline manager
+enum : uint16_t
+{
+  SHADER_QUAD_VERT,
+  SHADER_QUAD_FRAG,
+};
+
+static constexpr PipelineKey QUAD_PIPELINE
+    = PipelineKey ()
+          .withShaders (SHADER_QUAD_VERT, SHADER_QUAD_FRAG)
+          .withRasterizer (VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE,
+                           VK_FRONT_FACE_CLOCKWISE)
+          .withBlend (BlendMode::Alpha);
+
+// Matches the push constant block in quad.vert
+struct QuadConstants
+{
+  // 2 / canvas size, canvas pixels to clip space
+  float pixelToClip[2];
+};
+
+QuadBatcher::~QuadBatcher ()
+{
+  if (device != VK_NULL_HANDLE)
+    {
+      cleanup ();
+    }
+}
+
+void
+QuadBatcher::init (VkPhysicalDevice physicalDevice, VkDevice device,
+                   VkPipelineCache pipelineCache, VkRenderPass renderPass,
+                   const VkAllocationCallbacks *allocator)
+{
+  this->physicalDevice = physicalDevice;
+  this->device = device;
+  this->allocator = allocator;
+
+  VkSamplerCreateInfo samplerInfo{};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_LINEAR;
+  samplerInfo.minFilter = VK_FILTER_LINEAR;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  if (vkCreateSampler (device, &samplerInfo, allocator, &sampler)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to create quad sampler!");
+    }
+
+  VkDescriptorPoolSize poolSizes[2]{};
+  poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  poolSizes[0].descriptorCount = MAX_FRAMES_IN_FLIGHT;
+  poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSizes[1].descriptorCount = MAX_TEXTURES;
+
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.maxSets = MAX_FRAMES_IN_FLIGHT + MAX_TEXTURES;
+  poolInfo.poolSizeCount = 2;
+  poolInfo.pPoolSizes = poolSizes;
+  if (vkCreateDescriptorPool (device, &poolInfo, allocator, &descriptorPool)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to create quad descriptor pool!");
+    }
+
+  createPipeline (pipelineCache, renderPass);
+  createIndexBuffer ();
+
+  // Written on each slot's first begin and whenever its stream grows
+  VkDescriptorSetLayout layouts[MAX_FRAMES_IN_FLIGHT];
+  std::fill_n (layouts, MAX_FRAMES_IN_FLIGHT, streamSetLayout);
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
+  allocInfo.pSetLayouts = layouts;
+  if (vkAllocateDescriptorSets (device, &allocInfo, streamSets)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to allocate quad descriptor sets!");
+    }
+}
+
+void
+QuadBatcher::createPipeline (VkPipelineCache pipelineCache,
+                             VkRenderPass renderPass)
+{
+  VkDescriptorSetLayoutBinding binding{};
+  binding.binding = 0;
+  binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  binding.descriptorCount = 1;
+  binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = 1;
+  layoutInfo.pBindings = &binding;
+  if (vkCreateDescriptorSetLayout (device, &layoutInfo, allocator,
+                                   &streamSetLayout)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error (
+          "Failed to create quad descriptor set layout!");
+    }
+
+  binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  if (vkCreateDescriptorSetLayout (device, &layoutInfo, allocator,
+                                   &textureSetLayout)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error (
+          "Failed to create quad descriptor set layout!");
+    }
+
+  // The stream stays bound for the whole frame, only the texture set
+  // changes between batches
+  VkDescriptorSetLayout setLayouts[2] = { streamSetLayout, textureSetLayout };
+  VkPushConstantRange pushConstantRange{};
+  pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  pushConstantRange.size = sizeof (QuadConstants);
+
+  VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutInfo.setLayoutCount = 2;
+  pipelineLayoutInfo.pSetLayouts = setLayouts;
+  pipelineLayoutInfo.pushConstantRangeCount = 1;
+  pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+  if (vkCreatePipelineLayout (device, &pipelineLayoutInfo, allocator,
+                              &layout)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to create quad pipeline layout!");
+    }
+
+  pipelines.init (device, pipelineCache, layout, renderPass, false,
+                  allocator);
+  pipelines.setShader (SHADER_QUAD_VERT, "shaders/quad_vert.spv");
+  pipelines.setShader (SHADER_QUAD_FRAG, "shaders/quad_frag.spv");
+  pipeline = pipelines.get (QUAD_PIPELINE);
+}
+
+void
+QuadBatcher::createIndexBuffer ()
+{
+  // Corners 0 1 / 2 3, quad.vert takes the corner from the vertex index.
+  // Never written again, so host visible memory costs nothing on the GPU
+  // side where it is device local too.
+  uint32_t indexCount = QuadStream::MAX_CHUNK_QUADS * 6;
+  indices = createBuffer (physicalDevice, device,
+                          indexCount * sizeof (uint16_t),
+                          VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                              | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true,
+                          allocator);
+
+  static const uint16_t CORNERS[6] = { 0, 1, 2, 2, 1, 3 };
+  uint16_t *data = static_cast<uint16_t *> (indices.mapped);
+  for (uint32_t quad = 0; quad < QuadStream::MAX_CHUNK_QUADS; quad++)
+    {
+      for (uint32_t i = 0; i < 6; i++)
+        {
+          data[quad * 6 + i] = static_cast<uint16_t> (quad * 4 + CORNERS[i]);
+        }
+    }
+}
+
+uint32_t
+QuadBatcher::addTexture (VkImageView view)
+{
+  if (textureSets.size () == MAX_TEXTURES)
+    {
+      throw std::runtime_error ("Too many quad textures!");
+    }
+
+  VkDescriptorSetAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &textureSetLayout;
+  VkDescriptorSet set;
+  if (vkAllocateDescriptorSets (device, &allocInfo, &set) != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to allocate quad descriptor set!");
+    }
+
+  VkDescriptorImageInfo imageInfo{};
+  imageInfo.sampler = sampler;
+  imageInfo.imageView = view;
+  imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+  VkWriteDescriptorSet write{};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstSet = set;
+  write.dstBinding = 0;
+  write.descriptorCount = 1;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  write.pImageInfo = &imageInfo;
+  vkUpdateDescriptorSets (device, 1, &write, 0, nullptr);
+
+  textureSets.push_back (set);
+  return static_cast<uint32_t> (textureSets.size () - 1);
+}
+
+void
+QuadBatcher::reserve (uint32_t quadCount)
+{
+  uint32_t textureCount
+      = std::max (static_cast<uint32_t> (textureSets.size ()), 1u);
+  uint32_t needed = QuadStream::capacityFor (quadCount, textureCount);
+  // vertex offsets are signed 32 bit, four vertices per quad
+  quadCapacity = std::max (quadCapacity,
+                           std::min (needed, uint32_t (INT32_MAX / 4)));
+}
+
+void
+QuadBatcher::begin (uint32_t frame)
+{
+  this->frame = frame;
+
+  // The slot's last frame is done, nothing else reads its stream, so it
+  // can be replaced without waiting for the device
+  GpuBuffer &buffer = streams[frame];
+  VkDeviceSize size = VkDeviceSize (quadCapacity) * sizeof (Quad);
+  if (buffer.size < size)
+    {
+      destroyBuffer (device, buffer, allocator);
+      // NOTE: Device local and host visible is write-combined memory the
+      // GPU reads at full speed, without it the stream lives in system
+      // memory and is read over the bus
+      buffer = createBuffer (physicalDevice, device, size,
+                             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                                 | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true,
+                             allocator);
+
+      VkDescriptorBufferInfo bufferInfo{};
+      bufferInfo.buffer = buffer.buffer;
+      bufferInfo.range = VK_WHOLE_SIZE;
+
+      VkWriteDescriptorSet write{};
+      write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      write.dstSet = streamSets[frame];
+      write.dstBinding = 0;
+      write.descriptorCount = 1;
+      write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      write.pBufferInfo = &bufferInfo;
+      vkUpdateDescriptorSets (device, 1, &write, 0, nullptr);
+    }
+
+  stream.begin (static_cast<Quad *> (buffer.mapped), quadCapacity);
+}
+
+void
+QuadBatcher::end ()
+{
+  const std::vector<QuadBatch> &batches = stream.end ();
+
+  QuadBatcherStats stats;
+  stats.quads = stream.quadCount ();
+  stats.draws = static_cast<uint32_t> (batches.size ());
+  for (size_t i = 0; i < batches.size (); i++)
+    {
+      if (i == 0 || batches[i].texture != batches[i - 1].texture)
+        {
+          stats.textureBinds++;
+        }
+    }
+  stats.dropped = stream.dropped ();
+  lastStats = stats;
+}
+
+void
+QuadBatcher::record (VkCommandBuffer buffer, VkExtent2D canvas)
+{
+  const std::vector<QuadBatch> &batches = stream.batches ();
+  if (batches.empty ())
+    {
+      return;
+    }
+
+  vkCmdBindPipeline (buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+  vkCmdBindDescriptorSets (buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout,
+                           0, 1, &streamSets[frame], 0, nullptr);
+  vkCmdBindIndexBuffer (buffer, indices.buffer, 0, VK_INDEX_TYPE_UINT16);
+
+  QuadConstants constants;
+  constants.pixelToClip[0] = 2.0f / std::max (canvas.width, 1u);
+  constants.pixelToClip[1] = 2.0f / std::max (canvas.height, 1u);
+  vkCmdPushConstants (buffer, layout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                      sizeof (constants), &constants);
+
+  // The batches are ordered by texture, each texture is bound once
+  uint32_t bound = UINT32_MAX;
+  for (const QuadBatch &batch : batches)
+    {
+      if (batch.texture != bound)
+        {
+          vkCmdBindDescriptorSets (buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                   layout, 1, 1, &textureSets[batch.texture],
+                                   0, nullptr);
+          bound = batch.texture;
+        }
+      vkCmdDrawIndexed (buffer, batch.quadCount * 6, 1, 0,
+                        static_cast<int32_t> (batch.firstQuad * 4), 0);
+    }
+}
+
+void
+QuadBatcher::cleanup ()
+{
+  for (GpuBuffer &buffer : streams)
+    {
+      destroyBuffer (device, buffer, allocator);
+    }
+  destroyBuffer (device, indices, allocator);
+  textureSets.clear ();
+  quadCapacity = 0;
+  lastStats = QuadBatcherStats{};
+
+  pipelines.cleanup ();
+  pipeline = VK_NULL_HANDLE;
+  // frees the descriptor sets with it
+  vkDestroyDescriptorPool (device, descriptorPool, allocator);
+  vkDestroyPipelineLayout (device, layout, allocator);
+  vkDestroyDescriptorSetLayout (device, streamSetLayout, allocator);
+  vkDestroyDescriptorSetLayout (device, textureSetLayout, allocator);
+  vkDestroySampler (device, sampler, allocator);
+  device = VK_NULL_HANDLE;
+}
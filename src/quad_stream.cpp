@@ -0,0 +1,102 @@
+#include "../include/quad_stream.hpp"
+#include <algorithm>
+#include <cstdint>
+using namespace VulkanApp;
+
+// std::min and std::max take them by reference
+const uint32_t QuadStream::MIN_CHUNK_QUADS;
+const uint32_t QuadStream::MAX_CHUNK_QUADS;
+
+uint32_t
+QuadStream::capacityFor (uint32_t quadCount, uint32_t textureCount)
+{
+  // Chunks double from MIN_CHUNK_QUADS, so a texture's last chunk is at
+  // most MIN_CHUNK_QUADS larger than all of its quads
+  uint64_t slack = std::min (
+      uint64_t (quadCount) + uint64_t (textureCount) * MIN_CHUNK_QUADS,
+      uint64_t (textureCount) * MAX_CHUNK_QUADS);
+  return static_cast<uint32_t> (
+      std::min<uint64_t> (quadCount + slack, UINT32_MAX));
+}
+
+void
+QuadStream::begin (Quad *quads, uint32_t capacity)
+{
+  this->quads = quads;
+  this->capacity = capacity;
+  allocated = 0;
+  chunks.assign (chunks.size (), Chunk{});
+  frameBatches.clear ();
+  count = 0;
+  droppedCount = 0;
+}
+
+Quad *
+QuadStream::addChunk (uint32_t texture)
+{
+  if (texture >= chunks.size ())
+    {
+      chunks.resize (texture + 1);
+    }
+
+  // The texture's last chunk is full, its batch already counts all of it
+  Chunk &chunk = chunks[texture];
+  uint32_t size = std::min (std::max (chunk.size * 2, MIN_CHUNK_QUADS),
+                            MAX_CHUNK_QUADS);
+  size = std::min (size, capacity - allocated);
+  if (size == 0)
+    {
+      droppedCount++;
+      return &overflow;
+    }
+
+  chunk.next = allocated;
+  chunk.end = allocated + size;
+  chunk.size = size;
+  chunk.batch = static_cast<uint32_t> (frameBatches.size ());
+  frameBatches.push_back ({ texture, allocated, size });
+  allocated += size;
+  return quads + chunk.next++;
+}
+
+const std::vector<QuadBatch> &
+QuadStream::end ()
+{
+  for (const Chunk &chunk : chunks)
+    {
+      if (chunk.size != 0)
+        {
+          QuadBatch &batch = frameBatches[chunk.batch];
+          batch.quadCount = chunk.next - batch.firstQuad;
+        }
+    }
+
+  // Chunks were handed out in the order they filled up, sorting keeps
+  // each texture's in that order so the ones allocated back to back end up
+  // next to each other
+  std::stable_sort (frameBatches.begin (), frameBatches.end (),
+                    [] (const QuadBatch &a, const QuadBatch &b) {
+                      return a.texture < b.texture;
+                    });
+
+  size_t merged = 0;
+  count = 0;
+  for (const QuadBatch &batch : frameBatches)
+    {
+      count += batch.quadCount;
+      if (merged != 0)
+        {
+          QuadBatch &last = frameBatches[merged - 1];
+          if (last.texture == batch.texture
+              && last.firstQuad + last.quadCount == batch.firstQuad
+              && last.quadCount + batch.quadCount <= MAX_CHUNK_QUADS)
+            {
+              last.quadCount += batch.quadCount;
+              continue;
+            }
+        }
+      frameBatches[merged++] = batch;
+    }
+  frameBatches.resize (merged);
+  return frameBatches;
+}
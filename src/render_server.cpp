@@ -0,0 +1,340 @@
+#include "../include/render_server.hpp"
+#include "../include/vulkan_triangle.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+using namespace VulkanApp;
+
+static const char *SHUTDOWN_FILE = "shutdown";
+
+RenderJob
+VulkanApp::parseRenderJob (const std::filesystem::path &file,
+                           uint32_t maxSize)
+{
+  std::ifstream in (file);
+  if (!in)
+    {
+      throw std::runtime_error ("Failed to open " + file.string () + "!");
+    }
+
+  RenderJob job;
+  job.scene.name = file.stem ().string ();
+  // the camera stays where the job puts it
+  job.scene.animating = false;
+  bool columns = false;
+
+  std::string line;
+  for (int number = 1; std::getline (in, line); number++)
+    {
+      std::istringstream fields (line);
+      std::string key;
+      if (!(fields >> key) || key[0] == '#')
+        {
+          continue;
+        }
+
+      bool parsed = true;
+      if (key == "output")
+        {
+          parsed = static_cast<bool> (
+              std::getline (fields >> std::ws, job.output));
+        }
+      else if (key == "width")
+        {
+          parsed = fields >> job.width && job.width != 0;
+        }
+      else if (key == "height")
+        {
+          parsed = fields >> job.height && job.height != 0;
+        }
+      else if (key == "instances")
+        {
+          parsed = static_cast<bool> (fields >> job.scene.instanceCount);
+        }
+      else if (key == "columns")
+        {
+          parsed = fields >> job.scene.constants.columns
+                   && job.scene.constants.columns != 0;
+          columns = true;
+        }
+      else if (key == "scale")
+        {
+          parsed = static_cast<bool> (fields >> job.scene.constants.scale);
+        }
+      else if (key == "quads")
+        {
+          parsed = static_cast<bool> (fields >> job.scene.quadCount);
+        }
+      else if (key == "particles")
+        {
+          parsed = static_cast<bool> (fields >> job.scene.particleCount);
+        }
+      else if (key == "camera")
+        {
+          parsed = static_cast<bool> (fields >> job.cameraAngle);
+        }
+      else if (key == "frame")
+        {
+          parsed = static_cast<bool> (fields >> job.frame);
+        }
+      else
+        {
+          throw std::runtime_error (file.string () + ":"
+                                    + std::to_string (number)
+                                    + ": unknown key " + key);
+        }
+
+      if (!parsed)
+        {
+          throw std::runtime_error (file.string () + ":"
+                                    + std::to_string (number)
+                                    + ": bad value for " + key);
+        }
+    }
+
+  if (job.output.empty ())
+    {
+      throw std::runtime_error (file.string () + ": no output");
+    }
+  // Checked here so the defaults are too, the device may be small
+  if (job.width > maxSize || job.height > maxSize)
+    {
+      throw std::runtime_error (file.string () + ": larger than the device's "
+                                + std::to_string (maxSize) + " pixels");
+    }
+  // Relative to the spool directory, not to wherever the server runs
+  std::filesystem::path output (job.output);
+  if (output.is_relative ())
+    {
+      job.output = (file.parent_path () / output).string ();
+    }
+  if (!columns)
+    {
+      job.scene.constants.columns = std::max (
+          1u, static_cast<uint32_t> (std::ceil (
+                  std::sqrt (static_cast<double> (job.scene.instanceCount)))));
+    }
+  return job;
+}
+
+RenderServer::RenderServer (VulkanTriangleApplication &app,
+                            const ServerSettings &settings)
+    : app (app), settings (settings), spool (settings.spoolDirectory)
+{
+}
+
+void
+RenderServer::run ()
+{
+  std::filesystem::create_directories (spool);
+  printf ("Serving render jobs from %s\n", spool.string ().c_str ());
+
+  auto start = std::chrono::steady_clock::now ();
+  std::filesystem::path shutdown = spool / SHUTDOWN_FILE;
+  while (true)
+    {
+      std::error_code error;
+      if (std::filesystem::exists (shutdown, error))
+        {
+          app.finishFrames ();
+          reap ();
+          std::filesystem::remove (shutdown, error);
+          break;
+        }
+
+      std::vector<RenderJob> jobs = claimJobs ();
+      if (jobs.empty ())
+        {
+          // The last frames only come back once later ones reuse their
+          // slots, with nothing left to render they have to be waited for
+          if (!pending.empty ())
+            {
+              app.finishFrames ();
+              reap ();
+              continue;
+            }
+          std::this_thread::sleep_for (
+              std::chrono::milliseconds (settings.pollMilliseconds));
+          continue;
+        }
+
+      // Changing the size waits for the device, so jobs of one size go
+      // back to back
+      std::stable_sort (jobs.begin (), jobs.end (),
+                        [] (const RenderJob &a, const RenderJob &b) {
+                          return a.width != b.width ? a.width < b.width
+                                                    : a.height < b.height;
+                        });
+      for (const RenderJob &job : jobs)
+        {
+          try
+            {
+              render (job);
+            }
+          catch (const std::exception &e)
+            {
+              finishJob (job.file, false, e.what ());
+            }
+          reap ();
+        }
+    }
+
+  double seconds = std::chrono::duration<double> (
+                       std::chrono::steady_clock::now () - start)
+                       .count ();
+  printf ("Served %llu jobs, %llu failed, in %.2f s (%.1f jobs/s), %llu "
+          "resizes\n",
+          static_cast<unsigned long long> (counters.done + counters.failed),
+          static_cast<unsigned long long> (counters.failed), seconds,
+          seconds > 0.0 ? (counters.done + counters.failed) / seconds : 0.0,
+          static_cast<unsigned long long> (counters.resizes));
+}
+
+std::vector<RenderJob>
+RenderServer::claimJobs ()
+{
+  std::vector<std::filesystem::path> files;
+  for (const auto &entry : std::filesystem::directory_iterator (spool))
+    {
+      if (entry.is_regular_file () && entry.path ().extension () == ".job")
+        {
+          files.push_back (entry.path ());
+        }
+    }
+  std::sort (files.begin (), files.end ());
+
+  uint32_t maxSize = app.maxTargetSize ();
+  std::vector<RenderJob> jobs;
+  for (const std::filesystem::path &file : files)
+    {
+      if (jobs.size () >= settings.batchSize)
+        {
+          break;
+        }
+
+      // Fails when another server got there first
+      std::filesystem::path running = file;
+      running.replace_extension (".running");
+      std::error_code error;
+      std::filesystem::rename (file, running, error);
+      if (error)
+        {
+          continue;
+        }
+
+      RenderJob job;
+      try
+        {
+          job = parseRenderJob (running, maxSize);
+        }
+      catch (const std::exception &e)
+        {
+          finishJob (running, false, e.what ());
+          continue;
+        }
+      job.file = running;
+
+      // reap tells jobs apart by their output, two in flight can't share
+      // one
+      auto sameOutput = [&job] (const RenderJob &other) {
+        return other.output == job.output;
+      };
+      if (std::any_of (jobs.begin (), jobs.end (), sameOutput)
+          || std::any_of (pending.begin (), pending.end (), sameOutput))
+        {
+          finishJob (running, false,
+                     "output " + job.output
+                         + " is already written by another job");
+          continue;
+        }
+      jobs.push_back (std::move (job));
+    }
+  return jobs;
+}
+
+void
+RenderServer::render (const RenderJob &job)
+{
+  if (job.width != width || job.height != height)
+    {
+      // Waits for the device and collects the frames in flight. If it
+      // throws, the next job resizes again.
+      width = 0;
+      height = 0;
+      app.resizeTargets (job.width, job.height);
+      width = job.width;
+      height = job.height;
+      counters.resizes++;
+    }
+
+  std::error_code error;
+  std::filesystem::path parent
+      = std::filesystem::path (job.output).parent_path ();
+  if (!parent.empty ())
+    {
+      std::filesystem::create_directories (parent, error);
+    }
+
+  app.setScene (job.scene);
+  app.setCamera (job.cameraAngle, job.frame);
+  app.requestCapture (job.output);
+  try
+    {
+      app.renderFrame ();
+    }
+  catch (...)
+    {
+      // The next job's frame must not capture to this job's output
+      app.requestCapture (std::string ());
+      throw;
+    }
+  pending.push_back (job);
+}
+
+void
+RenderServer::reap ()
+{
+  for (const CaptureResult &result : app.takeCaptureResults ())
+    {
+      auto job = std::find_if (pending.begin (), pending.end (),
+                               [&result] (const RenderJob &job) {
+                                 return job.output == result.path;
+                               });
+      if (job == pending.end ())
+        {
+          continue;
+        }
+      finishJob (job->file, result.written, result.error);
+      pending.erase (job);
+    }
+}
+
+void
+RenderServer::finishJob (const std::filesystem::path &file, bool written,
+                         const std::string &error)
+{
+  std::filesystem::path finished = file;
+  if (written)
+    {
+      finished.replace_extension (".done");
+      counters.done++;
+    }
+  else
+    {
+      // The reason goes at the end of the job file
+      std::ofstream (file, std::ios::app) << "# failed: " << error << "\n";
+      std::cerr << "Render job " << file.stem ().string ()
+                << " failed: " << error << std::endl;
+      finished.replace_extension (".failed");
+      counters.failed++;
+    }
+
+  std::error_code renameError;
+  std::filesystem::rename (file, finished, renameError);
+}
@@ -0,0 +1,55 @@
+#include "../include/resolution_scaler.hpp"
+#include <algorithm>
+#include <cmath>
+using namespace VulkanApp;
+
+// weight of the newest measurement in the moving average
+static const double SMOOTHING = 0.2;
+// aim a bit below the target so noise doesn't push frames over it
+static const double HEADROOM = 0.9;
+// largest relative change of the scale per frame
+static const float MAX_STEP = 0.05f;
+// changes smaller than this aren't worth a different render area
+static const float DEAD_BAND = 0.01f;
+
+ResolutionScaler::ResolutionScaler (const ResolutionScalerSettings &settings)
+    : settings (settings)
+{
+  this->settings.minScale
+      = std::min (std::max (settings.minScale, 0.1f), 1.0f);
+}
+
+float
+ResolutionScaler::update (double gpuMilliseconds)
+{
+  if (!enabled () || gpuMilliseconds <= 0.0)
+    {
+      return currentScale;
+    }
+
+  smoothed = smoothed == 0.0
+                 ? gpuMilliseconds
+                 : smoothed + (gpuMilliseconds - smoothed) * SMOOTHING;
+
+  float desired = currentScale
+                  * static_cast<float> (std::sqrt (
+                      settings.targetMilliseconds * HEADROOM / smoothed));
+  desired = std::min (std::max (desired, currentScale * (1.0f - MAX_STEP)),
+                      currentScale * (1.0f + MAX_STEP));
+  desired = std::min (std::max (desired, settings.minScale), 1.0f);
+
+  if (std::fabs (desired - currentScale) >= DEAD_BAND || desired == 1.0f
+      || desired == settings.minScale)
+    {
+      currentScale = desired;
+    }
+  return currentScale;
+}
+
+uint32_t
+ResolutionScaler::scaled (uint32_t size) const
+{
+  uint32_t result
+      = static_cast<uint32_t> (std::lround (size * double (currentScale)));
+  return std::min (std::max (result, 1u), size);
+}
@@ -0,0 +1,102 @@
+#include "../include/sort_keys.hpp"
+#include <cstring>
+#include <utility>
+using namespace VulkanApp;
+
+// Below this many keys clearing and scanning the histograms costs more than
+// just sorting in place.
+static const size_t INSERTION_SORT_THRESHOLD = 32;
+
+static void
+insertionSort (uint64_t *keys, uint32_t *values, size_t count)
+{
+  for (size_t i = 1; i < count; i++)
+    {
+      uint64_t key = keys[i];
+      uint32_t value = values[i];
+      size_t j = i;
+
+      while (j > 0 && keys[j - 1] > key)
+        {
+          keys[j] = keys[j - 1];
+          values[j] = values[j - 1];
+          j--;
+        }
+
+      keys[j] = key;
+      values[j] = value;
+    }
+}
+
+void
+RadixSorter::sort (uint64_t *keys, uint32_t *values, size_t count)
+{
+  if (count <= INSERTION_SORT_THRESHOLD)
+    {
+      insertionSort (keys, values, count);
+      return;
+    }
+
+  const int PASSES = 8;
+  const int BUCKETS = 256;
+
+  keysScratch.resize (count);
+  valuesScratch.resize (count);
+
+  // One read over the keys builds the histograms for every pass
+  size_t histograms[PASSES][BUCKETS];
+  std::memset (histograms, 0, sizeof (histograms));
+
+  for (size_t i = 0; i < count; i++)
+    {
+      uint64_t key = keys[i];
+      for (int pass = 0; pass < PASSES; pass++)
+        {
+          histograms[pass][(key >> (pass * 8)) & 0xff]++;
+        }
+    }
+
+  uint64_t *srcKeys = keys;
+  uint32_t *srcValues = values;
+  uint64_t *dstKeys = keysScratch.data ();
+  uint32_t *dstValues = valuesScratch.data ();
+
+  for (int pass = 0; pass < PASSES; pass++)
+    {
+      size_t *histogram = histograms[pass];
+      const int shift = pass * 8;
+
+      // A digit shared by every key can't change the order, which is the
+      // common case for the pipeline and descriptor set bits
+      if (histogram[(srcKeys[0] >> shift) & 0xff] == count)
+        {
+          continue;
+        }
+
+      size_t offset = 0;
+      for (int bucket = 0; bucket < BUCKETS; bucket++)
+        {
+          size_t bucketCount = histogram[bucket];
+          histogram[bucket] = offset;
+          offset += bucketCount;
+        }
+
+      for (size_t i = 0; i < count; i++)
+        {
+          uint64_t key = srcKeys[i];
+          size_t destination = histogram[(key >> shift) & 0xff]++;
+          dstKeys[destination] = key;
+          dstValues[destination] = srcValues[i];
+        }
+
+      std::swap (srcKeys, dstKeys);
+      std::swap (srcValues, dstValues);
+    }
+
+  // An odd number of scatter passes leaves the result in the scratch arrays
+  if (srcKeys != keys)
+    {
+      std::memcpy (keys, srcKeys, count * sizeof (uint64_t));
+      std::memcpy (values, srcValues, count * sizeof (uint32_t));
+    }
+}
@@ -0,0 +1,144 @@
+#include "../include/texture.hpp"
+#include "../include/buffer_utils.hpp"
+#include <cstring>
+#include <stdexcept>
+using namespace VulkanApp;
+
+GpuImage
+VulkanApp::createTexture (VkPhysicalDevice physicalDevice, VkDevice device,
+                          VkCommandPool commandPool, VkQueue queue,
+                          VkFormat format, uint32_t width, uint32_t height,
+                          const void *pixels, size_t size,
+                          const VkAllocationCallbacks *allocator)
+{
+  GpuImage texture;
+  texture.extent = { width, height };
+  texture.format = format;
+
+  VkImageCreateInfo imageInfo{};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.format = format;
+  imageInfo.extent = { width, height, 1 };
+  imageInfo.mipLevels = 1;
+  imageInfo.arrayLayers = 1;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.usage
+      = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  if (vkCreateImage (device, &imageInfo, allocator, &texture.image)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to create texture!");
+    }
+
+  VkMemoryRequirements memRequirements;
+  vkGetImageMemoryRequirements (device, texture.image, &memRequirements);
+  VkMemoryAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = memRequirements.size;
+  allocInfo.memoryTypeIndex
+      = findMemoryType (physicalDevice, memRequirements.memoryTypeBits,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  if (vkAllocateMemory (device, &allocInfo, allocator, &texture.memory)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to allocate texture memory!");
+    }
+  vkBindImageMemory (device, texture.image, texture.memory, 0);
+
+  VkImageViewCreateInfo viewInfo{};
+  viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.image = texture.image;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format = format;
+  viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  viewInfo.subresourceRange.levelCount = 1;
+  viewInfo.subresourceRange.layerCount = 1;
+  if (vkCreateImageView (device, &viewInfo, allocator, &texture.view)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to create texture view!");
+    }
+
+  GpuBuffer staging = createBuffer (
+      physicalDevice, device, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+          | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      0, true, allocator);
+  std::memcpy (staging.mapped, pixels, size);
+
+  VkCommandBufferAllocateInfo bufferInfo{};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  bufferInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  bufferInfo.commandPool = commandPool;
+  bufferInfo.commandBufferCount = 1;
+
+  VkCommandBuffer buffer;
+  if (vkAllocateCommandBuffers (device, &bufferInfo, &buffer) != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to allocate upload command buffer!");
+    }
+
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer (buffer, &beginInfo);
+
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = texture.image;
+  barrier.subresourceRange = viewInfo.subresourceRange;
+  vkCmdPipelineBarrier (buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                        nullptr, 1, &barrier);
+
+  VkBufferImageCopy region{};
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.layerCount = 1;
+  region.imageExtent = { width, height, 1 };
+  vkCmdCopyBufferToImage (buffer, staging.buffer, texture.image,
+                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  vkCmdPipelineBarrier (buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr,
+                        0, nullptr, 1, &barrier);
+
+  vkEndCommandBuffer (buffer);
+
+  VkSubmitInfo submitInfo{};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &buffer;
+  if (vkQueueSubmit (queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to submit texture upload!");
+    }
+  vkQueueWaitIdle (queue);
+
+  vkFreeCommandBuffers (device, commandPool, 1, &buffer);
+  destroyBuffer (device, staging, allocator);
+  return texture;
+}
+
+void
+VulkanApp::destroyTexture (VkDevice device, GpuImage &texture,
+                           const VkAllocationCallbacks *allocator)
+{
+  vkDestroyImageView (device, texture.view, allocator);
+  vkDestroyImage (device, texture.image, allocator);
+  vkFreeMemory (device, texture.memory, allocator);
+  texture = GpuImage{};
+}
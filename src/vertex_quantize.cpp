@@ -0,0 +1,418 @@
+#include "../include/vertex_quantize.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+using namespace VulkanApp;
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#endif
+
+// F16C isn't part of the x86-64 baseline, so it is compiled in with a target
+// attribute and only used after checking the CPU at runtime
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_F16C 1
+#endif
+
+// Maps positions within the bounds to 0..65535
+static void
+boundsScale (const MeshBounds &bounds, float scale[3])
+{
+  for (int k = 0; k < 3; k++)
+    {
+      float extent = bounds.max[k] - bounds.min[k];
+      scale[k] = extent > 0.0f ? 65535.0f / extent : 0.0f;
+    }
+}
+
+static float
+clamp (float value, float low, float high)
+{
+  return std::min (std::max (value, low), high);
+}
+
+// Scalar reference encoders, also used for the tails of the SIMD loops.
+// They do the same operations in the same order so both paths produce
+// identical output.
+
+static void
+encodePosition (const Vertex &vertex, const MeshBounds &bounds,
+                const float scale[3], PackedVertex &packed)
+{
+  for (int k = 0; k < 3; k++)
+    {
+      float unit = clamp ((vertex.position[k] - bounds.min[k]) * scale[k],
+                          0.0f, 65535.0f);
+      packed.position[k] = static_cast<uint16_t> (std::lrint (unit));
+    }
+  packed.position[3] = 0;
+}
+
+static void
+encodeNormal (const Vertex &vertex, PackedVertex &packed)
+{
+  float x = vertex.normal[0];
+  float y = vertex.normal[1];
+  float z = vertex.normal[2];
+  float l1 = std::fabs (x) + std::fabs (y) + std::fabs (z);
+  float inverse = l1 > 0.0f ? 1.0f / l1 : 1.0f;
+  x *= inverse;
+  y *= inverse;
+
+  // Fold the lower hemisphere over the diagonals of the octahedron
+  if (z < 0.0f)
+    {
+      float foldedX = std::copysign (1.0f - std::fabs (y), x);
+      float foldedY = std::copysign (1.0f - std::fabs (x), y);
+      x = foldedX;
+      y = foldedY;
+    }
+
+  packed.normal[0]
+      = static_cast<int16_t> (std::lrint (clamp (x, -1.0f, 1.0f) * 32767.0f));
+  packed.normal[1]
+      = static_cast<int16_t> (std::lrint (clamp (y, -1.0f, 1.0f) * 32767.0f));
+}
+
+static void
+encodeColor (const Vertex &vertex, PackedVertex &packed)
+{
+  for (int k = 0; k < 4; k++)
+    {
+      packed.color[k] = static_cast<uint8_t> (
+          std::lrint (clamp (vertex.color[k], 0.0f, 1.0f) * 255.0f));
+    }
+}
+
+uint16_t
+VulkanApp::floatToHalf (float value)
+{
+  // Round to nearest even, overflow goes to infinity and NaN stays NaN
+  uint32_t bits;
+  std::memcpy (&bits, &value, sizeof (bits));
+  uint32_t sign = (bits >> 16) & 0x8000u;
+  bits &= 0x7fffffffu;
+
+  if (bits >= (127u + 16u) << 23)
+    {
+      return static_cast<uint16_t> (sign
+                                    | (bits > 0x7f800000u ? 0x7e00u : 0x7c00u));
+    }
+  if (bits < 113u << 23)
+    {
+      // Result is a denormal, let the FPU do the rounding by adding a magic
+      // number that shifts the mantissa into place
+      const uint32_t magicBits = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+      float magic, shifted;
+      std::memcpy (&magic, &magicBits, sizeof (magic));
+      std::memcpy (&shifted, &bits, sizeof (shifted));
+      shifted += magic;
+      std::memcpy (&bits, &shifted, sizeof (bits));
+      return static_cast<uint16_t> (sign | (bits - magicBits));
+    }
+
+  uint32_t mantissaOdd = (bits >> 13) & 1u;
+  bits -= (127u - 15u) << 23;
+  bits += 0xfffu + mantissaOdd;
+  return static_cast<uint16_t> (sign | (bits >> 13));
+}
+
+float
+VulkanApp::halfToFloat (uint16_t value)
+{
+  uint32_t sign = static_cast<uint32_t> (value & 0x8000u) << 16;
+  uint32_t exponent = (value >> 10) & 0x1fu;
+  uint32_t mantissa = value & 0x3ffu;
+
+  if (exponent == 0)
+    {
+      float result = std::ldexp (static_cast<float> (mantissa), -24);
+      return sign != 0 ? -result : result;
+    }
+
+  uint32_t bits = exponent == 31
+                      ? sign | 0x7f800000u | (mantissa << 13)
+                      : sign | ((exponent + 112u) << 23) | (mantissa << 13);
+  float result;
+  std::memcpy (&result, &bits, sizeof (result));
+  return result;
+}
+
+#if HAVE_SSE2
+// Four vertices per iteration. Positions and colors are converted straight
+// from the interleaved vertices, normals are transposed to one register per
+// component for the octahedral fold.
+static size_t
+quantizeSse2 (const Vertex *vertices, size_t count, const MeshBounds &bounds,
+              const float scale[3], PackedVertex *packed)
+{
+  const __m128 positionMin
+      = _mm_setr_ps (bounds.min[0], bounds.min[1], bounds.min[2], 0.0f);
+  // w is zeroed by a zero scale, it's padding in the packed vertex
+  const __m128 positionScale
+      = _mm_setr_ps (scale[0], scale[1], scale[2], 0.0f);
+  const __m128 zero = _mm_setzero_ps ();
+  const __m128 one = _mm_set1_ps (1.0f);
+  const __m128 signMask = _mm_set1_ps (-0.0f);
+  const __m128i bias16 = _mm_set1_epi32 (32768);
+  const __m128i flip16 = _mm_set1_epi16 (static_cast<short> (0x8000));
+
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4)
+    {
+      const Vertex *v = vertices + i;
+      PackedVertex *out = packed + i;
+
+      // Positions, unsigned 16-bit has no saturating pack in SSE2 so the
+      // values are biased into signed range and flipped back afterwards
+      __m128i p[4];
+      for (int j = 0; j < 4; j++)
+        {
+          // Reads position and normal[0], the latter is scaled away
+          __m128 position = _mm_loadu_ps (v[j].position);
+          __m128 unit = _mm_mul_ps (_mm_sub_ps (position, positionMin),
+                                    positionScale);
+          unit = _mm_min_ps (_mm_max_ps (unit, zero), _mm_set1_ps (65535.0f));
+          p[j] = _mm_sub_epi32 (_mm_cvtps_epi32 (unit), bias16);
+        }
+      __m128i p01 = _mm_xor_si128 (_mm_packs_epi32 (p[0], p[1]), flip16);
+      __m128i p23 = _mm_xor_si128 (_mm_packs_epi32 (p[2], p[3]), flip16);
+      _mm_storel_epi64 (reinterpret_cast<__m128i *> (out[0].position), p01);
+      _mm_storel_epi64 (reinterpret_cast<__m128i *> (out[1].position),
+                        _mm_srli_si128 (p01, 8));
+      _mm_storel_epi64 (reinterpret_cast<__m128i *> (out[2].position), p23);
+      _mm_storel_epi64 (reinterpret_cast<__m128i *> (out[3].position),
+                        _mm_srli_si128 (p23, 8));
+
+      // Normals
+      __m128 x = _mm_loadu_ps (v[0].normal);
+      __m128 y = _mm_loadu_ps (v[1].normal);
+      __m128 z = _mm_loadu_ps (v[2].normal);
+      __m128 w = _mm_loadu_ps (v[3].normal);
+      _MM_TRANSPOSE4_PS (x, y, z, w);
+
+      __m128 l1 = _mm_add_ps (
+          _mm_add_ps (_mm_andnot_ps (signMask, x), _mm_andnot_ps (signMask, y)),
+          _mm_andnot_ps (signMask, z));
+      __m128 nonZero = _mm_cmpgt_ps (l1, zero);
+      __m128 inverse = _mm_and_ps (_mm_div_ps (one, l1), nonZero);
+      inverse = _mm_or_ps (inverse, _mm_andnot_ps (nonZero, one));
+      x = _mm_mul_ps (x, inverse);
+      y = _mm_mul_ps (y, inverse);
+
+      __m128 foldedX
+          = _mm_or_ps (_mm_sub_ps (one, _mm_andnot_ps (signMask, y)),
+                       _mm_and_ps (x, signMask));
+      __m128 foldedY
+          = _mm_or_ps (_mm_sub_ps (one, _mm_andnot_ps (signMask, x)),
+                       _mm_and_ps (y, signMask));
+      __m128 lower = _mm_cmplt_ps (z, zero);
+      x = _mm_or_ps (_mm_and_ps (lower, foldedX), _mm_andnot_ps (lower, x));
+      y = _mm_or_ps (_mm_and_ps (lower, foldedY), _mm_andnot_ps (lower, y));
+
+      const __m128 snormScale = _mm_set1_ps (32767.0f);
+      __m128i nx = _mm_cvtps_epi32 (_mm_mul_ps (x, snormScale));
+      __m128i ny = _mm_cvtps_epi32 (_mm_mul_ps (y, snormScale));
+      __m128i nxy
+          = _mm_unpacklo_epi16 (_mm_packs_epi32 (nx, nx),
+                                _mm_packs_epi32 (ny, ny));
+
+      // Colors
+      const __m128 unormScale = _mm_set1_ps (255.0f);
+      __m128i c[4];
+      for (int j = 0; j < 4; j++)
+        {
+          __m128 color = _mm_loadu_ps (v[j].color);
+          color = _mm_min_ps (_mm_max_ps (color, zero), one);
+          c[j] = _mm_cvtps_epi32 (_mm_mul_ps (color, unormScale));
+        }
+      __m128i rgba = _mm_packus_epi16 (_mm_packs_epi32 (c[0], c[1]),
+                                       _mm_packs_epi32 (c[2], c[3]));
+
+      for (int j = 0; j < 4; j++)
+        {
+          int32_t normal = _mm_cvtsi128_si32 (nxy);
+          int32_t color = _mm_cvtsi128_si32 (rgba);
+          std::memcpy (out[j].normal, &normal, sizeof (normal));
+          std::memcpy (out[j].color, &color, sizeof (color));
+          nxy = _mm_srli_si128 (nxy, 4);
+          rgba = _mm_srli_si128 (rgba, 4);
+        }
+    }
+  return i;
+}
+#endif
+
+#if HAVE_F16C
+__attribute__ ((target ("f16c"))) static size_t
+quantizeUvsF16c (const Vertex *vertices, size_t count, PackedVertex *packed)
+{
+  size_t i = 0;
+  for (; i + 2 <= count; i += 2)
+    {
+      __m128 uv = _mm_setr_ps (vertices[i].uv[0], vertices[i].uv[1],
+                               vertices[i + 1].uv[0], vertices[i + 1].uv[1]);
+      __m128i half = _mm_cvtps_ph (uv, _MM_FROUND_TO_NEAREST_INT);
+      uint64_t bits = static_cast<uint64_t> (_mm_cvtsi128_si64 (half));
+      std::memcpy (packed[i].uv, &bits, sizeof (packed[i].uv));
+      bits >>= 32;
+      std::memcpy (packed[i + 1].uv, &bits, sizeof (packed[i + 1].uv));
+    }
+  return i;
+}
+#endif
+
+void
+VulkanApp::quantizeVertices (const Vertex *vertices, size_t count,
+                             const MeshBounds &bounds, PackedVertex *packed,
+                             bool useSimd)
+{
+  float scale[3];
+  boundsScale (bounds, scale);
+
+  size_t done = 0;
+#if HAVE_SSE2
+  if (useSimd)
+    {
+      done = quantizeSse2 (vertices, count, bounds, scale, packed);
+    }
+#endif
+  for (size_t i = done; i < count; i++)
+    {
+      encodePosition (vertices[i], bounds, scale, packed[i]);
+      encodeNormal (vertices[i], packed[i]);
+      encodeColor (vertices[i], packed[i]);
+    }
+
+  done = 0;
+#if HAVE_F16C
+  if (useSimd && __builtin_cpu_supports ("f16c"))
+    {
+      done = quantizeUvsF16c (vertices, count, packed);
+    }
+#endif
+  for (size_t i = done; i < count; i++)
+    {
+      packed[i].uv[0] = floatToHalf (vertices[i].uv[0]);
+      packed[i].uv[1] = floatToHalf (vertices[i].uv[1]);
+    }
+}
+
+Vertex
+VulkanApp::dequantizeVertex (const PackedVertex &packed,
+                             const MeshBounds &bounds)
+{
+  Vertex vertex;
+  float scale[3], offset[3];
+  positionDecodeTransform (bounds, scale, offset);
+  for (int k = 0; k < 3; k++)
+    {
+      vertex.position[k] = offset[k] + packed.position[k] / 65535.0f * scale[k];
+    }
+
+  // Same as the decode in mesh.vert
+  float x = std::max (packed.normal[0] / 32767.0f, -1.0f);
+  float y = std::max (packed.normal[1] / 32767.0f, -1.0f);
+  float z = 1.0f - std::fabs (x) - std::fabs (y);
+  float t = std::max (-z, 0.0f);
+  x += x >= 0.0f ? -t : t;
+  y += y >= 0.0f ? -t : t;
+  float length = std::sqrt (x * x + y * y + z * z);
+  vertex.normal[0] = x / length;
+  vertex.normal[1] = y / length;
+  vertex.normal[2] = z / length;
+
+  vertex.uv[0] = halfToFloat (packed.uv[0]);
+  vertex.uv[1] = halfToFloat (packed.uv[1]);
+  for (int k = 0; k < 4; k++)
+    {
+      vertex.color[k] = packed.color[k] / 255.0f;
+    }
+  return vertex;
+}
+
+void
+VulkanApp::positionDecodeTransform (const MeshBounds &bounds, float scale[3],
+                                    float offset[3])
+{
+  for (int k = 0; k < 3; k++)
+    {
+      scale[k] = bounds.max[k] - bounds.min[k];
+      offset[k] = bounds.min[k];
+    }
+}
+
+QuantizationError
+VulkanApp::measureQuantizationError (const Vertex *vertices,
+                                     const PackedVertex *packed, size_t count,
+                                     const MeshBounds &bounds)
+{
+  QuantizationError error;
+  if (count == 0)
+    {
+      return error;
+    }
+
+  float diagonal = 0.0f;
+  for (int k = 0; k < 3; k++)
+    {
+      float extent = bounds.max[k] - bounds.min[k];
+      diagonal += extent * extent;
+    }
+  diagonal = diagonal > 0.0f ? std::sqrt (diagonal) : 1.0f;
+
+  double positionSum = 0.0;
+  double normalSum = 0.0;
+  for (size_t i = 0; i < count; i++)
+    {
+      const Vertex &original = vertices[i];
+      Vertex decoded = dequantizeVertex (packed[i], bounds);
+
+      float distance = 0.0f;
+      for (int k = 0; k < 3; k++)
+        {
+          float d = decoded.position[k] - original.position[k];
+          distance += d * d;
+        }
+      distance = std::sqrt (distance) / diagonal;
+
+      // atan2 of |a x b| and a . b stays accurate for tiny angles where acos
+      // of the dot product does not
+      const float *a = original.normal;
+      const float *b = decoded.normal;
+      double crossX = double (a[1]) * b[2] - double (a[2]) * b[1];
+      double crossY = double (a[2]) * b[0] - double (a[0]) * b[2];
+      double crossZ = double (a[0]) * b[1] - double (a[1]) * b[0];
+      double dot = double (a[0]) * b[0] + double (a[1]) * b[1]
+                   + double (a[2]) * b[2];
+      float degrees = static_cast<float> (
+          std::atan2 (std::sqrt (crossX * crossX + crossY * crossY
+                                 + crossZ * crossZ),
+                      dot)
+          * 57.29577951308232);
+
+      error.maxPosition = std::max (error.maxPosition, distance);
+      error.maxNormalDegrees = std::max (error.maxNormalDegrees, degrees);
+      positionSum += distance;
+      normalSum += degrees;
+
+      for (int k = 0; k < 2; k++)
+        {
+          error.maxUv = std::max (
+              error.maxUv, std::fabs (decoded.uv[k] - original.uv[k]));
+        }
+      for (int k = 0; k < 4; k++)
+        {
+          error.maxColor = std::max (
+              error.maxColor,
+              std::fabs (decoded.color[k]
+                         - clamp (original.color[k], 0.0f, 1.0f)));
+        }
+    }
+
+  error.meanPosition = static_cast<float> (positionSum / count);
+  error.meanNormalDegrees = static_cast<float> (normalSum / count);
+  return error;
+}
@@ -1,8 +1,15 @@
 #include "../include/vulkan_triangle.hpp"
+#include "../include/bench_runner.hpp"
+#include "../include/mesh_cache.hpp"
+#include "../include/mesh_simplify.hpp"
+#include "../include/render_server.hpp"
+#include "../include/vertex_quantize.hpp"
 #include <algorithm>
+#include <cmath>
+#include <cstddef>
 #include <cstdint>
+#include <cstdio>
 #include <cstring>
-#include <fstream>
 #include <iostream>
 #include <set>
 #include <stdexcept>
@@ -10,11 +17,110 @@
 #include <vulkan/vulkan_core.h>
 using namespace VulkanApp;
 
-#ifdef NDEBUG
-const bool enableValidationLayers = false;
-#else
-const bool enableValidationLayers = true;
-#endif
+// Shader and vertex input ids registered with the pipeline manager
+enum : uint16_t
+{
+  SHADER_TRIANGLE_VERT,
+  SHADER_TRIANGLE_FRAG,
+  SHADER_MESH_VERT,
+  SHADER_MESH_FRAG,
+};
+
+enum : uint16_t
+{
+  VERTEX_INPUT_NONE,
+  VERTEX_INPUT_MESH,
+};
+
+static constexpr PipelineKey TRIANGLE_PIPELINE
+    = PipelineKey ().withShaders (SHADER_TRIANGLE_VERT, SHADER_TRIANGLE_FRAG);
+
+static constexpr PipelineKey MESH_PIPELINE
+    = PipelineKey ()
+          .withShaders (SHADER_MESH_VERT, SHADER_MESH_FRAG)
+          .withVertexInput (VERTEX_INPUT_MESH)
+          .withDepth (true, true);
+
+// Upper bound on how long the main thread sleeps in glfwWaitEventsTimeout
+// before it checks on the render thread again
+static const double EVENT_WAIT_SECONDS = 0.1;
+
+// Streamable resources are evicted once a device local heap uses more than
+// EVICT_PRESSURE of its budget, and only come back if the heap would stay
+// below RESTORE_PRESSURE with them
+static const double EVICT_PRESSURE = 0.9;
+static const double RESTORE_PRESSURE = 0.75;
+// frames between budget queries when no memory report is due
+static const uint64_t BUDGET_INTERVAL = 30;
+// frames between present latency messages, written at Info
+static const uint64_t LATENCY_LOG_INTERVAL = 600;
+// per frame context, for data written once per frame
+static const VkDeviceSize UPLOAD_RING_SIZE = 1 << 20;
+// frames between occlusion culling messages, written at Info
+static const uint64_t CULLING_LOG_INTERVAL = 600;
+// instances per culling job
+static const uint32_t CULL_CHUNK = 16384;
+// distance between mesh instances, relative to the mesh's larger
+// horizontal extent
+static const float INSTANCE_SPACING = 1.5f;
+// vertical field of view of the mesh camera, in radians
+static const float CAMERA_FOV = 0.8f;
+
+// texels along each side of the Scene::quadCount sprites
+static const uint32_t QUAD_TEXTURE_SIZE = 32;
+// radians the sprites turn per animation frame
+static const float QUAD_SPIN = 0.02f;
+// frames between quad batching messages, written at Info
+static const uint64_t QUAD_LOG_INTERVAL = 600;
+
+// Distance between mesh instances in world space
+static float
+gridSpacing (const MeshBounds &bounds)
+{
+  float spacing = INSTANCE_SPACING
+                  * std::max (bounds.max[0] - bounds.min[0],
+                              bounds.max[2] - bounds.min[2]);
+  return spacing > 0.0f ? spacing : 1.0f;
+}
+
+// How many pixels one world unit covers at distance 1 from the camera,
+// over the error allowed in pixels, see selectLod
+static float
+lodPixelsPerUnit (VkExtent2D extent, float errorPixels)
+{
+  if (errorPixels <= 0.0f)
+    {
+      return 0.0f;
+    }
+  return static_cast<float> (extent.height) * 0.5f
+         / std::tan (CAMERA_FOV * 0.5f) / errorPixels;
+}
+
+// Alpha of the quad sprite shape at u, v in -1..1: a disc, a ring, a
+// square or a diamond with a one texel soft edge
+static float
+spriteCoverage (uint32_t shape, float u, float v)
+{
+  float radius = std::sqrt (u * u + v * v);
+  float distance;
+  switch (shape % QUAD_TEXTURE_COUNT)
+    {
+    case 0:
+      distance = radius;
+      break;
+    case 1:
+      distance = std::abs (radius - 0.7f) / 0.3f;
+      break;
+    case 2:
+      distance = std::max (std::abs (u), std::abs (v));
+      break;
+    default:
+      distance = std::abs (u) + std::abs (v);
+      break;
+    }
+  float edge = (1.0f - distance) * QUAD_TEXTURE_SIZE * 0.5f;
+  return std::min (std::max (edge, 0.0f), 1.0f);
+}
 
 VkResult
 CreateDebugUtilsMessengerEXT (
@@ -50,10 +156,33 @@ DestroyDebugUtilsMessengerEXT (VkInstance instance,
 static void
 framebufferResizeCallback (GLFWwindow *window, int width, int height)
 {
-  printf("%d, %d\n", width, height);
-  auto app = reinterpret_cast<VulkanTriangleApplication *> (
-      glfwGetWindowUserPointer (window));
-  app->framebufferResized = true;
+  // Runs on the main thread, the render thread learns about it from the
+  // next snapshot
+  auto view
+      = reinterpret_cast<WindowView *> (glfwGetWindowUserPointer (window));
+  view->resizeCount++;
+  view->windowFramebufferSize
+      = { static_cast<uint32_t> (width), static_cast<uint32_t> (height) };
+}
+
+static void
+windowRefreshCallback (GLFWwindow *window)
+{
+  // The window system lost the contents, e.g. the window was uncovered
+  auto view
+      = reinterpret_cast<WindowView *> (glfwGetWindowUserPointer (window));
+  view->refreshCount++;
+}
+
+static void
+keyCallback (GLFWwindow *window, int key, int, int action, int)
+{
+  if (key == GLFW_KEY_SPACE && action == GLFW_PRESS)
+    {
+      auto view
+          = reinterpret_cast<WindowView *> (glfwGetWindowUserPointer (window));
+      view->animationToggles++;
+    }
 }
 
 static VKAPI_ATTR VkBool32 VKAPI_CALL
@@ -62,60 +191,255 @@ debugCallback (VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
                const VkDebugUtilsMessengerCallbackDataEXT *pCallbackData,
                void *pUserData)
 {
+  // Called on whatever thread made the API call, the logger only queues the
+  // message
+  LogSeverity severity = LogSeverity::Verbose;
+  if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT)
+    {
+      severity = LogSeverity::Error;
+    }
+  else if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT)
+    {
+      severity = LogSeverity::Warning;
+    }
+  else if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT)
+    {
+      severity = LogSeverity::Info;
+    }
 
-  std::cerr << "validation layer: " << pCallbackData->pMessage << std::endl;
+  auto logger = static_cast<Logger *> (pUserData);
+  logger->log (severity, pCallbackData->messageIdNumber,
+               pCallbackData->pMessage);
 
   return VK_FALSE;
 }
 
-static std::vector<char>
-readFile (const std::string &filename)
+// PUBLIC
+VulkanTriangleApplication::VulkanTriangleApplication (
+    const AppOptions &options)
+    : options (options), logger (options.log),
+      resolutionScaler (options.resolution)
 {
-  // ate - start reading at end of file
-  // binary - read file as binary no text transforms
-  std::ifstream file (filename, std::ios::ate | std::ios::binary);
-
-  if (!file.is_open ())
+  if (options.headless)
     {
-      throw std::runtime_error ("Failed to open file!");
+      // nothing is ever presented
+      deviceExtensions.clear ();
     }
+  framesInFlight = std::min (std::max (options.framesInFlight, 1u),
+                             MAX_FRAMES_IN_FLIGHT);
+  scene.quadCount = options.quadCount;
+  scene.particleCount = options.particleCount;
+  hudEnabled = options.hud && !options.headless;
+  // Its main thread is the one calling shared first, this one
+  JobSystem::shared ().setLogger (&logger);
+}
 
-  size_t fileSize = (size_t)file.tellg ();
-  std::vector<char> buffer (fileSize);
-
-  file.seekg (0);
-  file.read (buffer.data (), fileSize);
-
-  file.close ();
-  return buffer;
+VulkanTriangleApplication::~VulkanTriangleApplication ()
+{
+  // A failed initVulkan can leave the mesh still decoding into loadedMesh
+  try
+    {
+      JobSystem::shared ().wait (meshLoad);
+    }
+  catch (const std::exception &)
+    {
+      // the error that ended the run was reported already
+    }
+  JobSystem::shared ().setLogger (nullptr);
 }
 
-// PUBLIC
 void
 VulkanTriangleApplication::run ()
 {
   initWindow ();
   initVulkan ();
+
+  if (options.bench.enabled)
+    {
+      BenchRunner runner (*this, options.bench);
+      bool passed = runner.run ();
+      cleanup ();
+
+      if (!passed)
+        {
+          throw std::runtime_error ("Benchmark suite failed!");
+        }
+      return;
+    }
+  if (!options.server.spoolDirectory.empty ())
+    {
+      RenderServer server (*this, options.server);
+      server.run ();
+      cleanup ();
+      return;
+    }
+
   mainLoop ();
   cleanup ();
 }
 
+void
+VulkanTriangleApplication::setScene (const Scene &newScene)
+{
+  scene = newScene;
+}
+
+void
+VulkanTriangleApplication::renderFrame ()
+{
+  drawFrame ();
+}
+
+void
+VulkanTriangleApplication::resizeTargets (uint32_t width, uint32_t height)
+{
+  if (options.headless)
+    {
+      headlessExtent = { width, height };
+      recreateSwapChain (views[0]);
+    }
+  else
+    {
+      // picked up by drawFrame through framebufferResizeCallback
+      glfwSetWindowSize (views[0].window, static_cast<int> (width),
+                         static_cast<int> (height));
+    }
+}
+
+void
+VulkanTriangleApplication::requestCapture (const std::string &path)
+{
+  frameCapture.requestCapture (path);
+}
+
+std::vector<CaptureResult>
+VulkanTriangleApplication::takeCaptureResults ()
+{
+  return frameCapture.takeResults ();
+}
+
+void
+VulkanTriangleApplication::setCamera (float angle, uint64_t frame)
+{
+  views[0].cameraAngle = angle;
+  animationFrame = frame;
+}
+
+void
+VulkanTriangleApplication::finishFrames ()
+{
+  vkDeviceWaitIdle (device);
+  frameCapture.finish ();
+}
+
+uint32_t
+VulkanTriangleApplication::setFramesInFlight (uint32_t n)
+{
+  uint32_t previous = framesInFlight;
+  n = std::min (std::max (n, 1u), MAX_FRAMES_IN_FLIGHT);
+  if (n == previous)
+    {
+      return previous;
+    }
+
+  vkDeviceWaitIdle (device);
+  // Every frame is done, count them before their slots are reused
+  for (uint32_t i = 0; i < previous; i++)
+    {
+      presentLatency.retired (i);
+    }
+  destroyFrameContexts ();
+
+  framesInFlight = n;
+  currentFrame = 0;
+  createFrameContexts ();
+  // Headless views own one offscreen target per frame in flight
+  if (options.headless)
+    {
+      recreateSwapChain (views[0]);
+    }
+
+  // The capture ring has a slot per frame in flight too
+  frameCapture.collectAll ();
+  frameCapture.cleanup ();
+  createFrameCapture ();
+  return previous;
+}
+
+PresentLatencyStats
+VulkanTriangleApplication::frameLatency () const
+{
+  return presentLatency.stats ();
+}
+
+uint32_t
+VulkanTriangleApplication::maxTargetSize () const
+{
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties (physicalDevice, &properties);
+  return std::min ({ properties.limits.maxImageDimension2D,
+                     properties.limits.maxFramebufferWidth,
+                     properties.limits.maxFramebufferHeight });
+}
+
 // PRIVATE
 void
 VulkanTriangleApplication::initVulkan ()
 {
+  // Decoding the mesh needs no device, it runs on the job system while the
+  // device and pipelines are set up, createMeshBuffers waits for it
+  if (!options.meshPath.empty ())
+    {
+      meshDecoding = true;
+      JobSystem::shared ().run (
+          [this] () {
+            loadedMesh = loadMesh (options.meshPath,
+                                   options.meshCacheDirectory,
+                                   options.vertexFormat);
+          },
+          &meshLoad);
+    }
+
   createInstance ();
+  setupDebugMessenger ();
   createSurface ();
   pickPhysicalDevice ();
   createLogicalDevice ();
-  createSwapChain ();
-  createImageViews ();
+  setupMemoryTracking ();
+  createTimestampQueries ();
+  createPipelineCache ();
+  if (occlusionCulling)
+    {
+      occlusionCuller.init (
+          physicalDevice, device, static_cast<uint32_t> (views.size ()),
+          pipelineCache, memoryTracker.callbacks (HostAllocationType::Buffer));
+    }
+  renderTargets
+      = dynamicResolution || (options.redrawOnDemand && !options.headless);
+  for (WindowView &view : views)
+    {
+      createSwapChain (view);
+      createImageViews (view);
+      createDepthResources (view);
+      createRenderTarget (view);
+    }
   createRenderPass ();
   createGraphicsPipeline ();
-  createFramebuffers ();
+  for (WindowView &view : views)
+    {
+      createFramebuffers (view);
+    }
   createCommandPool ();
-  createCommandBuffers ();
-  createSyncObjects ();
+  if (hudEnabled)
+    {
+      hud.init (physicalDevice, device, commandPool, graphicsQueue,
+                pipelineCache, renderPass,
+                memoryTracker.callbacks (HostAllocationType::Image));
+    }
+  createMeshBuffers ();
+  setupDrawList ();
+  createFrameContexts ();
+  createFrameCapture ();
 }
 
 void
@@ -124,38 +448,56 @@ VulkanTriangleApplication::populateDebugMessengerCreateInfo (
 {
   createInfo = {};
   createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
-  createInfo.messageSeverity
-      = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT
-        | VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT
-        | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+  // Messages below the log level are filtered by the layer, so they never
+  // reach the callback
+  createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+  if (logger.enabled (LogSeverity::Warning))
+    {
+      createInfo.messageSeverity
+          |= VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT;
+    }
+  if (logger.enabled (LogSeverity::Info))
+    {
+      createInfo.messageSeverity
+          |= VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT;
+    }
+  if (logger.enabled (LogSeverity::Verbose))
+    {
+      createInfo.messageSeverity
+          |= VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT;
+    }
   createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT
                            | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT
                            | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
   createInfo.pfnUserCallback = debugCallback;
+  createInfo.pUserData = &logger;
 }
 
 void
 VulkanTriangleApplication::setupDebugMessenger ()
 {
-
-  if (!enableValidationLayers)
-    return;
+  if (!options.validation)
+    {
+      return;
+    }
 
   VkDebugUtilsMessengerCreateInfoEXT createInfo;
   populateDebugMessengerCreateInfo (createInfo);
 
-  if (CreateDebugUtilsMessengerEXT (instance, &createInfo, nullptr,
-                                    &debugMessenger)
+  if (CreateDebugUtilsMessengerEXT (
+          instance, &createInfo,
+          memoryTracker.callbacks (HostAllocationType::Instance),
+          &debugMessenger)
       != VK_SUCCESS)
     {
-      throw std::runtime_error ("failed to set up debug messenger!");
+      throw std::runtime_error ("Failed to set up debug messenger!");
     }
 }
 
 void
 VulkanTriangleApplication::createInstance ()
 {
-  if (enableValidationLayers && !checkValidationLayerSupport ())
+  if (options.validation && !checkValidationLayerSupport ())
     {
       throw std::runtime_error (
           "Validation layers requested, but not available!");
@@ -167,20 +509,32 @@ VulkanTriangleApplication::createInstance ()
   appInfo.applicationVersion = VK_MAKE_VERSION (1, 0, 0);
   appInfo.pEngineName = "No Engine";
   appInfo.engineVersion = VK_MAKE_VERSION (1, 0, 0);
-  appInfo.apiVersion = VK_API_VERSION_1_0;
+  // 1.1 for vkGetPhysicalDeviceFeatures2, see pipelineLibrariesSupported
+  appInfo.apiVersion = VK_API_VERSION_1_1;
 
   VkInstanceCreateInfo createInfo{};
   createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
   createInfo.pApplicationInfo = &appInfo;
 
+  // Headless rendering needs no surface, so no window system extensions
   uint32_t glfwExtensionCount = 0;
   const char **glfwExtensions
-      = glfwGetRequiredInstanceExtensions (&glfwExtensionCount);
+      = options.headless
+            ? nullptr
+            : glfwGetRequiredInstanceExtensions (&glfwExtensionCount);
+
+  std::vector<const char *> instanceExtensions (
+      glfwExtensions, glfwExtensions + glfwExtensionCount);
+  if (options.validation)
+    {
+      instanceExtensions.push_back (VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+    }
 
-  createInfo.enabledExtensionCount = glfwExtensionCount;
-  createInfo.ppEnabledExtensionNames = glfwExtensions;
+  createInfo.enabledExtensionCount
+      = static_cast<uint32_t> (instanceExtensions.size ());
+  createInfo.ppEnabledExtensionNames = instanceExtensions.data ();
   VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo{};
-  if (enableValidationLayers)
+  if (options.validation)
     {
       createInfo.enabledLayerCount
           = static_cast<uint32_t> (validationLayers.size ());
@@ -198,23 +552,14 @@ VulkanTriangleApplication::createInstance ()
       createInfo.pNext = nullptr;
     }
 
-  if (enableValidationLayers)
-    {
-      createInfo.enabledLayerCount
-          = static_cast<uint32_t> (validationLayers.size ());
-      createInfo.ppEnabledLayerNames = validationLayers.data ();
-    }
-  else
-    {
-      createInfo.enabledLayerCount = 0;
-    }
-
-  if (verifyExtensions (glfwExtensions, glfwExtensionCount))
+  if (!verifyExtensions (instanceExtensions))
     {
-      throw std::runtime_error ("Unsupported required glfw extension.");
+      throw std::runtime_error ("Required instance extension not supported!");
     }
 
-  if (vkCreateInstance (&createInfo, nullptr, &instance))
+  if (vkCreateInstance (&createInfo,
+                        memoryTracker.callbacks (HostAllocationType::Instance),
+                        &instance))
     {
       throw std::runtime_error ("Failed to create instance!");
     }
@@ -223,10 +568,21 @@ VulkanTriangleApplication::createInstance ()
 void
 VulkanTriangleApplication::createSurface ()
 {
-  if (glfwCreateWindowSurface (instance, window, nullptr, &surface)
-      != VK_SUCCESS)
+  if (options.headless)
+    {
+      return;
+    }
+
+  for (WindowView &view : views)
     {
-      throw std::runtime_error ("Failed to create window surface!");
+      if (glfwCreateWindowSurface (
+              instance, view.window,
+              memoryTracker.callbacks (HostAllocationType::Instance),
+              &view.surface)
+          != VK_SUCCESS)
+        {
+          throw std::runtime_error ("Failed to create window surface!");
+        }
     }
 }
 
@@ -249,9 +605,69 @@ VulkanTriangleApplication::createLogicalDevice ()
     }
 
   VkPhysicalDeviceFeatures deviceFeatures{};
+  // Optional features are chained in front of each other
+  void *features = nullptr;
+
+  // Optional, every mesh instance is drawn without it
+  occlusionCulling
+      = options.occlusionCulling && !options.meshPath.empty ()
+        && OcclusionCuller::supported (physicalDevice, findDepthFormat ());
+  if (occlusionCulling)
+    {
+      deviceFeatures.multiDrawIndirect = VK_TRUE;
+      deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+    }
+  else if (options.occlusionCulling)
+    {
+      logger.log (LogSeverity::Warning, 0,
+                  options.meshPath.empty ()
+                      ? "Occlusion culling needs a mesh, disabled"
+                      : "Occlusion culling isn't supported, disabled");
+    }
+
+  // Optional, pipelines are created whole without it
+  VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT libraryFeatures{};
+  libraryFeatures.sType
+      = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+  libraryFeatures.graphicsPipelineLibrary = VK_TRUE;
+  pipelineLibraries = options.pipelineLibrary && pipelineLibrariesSupported ();
+  if (pipelineLibraries)
+    {
+      deviceExtensions.push_back (VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+      deviceExtensions.push_back (
+          VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+      libraryFeatures.pNext = features;
+      features = &libraryFeatures;
+    }
+
+  // Optional, present latency is estimated without it
+  VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures{};
+  presentIdFeatures.sType
+      = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+  presentIdFeatures.presentId = VK_TRUE;
+  VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures{};
+  presentWaitFeatures.sType
+      = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+  presentWaitFeatures.presentWait = VK_TRUE;
+  presentWait = !options.headless && presentWaitSupported ();
+  if (presentWait)
+    {
+      deviceExtensions.push_back (VK_KHR_PRESENT_ID_EXTENSION_NAME);
+      deviceExtensions.push_back (VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+      presentIdFeatures.pNext = features;
+      presentWaitFeatures.pNext = &presentIdFeatures;
+      features = &presentWaitFeatures;
+    }
+  memoryBudget = deviceExtensionSupported (
+      physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+  if (memoryBudget)
+    {
+      deviceExtensions.push_back (VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    }
 
   VkDeviceCreateInfo createInfo{};
   createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+  createInfo.pNext = features;
   createInfo.queueCreateInfoCount
       = static_cast<uint32_t> (queueCreateInfos.size ());
   createInfo.pQueueCreateInfos = queueCreateInfos.data ();
@@ -261,7 +677,7 @@ VulkanTriangleApplication::createLogicalDevice ()
       = static_cast<uint32_t> (deviceExtensions.size ());
   createInfo.ppEnabledExtensionNames = deviceExtensions.data ();
 
-  if (enableValidationLayers)
+  if (options.validation)
     {
       createInfo.enabledLayerCount
           = static_cast<uint32_t> (validationLayers.size ());
@@ -272,7 +688,9 @@ VulkanTriangleApplication::createLogicalDevice ()
       createInfo.enabledLayerCount = 0;
     }
 
-  if (vkCreateDevice (physicalDevice, &createInfo, nullptr, &device)
+  if (vkCreateDevice (physicalDevice, &createInfo,
+                      memoryTracker.callbacks (HostAllocationType::Device),
+                      &device)
       != VK_SUCCESS)
     {
       throw std::runtime_error ("Failed to create logical device!");
@@ -281,16 +699,175 @@ VulkanTriangleApplication::createLogicalDevice ()
   vkGetDeviceQueue (device, indices.graphicsFamily.value (), 0,
                     &graphicsQueue);
   vkGetDeviceQueue (device, indices.presentFamily.value (), 0, &presentQueue);
+
+  // Headless frames aren't presented, their latency ends at the fence and
+  // there is no display to pace against
+  presentLatency.init (device, presentWait,
+                       options.framePacing && !options.headless);
+}
+
+void
+VulkanTriangleApplication::setupMemoryTracking ()
+{
+  memoryTracker.initBudget (physicalDevice, memoryBudget);
+  if (options.memoryStatsPath.empty ())
+    {
+      return;
+    }
+
+  memoryStats.open (options.memoryStatsPath, std::ios::trunc);
+  if (!memoryStats.is_open ())
+    {
+      throw std::runtime_error ("Failed to open " + options.memoryStatsPath
+                                + " for writing!");
+    }
+  MemoryTracker::writeReportHeader (memoryStats);
+}
+
+void
+VulkanTriangleApplication::manageMemory (bool report)
+{
+  memoryTracker.updateBudget ();
+  if (report)
+    {
+      memoryTracker.writeReport (memoryStats, frameNumber);
+    }
+
+  // The mesh is the only resource that can be brought back later, the
+  // rest is needed every frame. Without VK_EXT_memory_budget there is no
+  // usage to go by.
+  if (!memoryTracker.hasBudget () || meshIndexCount == 0)
+    {
+      return;
+    }
+
+  if (meshResident && memoryTracker.deviceLocalPressure () > EVICT_PRESSURE)
+    {
+      // Frames in flight may still read the buffers, they go once this
+      // frame's fence has signalled
+      GpuBuffer vertexBuffer = meshVertexBuffer;
+      GpuBuffer indexBuffer = meshIndexBuffer;
+      const VkAllocationCallbacks *allocator
+          = memoryTracker.callbacks (HostAllocationType::Buffer);
+      frames[currentFrame].defer (
+          [this, vertexBuffer, indexBuffer, allocator] () mutable {
+            destroyBuffer (device, vertexBuffer, allocator);
+            destroyBuffer (device, indexBuffer, allocator);
+          });
+      meshVertexBuffer = GpuBuffer ();
+      meshIndexBuffer = GpuBuffer ();
+      meshResident = false;
+      logger.log (LogSeverity::Warning, 0,
+                  "Device memory close to its budget, evicted the mesh");
+    }
+  else if (!meshResident && !meshDecoding
+           && memoryTracker.deviceLocalPressure (meshBytes)
+                  < RESTORE_PRESSURE)
+    {
+      // The cache is mapped on a worker, drawFrame uploads it once it's in
+      meshDecoding = true;
+      JobSystem::shared ().run (
+          [this] () {
+            loadedMesh = loadMesh (options.meshPath,
+                                   options.meshCacheDirectory,
+                                   options.vertexFormat);
+          },
+          &meshLoad);
+    }
+}
+
+bool
+VulkanTriangleApplication::pipelineLibrariesSupported ()
+{
+  if (!deviceExtensionSupported (physicalDevice,
+                                 VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME)
+      || !deviceExtensionSupported (
+          physicalDevice, VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME))
+    {
+      return false;
+    }
+
+  VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT libraryFeatures{};
+  libraryFeatures.sType
+      = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+  VkPhysicalDeviceFeatures2 features{};
+  features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  features.pNext = &libraryFeatures;
+  vkGetPhysicalDeviceFeatures2 (physicalDevice, &features);
+
+  // Without fast linking a link costs about as much as a whole pipeline,
+  // so libraries would only add work
+  VkPhysicalDeviceGraphicsPipelineLibraryPropertiesEXT libraryProperties{};
+  libraryProperties.sType
+      = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_PROPERTIES_EXT;
+  VkPhysicalDeviceProperties2 properties{};
+  properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+  properties.pNext = &libraryProperties;
+  vkGetPhysicalDeviceProperties2 (physicalDevice, &properties);
+
+  return libraryFeatures.graphicsPipelineLibrary
+         && libraryProperties.graphicsPipelineLibraryFastLinking;
+}
+
+bool
+VulkanTriangleApplication::presentWaitSupported ()
+{
+  if (!deviceExtensionSupported (physicalDevice,
+                                 VK_KHR_PRESENT_ID_EXTENSION_NAME)
+      || !deviceExtensionSupported (physicalDevice,
+                                    VK_KHR_PRESENT_WAIT_EXTENSION_NAME))
+    {
+      return false;
+    }
+
+  VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures{};
+  presentIdFeatures.sType
+      = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+  VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures{};
+  presentWaitFeatures.sType
+      = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+  presentWaitFeatures.pNext = &presentIdFeatures;
+  VkPhysicalDeviceFeatures2 features{};
+  features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  features.pNext = &presentWaitFeatures;
+  vkGetPhysicalDeviceFeatures2 (physicalDevice, &features);
+
+  return presentIdFeatures.presentId && presentWaitFeatures.presentWait;
 }
 
 void
-VulkanTriangleApplication::createSwapChain ()
+VulkanTriangleApplication::createSwapChain (WindowView &view)
 {
+  if (options.headless)
+    {
+      createOffscreenTargets (view);
+      return;
+    }
+
+  // Queried per swap chain, the capabilities change with the window size
+  querySwapChainSupport (physicalDevice, view.surface);
+
   VkSurfaceFormatKHR surfaceFormat
       = chooseSwapSurfaceFormat (swapChainDetails.formats);
+  if (swapChainImageFormat != VK_FORMAT_UNDEFINED)
+    {
+      // Every view renders with the same render pass and pipelines
+      auto shared = std::find_if (
+          swapChainDetails.formats.begin (), swapChainDetails.formats.end (),
+          [this] (const VkSurfaceFormatKHR &format) {
+            return format.format == swapChainImageFormat;
+          });
+      if (shared == swapChainDetails.formats.end ())
+        {
+          throw std::runtime_error (
+              "Window surface doesn't support the shared swap chain format!");
+        }
+      surfaceFormat = *shared;
+    }
   VkPresentModeKHR presentMode
       = chooseSwapPresentMode (swapChainDetails.presentModes);
-  VkExtent2D extent = chooseSwapExtent (swapChainDetails.capabilities);
+  VkExtent2D extent
+      = chooseSwapExtent (swapChainDetails.capabilities, view.framebufferSize);
 
   // sticking to the min means we might have the wait for the driver to
   // complete ops before fetching another image to render to. min + 1 is a work
@@ -307,15 +884,38 @@ VulkanTriangleApplication::createSwapChain ()
 
   VkSwapchainCreateInfoKHR createInfo{};
   createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-  createInfo.surface = surface;
+  createInfo.surface = view.surface;
   createInfo.minImageCount = imageCount;
   createInfo.imageFormat = surfaceFormat.format;
   createInfo.imageColorSpace = surfaceFormat.colorSpace;
   createInfo.imageExtent = extent;
   createInfo.imageArrayLayers = 1;
-  // Might use VK_IMAGE_USAGE_TRANSFER_DST_BIT for doing post processing
   createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 
+  if (renderTargets)
+    {
+      if (!(swapChainDetails.capabilities.supportedUsageFlags
+            & VK_IMAGE_USAGE_TRANSFER_DST_BIT))
+        {
+          throw std::runtime_error ("Swap chain images can't be blitted to, "
+                                    "render targets unavailable!");
+        }
+      // The view's render target is blitted into the acquired image
+      createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    }
+
+  if (!options.capture.directory.empty ())
+    {
+      if (!(swapChainDetails.capabilities.supportedUsageFlags
+            & VK_IMAGE_USAGE_TRANSFER_SRC_BIT))
+        {
+          throw std::runtime_error (
+              "Swap chain images can't be copied from, capture unavailable!");
+        }
+      // Frame capture copies the presented image into a readback buffer
+      createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    }
+
   uint32_t queueFamilyIndices[]
       = { indices.graphicsFamily.value (), indices.presentFamily.value () };
 
@@ -341,57 +941,189 @@ VulkanTriangleApplication::createSwapChain ()
   createInfo.clipped = VK_TRUE;
   createInfo.oldSwapchain = VK_NULL_HANDLE;
 
-  if (vkCreateSwapchainKHR (device, &createInfo, nullptr, &swapChain)
+  if (vkCreateSwapchainKHR (
+          device, &createInfo,
+          memoryTracker.callbacks (HostAllocationType::Swapchain),
+          &view.swapChain)
       != VK_SUCCESS)
     {
       throw std::runtime_error ("Failed to create swap chain!");
     }
 
-  vkGetSwapchainImagesKHR (device, swapChain, &imageCount, nullptr);
-  swapChainImages.resize (imageCount);
-  vkGetSwapchainImagesKHR (device, swapChain, &imageCount,
+  swapChainImageFormat = surfaceFormat.format;
+  view.swapChainExtent = extent;
+
+  vkGetSwapchainImagesKHR (device, view.swapChain, &imageCount, nullptr);
+  std::vector<VkImage> swapChainImages (imageCount);
+  vkGetSwapchainImagesKHR (device, view.swapChain, &imageCount,
                            swapChainImages.data ());
+  ImageCold owner;
+  owner.format = swapChainImageFormat;
+  owner.extent = extent;
+  view.swapChainImages.clear ();
+  for (VkImage image : swapChainImages)
+    {
+      view.swapChainImages.push_back (images.create ({ image }, owner));
+    }
 
-  swapChainImageFormat = surfaceFormat.format;
-  swapChainExtent = extent;
+  if (&view == &views[0])
+    {
+      presentLatency.setSwapchain (view.swapChain);
+    }
 }
 
 void
-VulkanTriangleApplication::recreateSwapChain ()
+VulkanTriangleApplication::createOffscreenTargets (WindowView &view)
 {
-  vkDeviceWaitIdle (device);
-  cleanupSwapChain ();
+  // Same format the windowed path prefers so captures look alike
+  swapChainImageFormat = VK_FORMAT_B8G8R8A8_SRGB;
+  view.swapChainExtent = headlessExtent;
+
+  // One target per frame in flight, there is no presentation engine
+  // holding on to images
+  view.swapChainImages.clear ();
+
+  const VkAllocationCallbacks *allocator
+      = memoryTracker.callbacks (HostAllocationType::Image);
+  for (uint32_t i = 0; i < framesInFlight; i++)
+    {
+      VkImageCreateInfo imageInfo{};
+      imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+      imageInfo.imageType = VK_IMAGE_TYPE_2D;
+      imageInfo.format = swapChainImageFormat;
+      imageInfo.extent
+          = { view.swapChainExtent.width, view.swapChainExtent.height, 1 };
+      imageInfo.mipLevels = 1;
+      imageInfo.arrayLayers = 1;
+      imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+      imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+      imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
+                        | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+      if (renderTargets)
+        {
+          imageInfo.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        }
+      imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+      imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+      ImageHot target;
+      if (vkCreateImage (device, &imageInfo, allocator, &target.image)
+          != VK_SUCCESS)
+        {
+          throw std::runtime_error ("Failed to create offscreen image!");
+        }
+
+      VkMemoryRequirements memRequirements;
+      vkGetImageMemoryRequirements (device, target.image, &memRequirements);
+
+      VkMemoryAllocateInfo allocInfo{};
+      allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+      allocInfo.allocationSize = memRequirements.size;
+      allocInfo.memoryTypeIndex
+          = findMemoryType (physicalDevice, memRequirements.memoryTypeBits,
+                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+      ImageCold owner;
+      owner.size = memRequirements.size;
+      owner.format = swapChainImageFormat;
+      owner.extent = view.swapChainExtent;
+      if (vkAllocateMemory (device, &allocInfo, allocator, &owner.memory)
+          != VK_SUCCESS)
+        {
+          throw std::runtime_error (
+              "Failed to allocate offscreen image memory!");
+        }
 
-  createSwapChain ();
-  createImageViews ();
-  createFramebuffers ();
+      vkBindImageMemory (device, target.image, owner.memory,
+                         owner.memoryOffset);
+      view.swapChainImages.push_back (images.create (target, owner));
+    }
 }
+
 void
-VulkanTriangleApplication::cleanupSwapChain ()
+VulkanTriangleApplication::recreateSwapChain (WindowView &view)
 {
-  for (size_t i = 0; i < swapChainFramebuffers.size (); i++)
-    {
-      vkDestroyFramebuffer (device, swapChainFramebuffers[i], nullptr);
-    }
-  for (size_t i = 0; i < swapChainImageViews.size (); i++)
+  vkDeviceWaitIdle (device);
+  // The device is idle so every pending readback is complete
+  frameCapture.collectAll ();
+  cleanupSwapChain (view);
+
+  createSwapChain (view);
+  createImageViews (view);
+  createDepthResources (view);
+  createRenderTarget (view);
+  createFramebuffers (view);
+  // whatever was on screen has the wrong size now
+  view.damaged = true;
+  if (&view == &views[0])
     {
-      vkDestroyImageView (device, swapChainImageViews[i], nullptr);
+      frameCapture.resize (view.swapChainExtent, swapChainImageFormat);
     }
-
-  vkDestroySwapchainKHR (device, swapChain, nullptr);
 }
-
 void
-VulkanTriangleApplication::createImageViews ()
+VulkanTriangleApplication::cleanupSwapChain (WindowView &view)
 {
-  swapChainImageViews.resize (swapChainImages.size ());
+  const VkAllocationCallbacks *imageAllocator
+      = memoryTracker.callbacks (HostAllocationType::Image);
+  vkDestroyImageView (device, view.depthImageView, imageAllocator);
+  vkDestroyImage (device, view.depthImage, imageAllocator);
+  vkFreeMemory (device, view.depthImageMemory, imageAllocator);
+  vkDestroyImageView (device, view.renderImageView, imageAllocator);
+  vkDestroyImage (device, view.renderImage, imageAllocator);
+  vkFreeMemory (device, view.renderImageMemory, imageAllocator);
+  view.renderImageView = VK_NULL_HANDLE;
+  view.renderImage = VK_NULL_HANDLE;
+  view.renderImageMemory = VK_NULL_HANDLE;
+
+  for (FramebufferHandle handle : view.swapChainFramebuffers)
+    {
+      vkDestroyFramebuffer (
+          device, framebuffers.hot (handle)->framebuffer,
+          memoryTracker.callbacks (HostAllocationType::RenderPass));
+      framebuffers.destroy (handle);
+    }
+  view.swapChainFramebuffers.clear ();
+  // Swap chain images go with their swap chain, offscreen ones own their
+  // memory
+  for (ImageHandle handle : view.swapChainImages)
+    {
+      const ImageHot &target = *images.hot (handle);
+      const ImageCold &owner = *images.cold (handle);
+      vkDestroyImageView (device, target.view, imageAllocator);
+      if (owner.memory != VK_NULL_HANDLE)
+        {
+          vkDestroyImage (device, target.image, imageAllocator);
+          vkFreeMemory (device, owner.memory, imageAllocator);
+        }
+      images.destroy (handle);
+    }
+  view.swapChainImages.clear ();
 
-  for (size_t i = 0; i < swapChainImages.size (); i++)
+  if (options.headless)
     {
+      return;
+    }
+
+  if (&view == &views[0])
+    {
+      // Its presents are never polled again
+      presentLatency.setSwapchain (VK_NULL_HANDLE);
+    }
+  vkDestroySwapchainKHR (
+      device, view.swapChain,
+      memoryTracker.callbacks (HostAllocationType::Swapchain));
+}
+
+void
+VulkanTriangleApplication::createImageViews (WindowView &view)
+{
+  for (ImageHandle handle : view.swapChainImages)
+    {
+      ImageHot &target = *images.hot (handle);
       VkImageViewCreateInfo createInfo{};
       createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
 
-      createInfo.image = swapChainImages[i];
+      createInfo.image = target.image;
       createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
       createInfo.format = swapChainImageFormat;
 
@@ -408,8 +1140,10 @@ VulkanTriangleApplication::createImageViews ()
       createInfo.subresourceRange.baseArrayLayer = 0;
       createInfo.subresourceRange.layerCount = 1;
 
-      if (vkCreateImageView (device, &createInfo, nullptr,
-                             &swapChainImageViews[i])
+      if (vkCreateImageView (
+              device, &createInfo,
+              memoryTracker.callbacks (HostAllocationType::Image),
+              &target.view)
           != VK_SUCCESS)
         {
           throw std::runtime_error ("Failed to create image views!");
@@ -417,162 +1151,1001 @@ VulkanTriangleApplication::createImageViews ()
     }
 }
 
+VkFormat
+VulkanTriangleApplication::findDepthFormat ()
+{
+  const VkFormat candidates[] = { VK_FORMAT_D32_SFLOAT,
+                                  VK_FORMAT_D32_SFLOAT_S8_UINT,
+                                  VK_FORMAT_D24_UNORM_S8_UINT };
+
+  for (VkFormat format : candidates)
+    {
+      VkFormatProperties properties;
+      vkGetPhysicalDeviceFormatProperties (physicalDevice, format,
+                                           &properties);
+      if (properties.optimalTilingFeatures
+          & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)
+        {
+          return format;
+        }
+    }
+
+  throw std::runtime_error ("Failed to find a supported depth format!");
+}
+
 void
-VulkanTriangleApplication::createGraphicsPipeline ()
+VulkanTriangleApplication::createDepthResources (WindowView &view)
 {
-  auto vertShaderCode = readFile ("shaders/vert.spv");
-  auto fragShaderCode = readFile ("shaders/frag.spv");
-
-  VkShaderModule vertShaderModule = createShaderModule (vertShaderCode);
-  VkShaderModule fragShaderModule = createShaderModule (fragShaderCode);
-
-  VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
-  vertShaderStageInfo.sType
-      = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-  vertShaderStageInfo.module = vertShaderModule;
-  vertShaderStageInfo.pName = "main";
-
-  VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
-  fragShaderStageInfo.sType
-      = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-  fragShaderStageInfo.module = fragShaderModule;
-  fragShaderStageInfo.pName = "main";
-
-  VkPipelineShaderStageCreateInfo shaderStages[]
-      = { vertShaderStageInfo, fragShaderStageInfo };
-
-  std::vector<VkDynamicState> dynamicStates
-      = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
-
-  VkPipelineDynamicStateCreateInfo dynamicState{};
-  dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-  dynamicState.dynamicStateCount
-      = static_cast<uint32_t> (dynamicStates.size ());
-  dynamicState.pDynamicStates = dynamicStates.data ();
-
-  VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
-  vertexInputInfo.sType
-      = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-  // We hardcoded vertext data into the shader so we don't need to fill in
-  // anything else in this struct
-  vertexInputInfo.vertexBindingDescriptionCount = 0;
-  vertexInputInfo.vertexAttributeDescriptionCount = 0;
-
-  VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
-  inputAssembly.sType
-      = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-  // Since we are 'hand' drawing triangles these settings are fine
-  inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-  inputAssembly.primitiveRestartEnable = VK_FALSE;
+  depthFormat = findDepthFormat ();
+  const VkAllocationCallbacks *allocator
+      = memoryTracker.callbacks (HostAllocationType::Image);
+
+  // NOTE: One depth buffer is enough for every frame in flight, the render
+  // pass dependency keeps a frame from clearing it while the previous one is
+  // still testing against it
+  VkImageCreateInfo imageInfo{};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.format = depthFormat;
+  imageInfo.extent
+      = { view.swapChainExtent.width, view.swapChainExtent.height, 1 };
+  imageInfo.mipLevels = 1;
+  imageInfo.arrayLayers = 1;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+  if (occlusionCulling)
+    {
+      // downsampled into the depth pyramid
+      imageInfo.usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+    }
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 
-  VkViewport viewport{};
-  viewport.x = 0.0f;
-  viewport.y = 0.0f;
-  viewport.width = (float)swapChainExtent.width;
-  viewport.height = (float)swapChainExtent.height;
-  viewport.minDepth = 0.0f;
-  viewport.maxDepth = 1.0f;
+  if (vkCreateImage (device, &imageInfo, allocator, &view.depthImage)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to create depth image!");
+    }
 
-  VkRect2D scissor{};
-  scissor.offset = { 0, 0 };
-  scissor.extent = swapChainExtent;
-
-  VkPipelineViewportStateCreateInfo viewportState{};
-  viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-  viewportState.viewportCount = 1;
-  viewportState.pViewports = &viewport;
-  viewportState.scissorCount = 1;
-  viewportState.pScissors = &scissor;
-
-  VkPipelineRasterizationStateCreateInfo rasterizer{};
-  rasterizer.sType
-      = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-  // VK_TRUE here requires GPU feature
-  rasterizer.depthClampEnable = VK_FALSE;
-  rasterizer.rasterizerDiscardEnable = VK_FALSE;
-  // Anything aside from VK_POLYGON_MODE_FILL required GPU feature
-  rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-  // lineWidth higher than 1.0f required wideLines GPU feature
-  rasterizer.lineWidth = 1.0f;
-  rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-  rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
-  rasterizer.depthBiasEnable = VK_FALSE;
-
-  VkPipelineMultisampleStateCreateInfo multisampling{};
-  multisampling.sType
-      = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-  multisampling.sampleShadingEnable = VK_FALSE;
-  multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-  // Here to alphaToOneEnable are optional
-  multisampling.minSampleShading = 1.0f;
-  multisampling.pSampleMask = nullptr;
-  multisampling.alphaToCoverageEnable = VK_FALSE;
-  multisampling.alphaToOneEnable = VK_FALSE;
-
-  // NOTE: if blendEnable is set to VK_FALSE then the color from the frag
-  // shader is passed through unmodified
-  VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-  colorBlendAttachment.colorWriteMask
-      = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT
-        | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-  colorBlendAttachment.blendEnable = VK_FALSE;
-
-  // NOTE: If wanting the implment alpha color blending
-  /* colorBlendAttachment.blendEnable = VK_TRUE; */
-  /* colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA; */
-  /* colorBlendAttachment.dstColorBlendFactor =
-   * VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA; */
-  /* colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD; */
-  /* colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE; */
-  /* colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO; */
-  /* colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD; */
-
-  VkPipelineColorBlendStateCreateInfo colorBlending{};
-  colorBlending.sType
-      = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-  colorBlending.logicOpEnable = VK_FALSE;
-  colorBlending.attachmentCount = 1;
-  colorBlending.pAttachments = &colorBlendAttachment;
+  VkMemoryRequirements memRequirements;
+  vkGetImageMemoryRequirements (device, view.depthImage, &memRequirements);
+
+  VkMemoryAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = memRequirements.size;
+  allocInfo.memoryTypeIndex
+      = findMemoryType (physicalDevice, memRequirements.memoryTypeBits,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+  if (vkAllocateMemory (device, &allocInfo, allocator,
+                        &view.depthImageMemory)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to allocate depth image memory!");
+    }
+  vkBindImageMemory (device, view.depthImage, view.depthImageMemory, 0);
+
+  VkImageViewCreateInfo viewInfo{};
+  viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.image = view.depthImage;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format = depthFormat;
+  viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+  viewInfo.subresourceRange.baseMipLevel = 0;
+  viewInfo.subresourceRange.levelCount = 1;
+  viewInfo.subresourceRange.baseArrayLayer = 0;
+  viewInfo.subresourceRange.layerCount = 1;
+
+  if (vkCreateImageView (device, &viewInfo, allocator, &view.depthImageView)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to create depth image view!");
+    }
+
+  if (occlusionCulling)
+    {
+      occlusionCuller.resize (view.index, view.depthImageView,
+                              view.swapChainExtent);
+    }
+}
+
+void
+VulkanTriangleApplication::createRenderTarget (WindowView &view)
+{
+  view.targetValid = false;
+  if (!renderTargets)
+    {
+      return;
+    }
+
+  VkFormatProperties properties;
+  vkGetPhysicalDeviceFormatProperties (physicalDevice, swapChainImageFormat,
+                                       &properties);
+  const VkFormatFeatureFlags blitFeatures
+      = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT
+        | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+  if ((properties.optimalTilingFeatures & blitFeatures) != blitFeatures)
+    {
+      throw std::runtime_error ("Swap chain format can't be blitted, "
+                                "render targets unavailable!");
+    }
+
+  const VkAllocationCallbacks *allocator
+      = memoryTracker.callbacks (HostAllocationType::Image);
+
+  // Sized for a scale of 1, lower scales only use its top left corner
+  VkImageCreateInfo imageInfo{};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.format = swapChainImageFormat;
+  imageInfo.extent
+      = { view.swapChainExtent.width, view.swapChainExtent.height, 1 };
+  imageInfo.mipLevels = 1;
+  imageInfo.arrayLayers = 1;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.usage
+      = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+  if (vkCreateImage (device, &imageInfo, allocator, &view.renderImage)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to create render target image!");
+    }
+
+  VkMemoryRequirements memRequirements;
+  vkGetImageMemoryRequirements (device, view.renderImage, &memRequirements);
+
+  VkMemoryAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = memRequirements.size;
+  allocInfo.memoryTypeIndex
+      = findMemoryType (physicalDevice, memRequirements.memoryTypeBits,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+  if (vkAllocateMemory (device, &allocInfo, allocator,
+                        &view.renderImageMemory)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to allocate render target memory!");
+    }
+  vkBindImageMemory (device, view.renderImage, view.renderImageMemory, 0);
+
+  VkImageViewCreateInfo viewInfo{};
+  viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.image = view.renderImage;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format = swapChainImageFormat;
+  viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  viewInfo.subresourceRange.baseMipLevel = 0;
+  viewInfo.subresourceRange.levelCount = 1;
+  viewInfo.subresourceRange.baseArrayLayer = 0;
+  viewInfo.subresourceRange.layerCount = 1;
+
+  if (vkCreateImageView (device, &viewInfo, allocator, &view.renderImageView)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to create render target view!");
+    }
+}
+
+VkExtent2D
+VulkanTriangleApplication::renderExtent (const WindowView &view) const
+{
+  if (!dynamicResolution)
+    {
+      return view.swapChainExtent;
+    }
+  return { resolutionScaler.scaled (view.swapChainExtent.width),
+           resolutionScaler.scaled (view.swapChainExtent.height) };
+}
+
+void
+VulkanTriangleApplication::createPipelineCache ()
+{
+  // NOTE: Every pipeline, graphics and compute, is created through this
+  // cache. It only lives as long as the process for now, it lets variants
+  // sharing shaders reuse the driver's compiled stages.
+  VkPipelineCacheCreateInfo pipelineCacheInfo{};
+  pipelineCacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  if (vkCreatePipelineCache (
+          device, &pipelineCacheInfo,
+          memoryTracker.callbacks (HostAllocationType::Pipeline),
+          &pipelineCache)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to create pipeline cache!");
+    }
+}
+
+void
+VulkanTriangleApplication::createGraphicsPipeline ()
+{
+  // Shared by every pipeline so the scene constants pushed once per frame
+  // stay valid across pipeline binds
+  VkPushConstantRange pushConstantRange{};
+  pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  pushConstantRange.offset = 0;
+  pushConstantRange.size = sizeof (ScenePushConstants);
 
   VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
   pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutInfo.pushConstantRangeCount = 1;
+  pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
-  if (vkCreatePipelineLayout (device, &pipelineLayoutInfo, nullptr,
+  const VkAllocationCallbacks *allocator
+      = memoryTracker.callbacks (HostAllocationType::Pipeline);
+  if (vkCreatePipelineLayout (device, &pipelineLayoutInfo, allocator,
                               &pipelineLayout)
       != VK_SUCCESS)
     {
       throw std::runtime_error ("Failed to create pipeline layout");
     }
 
-  VkGraphicsPipelineCreateInfo pipelineInfo{};
-  pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-  pipelineInfo.stageCount = 2;
-  pipelineInfo.pStages = shaderStages;
-  pipelineInfo.pVertexInputState = &vertexInputInfo;
-  pipelineInfo.pInputAssemblyState = &inputAssembly;
-  pipelineInfo.pViewportState = &viewportState;
-  pipelineInfo.pRasterizationState = &rasterizer;
-  pipelineInfo.pMultisampleState = &multisampling;
-  pipelineInfo.pDepthStencilState = nullptr;
-  pipelineInfo.pColorBlendState = &colorBlending;
-  pipelineInfo.pDynamicState = &dynamicState;
-  pipelineInfo.layout = pipelineLayout;
-  pipelineInfo.renderPass = renderPass;
-  pipelineInfo.subpass = 0;
-  pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
-  pipelineInfo.basePipelineIndex = -1;
-
-  if (vkCreateGraphicsPipelines (device, VK_NULL_HANDLE, 1, &pipelineInfo,
-                                 nullptr, &graphicsPipeline)
+  // NOTE: Pipelines are created once and used by every view
+  pipelines.init (device, pipelineCache, pipelineLayout, renderPass,
+                  pipelineLibraries, allocator, &logger);
+  pipelines.setShader (SHADER_TRIANGLE_VERT, "shaders/vert.spv");
+  pipelines.setShader (SHADER_TRIANGLE_FRAG, "shaders/frag.spv");
+  pipelines.setShader (SHADER_MESH_VERT, "shaders/mesh_vert.spv");
+  pipelines.setShader (SHADER_MESH_FRAG, "shaders/mesh_frag.spv");
+
+  bool quantized = options.vertexFormat == VertexFormat::Quantized;
+  if (!options.meshPath.empty ())
+    {
+      pipelines.setVertexInput (VERTEX_INPUT_MESH, meshVertexInput ());
+    }
+
+  // Everything the last run asked for compiles in the background from here
+  // on, the gets below usually find their pipeline already being compiled
+  if (!options.pipelineManifest.empty ())
+    {
+      pipelines.precompile (options.pipelineManifest);
+    }
+
+  // Both compile at once, this thread takes one of them while it waits.
+  // We hardcoded vertex data into the triangle's shader, it uses the empty
+  // vertex input.
+  JobSystem &jobs = JobSystem::shared ();
+  JobCounter compiles;
+  jobs.run (
+      [this] () { graphicsPipeline = pipelines.get (TRIANGLE_PIPELINE); },
+      &compiles);
+
+  if (!options.meshPath.empty ())
+    {
+      // Specialization constant 0 tells mesh.vert whether the normal is
+      // octahedral encoded
+      meshPipelineKey
+          = MESH_PIPELINE.withSpecialization (quantized ? VK_TRUE : VK_FALSE);
+      jobs.run ([this] () { meshPipeline = pipelines.get (meshPipelineKey); },
+                &compiles);
+    }
+  jobs.wait (compiles);
+}
+
+VertexInputLayout
+VulkanTriangleApplication::meshVertexInput ()
+{
+  bool quantized = options.vertexFormat == VertexFormat::Quantized;
+
+  VertexInputLayout meshInput;
+  meshInput.bindings.resize (1);
+  meshInput.bindings[0].binding = 0;
+  meshInput.bindings[0].stride = vertexStride (options.vertexFormat);
+  meshInput.bindings[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+  // NOTE: The fixed function fetch does the unpacking, UNORM/SNORM come out
+  // as floats in 0..1 / -1..1 and half floats as floats
+  meshInput.attributes.resize (4);
+  VkVertexInputAttributeDescription *attributeDescriptions
+      = meshInput.attributes.data ();
+  attributeDescriptions[0].location = 0;
+  attributeDescriptions[0].format = quantized
+                                        ? VK_FORMAT_R16G16B16A16_UNORM
+                                        : VK_FORMAT_R32G32B32_SFLOAT;
+  attributeDescriptions[0].offset = quantized
+                                        ? offsetof (PackedVertex, position)
+                                        : offsetof (Vertex, position);
+  attributeDescriptions[1].location = 1;
+  attributeDescriptions[1].format = quantized ? VK_FORMAT_R16G16_SNORM
+                                              : VK_FORMAT_R32G32B32_SFLOAT;
+  attributeDescriptions[1].offset = quantized ? offsetof (PackedVertex, normal)
+                                              : offsetof (Vertex, normal);
+  attributeDescriptions[2].location = 2;
+  attributeDescriptions[2].format
+      = quantized ? VK_FORMAT_R16G16_SFLOAT : VK_FORMAT_R32G32_SFLOAT;
+  attributeDescriptions[2].offset
+      = quantized ? offsetof (PackedVertex, uv) : offsetof (Vertex, uv);
+  attributeDescriptions[3].location = 3;
+  attributeDescriptions[3].format = quantized
+                                        ? VK_FORMAT_R8G8B8A8_UNORM
+                                        : VK_FORMAT_R32G32B32A32_SFLOAT;
+  attributeDescriptions[3].offset
+      = quantized ? offsetof (PackedVertex, color) : offsetof (Vertex, color);
+  return meshInput;
+}
+
+void
+VulkanTriangleApplication::createMeshBuffers ()
+{
+  if (options.meshPath.empty ())
+    {
+      return;
+    }
+
+  // Only the first load of a mesh pays for parsing and optimizing, after
+  // that this maps the cache file. initVulkan started it.
+  meshDecoding = false;
+  JobSystem::shared ().wait (meshLoad);
+  MappedMesh mesh = std::move (loadedMesh);
+  meshBounds = mesh.header ().bounds;
+  meshLodCount = mesh.header ().lodCount;
+  std::copy (mesh.header ().lods, mesh.header ().lods + meshLodCount,
+             meshLods.begin ());
+  meshIndexCount = meshLods[0].indexCount;
+  if (occlusionCulling)
+    {
+      occlusionCuller.setLods (meshLods.data (), meshLodCount);
+    }
+
+  const VkAllocationCallbacks *allocator
+      = memoryTracker.callbacks (HostAllocationType::Buffer);
+  GpuBuffer staging = stageMesh (mesh);
+
+  VkCommandBufferAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocInfo.commandPool = commandPool;
+  allocInfo.commandBufferCount = 1;
+
+  VkCommandBuffer buffer;
+  if (vkAllocateCommandBuffers (device, &allocInfo, &buffer) != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to allocate upload command buffer!");
+    }
+
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer (buffer, &beginInfo);
+  recordMeshUpload (buffer, staging);
+  vkEndCommandBuffer (buffer);
+
+  VkSubmitInfo submitInfo{};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &buffer;
+
+  // NOTE: Only at startup, where waiting for the queue costs nothing.
+  // Restoring after an eviction records the copy into a frame instead, see
+  // restoreMeshBuffers.
+  if (vkQueueSubmit (graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE)
       != VK_SUCCESS)
     {
-      throw std::runtime_error ("Failed to create graphics pipeline!");
+      throw std::runtime_error ("Failed to submit mesh upload!");
+    }
+  vkQueueWaitIdle (graphicsQueue);
+
+  vkFreeCommandBuffers (device, commandPool, 1, &buffer);
+  destroyBuffer (device, staging, allocator);
+  meshResident = true;
+}
+
+// The LOD table and bounds stay the first load's, the cache holds the same
+// mesh. The lodTable the culling dispatches read is left alone.
+void
+VulkanTriangleApplication::restoreMeshBuffers ()
+{
+  meshDecoding = false;
+  MappedMesh mesh;
+  try
+    {
+      JobSystem::shared ().wait (meshLoad);
+      mesh = std::move (loadedMesh);
+    }
+  catch (const std::exception &e)
+    {
+      // stays evicted, the next budget check tries again
+      std::string message
+          = std::string ("Failed to restore the mesh: ") + e.what ();
+      logger.log (LogSeverity::Warning, 0, message.c_str ());
+      return;
+    }
+
+  meshUpload = stageMesh (mesh);
+  meshResident = true;
+  for (uint32_t lod = 0; lod < meshLodCount; lod++)
+    {
+      drawList.setMesh (meshIds[lod], meshBinding (lod));
+    }
+  // on demand, the mesh wouldn't show up before the next event
+  sceneDirty = true;
+}
+
+// Creates the mesh buffers and returns a staging buffer holding their
+// contents. The cache is laid out like the buffers, one copy fills both.
+GpuBuffer
+VulkanTriangleApplication::stageMesh (MappedMesh &mesh)
+{
+  VkDeviceSize vertexBytes = mesh.vertexBytes ();
+  VkDeviceSize indexBytes = mesh.indexBytes ();
+  meshBytes = vertexBytes + indexBytes;
+  const VkAllocationCallbacks *allocator
+      = memoryTracker.callbacks (HostAllocationType::Buffer);
+  GpuBuffer staging = createBuffer (
+      physicalDevice, device, vertexBytes + indexBytes,
+      VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+          | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      0, true, allocator);
+  std::memcpy (staging.mapped, mesh.vertexData (), vertexBytes);
+  std::memcpy (static_cast<char *> (staging.mapped) + vertexBytes,
+               mesh.indices (), indexBytes);
+  mesh.close ();
+
+  meshVertexBuffer = createBuffer (
+      physicalDevice, device, vertexBytes,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, false, allocator);
+  meshIndexBuffer = createBuffer (
+      physicalDevice, device, indexBytes,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, false, allocator);
+  return staging;
+}
+
+void
+VulkanTriangleApplication::recordMeshUpload (VkCommandBuffer buffer,
+                                             const GpuBuffer &staging)
+{
+  VkBufferCopy vertexCopy{ 0, 0, meshVertexBuffer.size };
+  vkCmdCopyBuffer (buffer, staging.buffer, meshVertexBuffer.buffer, 1,
+                   &vertexCopy);
+  VkBufferCopy indexCopy{ meshVertexBuffer.size, 0, meshIndexBuffer.size };
+  vkCmdCopyBuffer (buffer, staging.buffer, meshIndexBuffer.buffer, 1,
+                   &indexCopy);
+
+  // the draws later in the same submit read them
+  VkMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask
+      = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+  vkCmdPipelineBarrier (buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &barrier,
+                        0, nullptr, 0, nullptr);
+}
+
+void
+VulkanTriangleApplication::releaseMeshBuffers ()
+{
+  const VkAllocationCallbacks *allocator
+      = memoryTracker.callbacks (HostAllocationType::Buffer);
+  destroyBuffer (device, meshVertexBuffer, allocator);
+  destroyBuffer (device, meshIndexBuffer, allocator);
+  meshResident = false;
+}
+
+// Levels share the vertices, each is its own range of the index buffer
+MeshBinding
+VulkanTriangleApplication::meshBinding (uint32_t lod) const
+{
+  MeshBinding mesh{};
+  mesh.vertexBuffer = meshVertexBuffer.buffer;
+  mesh.indexBuffer = meshIndexBuffer.buffer;
+  mesh.indexOffset = meshLods[lod].firstIndex * sizeof (uint32_t);
+  mesh.indexType = VK_INDEX_TYPE_UINT32;
+  mesh.elementCount = meshLods[lod].indexCount;
+  return mesh;
+}
+
+// World space box around every instance, see instanceSpacing
+void
+VulkanTriangleApplication::gridBounds (Vec3 &min, Vec3 &max) const
+{
+  uint32_t columns
+      = std::max (std::min (scene.constants.columns, scene.instanceCount), 1u);
+  uint32_t rows = (scene.instanceCount + columns - 1) / columns;
+  float spacing = gridSpacing (meshBounds);
+  min = Vec3{ meshBounds.min[0], meshBounds.min[1], meshBounds.min[2] };
+  max = Vec3{ meshBounds.max[0] + (columns - 1) * spacing, meshBounds.max[1],
+              meshBounds.max[2] + (std::max (rows, 1u) - 1) * spacing };
+}
+
+void
+VulkanTriangleApplication::cameraPosition (const WindowView &view, Vec3 &eye,
+                                           Vec3 &center, float &radius) const
+{
+  Vec3 min, max;
+  gridBounds (min, max);
+  center = (min + max) * 0.5f;
+  radius = length (max - min) * 0.5f;
+  if (radius <= 0.0f)
+    {
+      radius = 1.0f;
+    }
+
+  // Slowly orbit the mesh, framed so its bounding sphere always fits
+  float angle
+      = static_cast<float> (animationFrame) * 0.01f + view.cameraAngle;
+  float distance = radius * 2.5f;
+  eye = center
+        + Vec3{ std::sin (angle) * distance, radius * 0.5f,
+                std::cos (angle) * distance };
+}
+
+Mat4
+VulkanTriangleApplication::worldViewProjection (const WindowView &view) const
+{
+  Vec3 eye, center;
+  float radius;
+  cameraPosition (view, eye, center, radius);
+
+  float aspect = static_cast<float> (view.swapChainExtent.width)
+                 / static_cast<float> (view.swapChainExtent.height);
+  return perspective (CAMERA_FOV, aspect, radius * 0.5f, radius * 4.5f)
+         * lookAt (eye, center, Vec3{ 0.0f, 1.0f, 0.0f });
+}
+
+Mat4
+VulkanTriangleApplication::cameraViewProjection (const WindowView &view)
+{
+  Mat4 viewProjection = worldViewProjection (view);
+
+  // Quantized positions are 0..1 within the bounds, folding the decode into
+  // the matrix keeps it out of the shader
+  if (options.vertexFormat == VertexFormat::Quantized)
+    {
+      float decodeScale[3], decodeOffset[3];
+      positionDecodeTransform (meshBounds, decodeScale, decodeOffset);
+      viewProjection
+          = viewProjection
+            * translate (Vec3{ decodeOffset[0], decodeOffset[1],
+                               decodeOffset[2] })
+            * scale (Vec3{ decodeScale[0], decodeScale[1], decodeScale[2] });
+    }
+  return viewProjection;
+}
+
+void
+VulkanTriangleApplication::instanceSpacing (float spacing[2]) const
+{
+  float world = gridSpacing (meshBounds);
+  spacing[0] = world;
+  spacing[1] = world;
+
+  // mesh.vert offsets positions before the decode in viewProjection
+  if (options.vertexFormat == VertexFormat::Quantized)
+    {
+      float decodeScale[3], decodeOffset[3];
+      positionDecodeTransform (meshBounds, decodeScale, decodeOffset);
+      spacing[0] = decodeScale[0] != 0.0f ? world / decodeScale[0] : 0.0f;
+      spacing[1] = decodeScale[2] != 0.0f ? world / decodeScale[2] : 0.0f;
+    }
+}
+
+CullInput
+VulkanTriangleApplication::cullInput (
+    const WindowView &view, const ScenePushConstants &constants) const
+{
+  CullInput input;
+  input.viewProjection = constants.viewProjection;
+  for (int k = 0; k < 3; k++)
+    {
+      // quantized positions span 0..1 on every axis
+      bool quantized = options.vertexFormat == VertexFormat::Quantized;
+      input.boundsMin[k] = quantized ? 0.0f : meshBounds.min[k];
+      input.boundsMax[k] = quantized ? 1.0f : meshBounds.max[k];
+    }
+  input.spacingX = constants.instanceSpacing[0];
+  input.spacingZ = constants.instanceSpacing[1];
+  input.columns = std::max (constants.columns, 1u);
+  input.instanceCount = scene.instanceCount;
+  input.lodPixelsPerUnit
+      = lodPixelsPerUnit (renderExtent (view), options.lodErrorPixels);
+  input.viewport = renderExtent (view);
+  return input;
+}
+
+void
+VulkanTriangleApplication::setupDrawList ()
+{
+  trianglePipelineId = drawList.addPipeline (graphicsPipeline, pipelineLayout);
+
+  // The triangle's vertices live in shader.vert, so there is nothing to bind
+  MeshBinding triangle{};
+  triangle.elementCount = 3;
+  triangleMeshId = drawList.addMesh (triangle);
+
+  if (meshIndexCount != 0)
+    {
+      meshPipelineId = drawList.addPipeline (meshPipeline, pipelineLayout);
+
+      for (uint32_t lod = 0; lod < meshLodCount; lod++)
+        {
+          meshIds[lod] = drawList.addMesh (meshBinding (lod));
+        }
+      if (occlusionCulling)
+        {
+          // pointed at the culler's draws in recordScene
+          meshDrawsId = drawList.addIndirect (IndirectBinding ());
+        }
     }
+}
 
-  vkDestroyShaderModule (device, fragShaderModule, nullptr);
-  vkDestroyShaderModule (device, vertShaderModule, nullptr);
+void
+VulkanTriangleApplication::buildDrawList ()
+{
+  drawList.clear ();
+
+  // Fast-linked pipelines are swapped for their optimized link once the
+  // background link is done
+  uint64_t optimizedLinks = pipelines.stats ().optimizedLinks;
+  if (optimizedLinks != seenOptimizedLinks)
+    {
+      seenOptimizedLinks = optimizedLinks;
+      drawList.setPipeline (trianglePipelineId,
+                            pipelines.get (TRIANGLE_PIPELINE));
+      if (meshIndexCount != 0)
+        {
+          drawList.setPipeline (meshPipelineId,
+                                pipelines.get (meshPipelineKey));
+        }
+    }
+
+  DrawCommand command{};
+  command.pipeline = trianglePipelineId;
+  command.mesh = triangleMeshId;
+  command.instanceCount = scene.instanceCount;
+  if (meshIndexCount != 0)
+    {
+      command.pipeline = meshPipelineId;
+      command.mesh = meshIds[0];
+    }
+  // One indirect draw per instance, beyond the device's limit on draws per
+  // call every instance is drawn
+  frameCulled = occlusionCulling && meshResident
+                && scene.instanceCount <= occlusionCuller.maxInstances ();
+  if (frameCulled)
+    {
+      occlusionCuller.reserve (scene.instanceCount);
+      command.indirect = meshDrawsId;
+    }
+  // Otherwise instances outside every view can still be left out on the
+  // CPU, in runs of consecutive visible instances
+  frameCpuCulled = options.cpuCulling && meshIndexCount != 0 && meshResident
+                   && !frameCulled;
+  if (frameCpuCulled)
+    {
+      cullInstances ();
+    }
+  // An evicted mesh is left out until manageMemory brings it back
+  if (meshIndexCount == 0 || frameCulled)
+    {
+      drawList.push (command);
+    }
+  else if (meshResident)
+    {
+      pushMeshRows (command);
+    }
+
+  drawList.sort ();
+}
+
+// Picks a level of detail per row of mesh instances, the finest any view
+// needs for the row's closest point, and draws runs of rows at the same
+// level together
+void
+VulkanTriangleApplication::pushMeshRows (DrawCommand command)
+{
+  if (meshLodCount <= 1 || options.lodErrorPixels <= 0.0f)
+    {
+      pushVisible (command);
+      return;
+    }
+
+  Vec3 eyes[MAX_WINDOWS];
+  float pixelsPerUnit[MAX_WINDOWS];
+  for (size_t v = 0; v < views.size (); v++)
+    {
+      Vec3 center;
+      float radius;
+      cameraPosition (views[v], eyes[v], center, radius);
+      pixelsPerUnit[v] = lodPixelsPerUnit (renderExtent (views[v]),
+                                           options.lodErrorPixels);
+    }
+
+  uint32_t columns
+      = std::max (std::min (scene.constants.columns, scene.instanceCount), 1u);
+  uint32_t rows = (scene.instanceCount + columns - 1) / columns;
+  float spacing = gridSpacing (meshBounds);
+  Vec3 min, max;
+  gridBounds (min, max);
+
+  uint32_t runStart = 0;
+  uint32_t runLod = 0;
+  for (uint32_t row = 0; row <= rows; row++)
+    {
+      uint32_t lod = 0;
+      if (row < rows)
+        {
+          min.z = meshBounds.min[2] + row * spacing;
+          max.z = meshBounds.max[2] + row * spacing;
+          lod = meshLodCount - 1;
+          for (size_t v = 0; v < views.size (); v++)
+            {
+              Vec3 outside{
+                std::max ({ min.x - eyes[v].x, 0.0f, eyes[v].x - max.x }),
+                std::max ({ min.y - eyes[v].y, 0.0f, eyes[v].y - max.y }),
+                std::max ({ min.z - eyes[v].z, 0.0f, eyes[v].z - max.z })
+              };
+              lod = std::min (lod, selectLod (meshLods.data (), meshLodCount,
+                                              length (outside),
+                                              pixelsPerUnit[v]));
+            }
+        }
+
+      if (row == rows || (row > 0 && lod != runLod))
+        {
+          command.mesh = meshIds[runLod];
+          command.firstInstance = runStart * columns;
+          command.instanceCount
+              = std::min (row * columns, scene.instanceCount)
+                - command.firstInstance;
+          pushVisible (command);
+          runStart = row;
+        }
+      runLod = lod;
+    }
+}
+
+void
+VulkanTriangleApplication::cullInstances ()
+{
+  // Instance i sits at (i % columns, i / columns) * spacing on the XZ
+  // plane, see mesh.vert
+  uint32_t columns = std::max (scene.constants.columns, 1u);
+  if (frustumCuller.size () != scene.instanceCount
+      || cullerColumns != columns)
+    {
+      float spacing = gridSpacing (meshBounds);
+      float center[3], extent[3];
+      for (int k = 0; k < 3; k++)
+        {
+          center[k] = (meshBounds.min[k] + meshBounds.max[k]) * 0.5f;
+          extent[k] = (meshBounds.max[k] - meshBounds.min[k]) * 0.5f;
+        }
+      float radius = std::sqrt (extent[0] * extent[0] + extent[1] * extent[1]
+                                + extent[2] * extent[2]);
+
+      frustumCuller.clear ();
+      frustumCuller.reserve (scene.instanceCount);
+      for (uint32_t i = 0; i < scene.instanceCount; i++)
+        {
+          float position[3] = { center[0] + (i % columns) * spacing, center[1],
+                                center[2] + (i / columns) * spacing };
+          frustumCuller.add (position, radius, extent);
+        }
+      cullerColumns = columns;
+      visibleInstances.resize (scene.instanceCount);
+      chunkVisible.resize ((scene.instanceCount + CULL_CHUNK - 1)
+                           / CULL_CHUNK);
+    }
+
+  // Every view draws the same list, an instance any of them sees is kept
+  Frustum frustums[MAX_WINDOWS];
+  for (size_t v = 0; v < views.size (); v++)
+    {
+      frustums[v] = extractFrustum (worldViewProjection (views[v]));
+    }
+
+  // Chunks are culled by jobs into their own part of visibleInstances,
+  // then moved down in order so the list stays ascending
+  uint32_t frustumCount = static_cast<uint32_t> (views.size ());
+  JobSystem::shared ().parallelFor (
+      scene.instanceCount, CULL_CHUNK, [&] (uint32_t begin, uint32_t end) {
+        chunkVisible[begin / CULL_CHUNK]
+            = frustumCuller.cull (frustums, frustumCount, begin, end,
+                                  visibleInstances.data () + begin);
+      });
+  visibleCount = 0;
+  for (size_t chunk = 0; chunk < chunkVisible.size (); chunk++)
+    {
+      std::memmove (visibleInstances.data () + visibleCount,
+                    visibleInstances.data () + chunk * CULL_CHUNK,
+                    chunkVisible[chunk] * sizeof (uint32_t));
+      visibleCount += chunkVisible[chunk];
+    }
+
+  if (frameNumber % CULLING_LOG_INTERVAL == 0
+      && logger.enabled (LogSeverity::Info))
+    {
+      char message[160];
+      snprintf (message, sizeof (message),
+                "Frustum culling kept %u of %u instances (%s)", visibleCount,
+                scene.instanceCount, cullIsaName (bestCullIsa ()));
+      logger.log (LogSeverity::Info, 0, message);
+    }
+}
+
+// Pushes the command's instances that passed cullInstances, one draw per
+// run of consecutive ones
+void
+VulkanTriangleApplication::pushVisible (DrawCommand command)
+{
+  if (!frameCpuCulled)
+    {
+      drawList.push (command);
+      return;
+    }
+
+  uint32_t end = command.firstInstance + command.instanceCount;
+  const uint32_t *visible = visibleInstances.data ();
+  const uint32_t *visibleEnd = visible + visibleCount;
+  const uint32_t *i
+      = std::lower_bound (visible, visibleEnd, command.firstInstance);
+  while (i != visibleEnd && *i < end)
+    {
+      const uint32_t *run = i;
+      while (i + 1 != visibleEnd && i[1] == i[0] + 1 && i[1] < end)
+        {
+          i++;
+        }
+      command.firstInstance = *run;
+      command.instanceCount = *i - *run + 1;
+      drawList.push (command);
+      i++;
+    }
+}
+
+void
+VulkanTriangleApplication::createQuads ()
+{
+  quadBatcher.init (physicalDevice, device, pipelineCache, renderPass,
+                    memoryTracker.callbacks (HostAllocationType::Buffer));
+
+  // White shapes, the quads tint them
+  std::vector<uint32_t> pixels (QUAD_TEXTURE_SIZE * QUAD_TEXTURE_SIZE);
+  for (uint32_t shape = 0; shape < QUAD_TEXTURE_COUNT; shape++)
+    {
+      for (uint32_t y = 0; y < QUAD_TEXTURE_SIZE; y++)
+        {
+          for (uint32_t x = 0; x < QUAD_TEXTURE_SIZE; x++)
+            {
+              float u = (x + 0.5f) * 2.0f / QUAD_TEXTURE_SIZE - 1.0f;
+              float v = (y + 0.5f) * 2.0f / QUAD_TEXTURE_SIZE - 1.0f;
+              uint32_t alpha = static_cast<uint32_t> (
+                  spriteCoverage (shape, u, v) * 255.0f + 0.5f);
+              pixels[y * QUAD_TEXTURE_SIZE + x] = 0x00ffffffu | alpha << 24;
+            }
+        }
+
+      quadTextures[shape] = createTexture (
+          physicalDevice, device, commandPool, graphicsQueue,
+          VK_FORMAT_R8G8B8A8_UNORM, QUAD_TEXTURE_SIZE, QUAD_TEXTURE_SIZE,
+          pixels.data (), pixels.size () * sizeof (uint32_t),
+          memoryTracker.callbacks (HostAllocationType::Image));
+      quadBatcher.addTexture (quadTextures[shape].view);
+    }
+  quadsReady = true;
+}
+
+void
+VulkanTriangleApplication::buildQuads ()
+{
+  // Most runs never draw a quad, they don't pay for the pipeline
+  if (!quadsReady)
+    {
+      createQuads ();
+    }
+
+  // The frame's fence was waited for, its slot of the stream is free
+  quadBatcher.reserve (scene.quadCount);
+  quadBatcher.begin (currentFrame);
+
+  // One quad per cell of a grid over the first view, twice the cell's size
+  // so neighbours overlap, each turning with its own phase. Every quad is
+  // rewritten every frame. Neighbours cycle through the textures, so every
+  // texture's quads come interleaved with all the others.
+  quadCanvas = views[0].swapChainExtent;
+  float width = static_cast<float> (std::max (quadCanvas.width, 1u));
+  float height = static_cast<float> (std::max (quadCanvas.height, 1u));
+  uint32_t columns = std::max (
+      static_cast<uint32_t> (std::ceil (std::sqrt (scene.quadCount * width
+                                                   / height))),
+      1u);
+  uint32_t rows = (scene.quadCount + columns - 1) / columns;
+  float cell = width / columns;
+  float angle = static_cast<float> (animationFrame % 100000) * QUAD_SPIN;
+
+  uint32_t i = 0;
+  for (uint32_t row = 0; i < scene.quadCount; row++)
+    {
+      for (uint32_t column = 0; column < columns && i < scene.quadCount;
+           column++, i++)
+        {
+          Quad *quad = quadBatcher.add (i % QUAD_TEXTURE_COUNT);
+          quad->position[0] = (column - 0.5f) * cell;
+          quad->position[1] = (row - 0.5f) * cell;
+          quad->size[0] = 2.0f * cell;
+          quad->size[1] = 2.0f * cell;
+          quad->uv[0] = 0;
+          quad->uv[1] = 0;
+          quad->uv[2] = 0xffff;
+          quad->uv[3] = 0xffff;
+          // red across, green down, three quarters opaque
+          quad->color = (column * 255 / columns) | (row * 255 / rows) << 8
+                        | 0xc0800000u;
+          quad->rotation = angle + i * 0.1f;
+        }
+    }
+  quadBatcher.end ();
+
+  const QuadBatcherStats &batched = quadBatcher.stats ();
+  if (frameNumber % QUAD_LOG_INTERVAL == 0
+      && logger.enabled (LogSeverity::Info))
+    {
+      char message[160];
+      snprintf (message, sizeof (message),
+                "Quad batching drew %u quads in %u draws, %u texture binds, "
+                "%u dropped",
+                batched.quads, batched.draws, batched.textureBinds,
+                batched.dropped);
+      logger.log (LogSeverity::Info, 0, message);
+    }
+}
+
+void
+VulkanTriangleApplication::buildParticles ()
+{
+  if (!particlesReady)
+    {
+      particleSystem.init (
+          physicalDevice, device, pipelineCache, renderPass,
+          memoryTracker.callbacks (HostAllocationType::Buffer));
+      particlesReady = true;
+    }
+  particleSystem.reserve (scene.particleCount);
+
+  // A fountain in the middle of the grid's floor, as wide as the grid
+  Vec3 min, max;
+  gridBounds (min, max);
+  Vec3 center = (min + max) * 0.5f;
+  particleEmitter.position[0] = center.x;
+  particleEmitter.position[1] = min.y;
+  particleEmitter.position[2] = center.z;
+  particleEmitter.scale = std::max (length (max - min) * 0.5f, 1e-3f);
+}
+
+void
+VulkanTriangleApplication::buildHud ()
+{
+  HudStats stats;
+  stats.frame = frameNumber;
+  stats.frameSlot = currentFrame;
+  stats.framesInFlight = framesInFlight;
+  stats.intervalMilliseconds = frameInterval;
+  stats.cpuMilliseconds = frameCpuTime;
+  stats.gpuMilliseconds = gpuMilliseconds;
+  stats.latencyMilliseconds = presentLatency.stats ().latencyMilliseconds;
+  stats.resolutionScale = dynamicResolution ? resolutionScaler.scale () : 1.0f;
+  // as of the last manageMemory
+  if (memoryTracker.hasBudget ())
+    {
+      for (const HeapBudget &heap : memoryTracker.heaps ())
+        {
+          if (heap.deviceLocal)
+            {
+              stats.deviceUsage += heap.usage;
+              stats.deviceBudget += heap.budget;
+            }
+        }
+    }
+  hud.build (stats, frames[currentFrame]);
 }
 
 void
@@ -586,35 +2159,106 @@ VulkanTriangleApplication::createRenderPass ()
   colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
   colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
   colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  // Offscreen targets are only ever copied from, render targets only ever
+  // blitted from
+  colorAttachment.finalLayout
+      = options.headless || renderTargets
+            ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+            : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+  VkAttachmentDescription depthAttachment{};
+  depthAttachment.format = depthFormat;
+  depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  depthAttachment.finalLayout
+      = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
   VkAttachmentReference colorAttachmentRef{};
   colorAttachmentRef.attachment = 0;
   colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+  VkAttachmentReference depthAttachmentRef{};
+  depthAttachmentRef.attachment = 1;
+  depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
   VkSubpassDescription subpass{};
   subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
   subpass.colorAttachmentCount = 1;
   subpass.pColorAttachments = &colorAttachmentRef;
+  subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
-  VkSubpassDependency dependency{};
+  VkSubpassDependency dependencies[2]{};
+  VkSubpassDependency &dependency = dependencies[0];
   dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
   dependency.dstSubpass = 0;
-  dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependency.srcAccessMask = 0;
-  dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  // The depth buffer is shared between frames, so the clear has to wait
+  // for the previous frame's depth tests too
+  dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+                            | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+                            | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+  dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+                             | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  if (renderTargets)
+    {
+      // The render target is shared too, the previous frame's blit has to
+      // read it before the clear
+      dependency.srcStageMask |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+    }
+
+  // NOTE: With capture on the image is copied right after the pass, and
+  // with dynamic resolution blitted, so the final layout transition has to
+  // finish before the transfer reads it
+  VkSubpassDependency &captureDependency = dependencies[1];
+  captureDependency.srcSubpass = 0;
+  captureDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+  captureDependency.srcStageMask
+      = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  captureDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  captureDependency.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  captureDependency.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+  if (occlusionCulling)
+    {
+      // The previous frame's depth pyramid reads the depth buffer too
+      dependency.srcStageMask |= VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+      createEarlyRenderPass (colorAttachment, depthAttachment, subpass,
+                             dependency);
+
+      // Picks up where the early pass and the depth pyramid left off
+      colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+      colorAttachment.initialLayout
+          = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+      depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+      depthAttachment.initialLayout
+          = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+      dependency.srcAccessMask |= VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+      dependency.dstAccessMask
+          |= VK_ACCESS_COLOR_ATTACHMENT_READ_BIT
+             | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+    }
 
   VkRenderPassCreateInfo renderPassInfo{};
   renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-  renderPassInfo.attachmentCount = 1;
-  renderPassInfo.pAttachments = &colorAttachment;
+  VkAttachmentDescription attachments[] = { colorAttachment, depthAttachment };
+  renderPassInfo.attachmentCount = 2;
+  renderPassInfo.pAttachments = attachments;
   renderPassInfo.subpassCount = 1;
   renderPassInfo.pSubpasses = &subpass;
-  renderPassInfo.dependencyCount = 1;
-  renderPassInfo.pDependencies = &dependency;
-
-  if (vkCreateRenderPass (device, &renderPassInfo, nullptr, &renderPass)
+  bool transferReads = !options.capture.directory.empty ()
+                       || options.headless || renderTargets;
+  renderPassInfo.dependencyCount = transferReads ? 2 : 1;
+  renderPassInfo.pDependencies = dependencies;
+
+  if (vkCreateRenderPass (
+          device, &renderPassInfo,
+          memoryTracker.callbacks (HostAllocationType::RenderPass),
+          &renderPass)
       != VK_SUCCESS)
     {
       throw std::runtime_error ("Failed to create render pass!");
@@ -622,29 +2266,92 @@ VulkanTriangleApplication::createRenderPass ()
 }
 
 void
-VulkanTriangleApplication::createFramebuffers ()
+VulkanTriangleApplication::createEarlyRenderPass (
+    VkAttachmentDescription colorAttachment,
+    VkAttachmentDescription depthAttachment,
+    const VkSubpassDescription &subpass, const VkSubpassDependency &dependency)
+{
+  // Compatible with renderPass, so its pipelines and framebuffers work in
+  // both. The depth ends up read only for the pyramid's downsample.
+  colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  depthAttachment.finalLayout
+      = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+  VkSubpassDependency dependencies[2] = { dependency, {} };
+  VkSubpassDependency &cullDependency = dependencies[1];
+  cullDependency.srcSubpass = 0;
+  cullDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+  cullDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+                                | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  cullDependency.srcAccessMask
+      = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+        | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  cullDependency.dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+                                | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+                                | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+  cullDependency.dstAccessMask
+      = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT
+        | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+        | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT
+        | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+  VkRenderPassCreateInfo renderPassInfo{};
+  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  VkAttachmentDescription attachments[] = { colorAttachment, depthAttachment };
+  renderPassInfo.attachmentCount = 2;
+  renderPassInfo.pAttachments = attachments;
+  renderPassInfo.subpassCount = 1;
+  renderPassInfo.pSubpasses = &subpass;
+  renderPassInfo.dependencyCount = 2;
+  renderPassInfo.pDependencies = dependencies;
+
+  if (vkCreateRenderPass (
+          device, &renderPassInfo,
+          memoryTracker.callbacks (HostAllocationType::RenderPass),
+          &earlyRenderPass)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to create early render pass!");
+    }
+}
+
+void
+VulkanTriangleApplication::createFramebuffers (WindowView &view)
 {
-  swapChainFramebuffers.resize (swapChainImageViews.size ());
+  view.swapChainFramebuffers.clear ();
 
-  for (size_t i = 0; i < swapChainImageViews.size (); i++)
+  FramebufferCold owner;
+  owner.renderPass = renderPass;
+  owner.extent = view.swapChainExtent;
+  for (ImageHandle handle : view.swapChainImages)
     {
-      VkImageView attachments[] = { swapChainImageViews[i] };
+      // Every framebuffer of a view with a render target draws into it
+      VkImageView attachments[]
+          = { renderTargets ? view.renderImageView
+                            : images.hot (handle)->view,
+              view.depthImageView };
 
       VkFramebufferCreateInfo framebufferInfo{};
       framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
       framebufferInfo.renderPass = renderPass;
-      framebufferInfo.attachmentCount = 1;
+      framebufferInfo.attachmentCount = 2;
       framebufferInfo.pAttachments = attachments;
-      framebufferInfo.width = swapChainExtent.width;
-      framebufferInfo.height = swapChainExtent.height;
+      framebufferInfo.width = view.swapChainExtent.width;
+      framebufferInfo.height = view.swapChainExtent.height;
       framebufferInfo.layers = 1;
 
-      if (vkCreateFramebuffer (device, &framebufferInfo, nullptr,
-                               &swapChainFramebuffers[i])
+      FramebufferHot target;
+      if (vkCreateFramebuffer (
+              device, &framebufferInfo,
+              memoryTracker.callbacks (HostAllocationType::RenderPass),
+              &target.framebuffer)
           != VK_SUCCESS)
         {
           throw std::runtime_error ("Failed to create framebuffer!");
         }
+      view.swapChainFramebuffers.push_back (
+          framebuffers.create (target, owner));
     }
 }
 
@@ -653,12 +2360,14 @@ VulkanTriangleApplication::createCommandPool ()
 {
   VkCommandPoolCreateInfo poolInfo{};
   poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-  // NOTE: Since we are recording a command buffer every frame, we need to be
-  // able to reset and rerecord over it
-  poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  // NOTE: Only one time uploads come from here, frames record from the
+  // pool of their FrameContext
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
   poolInfo.queueFamilyIndex = indices.graphicsFamily.value ();
 
-  if (vkCreateCommandPool (device, &poolInfo, nullptr, &commandPool)
+  if (vkCreateCommandPool (
+          device, &poolInfo,
+          memoryTracker.callbacks (HostAllocationType::Command), &commandPool)
       != VK_SUCCESS)
     {
       throw std::runtime_error ("Failed to create command pool!");
@@ -666,13 +2375,17 @@ VulkanTriangleApplication::createCommandPool ()
 }
 
 void
-VulkanTriangleApplication::createCommandBuffers ()
+VulkanTriangleApplication::createFrameContexts ()
 {
-  commandBuffers.resize (MAX_FRAMES_IN_FLIGHT);
+  VkCommandPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  // NOTE: Buffers are rerecorded every frame, the whole pool is reset at
+  // once instead of buffer by buffer
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+  poolInfo.queueFamilyIndex = indices.graphicsFamily.value ();
 
   VkCommandBufferAllocateInfo allocInfo{};
   allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  allocInfo.commandPool = commandPool;
   /*
    * VK_COMMAND_BUFFER_LEVEL_PRIMARY - can be submitted to queue for execution,
    * but not accessable from other command buffers
@@ -681,19 +2394,107 @@ VulkanTriangleApplication::createCommandBuffers ()
    * be used by other primary command buffers
    */
   allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-  allocInfo.commandBufferCount = (uint32_t)commandBuffers.size ();
+  // Every view records its own buffer, they all go into the same submit
+  allocInfo.commandBufferCount = static_cast<uint32_t> (views.size ());
 
-  if (vkAllocateCommandBuffers (device, &allocInfo, commandBuffers.data ())
-      != VK_SUCCESS)
+  VkSemaphoreCreateInfo semaphoreInfo{};
+  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+  VkFenceCreateInfo fenceInfo{};
+  fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+  const VkAllocationCallbacks *commandAllocator
+      = memoryTracker.callbacks (HostAllocationType::Command);
+  const VkAllocationCallbacks *syncAllocator
+      = memoryTracker.callbacks (HostAllocationType::Sync);
+  for (uint32_t i = 0; i < framesInFlight; i++)
+    {
+      FrameContext &frame = frames[i];
+      if (vkCreateCommandPool (device, &poolInfo, commandAllocator,
+                               &frame.commandPool)
+          != VK_SUCCESS)
+        {
+          throw std::runtime_error ("Failed to create command pool!");
+        }
+
+      allocInfo.commandPool = frame.commandPool;
+      if (vkAllocateCommandBuffers (device, &allocInfo, frame.commandBuffers)
+          != VK_SUCCESS)
+        {
+          throw std::runtime_error ("Failed to allocate command buffers!");
+        }
+
+      if (vkCreateFence (device, &fenceInfo, syncAllocator,
+                         &frame.inFlightFence)
+          != VK_SUCCESS)
+        {
+          throw std::runtime_error (
+              "Failed to create sync objects for a frame!");
+        }
+      for (size_t j = 0; j < views.size (); j++)
+        {
+          if (vkCreateSemaphore (device, &semaphoreInfo, syncAllocator,
+                                 &frame.imageAvailableSemaphores[j])
+                  != VK_SUCCESS
+              || vkCreateSemaphore (device, &semaphoreInfo, syncAllocator,
+                                    &frame.renderFinishedSemaphores[j])
+                     != VK_SUCCESS)
+            {
+              throw std::runtime_error (
+                  "Failed to create sync objects for a frame!");
+            }
+        }
+
+      // Device local when the host can map it, e.g. with resizable BAR
+      frame.uploadBuffer = createBuffer (
+          physicalDevice, device, UPLOAD_RING_SIZE,
+          VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
+              | VK_BUFFER_USAGE_INDEX_BUFFER_BIT
+              | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
+              | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+              | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+              | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true,
+          memoryTracker.callbacks (HostAllocationType::Buffer));
+    }
+}
+
+void
+VulkanTriangleApplication::destroyFrameContexts ()
+{
+  const VkAllocationCallbacks *syncAllocator
+      = memoryTracker.callbacks (HostAllocationType::Sync);
+  for (uint32_t i = 0; i < framesInFlight; i++)
     {
-      throw std::runtime_error ("Failed to allocate command buffers!");
+      FrameContext &frame = frames[i];
+      // The device is idle, whatever was deferred can go
+      frame.retire ();
+
+      vkDestroyFence (device, frame.inFlightFence, syncAllocator);
+      for (size_t j = 0; j < views.size (); j++)
+        {
+          vkDestroySemaphore (device, frame.imageAvailableSemaphores[j],
+                              syncAllocator);
+          vkDestroySemaphore (device, frame.renderFinishedSemaphores[j],
+                              syncAllocator);
+        }
+      // frees the command buffers with it
+      vkDestroyCommandPool (
+          device, frame.commandPool,
+          memoryTracker.callbacks (HostAllocationType::Command));
+      destroyBuffer (device, frame.uploadBuffer,
+                     memoryTracker.callbacks (HostAllocationType::Buffer));
+      frame = FrameContext ();
     }
 }
 
 void
-VulkanTriangleApplication::recordCommandBuffer (VkCommandBuffer buffer,
-                                                uint32_t imageIndex)
+VulkanTriangleApplication::recordCommandBuffer (WindowView &view)
 {
+  FrameContext &frame = frames[currentFrame];
+  VkCommandBuffer buffer = frame.commandBuffers[view.index];
   VkCommandBufferBeginInfo beginInfo{};
   beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
@@ -702,154 +2503,640 @@ VulkanTriangleApplication::recordCommandBuffer (VkCommandBuffer buffer,
       throw std::runtime_error ("Failed to begin recording command buffer!");
     }
 
+  // An on-demand redraw with nothing new only blits the last frame again
+  bool redraw = !options.redrawOnDemand || sceneDirty || !view.targetValid;
+
+  // One pair of timestamps brackets the rendering of every view, frames
+  // that only present again would make the GPU look idle
+  bool timed = gpuTimed && (!options.redrawOnDemand || sceneDirty);
+  uint32_t firstQuery = 2 * currentFrame;
+  if (timed && &view == batch.views.front ())
+    {
+      vkCmdResetQueryPool (buffer, timestampPool, firstQuery, 2);
+      vkCmdWriteTimestamp (buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                           timestampPool, firstQuery);
+    }
+
+  // A restored mesh is copied ahead of every view drawing it, the staging
+  // buffer goes once the frame's fence has signalled
+  if (meshUpload.buffer != VK_NULL_HANDLE && &view == batch.views.front ())
+    {
+      recordMeshUpload (buffer, meshUpload);
+      GpuBuffer staging = meshUpload;
+      const VkAllocationCallbacks *allocator
+          = memoryTracker.callbacks (HostAllocationType::Buffer);
+      frame.defer ([this, staging, allocator] () mutable {
+        destroyBuffer (device, staging, allocator);
+      });
+      meshUpload = GpuBuffer ();
+    }
+
+  // One step a frame, ahead of every view drawing it, the views share one
+  // submit
+  if (scene.particleCount != 0 && &view == batch.views.front ()
+      && (!options.redrawOnDemand || sceneDirty))
+    {
+      particleSystem.recordSimulation (buffer, particleEmitter,
+                                       static_cast<uint32_t> (frameNumber));
+    }
+
+  if (redraw)
+    {
+      recordScene (buffer, view);
+      view.targetValid = renderTargets;
+    }
+
+  // NOTE: Taken before the upscale, which waits for the acquired image.
+  // Timing it would count the time the presentation engine held on to the
+  // image as GPU time.
+  if (timed && &view == batch.views.back ())
+    {
+      vkCmdWriteTimestamp (buffer,
+                           VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                           timestampPool, firstQuery + 1);
+      frame.timed = true;
+    }
+  if (renderTargets)
+    {
+      recordUpscale (buffer, view);
+    }
+
+  // Only the first view is captured, the capture ring has one slot per
+  // frame in flight
+  if (&view == &views[0] && frameCapture.wantsCopy ())
+    {
+      frameCapture.recordCopy (
+          buffer, currentFrame,
+          images.hot (view.swapChainImages[view.imageIndex])->image,
+          frameNumber);
+    }
+
+  if (vkEndCommandBuffer (buffer) != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to record command buffer!");
+    }
+}
+
+void
+VulkanTriangleApplication::recordScene (VkCommandBuffer buffer,
+                                        WindowView &view)
+{
+  ScenePushConstants constants = scene.constants;
+  if (meshIndexCount != 0)
+    {
+      constants.viewProjection = cameraViewProjection (view);
+      instanceSpacing (constants.instanceSpacing);
+    }
+
+  if (!occlusionCulling)
+    {
+      beginScenePass (buffer, view, renderPass, constants);
+      drawList.record (buffer);
+      recordParticles (buffer, view);
+      recordOverlays (buffer, view);
+      vkCmdEndRenderPass (buffer);
+      return;
+    }
+
+  // The instances visible last frame go first and fill the depth buffer,
+  // the pyramid built from it decides about the rest. The early pass still
+  // clears when nothing is culled this frame.
+  CullInput input = cullInput (view, constants);
+  if (frameCulled)
+    {
+      occlusionCuller.recordEarly (buffer, view.index, currentFrame, input);
+      drawList.setIndirect (meshDrawsId,
+                            occlusionCuller.draws (view.index, false,
+                                                   input.instanceCount));
+    }
+  beginScenePass (buffer, view, earlyRenderPass, constants);
+  if (frameCulled)
+    {
+      drawList.record (buffer);
+    }
+  vkCmdEndRenderPass (buffer);
+
+  if (frameCulled)
+    {
+      occlusionCuller.recordLate (buffer, view.index, currentFrame, input);
+      drawList.setIndirect (meshDrawsId,
+                            occlusionCuller.draws (view.index, true,
+                                                   input.instanceCount));
+    }
+  beginScenePass (buffer, view, renderPass, constants);
+  drawList.record (buffer);
+  recordParticles (buffer, view);
+  recordOverlays (buffer, view);
+  vkCmdEndRenderPass (buffer);
+}
+
+void
+VulkanTriangleApplication::recordParticles (VkCommandBuffer buffer,
+                                            WindowView &view)
+{
+  if (scene.particleCount != 0)
+    {
+      particleSystem.record (buffer, worldViewProjection (view),
+                             renderExtent (view));
+    }
+}
+
+void
+VulkanTriangleApplication::recordOverlays (VkCommandBuffer buffer,
+                                           WindowView &view)
+{
+  if (scene.quadCount != 0)
+    {
+      quadBatcher.record (buffer, quadCanvas);
+    }
+  // Laid out in the view's own pixels, the viewport maps them onto the
+  // render resolution
+  if (hudEnabled)
+    {
+      hud.record (buffer, view.swapChainExtent);
+    }
+}
+
+void
+VulkanTriangleApplication::beginScenePass (
+    VkCommandBuffer buffer, WindowView &view, VkRenderPass pass,
+    const ScenePushConstants &constants)
+{
+  // Viewport, scissor and render area shrink with the resolution scale,
+  // the framebuffer keeps the full extent
+  VkExtent2D extent = renderExtent (view);
+
   VkRenderPassBeginInfo renderPassInfo{};
   renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-  renderPassInfo.renderPass = renderPass;
-  renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
+  renderPassInfo.renderPass = pass;
+  renderPassInfo.framebuffer
+      = framebuffers.hot (view.swapChainFramebuffers[view.imageIndex])
+            ->framebuffer;
 
   renderPassInfo.renderArea.offset = { 0, 0 };
-  renderPassInfo.renderArea.extent = swapChainExtent;
-  VkClearValue clearColor = { { { 0.0f, 0.0f, 0.0f, 1.0f } } };
-  renderPassInfo.clearValueCount = 1;
-  renderPassInfo.pClearValues = &clearColor;
+  renderPassInfo.renderArea.extent = extent;
+  VkClearValue clearValues[2]{};
+  clearValues[0].color = { { 0.0f, 0.0f, 0.0f, 1.0f } };
+  clearValues[1].depthStencil = { 1.0f, 0 };
+  renderPassInfo.clearValueCount = 2;
+  renderPassInfo.pClearValues = clearValues;
 
   vkCmdBeginRenderPass (buffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-  vkCmdBindPipeline (buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                     graphicsPipeline);
 
+  // Viewport and scissor are dynamic state, so they can be set before the
+  // draw list binds its first pipeline
   VkViewport viewport{};
   viewport.x = 0.0f;
   viewport.y = 0.0f;
 
-  viewport.width = static_cast<float> (swapChainExtent.width);
-  viewport.height = static_cast<float> (swapChainExtent.height);
+  viewport.width = static_cast<float> (extent.width);
+  viewport.height = static_cast<float> (extent.height);
   viewport.minDepth = 0.0f;
   viewport.maxDepth = 1.0f;
   vkCmdSetViewport (buffer, 0, 1, &viewport);
 
   VkRect2D scissor{};
   scissor.offset = { 0, 0 };
-  scissor.extent = swapChainExtent;
+  scissor.extent = extent;
   vkCmdSetScissor (buffer, 0, 1, &scissor);
 
-  vkCmdDraw (buffer, 3, 1, 0, 0);
+  // Push constants belong to the layout, not the pipeline, so they stay
+  // valid across the draw list's pipeline binds
+  vkCmdPushConstants (buffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                      sizeof (ScenePushConstants), &constants);
+}
 
-  vkCmdEndRenderPass (buffer);
+void
+VulkanTriangleApplication::recordUpscale (VkCommandBuffer buffer,
+                                          WindowView &view)
+{
+  VkImage output = images.hot (view.swapChainImages[view.imageIndex])->image;
+  VkExtent2D source = renderExtent (view);
+
+  // The blit overwrites all of it, so the old contents can go. The acquire
+  // semaphore is waited on at the transfer stage, which this chains to.
+  VkImageMemoryBarrier toTransfer{};
+  toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  toTransfer.srcAccessMask = 0;
+  toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  toTransfer.image = output;
+  toTransfer.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  toTransfer.subresourceRange.levelCount = 1;
+  toTransfer.subresourceRange.layerCount = 1;
+
+  vkCmdPipelineBarrier (buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                        nullptr, 1, &toTransfer);
+
+  VkImageBlit region{};
+  region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.srcSubresource.layerCount = 1;
+  region.srcOffsets[1] = { static_cast<int32_t> (source.width),
+                           static_cast<int32_t> (source.height), 1 };
+  region.dstSubresource = region.srcSubresource;
+  region.dstOffsets[1]
+      = { static_cast<int32_t> (view.swapChainExtent.width),
+          static_cast<int32_t> (view.swapChainExtent.height), 1 };
+
+  vkCmdBlitImage (buffer, view.renderImage,
+                  VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, output,
+                  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region,
+                  VK_FILTER_LINEAR);
+
+  // Leaves the image where the render pass would have without scaling,
+  // frame capture may copy it right after
+  VkImageMemoryBarrier toPresent = toTransfer;
+  toPresent.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  toPresent.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  toPresent.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  toPresent.newLayout = options.headless
+                            ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                            : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+  vkCmdPipelineBarrier (buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                        nullptr, 1, &toPresent);
+}
 
-  if (vkEndCommandBuffer (buffer) != VK_SUCCESS)
+void
+VulkanTriangleApplication::createTimestampQueries ()
+{
+  if (!resolutionScaler.enabled () && !hudEnabled)
     {
-      throw std::runtime_error ("Failed to record command buffer!");
+      return;
+    }
+
+  uint32_t queueFamilyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties (physicalDevice,
+                                            &queueFamilyCount, nullptr);
+  std::vector<VkQueueFamilyProperties> queueFamilies (queueFamilyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties (physicalDevice,
+                                            &queueFamilyCount,
+                                            queueFamilies.data ());
+  uint32_t validBits
+      = queueFamilies[indices.graphicsFamily.value ()].timestampValidBits;
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties (physicalDevice, &properties);
+
+  // Without GPU times there is nothing to pick a resolution by, the HUD
+  // leaves the GPU time out
+  if (validBits == 0 || properties.limits.timestampPeriod == 0.0f)
+    {
+      if (resolutionScaler.enabled ())
+        {
+          logger.log (LogSeverity::Warning, 0,
+                      "No timestamps on the graphics queue, dynamic "
+                      "resolution disabled");
+        }
+      return;
+    }
+  timestampPeriod = properties.limits.timestampPeriod;
+  timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+  VkQueryPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  // sized for the deepest setting, setFramesInFlight keeps the pool
+  poolInfo.queryCount = 2 * MAX_FRAMES_IN_FLIGHT;
+
+  if (vkCreateQueryPool (device, &poolInfo,
+                         memoryTracker.callbacks (HostAllocationType::Command),
+                         &timestampPool)
+      != VK_SUCCESS)
+    {
+      throw std::runtime_error ("Failed to create timestamp query pool!");
     }
+  gpuTimed = true;
+  dynamicResolution = resolutionScaler.enabled ();
 }
 
 void
-VulkanTriangleApplication::createSyncObjects ()
+VulkanTriangleApplication::readFrameTime ()
 {
-  imageAvailableSemaphores.resize (MAX_FRAMES_IN_FLIGHT);
-  renderFinishedSemaphores.resize (MAX_FRAMES_IN_FLIGHT);
-  inFlightFences.resize (MAX_FRAMES_IN_FLIGHT);
+  FrameContext &frame = frames[currentFrame];
+  if (!frame.timed)
+    {
+      return;
+    }
+  frame.timed = false;
 
-  VkSemaphoreCreateInfo semaphoreInfo{};
-  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  // The frame's fence has been waited on, so both results are available
+  uint64_t timestamps[2];
+  if (vkGetQueryPoolResults (device, timestampPool, 2 * currentFrame, 2,
+                             sizeof (timestamps), timestamps,
+                             sizeof (uint64_t), VK_QUERY_RESULT_64_BIT)
+      != VK_SUCCESS)
+    {
+      return;
+    }
 
-  VkFenceCreateInfo fenceInfo{};
-  fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-  fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+  uint64_t ticks = (timestamps[1] - timestamps[0]) & timestampMask;
+  gpuMilliseconds = ticks * static_cast<double> (timestampPeriod) / 1e6;
+  if (dynamicResolution)
+    {
+      resolutionScaler.update (gpuMilliseconds);
+    }
+}
 
-  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+void
+VulkanTriangleApplication::createFrameCapture ()
+{
+  FrameCaptureSettings settings = options.capture;
+  // the bench compares single captured frames against golden PPMs
+  settings.onDemand = options.headless;
+  if (options.bench.enabled)
     {
-      if (vkCreateSemaphore (device, &semaphoreInfo, nullptr,
-                             &imageAvailableSemaphores[i])
-              != VK_SUCCESS
-          || vkCreateSemaphore (device, &semaphoreInfo, nullptr,
-                                &renderFinishedSemaphores[i])
-                 != VK_SUCCESS
-          || vkCreateFence (device, &fenceInfo, nullptr, &inFlightFences[i])
-                 != VK_SUCCESS)
-        {
-          throw std::runtime_error (
-              "Failed to create sync objects for a frame!");
-        }
+      settings.format = ImageFileFormat::PPM;
+    }
+
+  frameCapture.init (physicalDevice, device, framesInFlight,
+                     options.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                      : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                     settings,
+                     memoryTracker.callbacks (HostAllocationType::Buffer),
+                     &logger);
+  frameCapture.resize (views[0].swapChainExtent, swapChainImageFormat);
+}
+
+void
+VulkanTriangleApplication::FrameBatch::clear ()
+{
+  views.clear ();
+  commandBuffers.clear ();
+  waitSemaphores.clear ();
+  waitStages.clear ();
+  signalSemaphores.clear ();
+  swapChains.clear ();
+  imageIndices.clear ();
+}
+
+void
+VulkanTriangleApplication::FrameBatch::add (WindowView &view,
+                                            const FrameContext &frame,
+                                            bool headless, bool upscaled)
+{
+  views.push_back (&view);
+  commandBuffers.push_back (frame.commandBuffers[view.index]);
+  if (headless)
+    {
+      // Nothing is acquired or presented, so there is nothing to wait for
+      return;
     }
+
+  waitSemaphores.push_back (frame.imageAvailableSemaphores[view.index]);
+  waitStages.push_back (upscaled
+                            ? VK_PIPELINE_STAGE_TRANSFER_BIT
+                            : VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+  signalSemaphores.push_back (frame.renderFinishedSemaphores[view.index]);
+  swapChains.push_back (view.swapChain);
+  imageIndices.push_back (view.imageIndex);
 }
 
 void
 VulkanTriangleApplication::drawFrame ()
 {
-  // Wait for previous frame to have finished
-  vkWaitForFences (device, 1, &inFlightFences[currentFrame], VK_TRUE,
-                   UINT64_MAX);
+  // Wait for the frame that last used this context to have finished
+  FrameContext &frame = frames[currentFrame];
+  auto start = std::chrono::steady_clock::now ();
+  vkWaitForFences (device, 1, &frame.inFlightFence, VK_TRUE, UINT64_MAX);
+  auto waited = std::chrono::steady_clock::now ();
+  frame.retire ();
+  if (frameStart != std::chrono::steady_clock::time_point{})
+    {
+      frameInterval = std::chrono::duration<double, std::milli> (
+                          start - frameStart)
+                          .count ();
+    }
+  frameStart = start;
+
+  // The fence also covers the readback this frame slot recorded last time
+  frameCapture.collect (currentFrame);
+  presentLatency.retired (currentFrame);
+  if (gpuTimed)
+    {
+      readFrameTime ();
+    }
+  if (occlusionCulling)
+    {
+      occlusionCuller.collect (currentFrame);
+      const OcclusionCullStats &culled = occlusionCuller.stats ();
+      if (frameNumber % CULLING_LOG_INTERVAL == 0 && culled.instances != 0
+          && logger.enabled (LogSeverity::Info))
+        {
+          uint64_t drawn = culled.earlyDraws + culled.lateDraws;
+          char message[160];
+          snprintf (message, sizeof (message),
+                    "Occlusion culling drew %llu of %llu instances (%llu "
+                    "early), %llu of %llu triangles",
+                    static_cast<unsigned long long> (drawn),
+                    static_cast<unsigned long long> (culled.instances),
+                    static_cast<unsigned long long> (culled.earlyDraws),
+                    static_cast<unsigned long long> (culled.triangles),
+                    static_cast<unsigned long long> (
+                        culled.instances * meshIndexCount / 3));
+          logger.log (LogSeverity::Info, 0, message);
+        }
+    }
+
+  bool report = memoryStats.is_open ()
+                && frameNumber % options.memoryStatsInterval == 0;
+  if (report || frameNumber % BUDGET_INTERVAL == 0)
+    {
+      manageMemory (report);
+    }
+
+  batch.clear ();
+  // The latency clock starts right before the first acquire
+  uint64_t presentId = presentLatency.beginFrame (currentFrame);
+  for (WindowView &view : views)
+    {
+      view.acquired = false;
+      if (options.headless)
+        {
+          // Each frame in flight owns its offscreen target, nothing to
+          // acquire
+          view.imageIndex = currentFrame;
+        }
+      else
+        {
+          VkResult result = vkAcquireNextImageKHR (
+              device, view.swapChain, UINT64_MAX,
+              frame.imageAvailableSemaphores[view.index], VK_NULL_HANDLE,
+              &view.imageIndex);
+
+          // NOTE: A view that can't acquire sits this frame out, the
+          // others still render
+          if (result == VK_ERROR_OUT_OF_DATE_KHR)
+            {
+              recreateSwapChain (view);
+              continue;
+            }
+          else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+            {
+              throw std::runtime_error ("Failed to acquire swap chain image!");
+            }
+        }
 
-  uint32_t imageIndex;
-  VkResult result = vkAcquireNextImageKHR (
-      device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame],
-      VK_NULL_HANDLE, &imageIndex);
+      view.acquired = true;
+      batch.add (view, frame, options.headless, renderTargets);
+    }
 
-  if (result == VK_ERROR_OUT_OF_DATE_KHR)
+  if (batch.views.empty ())
     {
-      recreateSwapChain ();
       return;
     }
-  else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+
+  vkResetFences (device, 1, &frame.inFlightFence);
+  vkResetCommandPool (device, frame.commandPool, 0);
+
+  // An evicted mesh comes back once its cache is mapped, ahead of the draw
+  // list that binds it
+  if (meshDecoding && meshLoad.done ())
     {
-      throw std::runtime_error ("Failed to acquire swap chain image!");
+      restoreMeshBuffers ();
     }
 
-  vkResetFences (device, 1, &inFlightFences[currentFrame]);
-  vkResetCommandBuffer (commandBuffers[currentFrame], 0);
-  recordCommandBuffer (commandBuffers[currentFrame], imageIndex);
+  // The scene is the same in every view, only the camera differs
+  buildDrawList ();
+  if (scene.quadCount != 0)
+    {
+      buildQuads ();
+    }
+  if (scene.particleCount != 0)
+    {
+      buildParticles ();
+    }
+  if (hudEnabled)
+    {
+      buildHud ();
+    }
+  for (WindowView *view : batch.views)
+    {
+      recordCommandBuffer (*view);
+      view->damaged = false;
+    }
 
   VkSubmitInfo submitInfo{};
   submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-
-  VkSemaphore waitSemaphores[] = { imageAvailableSemaphores[currentFrame] };
-  VkPipelineStageFlags waitStages[]
-      = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-  submitInfo.waitSemaphoreCount = 1;
-  submitInfo.pWaitSemaphores = waitSemaphores;
-  submitInfo.pWaitDstStageMask = waitStages;
-  submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
-  VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrame] };
-  submitInfo.signalSemaphoreCount = 1;
-  submitInfo.pSignalSemaphores = signalSemaphores;
-
-  // Submit command buffer to the graphics queue
-  if (vkQueueSubmit (graphicsQueue, 1, &submitInfo,
-                     inFlightFences[currentFrame])
+  submitInfo.waitSemaphoreCount
+      = static_cast<uint32_t> (batch.waitSemaphores.size ());
+  submitInfo.pWaitSemaphores = batch.waitSemaphores.data ();
+  submitInfo.pWaitDstStageMask = batch.waitStages.data ();
+  submitInfo.commandBufferCount
+      = static_cast<uint32_t> (batch.commandBuffers.size ());
+  submitInfo.pCommandBuffers = batch.commandBuffers.data ();
+  submitInfo.signalSemaphoreCount
+      = static_cast<uint32_t> (batch.signalSemaphores.size ());
+  submitInfo.pSignalSemaphores = batch.signalSemaphores.data ();
+
+  // One submit for every view, so the driver overhead doesn't grow with
+  // the number of windows
+  if (vkQueueSubmit (graphicsQueue, 1, &submitInfo, frame.inFlightFence)
       != VK_SUCCESS)
     {
       throw std::runtime_error ("Failed to submit draw command buffer!");
     }
+  frameCpuTime = std::chrono::duration<double, std::milli> (
+                     std::chrono::steady_clock::now () - waited)
+                     .count ();
+  frameNumber++;
+  if (scene.animating && (!options.redrawOnDemand || sceneDirty))
+    {
+      animationFrame++;
+    }
+
+  if (options.headless)
+    {
+      presentLatency.presented (currentFrame);
+      currentFrame = (currentFrame + 1) % framesInFlight;
+      return;
+    }
+
+  batch.presentResults.resize (batch.swapChains.size ());
 
   VkPresentInfoKHR presentInfo{};
   presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-  presentInfo.waitSemaphoreCount = 1;
-  presentInfo.pWaitSemaphores = signalSemaphores;
-  VkSwapchainKHR swapChains[] = { swapChain };
-  presentInfo.swapchainCount = 1;
-  presentInfo.pSwapchains = swapChains;
-  presentInfo.pImageIndices = &imageIndex;
+  presentInfo.waitSemaphoreCount
+      = static_cast<uint32_t> (batch.signalSemaphores.size ());
+  presentInfo.pWaitSemaphores = batch.signalSemaphores.data ();
+  presentInfo.swapchainCount
+      = static_cast<uint32_t> (batch.swapChains.size ());
+  presentInfo.pSwapchains = batch.swapChains.data ();
+  presentInfo.pImageIndices = batch.imageIndices.data ();
+  presentInfo.pResults = batch.presentResults.data ();
+
+  // Only the first view's presents are waited for, 0 tags none
+  bool timedView = batch.views[0] == &views[0];
+  VkPresentIdKHR presentIdInfo{};
+  if (presentLatency.waitsForPresent ())
+    {
+      batch.presentIds.assign (batch.swapChains.size (), 0);
+      batch.presentIds[0] = timedView ? presentId : 0;
+      presentIdInfo.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+      presentIdInfo.swapchainCount
+          = static_cast<uint32_t> (batch.presentIds.size ());
+      presentIdInfo.pPresentIds = batch.presentIds.data ();
+      presentInfo.pNext = &presentIdInfo;
+    }
 
-  result = vkQueuePresentKHR (presentQueue, &presentInfo);
+  VkResult result = vkQueuePresentKHR (presentQueue, &presentInfo);
+  if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR
+      && result != VK_ERROR_OUT_OF_DATE_KHR)
+    {
+      throw std::runtime_error ("Failed to present swap chain image!");
+    }
 
-  if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR
-      || framebufferResized)
+  // Before any swap chain is recreated, the present went to the old one
+  if (timedView
+      && (batch.presentResults[0] == VK_SUCCESS
+          || batch.presentResults[0] == VK_SUBOPTIMAL_KHR))
     {
-      framebufferResized = false;
-      recreateSwapChain ();
+      presentLatency.presented (currentFrame);
     }
-  else if (result != VK_SUCCESS)
+  if (frameNumber % LATENCY_LOG_INTERVAL == 0
+      && logger.enabled (LogSeverity::Info))
     {
-      throw std::runtime_error ("Failed to present swap chain image!");
+      PresentLatencyStats latency = presentLatency.stats ();
+      char message[160];
+      snprintf (message, sizeof (message),
+                "Present latency %.2f ms (%s), interval %.2f ms, frames "
+                "held back %.2f ms",
+                latency.latencyMilliseconds,
+                latency.measured ? "present wait" : "estimated",
+                latency.intervalMilliseconds, latency.delayMilliseconds);
+      logger.log (LogSeverity::Info, 0, message);
+    }
+
+  // The overall result only tells the worst case, each swap chain reports
+  // its own
+  for (size_t i = 0; i < batch.views.size (); i++)
+    {
+      WindowView &view = *batch.views[i];
+      VkResult viewResult = batch.presentResults[i];
+
+      if (viewResult == VK_ERROR_OUT_OF_DATE_KHR
+          || viewResult == VK_SUBOPTIMAL_KHR || view.framebufferResized)
+        {
+          view.framebufferResized = false;
+          recreateSwapChain (view);
+        }
+      else if (viewResult != VK_SUCCESS)
+        {
+          throw std::runtime_error ("Failed to present swap chain image!");
+        }
     }
 
-  currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+  currentFrame = (currentFrame + 1) % framesInFlight;
 }
 
 bool
-VulkanTriangleApplication::verifyExtensions (const char **glfwExtensions,
-                                             uint32_t glfwExtensionCount)
+VulkanTriangleApplication::verifyExtensions (
+    const std::vector<const char *> &requiredExtensions)
 {
   uint32_t extensionCount = 0;
   vkEnumerateInstanceExtensionProperties (nullptr, &extensionCount, nullptr);
@@ -858,15 +3145,22 @@ VulkanTriangleApplication::verifyExtensions (const char **glfwExtensions,
   vkEnumerateInstanceExtensionProperties (nullptr, &extensionCount,
                                           extensions.data ());
 
-  for (uint32_t i{}; i < glfwExtensionCount; i++)
+  for (const char *required : requiredExtensions)
     {
+      bool found = false;
       for (const auto &extension : extensions)
         {
-          if (strcmp (extension.extensionName, glfwExtensions[i]) == 0)
+          if (strcmp (extension.extensionName, required) == 0)
             {
-              return false;
+              found = true;
+              break;
             }
         }
+
+      if (!found)
+        {
+          return false;
+        }
     }
 
   return true;
@@ -910,17 +3204,43 @@ VulkanTriangleApplication::isDeviceSuitable (VkPhysicalDevice device)
   findQueueFamilies (device);
   bool extensionsSupported = checkDeviceExtensionSupport (device);
 
-  bool swapChainAdequate = false;
-  if (extensionsSupported)
+  bool swapChainAdequate = extensionsSupported;
+  if (extensionsSupported && !options.headless)
     {
-      querySwapChainSupport (device);
-      swapChainAdequate = !swapChainDetails.formats.empty ()
-                          && !swapChainDetails.presentModes.empty ();
+      for (const WindowView &view : views)
+        {
+          querySwapChainSupport (device, view.surface);
+          swapChainAdequate = swapChainAdequate
+                              && !swapChainDetails.formats.empty ()
+                              && !swapChainDetails.presentModes.empty ();
+        }
     }
 
   return indices.isComplete () && extensionsSupported && swapChainAdequate;
 }
 
+bool
+VulkanTriangleApplication::deviceExtensionSupported (VkPhysicalDevice device,
+                                                     const char *extension)
+{
+  uint32_t extensionCount;
+  vkEnumerateDeviceExtensionProperties (device, nullptr, &extensionCount,
+                                        nullptr);
+
+  std::vector<VkExtensionProperties> availableExtensions (extensionCount);
+  vkEnumerateDeviceExtensionProperties (device, nullptr, &extensionCount,
+                                        availableExtensions.data ());
+
+  for (const auto &available : availableExtensions)
+    {
+      if (strcmp (available.extensionName, extension) == 0)
+        {
+          return true;
+        }
+    }
+  return false;
+}
+
 bool
 VulkanTriangleApplication::checkDeviceExtensionSupport (
     VkPhysicalDevice device)
@@ -977,7 +3297,7 @@ VulkanTriangleApplication::chooseSwapPresentMode (
 
 VkExtent2D
 VulkanTriangleApplication::chooseSwapExtent (
-    const VkSurfaceCapabilitiesKHR &capabilities)
+    const VkSurfaceCapabilitiesKHR &capabilities, VkExtent2D framebufferSize)
 {
   if (capabilities.currentExtent.width
       != std::numeric_limits<uint32_t>::max ())
@@ -986,11 +3306,7 @@ VulkanTriangleApplication::chooseSwapExtent (
     }
   else
     {
-      int width, height;
-      glfwGetFramebufferSize (window, &width, &height);
-
-      VkExtent2D actualExtent
-          = { static_cast<uint32_t> (width), static_cast<uint32_t> (height) };
+      VkExtent2D actualExtent = framebufferSize;
 
       actualExtent.width
           = std::clamp (actualExtent.width, capabilities.minImageExtent.width,
@@ -1003,24 +3319,6 @@ VulkanTriangleApplication::chooseSwapExtent (
     }
 }
 
-VkShaderModule
-VulkanTriangleApplication::createShaderModule (const std::vector<char> &code)
-{
-  VkShaderModuleCreateInfo createInfo{};
-  createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-  createInfo.codeSize = code.size ();
-  createInfo.pCode = reinterpret_cast<const uint32_t *> (code.data ());
-
-  VkShaderModule shaderModule;
-  if (vkCreateShaderModule (device, &createInfo, nullptr, &shaderModule)
-      != VK_SUCCESS)
-    {
-      throw std::runtime_error ("Failed to create shader module!");
-    }
-
-  return shaderModule;
-}
-
 void
 VulkanTriangleApplication::findQueueFamilies (VkPhysicalDevice device)
 {
@@ -1035,12 +3333,24 @@ VulkanTriangleApplication::findQueueFamilies (VkPhysicalDevice device)
   int i = 0;
   for (const auto &queueFamily : queueFamilies)
     {
-      VkBool32 presentSupport = false;
-      vkGetPhysicalDeviceSurfaceSupportKHR (device, i, surface,
-                                            &presentSupport);
+      // Every window is presented from one queue, so the family has to
+      // support all of their surfaces
+      VkBool32 presentSupport = !options.headless;
+      for (const WindowView &view : views)
+        {
+          VkBool32 viewSupport = false;
+          if (!options.headless)
+            {
+              vkGetPhysicalDeviceSurfaceSupportKHR (device, i, view.surface,
+                                                    &viewSupport);
+            }
+          presentSupport = presentSupport && viewSupport;
+        }
       if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
         {
           indices.graphicsFamily = i;
+          // Headless "presents" by copying on the graphics queue
+          presentSupport = presentSupport || options.headless;
         }
 
       if (presentSupport)
@@ -1058,7 +3368,8 @@ VulkanTriangleApplication::findQueueFamilies (VkPhysicalDevice device)
 }
 
 void
-VulkanTriangleApplication::querySwapChainSupport (VkPhysicalDevice device)
+VulkanTriangleApplication::querySwapChainSupport (VkPhysicalDevice device,
+                                                  VkSurfaceKHR surface)
 {
   vkGetPhysicalDeviceSurfaceCapabilitiesKHR (device, surface,
                                              &swapChainDetails.capabilities);
@@ -1118,56 +3429,329 @@ VulkanTriangleApplication::pickPhysicalDevice ()
 void
 VulkanTriangleApplication::initWindow ()
 {
+  // Headless renders a single offscreen view
+  views.resize (options.headless ? 1 : std::max (options.windowCount, 1u));
+  for (size_t i = 0; i < views.size (); i++)
+    {
+      views[i].index = static_cast<uint32_t> (i);
+    }
+  if (options.headless)
+    {
+      return;
+    }
+
   glfwInit ();
   glfwWindowHint (GLFW_CLIENT_API, GLFW_NO_API);
 
-  window = glfwCreateWindow (WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
-  glfwSetWindowUserPointer (window, this);
-  glfwSetFramebufferSizeCallback (window, framebufferResizeCallback);
+  for (size_t i = 0; i < views.size (); i++)
+    {
+      WindowView &view = views[i];
+      std::string title = "Vulkan";
+      if (i != 0)
+        {
+          title += " " + std::to_string (i + 1);
+        }
+
+      view.window
+          = glfwCreateWindow (WIDTH, HEIGHT, title.c_str (), nullptr, nullptr);
+      view.cameraAngle = 6.2831853f * i / views.size ();
+      glfwSetWindowUserPointer (view.window, &view);
+      glfwSetFramebufferSizeCallback (view.window, framebufferResizeCallback);
+      glfwSetWindowRefreshCallback (view.window, windowRefreshCallback);
+      glfwSetKeyCallback (view.window, keyCallback);
+
+      int width, height;
+      glfwGetFramebufferSize (view.window, &width, &height);
+      view.windowFramebufferSize
+          = { static_cast<uint32_t> (width), static_cast<uint32_t> (height) };
+      view.framebufferSize = view.windowFramebufferSize;
+    }
 }
 
 void
 VulkanTriangleApplication::mainLoop ()
 {
-  while (!glfwWindowShouldClose (window))
+  if (options.headless)
     {
-      glfwPollEvents ();
-      drawFrame ();
+      for (uint32_t i = 0; i < options.headlessFrames; i++)
+        {
+          drawFrame ();
+        }
+
+      vkDeviceWaitIdle (device);
+      return;
     }
 
+  // Closing any window ends the run
+  auto anyClosed = [this] () {
+    for (const WindowView &view : views)
+      {
+        if (glfwWindowShouldClose (view.window))
+          {
+            return true;
+          }
+      }
+    return false;
+  };
+
+  FrameSnapshot snapshot;
+  snapshot.instanceCount = scene.instanceCount;
+  snapshot.constants = scene.constants;
+  publishSnapshot (snapshot);
+
+  // Jobs with main thread affinity post an empty event so the loop below
+  // runs them right away
+  JobSystem &jobs = JobSystem::shared ();
+  jobs.setMainThreadWakeup ([] () { glfwPostEmptyEvent (); });
+
+  rendering = true;
+  renderThread = std::thread (&VulkanTriangleApplication::renderLoop, this);
+
+  // NOTE: GLFW's event functions may only be called from the main thread,
+  // the render thread never touches GLFW
+  while (rendering.load (std::memory_order_acquire) && !anyClosed ())
+    {
+      glfwWaitEventsTimeout (EVENT_WAIT_SECONDS);
+      jobs.runMainThreadJobs ();
+      publishSnapshot (snapshot);
+    }
+
+  jobs.setMainThreadWakeup (nullptr);
+  rendering = false;
+  snapshotPublished.notify_one ();
+  renderThread.join ();
   vkDeviceWaitIdle (device);
+
+  if (renderError)
+    {
+      std::rethrow_exception (renderError);
+    }
 }
 
 void
-VulkanTriangleApplication::cleanup ()
+VulkanTriangleApplication::publishSnapshot (FrameSnapshot &snapshot)
+{
+  for (size_t i = 0; i < views.size (); i++)
+    {
+      snapshot.resizeCounts[i] = views[i].resizeCount;
+      snapshot.framebufferSizes[i] = views[i].windowFramebufferSize;
+      snapshot.refreshCounts[i] = views[i].refreshCount;
+    }
+  snapshot.animationToggles = 0;
+  for (const WindowView &view : views)
+    {
+      snapshot.animationToggles += view.animationToggles;
+    }
+
+  snapshots.back () = snapshot;
+  snapshots.publish ();
+
+  {
+    std::lock_guard<std::mutex> lock (snapshotMutex);
+    publishedSnapshots++;
+  }
+  snapshotPublished.notify_one ();
+}
+
+void
+VulkanTriangleApplication::applySnapshot (const FrameSnapshot &snapshot)
+{
+  if (scene.instanceCount != snapshot.instanceCount
+      || std::memcmp (&scene.constants, &snapshot.constants,
+                      sizeof (ScenePushConstants))
+             != 0)
+    {
+      sceneDirty = true;
+    }
+  scene.instanceCount = snapshot.instanceCount;
+  scene.constants = snapshot.constants;
+  if ((snapshot.animationToggles - seenAnimationToggles) % 2 != 0)
+    {
+      scene.animating = !scene.animating;
+    }
+  seenAnimationToggles = snapshot.animationToggles;
+
+  for (size_t i = 0; i < views.size (); i++)
+    {
+      WindowView &view = views[i];
+      view.framebufferSize = snapshot.framebufferSizes[i];
+      if (snapshot.resizeCounts[i] != view.seenResizeCount)
+        {
+          view.seenResizeCount = snapshot.resizeCounts[i];
+          view.framebufferResized = true;
+        }
+      if (snapshot.refreshCounts[i] != view.seenRefreshCount)
+        {
+          view.seenRefreshCount = snapshot.refreshCounts[i];
+          view.damaged = true;
+        }
+    }
+}
+
+bool
+VulkanTriangleApplication::needsFrame () const
+{
+  if (sceneDirty)
+    {
+      return true;
+    }
+  for (const WindowView &view : views)
+    {
+      if (view.damaged || view.framebufferResized)
+        {
+          return true;
+        }
+    }
+  return false;
+}
+
+void
+VulkanTriangleApplication::waitForSnapshot ()
+{
+  // Bounded like the main thread's event wait, in case a wake up is missed
+  std::unique_lock<std::mutex> lock (snapshotMutex);
+  snapshotPublished.wait_for (
+      lock, std::chrono::duration<double> (EVENT_WAIT_SECONDS), [this] {
+        return publishedSnapshots != seenSnapshots
+               || !rendering.load (std::memory_order_acquire);
+      });
+  seenSnapshots = publishedSnapshots;
+}
+
+void
+VulkanTriangleApplication::renderLoop ()
 {
-  cleanupSwapChain ();
+  try
+    {
+      while (rendering.load (std::memory_order_acquire))
+        {
+          // Held back while frames queue up in front of the display, the
+          // frame starts from fresher input without presenting any later
+          std::this_thread::sleep_for (presentLatency.frameDelay ());
+          if (snapshots.update ())
+            {
+              applySnapshot (snapshots.front ());
+            }
+
+          // Continuous redraws keep frames coming without new events. On
+          // demand, the orbiting mesh, the spinning sprites and the
+          // particles change without them.
+          if ((scene.animating
+               && (meshIndexCount != 0 || scene.quadCount != 0))
+              || scene.particleCount != 0)
+            {
+              sceneDirty = true;
+            }
+          if (options.redrawOnDemand && !needsFrame ())
+            {
+              waitForSnapshot ();
+              continue;
+            }
+          drawFrame ();
+          sceneDirty = false;
+        }
+    }
+  catch (...)
+    {
+      renderError = std::current_exception ();
+      rendering = false;
+      // wake the main thread up so it rethrows right away
+      glfwPostEmptyEvent ();
+    }
+}
 
-  vkDestroyPipeline (device, graphicsPipeline, nullptr);
-  vkDestroyPipelineLayout (device, pipelineLayout, nullptr);
+void
+VulkanTriangleApplication::cleanup ()
+{
+  // mainLoop left the device idle, so the last frames can be read back
+  frameCapture.collectAll ();
+  frameCapture.cleanup ();
+  presentLatency.cleanup ();
 
-  vkDestroyRenderPass (device, renderPass, nullptr);
+  for (WindowView &view : views)
+    {
+      cleanupSwapChain (view);
+    }
 
-  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+  if (!options.pipelineManifest.empty ()
+      && !pipelines.saveManifest (options.pipelineManifest))
+    {
+      std::string message
+          = "Failed to write pipeline manifest " + options.pipelineManifest;
+      logger.log (LogSeverity::Warning, 0, message.c_str ());
+    }
+  pipelines.cleanup ();
+  const VkAllocationCallbacks *pipelineAllocator
+      = memoryTracker.callbacks (HostAllocationType::Pipeline);
+  vkDestroyPipelineLayout (device, pipelineLayout, pipelineAllocator);
+  vkDestroyPipelineCache (device, pipelineCache, pipelineAllocator);
+
+  vkDestroyRenderPass (
+      device, renderPass,
+      memoryTracker.callbacks (HostAllocationType::RenderPass));
+  vkDestroyRenderPass (
+      device, earlyRenderPass,
+      memoryTracker.callbacks (HostAllocationType::RenderPass));
+  if (occlusionCulling)
+    {
+      occlusionCuller.cleanup ();
+    }
+  if (hudEnabled)
+    {
+      hud.cleanup ();
+    }
+  if (particlesReady)
+    {
+      particleSystem.cleanup ();
+    }
+  if (quadsReady)
     {
-      vkDestroySemaphore (device, imageAvailableSemaphores[i], nullptr);
-      vkDestroySemaphore (device, renderFinishedSemaphores[i], nullptr);
-      vkDestroyFence (device, inFlightFences[i], nullptr);
+      quadBatcher.cleanup ();
+      for (GpuImage &texture : quadTextures)
+        {
+          destroyTexture (device, texture,
+                          memoryTracker.callbacks (HostAllocationType::Image));
+        }
     }
 
-  vkDestroyCommandPool (device, commandPool, nullptr);
+  destroyFrameContexts ();
+
+  const VkAllocationCallbacks *commandAllocator
+      = memoryTracker.callbacks (HostAllocationType::Command);
+  vkDestroyQueryPool (device, timestampPool, commandAllocator);
+  vkDestroyCommandPool (device, commandPool, commandAllocator);
 
-  vkDestroyDevice (device, nullptr);
+  if (meshResident)
+    {
+      releaseMeshBuffers ();
+    }
+  // only left when recording the frame that restored the mesh failed
+  destroyBuffer (device, meshUpload,
+                 memoryTracker.callbacks (HostAllocationType::Buffer));
 
-  if (enableValidationLayers)
+  vkDestroyDevice (device,
+                   memoryTracker.callbacks (HostAllocationType::Device));
+
+  const VkAllocationCallbacks *instanceAllocator
+      = memoryTracker.callbacks (HostAllocationType::Instance);
+  if (debugMessenger != VK_NULL_HANDLE)
     {
-      DestroyDebugUtilsMessengerEXT (instance, debugMessenger, nullptr);
+      DestroyDebugUtilsMessengerEXT (instance, debugMessenger,
+                                     instanceAllocator);
     }
 
-  vkDestroySurfaceKHR (instance, surface, nullptr);
-  vkDestroyInstance (instance, nullptr);
+  if (options.headless)
+    {
+      vkDestroyInstance (instance, instanceAllocator);
+      return;
+    }
 
-  glfwDestroyWindow (window);
+  for (WindowView &view : views)
+    {
+      vkDestroySurfaceKHR (instance, view.surface, instanceAllocator);
+      glfwDestroyWindow (view.window);
+    }
+  vkDestroyInstance (instance, instanceAllocator);
 
   glfwTerminate ();
 }